@@ -32,8 +32,7 @@ void EXPAND(GEN_FUNC_NAME(insert, name) (FSD_ARRAY_TYPE(name)* array, type value
             void* tmp = realloc((void*) (array->data), array->size * sizeof(type));                \
             if (!tmp)                                                                              \
             {                                                                                      \
-                printf("Realloc failed!\n");                                                       \
-                exit(1);                                                                           \
+                PRINT_ERROR_AND_QUIT("Realloc failed!\n");                                          \
             }                                                                                      \
             array->data = (type*)tmp;                                                              \
         }                                                                                          \
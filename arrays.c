@@ -4,6 +4,7 @@
 
 #include "array_generics.h"
 #include "model.h"
+#include "utils.h"
 
 #define max(a, b)  (((a) > (b)) ? (a) : (b))
 
@@ -35,7 +36,8 @@ void free_vsd_array(vsd_array* array)
     array->size = 0;
 }
 
-size_t allocate_vsd_array(vsd_array* array, size_t bytes)
+// Make sure that the given number of bytes can be allocated without reallocating the array
+void reserve_vsd_array(vsd_array* array, size_t bytes)
 {
     // Realloc if new size exceeds current limit
     if (array->used + bytes > array->size)
@@ -44,11 +46,15 @@ size_t allocate_vsd_array(vsd_array* array, size_t bytes)
         void* tmp = realloc(array->data, array->size);
         if (!tmp)
         {
-            printf("Realloc failed!\n");
-            exit(1);
+            PRINT_ERROR_AND_QUIT("Realloc failed!\n");
         }
         array->data = tmp;
     }
+}
+
+size_t allocate_vsd_array(vsd_array* array, size_t bytes)
+{
+    reserve_vsd_array(array, bytes);
 
     // Assign memory address
     size_t offset = array->used;
@@ -82,8 +88,7 @@ void* allocate_vss_array(vss_array* memory, size_t bytes)
     // Realloc if new size exceeds current limit
     if (memory->used + bytes > memory->size)
     {
-        printf("Max VSS memory exceeded!\n");
-        exit(1);
+        PRINT_ERROR_AND_QUIT("Max VSS memory exceeded!\n");
     }
 
     // Assign memory address
@@ -27,6 +27,7 @@ void init_vsd_array(vsd_array* array, size_t initial_size);
 void clear_vsd_array(vsd_array* array);
 void free_vsd_array(vsd_array* array);
 size_t allocate_vsd_array(vsd_array* array, size_t bytes);
+void reserve_vsd_array(vsd_array* array, size_t bytes);
 
 // Variable element-size static array (VSS array). Used as a temporary memory for expression evaluation
 typedef struct
@@ -0,0 +1,358 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "batch.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libpinky.h"
+#include "utils.h"
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define MANIFEST_LINE_SIZE 4096
+
+// Exit codes of worker processes
+#define JOB_OK            0
+#define JOB_RUNTIME_ERROR 1
+#define JOB_OUTPUT_ERROR  2
+
+typedef struct batch_script
+{
+    char* filename;
+    pinky_program* program;
+} batch_script;
+
+typedef struct batch_job
+{
+    size_t script;
+    char* output_filename;
+    int line;
+
+#ifndef _WIN32
+    pid_t pid;
+    struct timespec start_time;
+#endif
+    double elapsed_ms;
+    int exit_status;
+    const char* status_message;
+} batch_job;
+
+typedef struct batch
+{
+    batch_script* scripts;
+    size_t num_scripts, scripts_size;
+
+    batch_job* jobs;
+    size_t num_jobs, jobs_size;
+} batch;
+
+static char* copy_string(const char* string)
+{
+    char* copy = malloc(strlen(string) + 1);
+    if (copy == NULL)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot allocate memory for the batch manifest\n");
+    }
+
+    strcpy(copy, string);
+    return copy;
+}
+
+// Scripts which appear several times in the manifest are only stored (and compiled) once
+static size_t add_script(batch* batch, const char* filename)
+{
+    for (size_t i = 0; i < batch->num_scripts; i++)
+    {
+        if (strcmp(batch->scripts[i].filename, filename) == 0)
+            return i;
+    }
+
+    if (batch->num_scripts == batch->scripts_size)
+    {
+        batch->scripts_size = batch->scripts_size ? batch->scripts_size * 2 : 16;
+        void* tmp = realloc(batch->scripts, batch->scripts_size * sizeof(batch_script));
+        if (!tmp)
+        {
+            PRINT_ERROR_AND_QUIT("Realloc failed!\n");
+        }
+        batch->scripts = tmp;
+    }
+
+    batch->scripts[batch->num_scripts] = (batch_script) { .filename = copy_string(filename), .program = NULL };
+    return batch->num_scripts++;
+}
+
+static void add_job(batch* batch, size_t script, const char* output_filename, int line)
+{
+    if (batch->num_jobs == batch->jobs_size)
+    {
+        batch->jobs_size = batch->jobs_size ? batch->jobs_size * 2 : 64;
+        void* tmp = realloc(batch->jobs, batch->jobs_size * sizeof(batch_job));
+        if (!tmp)
+        {
+            PRINT_ERROR_AND_QUIT("Realloc failed!\n");
+        }
+        batch->jobs = tmp;
+    }
+
+    batch->jobs[batch->num_jobs++] = (batch_job) {
+        .script = script,
+        .output_filename = copy_string(output_filename),
+        .line = line,
+        .exit_status = -1,
+        .status_message = "not run"
+    };
+}
+
+static void read_manifest(batch* batch, const char* manifest_filename)
+{
+    FILE* fp;
+    char line[MANIFEST_LINE_SIZE];
+    int line_number = 0;
+
+    if ((fp = fopen(manifest_filename, "r")) == NULL)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot open file '%s': %s\n", manifest_filename, strerror(errno));
+    }
+
+    while (fgets(line, MANIFEST_LINE_SIZE, fp))
+    {
+        line_number++;
+
+        char* comment = strchr(line, '#');
+        if (comment)
+            *comment = '\0';
+
+        char* script_filename = strtok(line, " \t\r\n");
+        if (script_filename == NULL)
+            continue;
+
+        char* output_filename = strtok(NULL, " \t\r\n");
+        if (output_filename == NULL || strtok(NULL, " \t\r\n") != NULL)
+        {
+            fclose(fp);
+            PRINT_ERROR_AND_QUIT("Manifest '%s', line %d: expected a script and an output file\n", manifest_filename, line_number);
+        }
+
+        add_job(batch, add_script(batch, script_filename), output_filename, line_number);
+    }
+
+    fclose(fp);
+}
+
+static void free_batch(batch* batch)
+{
+    for (size_t i = 0; i < batch->num_scripts; i++)
+    {
+        free(batch->scripts[i].filename);
+        pinky_program_free(batch->scripts[i].program);
+    }
+
+    for (size_t i = 0; i < batch->num_jobs; i++)
+    {
+        free(batch->jobs[i].output_filename);
+    }
+
+    free(batch->scripts);
+    free(batch->jobs);
+}
+
+#ifdef _WIN32
+
+int run_batch(const char* manifest_filename, int num_workers)
+{
+    (void) manifest_filename;
+    (void) num_workers;
+    PRINT_ERROR_AND_QUIT("Batch mode relies on fork() and is not available on Windows\n");
+}
+
+#else
+
+static double elapsed_ms(const struct timespec* start, const struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+// Body of a worker process. It never returns
+static void run_job(const batch* batch, const batch_job* job)
+{
+    FILE* output = fopen(job->output_filename, "w");
+    if (output == NULL)
+    {
+        _exit(JOB_OUTPUT_ERROR);
+    }
+
+    pinky_vm* vm;
+    pinky_status status = pinky_vm_create(batch->scripts[job->script].program, &vm);
+    if (status == PINKY_OK)
+    {
+        pinky_vm_set_output(vm, output);
+        status = pinky_vm_run(vm);
+        pinky_vm_free(vm);
+    }
+
+    if (status != PINKY_OK)
+    {
+        fprintf(output, "\n%s\n", pinky_last_error());
+    }
+
+    fclose(output);
+    _exit(status == PINKY_OK ? JOB_OK : JOB_RUNTIME_ERROR);
+}
+
+static void finish_job(batch_job* job, int wait_status)
+{
+    struct timespec end_time;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    job->elapsed_ms = elapsed_ms(&job->start_time, &end_time);
+
+    if (WIFEXITED(wait_status))
+    {
+        job->exit_status = WEXITSTATUS(wait_status);
+        switch (job->exit_status)
+        {
+            case JOB_OK:
+                job->status_message = "ok";
+                break;
+
+            case JOB_RUNTIME_ERROR:
+                job->status_message = "runtime error";
+                break;
+
+            case JOB_OUTPUT_ERROR:
+                job->status_message = "cannot open output";
+                break;
+
+            default:
+                job->status_message = "failed";
+                break;
+        }
+    }
+
+    else
+    {
+        job->exit_status = 128 + WTERMSIG(wait_status);
+        job->status_message = "killed by signal";
+    }
+}
+
+// Wait for any worker to finish, and record its results
+static void wait_for_job(batch* batch)
+{
+    int wait_status;
+    pid_t pid = waitpid(-1, &wait_status, 0);
+    if (pid < 0)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot wait for batch workers: %s\n", strerror(errno));
+    }
+
+    for (size_t i = 0; i < batch->num_jobs; i++)
+    {
+        if (batch->jobs[i].pid == pid)
+        {
+            finish_job(&batch->jobs[i], wait_status);
+            return;
+        }
+    }
+}
+
+int run_batch(const char* manifest_filename, int num_workers)
+{
+    batch batch = { 0 };
+    struct timespec batch_start, batch_end;
+    clock_gettime(CLOCK_MONOTONIC, &batch_start);
+
+    if (num_workers <= 0)
+    {
+        long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_workers = num_cpus > 0 ? (int) num_cpus : 1;
+    }
+
+    read_manifest(&batch, manifest_filename);
+
+    // Compilation stage. Scripts that fail to compile make all their jobs fail
+    for (size_t i = 0; i < batch.num_scripts; i++)
+    {
+        if (pinky_compile_file(batch.scripts[i].filename, 0, &batch.scripts[i].program) != PINKY_OK)
+        {
+            printf("%s%s: %s%s\n", KRED, batch.scripts[i].filename, pinky_last_error(), KNRM);
+        }
+    }
+
+    // Execution stage. Output is flushed before forking, so that it is not duplicated by workers
+    int running_workers = 0;
+    fflush(stdout);
+    for (size_t i = 0; i < batch.num_jobs; i++)
+    {
+        batch_job* job = &batch.jobs[i];
+        job->pid = 0;
+
+        if (batch.scripts[job->script].program == NULL)
+        {
+            job->status_message = "compile error";
+            continue;
+        }
+
+        if (running_workers == num_workers)
+        {
+            wait_for_job(&batch);
+            running_workers--;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &job->start_time);
+        job->pid = fork();
+        if (job->pid < 0)
+        {
+            job->pid = 0;
+            job->status_message = "cannot fork";
+            continue;
+        }
+
+        if (job->pid == 0)
+        {
+            run_job(&batch, job);
+        }
+
+        running_workers++;
+    }
+
+    while (running_workers > 0)
+    {
+        wait_for_job(&batch);
+        running_workers--;
+    }
+
+    // Report
+    int num_failed = 0;
+    for (size_t i = 0; i < batch.num_jobs; i++)
+    {
+        batch_job* job = &batch.jobs[i];
+        if (job->exit_status != JOB_OK)
+        {
+            num_failed++;
+        }
+
+        printf("%s[job %zu, line %d] %-18s %10.3f ms  %s -> %s%s\n",
+            job->exit_status == JOB_OK ? KGRN : KRED, i + 1, job->line, job->status_message,
+            job->elapsed_ms, batch.scripts[job->script].filename, job->output_filename, KNRM);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &batch_end);
+    printf("\n%zu jobs (%zu scripts) run by %d workers in %.3f ms: %zu succeeded, %d failed\n",
+        batch.num_jobs, batch.num_scripts, num_workers, elapsed_ms(&batch_start, &batch_end),
+        batch.num_jobs - num_failed, num_failed);
+
+    free_batch(&batch);
+    return num_failed == 0 ? 0 : 1;
+}
+
+#endif
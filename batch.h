@@ -0,0 +1,15 @@
+#pragma once
+
+// Batch mode runs every job listed in a manifest file. Each line of the manifest holds a job,
+// formed by the path of a script and the path of the file where its output is written:
+
+//      scripts/report.pinky    out/report_1.txt
+//      scripts/report.pinky    out/report_2.txt    # Comments start with '#'
+
+// Every distinct script is compiled just once, before any job is started. Jobs are then run in
+// forked worker processes, which share the compiled programs with the main process, and at most
+// num_workers of them run at the same time. If num_workers is zero or less, one worker per
+// available CPU is used.
+
+// Returns 0 if every job ran successfully, or 1 otherwise
+int run_batch(const char* manifest_filename, int num_workers);
@@ -0,0 +1,568 @@
+#include "closure.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "interpreter.h"
+#include "memo.h"
+#include "model.h"
+#include "state.h"
+#include "types.h"
+#include "utils.h"
+
+MAKE_FSD_ARRAY_FUNCTIONS(closure*, closure)
+
+#define RUN(child, env) ((child)->run((child), interpreter, (env)))
+#define NONE_RESULT ((expression_result) {.type = NONE})
+
+void init_closure_compiler(closure_compiler* compiler)
+{
+    init_closure_array(&compiler->closures, 64);
+}
+
+void destroy_closure_compiler(closure_compiler* compiler)
+{
+    for (size_t i = 0; i < compiler->closures.used; i++)
+    {
+        free(compiler->closures.data[i]);
+    }
+    free_closure_array(&compiler->closures);
+}
+
+// Statements
+
+static expression_result run_statement_list(const closure* self, interpreter* interpreter, environment* env)
+{
+    for (size_t i = 0; i < self->num_children; i++)
+    {
+        RUN(self->children[i], env);
+        clear_vss_array(&interpreter->memory);
+        if (interpreter->is_returning)
+            break;
+    }
+
+    return NONE_RESULT;
+}
+
+static expression_result run_print(const closure* self, interpreter* interpreter, environment* env)
+{
+    string_type result_str = cast_to_string(&interpreter->memory, RUN(self->children[0], env));
+    printf("%.*s", result_str.length, result_str.string_value);
+    return NONE_RESULT;
+}
+
+static expression_result run_println(const closure* self, interpreter* interpreter, environment* env)
+{
+    string_type result_str = cast_to_string(&interpreter->memory, RUN(self->children[0], env));
+    printf("%.*s\n", result_str.length, result_str.string_value);
+    return NONE_RESULT;
+}
+
+// Children are the condition, the then branch and the else branch, which might be missing
+static expression_result run_if(const closure* self, interpreter* interpreter, environment* env)
+{
+    expression_result test_result = RUN(self->children[0], env);
+    if (test_result.type != BOOL_VALUE)
+    {
+        PRINT_INTERPRETER_ERROR_AND_QUIT(self->line, "Condition test is not boolean\n");
+    }
+
+    const closure* branch = test_result.value.bool_value ? self->children[1] : self->children[2];
+    if (branch != NULL)
+    {
+        RUN(branch, push_environment(interpreter, env, ENV_BLOCK, branch->node, self->line));
+        pop_environment(interpreter);
+    }
+
+    return NONE_RESULT;
+}
+
+// Children are the condition and the body
+static expression_result run_while(const closure* self, interpreter* interpreter, environment* env)
+{
+    const closure* condition = self->children[0];
+    const closure* body = self->children[1];
+
+    expression_result test_result = RUN(condition, env);
+    if (test_result.type != BOOL_VALUE)
+    {
+        PRINT_INTERPRETER_ERROR_AND_QUIT(self->line, "Condition test is not boolean\n");
+    }
+
+    environment* while_env = push_environment(interpreter, env, ENV_BLOCK, body->node, self->line);
+    while (test_result.value.bool_value)
+    {
+        RUN(body, while_env);
+        if (interpreter->is_returning)
+            break;
+        test_result = RUN(condition, env);
+    }
+    pop_environment(interpreter);
+
+    return NONE_RESULT;
+}
+
+// Children are the initial assignment, the stop value, the step, which might be missing, and the body
+static expression_result run_for(const closure* self, interpreter* interpreter, environment* env)
+{
+    const closure* body = self->children[3];
+    environment* for_env = push_environment(interpreter, env, ENV_BLOCK, body->node, self->line);
+
+    RUN(self->children[0], for_env);
+    const Identifier* iterator_identifier = ((Assignment*)((For*)self->node)->initial_assignment)->lhs;
+    expression_result iterator = get_variable(for_env, iterator_identifier->name, self->line);
+    expression_result stop_value = RUN(self->children[1], for_env);
+    int step = 1;
+
+    if (self->children[2] != NULL)
+    {
+        expression_result step_value = RUN(self->children[2], for_env);
+        if (step_value.type != INT_VALUE)
+        {
+            PRINT_INTERPRETER_ERROR_AND_QUIT(self->line, "For step value must be an integer.");
+        }
+        step = step_value.value.int_value;
+    }
+
+    if (stop_value.type != INT_VALUE)
+    {
+        PRINT_INTERPRETER_ERROR_AND_QUIT(self->line, "For stop value must be an integer.");
+    }
+
+    if (iterator.type != INT_VALUE)
+    {
+        PRINT_INTERPRETER_ERROR_AND_QUIT(self->line, "For iterator must be an integer.");
+    }
+
+    while (iterator.value.int_value <= stop_value.value.int_value)
+    {
+        RUN(body, for_env);
+        if (interpreter->is_returning)
+            break;
+        expression_result new_iter_value = (expression_result) {.type = INT_VALUE, .value.int_value = iterator.value.int_value + step};
+        set_variable(for_env, iterator_identifier->name, new_iter_value, false);
+        iterator = get_variable(for_env, iterator_identifier->name, self->line);
+    }
+    pop_environment(interpreter);
+
+    return NONE_RESULT;
+}
+
+static expression_result run_assignment(const closure* self, interpreter* interpreter, environment* env)
+{
+    const Assignment* assignment = self->node;
+    const Identifier* lhs = assignment->lhs;
+    set_variable_at(env, lhs->scope_depth, lhs->slot, lhs->name, RUN(self->children[0], env), assignment->is_local);
+    return NONE_RESULT;
+}
+
+// Functions point to the closure of their declaration, whose only child is their body
+static expression_result run_func_decl(const closure* self, interpreter* interpreter, environment* env)
+{
+    (void)interpreter;
+    const FuncDecl* func_decl = self->node;
+    if (set_function(env, func_decl->name, (function) {.addr = (size_t)self, .env = env}) == -1)
+    {
+        PRINT_INTERPRETER_ERROR_AND_QUIT(self->line, "Function %.*s was already declared.", func_decl->name.length, func_decl->name.string_value);
+    }
+
+    return NONE_RESULT;
+}
+
+static expression_result run_return(const closure* self, interpreter* interpreter, environment* env)
+{
+    expression_result retval = RUN(self->children[0], env);
+    interpreter->is_returning = 1;
+    set_return(env, retval, self->line);
+    return NONE_RESULT;
+}
+
+// Calls, whose children are their arguments. A call which is a statement drops its result and is never
+// memoized, as in the interpreter
+static expression_result call_function(const closure* self, interpreter* interpreter, environment* env, int is_expression)
+{
+    const FuncCall* func_call = self->node;
+    function func = get_function(env, func_call->name, self->line);
+    const closure* func_closure = (const closure*)func.addr;
+    const FuncDecl* func_decl = func_closure->node;
+
+    if (self->num_children != func_decl->num_params)
+    {
+        PRINT_INTERPRETER_ERROR_AND_QUIT(self->line, "Function %.*s was declared with %lu parameters, but %lu arguments were given", func_decl->name.length, func_decl->name.string_value, func_decl->num_params, self->num_children);
+    }
+
+    const closure* body = func_closure->children[0];
+    environment* func_env = push_environment(interpreter, func.env, ENV_FUNC, body->node, self->line);
+
+    expression_result memo_args[MEMO_MAX_ARGS];
+    int is_memoized = is_expression && interpreter->memo != NULL && func_decl->is_pure && self->num_children <= MEMO_MAX_ARGS;
+
+    const string_type* param_ptrs = (const string_type*)((const char*)func_decl + sizeof(FuncDecl));
+    for (size_t i = 0; i < self->num_children; i++)
+    {
+        expression_result arg = RUN(self->children[i], env);
+        set_variable(func_env, param_ptrs[i], arg, true);
+        if (is_memoized)
+            memo_args[i] = arg;
+    }
+
+    expression_result ret = NONE_RESULT;
+    if (is_memoized && memo_lookup(interpreter->memo, func_decl, memo_args, self->num_children, &ret))
+    {
+        pop_environment(interpreter);
+        return ret;
+    }
+
+    RUN(body, func_env);
+    if (is_expression && interpreter->is_returning)
+    {
+        ret = get_variable(env, ret_var, self->line);
+    }
+    if (is_memoized)
+        memo_store(interpreter->memo, func_decl, memo_args, self->num_children, ret);
+
+    interpreter->is_returning = 0;
+    pop_environment(interpreter);
+    return ret;
+}
+
+static expression_result run_call_statement(const closure* self, interpreter* interpreter, environment* env)
+{
+    call_function(self, interpreter, env, 0);
+    return NONE_RESULT;
+}
+
+static expression_result run_call(const closure* self, interpreter* interpreter, environment* env)
+{
+    return call_function(self, interpreter, env, 1);
+}
+
+// Expressions
+
+static expression_result run_constant(const closure* self, interpreter* interpreter, environment* env)
+{
+    (void)interpreter;
+    (void)env;
+    return self->value;
+}
+
+static expression_result run_variable(const closure* self, interpreter* interpreter, environment* env)
+{
+    (void)interpreter;
+    const Identifier* identifier = self->node;
+    return get_variable_at(env, identifier->scope_depth, identifier->slot, identifier->name, self->line);
+}
+
+// Logic operators give one of their operands, and only evaluate the right one when the left one does not
+// decide the result
+static expression_result run_and(const closure* self, interpreter* interpreter, environment* env)
+{
+    expression_result lhs = RUN(self->children[0], env);
+    return cast_to_bool(&interpreter->memory, lhs) ? RUN(self->children[1], env) : lhs;
+}
+
+static expression_result run_or(const closure* self, interpreter* interpreter, environment* env)
+{
+    expression_result lhs = RUN(self->children[0], env);
+    return cast_to_bool(&interpreter->memory, lhs) ? lhs : RUN(self->children[1], env);
+}
+
+// Other binary operators handle operands of the same type, integers or floats, on their own. Everything
+// else, including errors, is left to the interpreter
+#define MAKE_ARITHMETIC_CLOSURE(name, op, token, rhs_int_ok, rhs_float_ok)                                                         \
+    static expression_result name(const closure* self, interpreter* interpreter, environment* env)                                 \
+    {                                                                                                                              \
+        expression_result lhs = RUN(self->children[0], env);                                                                       \
+        expression_result rhs = RUN(self->children[1], env);                                                                       \
+        if (lhs.type == INT_VALUE && rhs.type == INT_VALUE && (rhs_int_ok))                                                        \
+        {                                                                                                                          \
+            return (expression_result) {.type = INT_VALUE, .value.int_value = lhs.value.int_value op rhs.value.int_value};         \
+        }                                                                                                                          \
+        if (lhs.type == FLOAT_VALUE && rhs.type == FLOAT_VALUE && (rhs_float_ok))                                                  \
+        {                                                                                                                          \
+            return (expression_result) {.type = FLOAT_VALUE, .value.float_value = lhs.value.float_value op rhs.value.float_value}; \
+        }                                                                                                                          \
+        return interpret_binary_operation(interpreter, token, lhs, rhs, self->line);                                               \
+    }
+
+#define MAKE_COMPARISON_CLOSURE(name, op, token)                                                                                   \
+    static expression_result name(const closure* self, interpreter* interpreter, environment* env)                                 \
+    {                                                                                                                              \
+        expression_result lhs = RUN(self->children[0], env);                                                                       \
+        expression_result rhs = RUN(self->children[1], env);                                                                       \
+        if (lhs.type == INT_VALUE && rhs.type == INT_VALUE)                                                                        \
+        {                                                                                                                          \
+            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = lhs.value.int_value op rhs.value.int_value};       \
+        }                                                                                                                          \
+        if (lhs.type == FLOAT_VALUE && rhs.type == FLOAT_VALUE)                                                                    \
+        {                                                                                                                          \
+            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = lhs.value.float_value op rhs.value.float_value};   \
+        }                                                                                                                          \
+        return interpret_binary_operation(interpreter, token, lhs, rhs, self->line);                                               \
+    }
+
+// Divisions by zero are errors, which the interpreter reports
+MAKE_ARITHMETIC_CLOSURE(run_add, +, TOK_PLUS, 1, 1)
+MAKE_ARITHMETIC_CLOSURE(run_sub, -, TOK_MINUS, 1, 1)
+MAKE_ARITHMETIC_CLOSURE(run_mul, *, TOK_STAR, 1, 1)
+MAKE_ARITHMETIC_CLOSURE(run_div, /, TOK_SLASH, rhs.value.int_value != 0, rhs.value.float_value != 0)
+MAKE_COMPARISON_CLOSURE(run_gt, >, TOK_GT)
+MAKE_COMPARISON_CLOSURE(run_lt, <, TOK_LT)
+MAKE_COMPARISON_CLOSURE(run_ge, >=, TOK_GE)
+MAKE_COMPARISON_CLOSURE(run_le, <=, TOK_LE)
+MAKE_COMPARISON_CLOSURE(run_eq, ==, TOK_EQEQ)
+MAKE_COMPARISON_CLOSURE(run_ne, !=, TOK_NE)
+
+// Modulo of floats is left to the interpreter, which uses fmod
+static expression_result run_mod(const closure* self, interpreter* interpreter, environment* env)
+{
+    expression_result lhs = RUN(self->children[0], env);
+    expression_result rhs = RUN(self->children[1], env);
+    if (lhs.type == INT_VALUE && rhs.type == INT_VALUE && rhs.value.int_value != 0)
+    {
+        return (expression_result) {.type = INT_VALUE, .value.int_value = lhs.value.int_value % rhs.value.int_value};
+    }
+    return interpret_binary_operation(interpreter, TOK_MOD, lhs, rhs, self->line);
+}
+
+static expression_result run_binary_operation(const closure* self, interpreter* interpreter, environment* env)
+{
+    expression_result lhs = RUN(self->children[0], env);
+    expression_result rhs = RUN(self->children[1], env);
+    return interpret_binary_operation(interpreter, ((const BinOp*)self->node)->op, lhs, rhs, self->line);
+}
+
+static expression_result run_negate(const closure* self, interpreter* interpreter, environment* env)
+{
+    expression_result operand = RUN(self->children[0], env);
+    if (operand.type == INT_VALUE)
+    {
+        return (expression_result) {.type = INT_VALUE, .value.int_value = -operand.value.int_value};
+    }
+    return interpret_unary_operation(TOK_MINUS, operand, self->line);
+}
+
+static expression_result run_not(const closure* self, interpreter* interpreter, environment* env)
+{
+    expression_result operand = RUN(self->children[0], env);
+    if (operand.type == BOOL_VALUE)
+    {
+        return (expression_result) {.type = BOOL_VALUE, .value.bool_value = !operand.value.bool_value};
+    }
+    return interpret_unary_operation(TOK_NOT, operand, self->line);
+}
+
+static expression_result run_unary_operation(const closure* self, interpreter* interpreter, environment* env)
+{
+    expression_result operand = RUN(self->children[0], env);
+    return interpret_unary_operation(((const UnOp*)self->node)->op, operand, self->line);
+}
+
+// Conversion
+
+static closure* compile_node(closure_compiler* compiler, void* node);
+
+static closure* new_closure(closure_compiler* compiler, closure_function run, void* node, size_t num_children)
+{
+    // Children are stored right after the closure
+    closure* new = malloc(sizeof(closure) + num_children * sizeof(closure*));
+    if (new == NULL)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot allocate memory for a closure\n");
+    }
+
+    new->run = run;
+    new->line = GET_ELEMENT_LINE(node);
+    new->node = node;
+    new->value = NONE_RESULT;
+    new->children = (closure**)(new + 1);
+    new->num_children = num_children;
+    insert_closure_array(&compiler->closures, new);
+    return new;
+}
+
+// Closures with a single child, or two, which are compiled right away. Children might be missing
+static closure* new_closure_of(closure_compiler* compiler, closure_function run, void* node, void* child0, void* child1)
+{
+    closure* new = new_closure(compiler, run, node, (child1 != NULL) ? 2 : 1);
+    new->children[0] = compile_node(compiler, child0);
+    if (child1 != NULL)
+    {
+        new->children[1] = compile_node(compiler, child1);
+    }
+    return new;
+}
+
+static closure_function binary_function(token_type op)
+{
+    switch (op)
+    {
+        case TOK_AND:  return run_and;
+        case TOK_OR:   return run_or;
+        case TOK_PLUS:  return run_add;
+        case TOK_MINUS: return run_sub;
+        case TOK_STAR:  return run_mul;
+        case TOK_SLASH: return run_div;
+        case TOK_MOD:   return run_mod;
+        case TOK_GT:    return run_gt;
+        case TOK_LT:    return run_lt;
+        case TOK_GE:    return run_ge;
+        case TOK_LE:    return run_le;
+        case TOK_EQEQ:  return run_eq;
+        case TOK_NE:    return run_ne;
+        default:        return run_binary_operation;
+    }
+}
+
+static closure_function unary_function(token_type op)
+{
+    switch (op)
+    {
+        case TOK_MINUS: return run_negate;
+        case TOK_NOT:   return run_not;
+        default:        return run_unary_operation;
+    }
+}
+
+static closure* compile_call(closure_compiler* compiler, void* node, closure_function run)
+{
+    FuncCall* func_call = (FuncCall*)node;
+    closure* new = new_closure(compiler, run, node, func_call->num_args);
+
+    void** args_ptrs = (void**)((char*)node + sizeof(FuncCall));
+    for (size_t i = 0; i < func_call->num_args; i++)
+    {
+        new->children[i] = compile_node(compiler, args_ptrs[i]);
+    }
+    return new;
+}
+
+static closure* compile_expression(closure_compiler* compiler, void* node)
+{
+    closure* new;
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case Integer_expr:
+            new = new_closure(compiler, run_constant, node, 0);
+            new->value = (expression_result) {.type = INT_VALUE, .value.int_value = ((Integer*)node)->value};
+            return new;
+
+        case Float_expr:
+            new = new_closure(compiler, run_constant, node, 0);
+            new->value = (expression_result) {.type = FLOAT_VALUE, .value.float_value = ((Float*)node)->value};
+            return new;
+
+        case Bool_expr:
+            new = new_closure(compiler, run_constant, node, 0);
+            new->value = ((Bool*)node)->value ? true_expression : false_expression;
+            return new;
+
+        case String_expr:
+            new = new_closure(compiler, run_constant, node, 0);
+            new->value = (expression_result) {.type = STRING_VALUE, .value.string_value = ((String*)node)->value};
+            return new;
+
+        case Identifier_expr:
+            return new_closure(compiler, run_variable, node, 0);
+
+        case BinOp_expr:
+            BinOp* binop = (BinOp*)node;
+            return new_closure_of(compiler, binary_function(binop->op), node, binop->left, binop->right);
+
+        case UnOp_expr:
+            UnOp* unop = (UnOp*)node;
+            return new_closure_of(compiler, unary_function(unop->op), node, unop->operand, NULL);
+
+        // Groupings only matter to the parser
+        case Grouping_expr:
+            return compile_node(compiler, ((Grouping*)node)->expression);
+
+        case FuncCall_expr:
+            return compile_call(compiler, node, run_call);
+
+        default:
+            PRINT_INTERPRETER_ERROR_AND_QUIT(GET_ELEMENT_LINE(node), "Unknown expression type ID %d\n", GET_ELEMENT_TYPE(node));
+    }
+}
+
+static closure* compile_statement(closure_compiler* compiler, void* node)
+{
+    closure* new;
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case StatementList_stmt:
+            StatementList* statement_list = (StatementList*)node;
+            new = new_closure(compiler, run_statement_list, node, statement_list->size);
+
+            void** statement_ptrs = (void**)((char*)(node) + sizeof(StatementList));
+            for (size_t i = 0; i < statement_list->size; i++)
+            {
+                new->children[i] = compile_node(compiler, statement_ptrs[i]);
+            }
+            return new;
+
+        case Print_stmt:
+            Print* print_stmt = (Print*)node;
+            return new_closure_of(compiler, print_stmt->break_line ? run_println : run_print, node, print_stmt->expression, NULL);
+
+        case If_stmt:
+            If* if_stmt = (If*)node;
+            new = new_closure(compiler, run_if, node, 3);
+            new->children[0] = compile_node(compiler, if_stmt->condition);
+            new->children[1] = compile_node(compiler, if_stmt->then_branch);
+            new->children[2] = (if_stmt->else_branch != NULL) ? compile_node(compiler, if_stmt->else_branch) : NULL;
+            return new;
+
+        case While_stmt:
+            While* while_stmt = (While*)node;
+            return new_closure_of(compiler, run_while, node, while_stmt->condition, while_stmt->statements);
+
+        case For_stmt:
+            For* for_stmt = (For*)node;
+            new = new_closure(compiler, run_for, node, 4);
+            new->children[0] = compile_node(compiler, for_stmt->initial_assignment);
+            new->children[1] = compile_node(compiler, for_stmt->stop);
+            new->children[2] = (for_stmt->step != NULL) ? compile_node(compiler, for_stmt->step) : NULL;
+            new->children[3] = compile_node(compiler, for_stmt->statements);
+            return new;
+
+        case Assignment_stmt:
+            return new_closure_of(compiler, run_assignment, node, ((Assignment*)node)->rhs, NULL);
+
+        case FuncDecl_stmt:
+            return new_closure_of(compiler, run_func_decl, node, ((FuncDecl*)node)->statements, NULL);
+
+        case Return_stmt:
+            return new_closure_of(compiler, run_return, node, ((Return*)node)->expression, NULL);
+
+        // Calls whose result is dropped are statements
+        case FuncCall_expr:
+            return compile_call(compiler, node, run_call_statement);
+
+        default:
+            PRINT_INTERPRETER_ERROR_AND_QUIT(GET_ELEMENT_LINE(node), "Unknown statement type ID %d\n", GET_ELEMENT_TYPE(node));
+    }
+}
+
+static closure* compile_node(closure_compiler* compiler, void* node)
+{
+    return CHECK_ELEMENT_SUPERTYPE(node, Statement) ? compile_statement(compiler, node) : compile_expression(compiler, node);
+}
+
+closure* compile_closures(closure_compiler* compiler, void* ast_node)
+{
+    return compile_node(compiler, ast_node);
+}
+
+void run_closures(interpreter* interpreter, const closure* program)
+{
+    char stack_base;
+    interpreter->stack_base = &stack_base;
+
+    environment* main_env = interpreter->environ_stack[0];
+    const void* node = program->node;
+    set_environment_layout(main_env, (CHECK_ELEMENT_SUPERTYPE(node, Statement) && GET_ELEMENT_TYPE(node) == StatementList_stmt) ? ((const StatementList*)node)->layout : NULL);
+    RUN(program, main_env);
+    clear_environment(main_env);
+    interpreter->stack_base = NULL;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "array_generics.h"
+#include "compiler_commons.h"
+
+// Closure-compiled engine, between the tree-walking interpreter and the bytecode VM. The AST is converted
+// once into a tree of closures, each made of the function which runs it and of what that function needs,
+// already decoded: the closures of its children, the value of a constant, the resolved slot of a variable
+// (see resolver.h). The kind of each node and the operator of each operation are picked when converting,
+// as the function of the closure, so running the program is a chain of direct calls, with no tag to decode
+// and no switch to go through. Operations check the types of their operands for their most common cases
+// first, and defer to the interpreter for the others.
+
+// Programs run exactly as in the interpreter, through the same environments (see interpreter.h).
+
+typedef struct closure closure;
+typedef expression_result (*closure_function)(const closure* self, interpreter* interpreter, environment* env);
+
+struct closure
+{
+    closure_function run;
+    int line;
+
+    // Node the closure was built from, for what is used by reference: the names of variables and
+    // functions, the parameters of functions, and blocks, whose layouts their environments take
+    const void* node;
+
+    // Value of a constant
+    expression_result value;
+
+    // Closures of the children of the node, in the order they run. Missing ones are NULL
+    closure** children;
+    size_t num_children;
+};
+
+MAKE_FSD_ARRAY_HEADERS(closure*, closure)
+
+typedef struct closure_compiler
+{
+    // Every closure built, which live until the compiler is destroyed
+    closure_array closures;
+} closure_compiler;
+
+void init_closure_compiler(closure_compiler* compiler);
+void destroy_closure_compiler(closure_compiler* compiler);
+
+// Convert a program into closures, returning the one which runs it. Variables must be resolved already
+closure* compile_closures(closure_compiler* compiler, void* ast_node);
+
+// Run a program converted into closures, in the main environment of the interpreter
+void run_closures(interpreter* interpreter, const closure* program);
@@ -3,61 +3,50 @@
 #include "arrays.h"
 #include "hashmap.h"
 #include "model.h"
+#include "ir.h"
+#include "peephole.h"
 #include "string_type.h"
 #include "tokens.h"
 #include "utils.h"
+#include "vm.h"
 
 #include <stdalign.h>
+#include <stdlib.h>
 #include <string.h>
 
-#define ADD_INSTRUCTION(opcode) do { \
-    arr_offset = allocate_vsd_array(&compiler->temp_code, 1); \
-    *(char*)((char*)(compiler->temp_code.data) + arr_offset) = opcode; \
-} while(0)
-
-#define ADD_INSTRUCTION_PADDING(padding) do { \
-    arr_offset = allocate_vsd_array(&compiler->temp_code, padding); \
-    for (int _poff = 0; _poff < padding; _poff++) \
-        *(char*)((char*)(compiler->temp_code.data) + arr_offset + _poff) = 0x00; \
-} while(0)
-
-#define ADD_ALIGNED_CONSTANT(type, valaddr, size, align) do { \
-    alloc_size = size + ((compiler->temp_constants.used + align - 1) / align * align) - compiler->temp_constants.used; \
-    arr_offset = allocate_vsd_array(&compiler->temp_constants, alloc_size); \
-    aligned_target_addr = arr_offset + alloc_size - size; \
-    *((type*) (((char*) compiler->temp_constants.data) + aligned_target_addr)) = *valaddr; \
-} while(0)
-
-#define ADD_LAST_CONSTANT_OFFSET do { \
-    arr_offset = allocate_vsd_array(&compiler->temp_code, 3); \
-    *(char*)((char*)(compiler->temp_code.data) + arr_offset + 0) = aligned_target_addr          & 0xFF; \
-    *(char*)((char*)(compiler->temp_code.data) + arr_offset + 1) = (aligned_target_addr >> 8  ) & 0xFF; \
-    *(char*)((char*)(compiler->temp_code.data) + arr_offset + 2) = (aligned_target_addr >> 16 ) & 0xFF; \
-} while(0)
-
-#define ADD_LABEL_ID(label) do { \
-    arr_offset = allocate_vsd_array(&compiler->temp_code, 3); \
-    *(char*)((char*)(compiler->temp_code.data) + arr_offset + 0) = label                        & 0xFF; \
-    *(char*)((char*)(compiler->temp_code.data) + arr_offset + 1) = (label >> 8  )               & 0xFF; \
-    *(char*)((char*)(compiler->temp_code.data) + arr_offset + 2) = (label >> 16 )               & 0xFF; \
-} while(0)
-
-#define GENERATE_LABEL_ID(name) \
-    uint32_t name = compiler->label_addrs.used; \
-    insert_label_addr_array(&compiler->label_addrs, -1)
-
-#define SET_LABEL_ADDR(label) compiler->label_addrs.data[label] = compiler->temp_code.used
+// Shadowed slot of locals which do not shadow another one
+#define NO_LOCAL_SYMBOL UINT32_MAX
 
 void init_compiler(compiler* compiler) 
 {
+    init_vsd_array(&compiler->temp_constants, 0);
+    init_vsd_array(&compiler->temp_code, 0);
     init_vsd_array(&compiler->program, 0);
     init_label_addr_array(&compiler->label_addrs, 1024);
+    init_uint32_t_array(&compiler->jump_addrs, 1024);
+    init_hashmap(&compiler->int_constants, 64, 4);
+    init_hashmap(&compiler->float_constants, 64, 4);
+    init_hashmap(&compiler->bool_constants, 2, 1);
+    init_hashmap(&compiler->string_constants, 64, 4);
     init_hashmap(&compiler->symbols, 32, 32);
+    init_string_array(&compiler->symbol_names, 64);
+    init_hashmap(&compiler->local_symbols, 64, 4);
     init_string_array(&compiler->local_symbol_names, 1024);
     init_uint32_t_array(&compiler->local_symbol_depths, 1024);
+    init_uint32_t_array(&compiler->local_symbol_shadows, 1024);
+    init_expression_array(&compiler->hoisted_exprs, 64);
+    init_uint32_t_array(&compiler->hoisted_locals, 64);
+    init_uint32_t_array(&compiler->statement_lines, 1024);
+    init_uint32_t_array(&compiler->statement_addrs, 1024);
 
     compiler->constants_size = 0;
+    compiler->constants_base = 0;
+    compiler->text_base = 0;
     compiler->scope_depth = 0;
+    compiler->optimize = 1;
+    compiler->peephole = 1;
+    compiler->use_ir = 0;
+    compiler->print_ir = 0;
 
     compiler->num_symbols = 0;
     compiler->num_local_symbols = 0;
@@ -65,41 +54,720 @@ void init_compiler(compiler* compiler)
 
 void destroy_compiler(compiler* compiler)
 {
+    free_vsd_array(&compiler->temp_constants);
+    free_vsd_array(&compiler->temp_code);
     free_vsd_array(&compiler->program);
     free_label_addr_array(&compiler->label_addrs);
+    free_uint32_t_array(&compiler->jump_addrs);
+    free_hashmap(&compiler->int_constants);
+    free_hashmap(&compiler->float_constants);
+    free_hashmap(&compiler->bool_constants);
+    free_hashmap(&compiler->string_constants);
+    forget_symbols(compiler, 0);
     free_hashmap(&compiler->symbols);
+    free_string_array(&compiler->symbol_names);
+    free_hashmap(&compiler->local_symbols);
     free_string_array(&compiler->local_symbol_names);
     free_uint32_t_array(&compiler->local_symbol_depths);
+    free_uint32_t_array(&compiler->local_symbol_shadows);
+    free_expression_array(&compiler->hoisted_exprs);
+    free_uint32_t_array(&compiler->hoisted_locals);
+    free_uint32_t_array(&compiler->statement_lines);
+    free_uint32_t_array(&compiler->statement_addrs);
 
     compiler->constants_size = 0;
 }
 
-int find_local_symbol(const compiler* compiler, const string_type* key, size_t* value)
+// Globals outlive the source code declaring them when more code is appended to the program later
+static string_type copy_symbol_name(string_type name)
 {
-    for (int i = 0; i < compiler->num_local_symbols; i++)
+    string_type copy = { malloc(name.length), name.length };
+    if (copy.string_value == NULL)
     {
-        if (string_comparison(key, &compiler->local_symbol_names.data[i], COMPARE_EQ))
-        {
-            *value = i;
-            return 0;
-        }
+        PRINT_ERROR_AND_QUIT("Failed to allocate the name of a global!\n");
     }
 
+    memcpy(copy.string_value, name.string_value, name.length);
+    return copy;
+}
 
-    return -1;
+uint32_t declare_global_symbol(compiler* compiler, string_type name)
+{
+    string_type copy = copy_symbol_name(name);
+    insert_string_array(&compiler->symbol_names, copy);
+    hashmap_set(&compiler->symbols, copy, compiler->num_symbols);
+    return compiler->num_symbols++;
+}
+
+int find_local_symbol(const compiler* compiler, const string_type* key, size_t* value)
+{
+    if (hashmap_get(&compiler->local_symbols, key, value) == -1 || *value == NO_LOCAL_SYMBOL)
+        return -1;
+
+    return 0;
+}
+
+// Declare a local in the current scope, in the next stack slot, shadowing any other local with its name
+uint32_t declare_local_symbol(compiler* compiler, string_type name)
+{
+    size_t shadowed_slot;
+    if (hashmap_get(&compiler->local_symbols, &name, &shadowed_slot) == -1)
+        shadowed_slot = NO_LOCAL_SYMBOL;
+
+    insert_string_array(&compiler->local_symbol_names, name);
+    insert_uint32_t_array(&compiler->local_symbol_depths, compiler->scope_depth);
+    insert_uint32_t_array(&compiler->local_symbol_shadows, shadowed_slot);
+    hashmap_set(&compiler->local_symbols, name, compiler->num_local_symbols);
+
+    return compiler->num_local_symbols++;
 }
 
 void destroy_block(compiler* compiler)
 {
     size_t arr_offset;
     compiler->scope_depth -= 1;
-    for (int i = compiler->num_local_symbols-1; compiler->local_symbol_depths.data[i] > compiler->scope_depth; i--)
+    for (int i = compiler->num_local_symbols-1; i >= 0 && compiler->local_symbol_depths.data[i] > compiler->scope_depth; i--)
     {
-        ADD_INSTRUCTION(0x08);
-        ADD_INSTRUCTION_PADDING(3);
+        ADD_INSTRUCTION(OPCODE_POP);
+        hashmap_set(&compiler->local_symbols, compiler->local_symbol_names.data[i], compiler->local_symbol_shadows.data[i]);
         compiler->num_local_symbols -= 1;
         compiler->local_symbol_depths.used -= 1;
         compiler->local_symbol_names.used -= 1;
+        compiler->local_symbol_shadows.used -= 1;
+    }
+}
+
+// Address of a constant, which is added to the constants section the first time it is used. The
+// header (the length of strings) goes right before the bytes of the value, which identify the constant.
+// Keys point to the literals in the AST, so they outlive the compilation
+uint32_t add_constant(compiler* compiler, hashmap* pool, string_type value, const void* header, size_t header_size, size_t align)
+{
+    size_t addr;
+    if (hashmap_get(pool, &value, &addr) != -1)
+        return addr;
+
+    size_t padding = (compiler->temp_constants.used + align - 1) / align * align - compiler->temp_constants.used;
+    size_t arr_offset = allocate_vsd_array(&compiler->temp_constants, padding + header_size + value.length);
+    char* constant = (char*)compiler->temp_constants.data + arr_offset;
+    memset(constant, 0, padding);
+    memcpy(constant + padding, header, header_size);
+    memcpy(constant + padding + header_size, value.string_value, value.length);
+
+    addr = compiler->constants_base + arr_offset + padding;
+    hashmap_set(pool, value, addr);
+    return addr;
+}
+
+uint32_t add_bool_constant(compiler* compiler, char value)
+{
+    static char bool_values[2] = { 0, 1 };
+    string_type bool_val = { &bool_values[value != 0], sizeof(char) };
+    return add_constant(compiler, &compiler->bool_constants, bool_val, NULL, 0, alignof(char));
+}
+
+uint32_t add_literal_constant(compiler* compiler, void* literal)
+{
+    switch (GET_ELEMENT_TYPE(literal))
+    {
+        case Integer_expr:
+            string_type int_val = { (char*)&((Integer*)literal)->value, sizeof(int) };
+            return add_constant(compiler, &compiler->int_constants, int_val, NULL, 0, alignof(int));
+
+        case Float_expr:
+            string_type double_val = { (char*)&((Float*)literal)->value, sizeof(double) };
+            return add_constant(compiler, &compiler->float_constants, double_val, NULL, 0, alignof(double));
+
+        case Bool_expr:
+            return add_bool_constant(compiler, ((Bool*)literal)->value);
+
+        default:
+            string_type string_val = ((String*)literal)->value;
+            return add_constant(compiler, &compiler->string_constants, string_val, &string_val.length, sizeof(int), alignof(int));
+    }
+}
+
+size_t get_literal_alignment(void* literal)
+{
+    switch (GET_ELEMENT_TYPE(literal))
+    {
+        case Integer_expr:  return alignof(int);
+        case Float_expr:    return alignof(double);
+        case Bool_expr:     return alignof(char);
+        case String_expr:   return alignof(int);
+        default:            return 0;
+    }
+}
+
+// Squares of numbers are computed by multiplying them by themselves, so their exponent is never used
+int is_square(const compiler* compiler, const BinOp* binop)
+{
+    return compiler->optimize && binop->op == TOK_CARET && CHECK_ELEMENT_TYPE(binop->right, Integer_expr)
+        && ((Integer*)binop->right)->value == 2;
+}
+
+// Integer multiplications, divisions and remainders by a power of two are computed with shifts and masks,
+// which take the exponent as operand. Returns the instruction to use, or OPCODE_HALT when the right
+// operand is not a power of two or the left one might not be an integer
+uint8_t select_shift_opcode(token_type op, uint8_t lhs_type, int rhs_value, uint8_t* shift)
+{
+    if (lhs_type != INT_VALUE || rhs_value <= 0 || (rhs_value & (rhs_value - 1)) != 0)
+        return OPCODE_HALT;
+
+    for (*shift = 0; (1 << *shift) != rhs_value; *shift += 1);
+
+    switch (op)
+    {
+        case TOK_STAR:  return OPCODE_ISHL;
+        case TOK_SLASH: return OPCODE_ISHR;
+        case TOK_MOD:   return OPCODE_IMASK;
+        default:        return OPCODE_HALT;
+    }
+}
+
+// Operand of a binary operation left once the other one, a constant power of two, is turned into the
+// operand of a shift (see select_shift_opcode), or NULL if the operation is not computed with a shift
+void* get_shifted_operand(const compiler* compiler, const BinOp* binop, uint8_t* opcode, uint8_t* shift)
+{
+    if (!compiler->optimize)
+        return NULL;
+
+    if (CHECK_ELEMENT_TYPE(binop->right, Integer_expr))
+    {
+        *opcode = select_shift_opcode(binop->op, GET_STATIC_TYPE(binop->left), ((Integer*)binop->right)->value, shift);
+        if (*opcode != OPCODE_HALT)
+            return binop->left;
+    }
+
+    // Multiplications are commutative, and literals are evaluated without side effects
+    if (binop->op == TOK_STAR && CHECK_ELEMENT_TYPE(binop->left, Integer_expr))
+    {
+        *opcode = select_shift_opcode(binop->op, GET_STATIC_TYPE(binop->right), ((Integer*)binop->left)->value, shift);
+        if (*opcode != OPCODE_HALT)
+            return binop->right;
+    }
+
+    return NULL;
+}
+
+// Add the literals with the given alignment found in the code that will be compiled. Adding them before
+// compiling, from the most to the least strictly aligned, groups the constants by alignment, so that
+// there is no padding between them. Returns the number of nodes that will be compiled
+size_t collect_constants(compiler* compiler, void* node, size_t align)
+{
+    size_t num_nodes = 1;
+
+    if (CHECK_ELEMENT_SUPERTYPE(node, Expression))
+    {
+        switch (GET_ELEMENT_TYPE(node))
+        {
+            case Integer_expr:
+            case Float_expr:
+            case Bool_expr:
+            case String_expr:
+                if (get_literal_alignment(node) == align)
+                    add_literal_constant(compiler, node);
+                break;
+
+            case Grouping_expr:
+                num_nodes += collect_constants(compiler, ((Grouping*)node)->expression, align);
+                break;
+
+            case UnOp_expr:
+                num_nodes += collect_constants(compiler, ((UnOp*)node)->operand, align);
+                break;
+
+            case BinOp_expr:
+                uint8_t shift_opcode, shift;
+                void* shifted_operand = get_shifted_operand(compiler, (BinOp*)node, &shift_opcode, &shift);
+                if (shifted_operand != NULL)
+                {
+                    num_nodes += collect_constants(compiler, shifted_operand, align);
+                    break;
+                }
+
+                num_nodes += collect_constants(compiler, ((BinOp*)node)->left, align);
+                if (!is_square(compiler, (BinOp*)node))
+                    num_nodes += collect_constants(compiler, ((BinOp*)node)->right, align);
+                break;
+        }
+        return num_nodes;
+    }
+
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case StatementList_stmt:
+            void** statement_ptrs = (void**)((char*)(node) + sizeof(StatementList));
+            for (size_t i = 0; i < ((StatementList*)(node))->size; i++)
+            {
+                num_nodes += collect_constants(compiler, statement_ptrs[i], align);
+            }
+            break;
+
+        case Print_stmt:
+            num_nodes += collect_constants(compiler, ((Print*)node)->expression, align);
+            break;
+
+        // Branches and loops on constant conditions are pruned the same way they are when compiling them
+        case If_stmt:
+            If* if_stmt = (If*)node;
+            if (CHECK_ELEMENT_TYPE(if_stmt->condition, Bool_expr))
+            {
+                void* taken_branch = ((Bool*)if_stmt->condition)->value ? if_stmt->then_branch : if_stmt->else_branch;
+                if (taken_branch != NULL)
+                    num_nodes += collect_constants(compiler, taken_branch, align);
+                break;
+            }
+
+            num_nodes += collect_constants(compiler, if_stmt->condition, align);
+            num_nodes += collect_constants(compiler, if_stmt->then_branch, align);
+            if (if_stmt->else_branch != NULL)
+                num_nodes += collect_constants(compiler, if_stmt->else_branch, align);
+            break;
+
+        case While_stmt:
+            While* while_stmt = (While*)node;
+            if (CHECK_ELEMENT_TYPE(while_stmt->condition, Bool_expr))
+            {
+                if (((Bool*)while_stmt->condition)->value)
+                    num_nodes += collect_constants(compiler, while_stmt->statements, align);
+                break;
+            }
+
+            num_nodes += collect_constants(compiler, while_stmt->condition, align);
+            num_nodes += collect_constants(compiler, while_stmt->statements, align);
+            break;
+
+        case Assignment_stmt:
+            num_nodes += collect_constants(compiler, ((Assignment*)node)->rhs, align);
+            break;
+    }
+
+    return num_nodes;
+}
+
+void compile(compiler* compiler, void* ast_node);
+
+int find_hoisted_expression(const compiler* compiler, const void* expression, size_t* value)
+{
+    for (size_t i = 0; i < compiler->hoisted_exprs.used; i++)
+    {
+        if (compiler->hoisted_exprs.data[i] == (size_t)expression)
+        {
+            *value = compiler->hoisted_locals.data[i];
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+// Gather the names of all the variables assigned inside a loop, and whether it calls any function
+// (which could assign any global variable)
+void collect_loop_assignments(void* node, hashmap* assigned, int* has_calls)
+{
+    // Missing else branches are NULL
+    if (node == NULL)
+        return;
+
+    if (CHECK_ELEMENT_SUPERTYPE(node, Expression))
+    {
+        switch (GET_ELEMENT_TYPE(node))
+        {
+            case Grouping_expr:
+                collect_loop_assignments(((Grouping*)node)->expression, assigned, has_calls);
+                break;
+
+            case UnOp_expr:
+                collect_loop_assignments(((UnOp*)node)->operand, assigned, has_calls);
+                break;
+
+            case BinOp_expr:
+                collect_loop_assignments(((BinOp*)node)->left, assigned, has_calls);
+                collect_loop_assignments(((BinOp*)node)->right, assigned, has_calls);
+                break;
+
+            case FuncCall_expr:
+                *has_calls = 1;
+                break;
+        }
+        return;
+    }
+
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case StatementList_stmt:
+            void** statement_ptrs = (void**)((char*)(node) + sizeof(StatementList));
+            for (size_t i = 0; i < ((StatementList*)(node))->size; i++)
+            {
+                collect_loop_assignments(statement_ptrs[i], assigned, has_calls);
+            }
+            break;
+
+        case Print_stmt:
+            collect_loop_assignments(((Print*)node)->expression, assigned, has_calls);
+            break;
+
+        case If_stmt:
+            collect_loop_assignments(((If*)node)->condition, assigned, has_calls);
+            collect_loop_assignments(((If*)node)->then_branch, assigned, has_calls);
+            collect_loop_assignments(((If*)node)->else_branch, assigned, has_calls);
+            break;
+
+        case While_stmt:
+            collect_loop_assignments(((While*)node)->condition, assigned, has_calls);
+            collect_loop_assignments(((While*)node)->statements, assigned, has_calls);
+            break;
+
+        case Assignment_stmt:
+            hashmap_set(assigned, ((Identifier*)((Assignment*)node)->lhs)->name, 1);
+            collect_loop_assignments(((Assignment*)node)->rhs, assigned, has_calls);
+            break;
+
+        // Anything else is conservatively assumed to have side effects
+        default:
+            *has_calls = 1;
+            break;
+    }
+}
+
+int is_loop_invariant(void* expression, const hashmap* assigned)
+{
+    size_t unused;
+    switch (GET_ELEMENT_TYPE(expression))
+    {
+        case Integer_expr:
+        case Float_expr:
+        case Bool_expr:
+        case String_expr:
+            return 1;
+
+        case Identifier_expr:
+            return hashmap_get(assigned, &((Identifier*)expression)->name, &unused) == -1;
+
+        case Grouping_expr:
+            return is_loop_invariant(((Grouping*)expression)->expression, assigned);
+
+        case UnOp_expr:
+            return is_loop_invariant(((UnOp*)expression)->operand, assigned);
+
+        case BinOp_expr:
+            return is_loop_invariant(((BinOp*)expression)->left, assigned) && is_loop_invariant(((BinOp*)expression)->right, assigned);
+
+        default:
+            return 0;
+    }
+}
+
+// Whether evaluating an expression can never stop the program with an error: arithmetic and comparisons
+// of operands statically known to be numbers, and divisions by nonzero constants (other than -1, as
+// dividing the smallest integer by it overflows)
+int cannot_fail(void* expression)
+{
+    switch (GET_ELEMENT_TYPE(expression))
+    {
+        case Integer_expr:
+        case Float_expr:
+        case Bool_expr:
+        case String_expr:
+            return 1;
+
+        // Variables only have a static type once they are certainly assigned
+        case Identifier_expr:
+            return GET_STATIC_TYPE(expression) != STATIC_TYPE_UNKNOWN;
+
+        case Grouping_expr:
+            return cannot_fail(((Grouping*)expression)->expression);
+
+        case UnOp_expr:
+            UnOp* unop = (UnOp*)expression;
+            uint8_t operand_type = GET_STATIC_TYPE(unop->operand);
+
+            if (!cannot_fail(unop->operand))
+                return 0;
+            if (unop->op == TOK_MINUS)
+                return operand_type == INT_VALUE || operand_type == FLOAT_VALUE;
+            return unop->op == TOK_NOT && operand_type == BOOL_VALUE;
+
+        case BinOp_expr:
+            BinOp* binop = (BinOp*)expression;
+            uint8_t lhs_type = GET_STATIC_TYPE(binop->left);
+            uint8_t rhs_type = GET_STATIC_TYPE(binop->right);
+            int lhs_is_number = (lhs_type == INT_VALUE || lhs_type == FLOAT_VALUE);
+            int rhs_is_number = (rhs_type == INT_VALUE || rhs_type == FLOAT_VALUE);
+
+            if (!cannot_fail(binop->left) || !cannot_fail(binop->right))
+                return 0;
+
+            switch (binop->op)
+            {
+                case TOK_PLUS:
+                case TOK_MINUS:
+                case TOK_STAR:
+                case TOK_EQEQ:
+                case TOK_NE:
+                case TOK_GT:
+                case TOK_GE:
+                case TOK_LT:
+                case TOK_LE:
+                    return lhs_is_number && rhs_is_number;
+
+                case TOK_SLASH:
+                case TOK_MOD:
+                    if (!lhs_is_number)
+                        return 0;
+                    if (CHECK_ELEMENT_TYPE(binop->right, Integer_expr))
+                        return ((Integer*)binop->right)->value != 0 && ((Integer*)binop->right)->value != -1;
+                    if (CHECK_ELEMENT_TYPE(binop->right, Float_expr))
+                        return ((Float*)binop->right)->value != 0;
+                    return 0;
+
+                default:
+                    return 0;
+            }
+
+        default:
+            return 0;
+    }
+}
+
+// Compute the largest loop invariant subexpressions of an expression, leaving each value in a hidden
+// local. Literals and variables are left alone, as loading them is already as cheap as loading a local.
+// Unless may_fail is set, only the subexpressions which cannot fail are computed in advance
+void hoist_loop_invariants(compiler* compiler, void* expression, const hashmap* assigned, int may_fail)
+{
+    // Invariants of an enclosing loop are already computed
+    size_t unused;
+    if (find_hoisted_expression(compiler, expression, &unused) != -1)
+        return;
+
+    switch (GET_ELEMENT_TYPE(expression))
+    {
+        case Grouping_expr:
+        case UnOp_expr:
+        case BinOp_expr:
+            if (is_loop_invariant(expression, assigned) && (may_fail || cannot_fail(expression)))
+            {
+                compile(compiler, expression);
+
+                // Hidden locals are named so that they can never be found by an identifier lookup
+                uint32_t hoisted_local = declare_local_symbol(compiler, (string_type) { .string_value = "(invariant)", .length = 11 });
+                insert_expression_array(&compiler->hoisted_exprs, (size_t)expression);
+                insert_uint32_t_array(&compiler->hoisted_locals, hoisted_local);
+                return;
+            }
+            break;
+
+        default:
+            return;
+    }
+
+    switch (GET_ELEMENT_TYPE(expression))
+    {
+        case Grouping_expr:
+            hoist_loop_invariants(compiler, ((Grouping*)expression)->expression, assigned, may_fail);
+            break;
+
+        case UnOp_expr:
+            hoist_loop_invariants(compiler, ((UnOp*)expression)->operand, assigned, may_fail);
+            break;
+
+        // The second operand of `and` and `or` might not be evaluated, so computing it before the loop
+        // could fail when the loop itself would not. Failures of the second operand of other operations
+        // must not come before those of the first one, which is evaluated earlier
+        case BinOp_expr:
+            hoist_loop_invariants(compiler, ((BinOp*)expression)->left, assigned, may_fail);
+            if (((BinOp*)expression)->op != TOK_AND && ((BinOp*)expression)->op != TOK_OR)
+                hoist_loop_invariants(compiler, ((BinOp*)expression)->right, assigned, may_fail && cannot_fail(((BinOp*)expression)->left));
+            break;
+    }
+}
+
+// Hoist the invariants of a loop into its preheader, which runs once the condition has held the first time.
+// Only expressions evaluated in every iteration (those of the condition and of the statements directly
+// inside the loop) are considered. Computing an expression in advance must not change the error that
+// stops the program, nor skip the output printed before it, so expressions which might fail are only
+// hoisted from the condition (already evaluated before the preheader) and from the statements before
+// anything which might print or fail
+void hoist_while_invariants(compiler* compiler, While* while_stmt, int is_constant_condition)
+{
+    hashmap assigned;
+    int has_calls = 0;
+
+    init_hashmap(&assigned, 16, 4);
+    collect_loop_assignments(while_stmt->statements, &assigned, &has_calls);
+
+    if (!has_calls)
+    {
+        if (!is_constant_condition)
+        {
+            hoist_loop_invariants(compiler, while_stmt->condition, &assigned, 1);
+        }
+
+        int may_fail = 1;
+        void** statement_ptrs = (void**)((char*)(while_stmt->statements) + sizeof(StatementList));
+        for (size_t i = 0; i < ((StatementList*)(while_stmt->statements))->size; i++)
+        {
+            void* statement = statement_ptrs[i];
+            switch (GET_ELEMENT_TYPE(statement))
+            {
+                case Print_stmt:
+                    hoist_loop_invariants(compiler, ((Print*)statement)->expression, &assigned, may_fail);
+                    break;
+
+                case If_stmt:
+                    hoist_loop_invariants(compiler, ((If*)statement)->condition, &assigned, may_fail);
+                    break;
+
+                case While_stmt:
+                    hoist_loop_invariants(compiler, ((While*)statement)->condition, &assigned, may_fail);
+                    break;
+
+                case Assignment_stmt:
+                    hoist_loop_invariants(compiler, ((Assignment*)statement)->rhs, &assigned, may_fail);
+                    break;
+            }
+
+            // Only assignments of values which cannot fail have no visible effect
+            if (!CHECK_ELEMENT_TYPE(statement, Assignment_stmt) || !cannot_fail(((Assignment*)statement)->rhs))
+                may_fail = 0;
+        }
+    }
+
+    free_hashmap(&assigned);
+}
+
+uint8_t get_binop_opcode(token_type op)
+{
+    switch (op)
+    {
+        case TOK_PLUS:  return OPCODE_ADD;
+        case TOK_MINUS: return OPCODE_SUB;
+        case TOK_STAR:  return OPCODE_MUL;
+        case TOK_SLASH: return OPCODE_DIV;
+        case TOK_OR:    return OPCODE_OR;
+        case TOK_AND:   return OPCODE_AND;
+        case TOK_CARET: return OPCODE_EXP;
+        case TOK_MOD:   return OPCODE_MOD;
+        case TOK_EQEQ:  return OPCODE_EQ;
+        case TOK_NE:    return OPCODE_NE;
+        case TOK_GT:    return OPCODE_GT;
+        case TOK_GE:    return OPCODE_GE;
+        case TOK_LT:    return OPCODE_LT;
+        case TOK_LE:    return OPCODE_LE;
+
+        default:
+            PRINT_COMPILER_ERROR_AND_QUIT(0, "Unsupported binary operator %s\n", token_symbols[op]);
+    }
+}
+
+// Typed version of an arithmetic or comparison instruction, when both operands are known to be integers
+// or floats (see typer.h). The instruction is kept as it is otherwise
+uint8_t select_typed_opcode(uint8_t opcode, uint8_t lhs_type, uint8_t rhs_type)
+{
+    switch (opcode)
+    {
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_MOD:
+        case OPCODE_EQ:
+        case OPCODE_NE:
+        case OPCODE_GT:
+        case OPCODE_GE:
+        case OPCODE_LT:
+        case OPCODE_LE:
+            if (lhs_type == INT_VALUE && rhs_type == INT_VALUE)
+                return opcode - OPCODE_ADD + OPCODE_IADD;
+            if (lhs_type == FLOAT_VALUE && rhs_type == FLOAT_VALUE)
+                return opcode - OPCODE_ADD + OPCODE_FADD;
+            return opcode;
+
+        default:
+            return opcode;
+    }
+}
+
+uint8_t negate_comparison(uint8_t opcode)
+{
+    switch (opcode)
+    {
+        case OPCODE_EQ: return OPCODE_NE;
+        case OPCODE_NE: return OPCODE_EQ;
+        case OPCODE_GT: return OPCODE_LE;
+        case OPCODE_GE: return OPCODE_LT;
+        case OPCODE_LT: return OPCODE_GE;
+        default:        return OPCODE_GT;
+    }
+}
+
+// Compile a condition followed by a jump to a label, taken when the value of the condition is jump_if_true.
+// `and` and `or` are compiled into chains of jumps, which only evaluate their second operand when the
+// first one does not decide the result. Their operands (is_logic_operand) are cast to bool, as OPCODE_AND
+// and OPCODE_OR do, while any other condition must be a bool. Comparisons between integers are fused
+// with the jump
+void compile_conditional_jump(compiler* compiler, void* condition, int jump_if_true, uint32_t label, int is_logic_operand)
+{
+    size_t arr_offset, symbol_id;
+
+    while (find_hoisted_expression(compiler, condition, &symbol_id) == -1 && CHECK_ELEMENT_TYPE(condition, Grouping_expr))
+    {
+        condition = ((Grouping*)condition)->expression;
+    }
+
+    if (find_hoisted_expression(compiler, condition, &symbol_id) == -1 && CHECK_ELEMENT_TYPE(condition, BinOp_expr))
+    {
+        BinOp* binop = (BinOp*)condition;
+        if (binop->op == TOK_AND || binop->op == TOK_OR)
+        {
+            // A false operand of `and` makes it false, and a true operand of `or` makes it true. In those
+            // cases, both operands jump to the label. Otherwise, the first one skips the second one
+            if ((binop->op == TOK_AND) != jump_if_true)
+            {
+                compile_conditional_jump(compiler, binop->left, jump_if_true, label, 1);
+                compile_conditional_jump(compiler, binop->right, jump_if_true, label, 1);
+            }
+            else
+            {
+                GENERATE_LABEL_ID(skip_label);
+                compile_conditional_jump(compiler, binop->left, !jump_if_true, skip_label, 1);
+                compile_conditional_jump(compiler, binop->right, jump_if_true, label, 1);
+                SET_LABEL_ADDR(skip_label);
+            }
+            return;
+        }
+
+        uint8_t comparison_opcode = get_binop_opcode(binop->op);
+        if (comparison_opcode >= OPCODE_EQ && comparison_opcode <= OPCODE_LE
+            && GET_STATIC_TYPE(binop->left) == INT_VALUE && GET_STATIC_TYPE(binop->right) == INT_VALUE)
+        {
+            // Negating integer comparisons is exact, unlike with floats (as NaN compares false to everything)
+            if (!jump_if_true)
+                comparison_opcode = negate_comparison(comparison_opcode);
+
+            compile(compiler, binop->left);
+            compile(compiler, binop->right);
+            ADD_JUMP(comparison_opcode - OPCODE_EQ + OPCODE_JMP_IEQ, label);
+            return;
+        }
+    }
+
+    // Negating a bool only swaps the outcomes of the jump
+    if (find_hoisted_expression(compiler, condition, &symbol_id) == -1 && CHECK_ELEMENT_TYPE(condition, UnOp_expr)
+        && ((UnOp*)condition)->op == TOK_NOT && GET_STATIC_TYPE(((UnOp*)condition)->operand) == BOOL_VALUE)
+    {
+        compile_conditional_jump(compiler, ((UnOp*)condition)->operand, !jump_if_true, label, is_logic_operand);
+        return;
+    }
+
+    compile(compiler, condition);
+    if (is_logic_operand && GET_STATIC_TYPE(condition) != BOOL_VALUE)
+    {
+        ADD_JUMP(jump_if_true ? OPCODE_JMPT : OPCODE_JMPF, label);
+    }
+    else
+    {
+        ADD_JUMP(jump_if_true ? OPCODE_JMPNZ : OPCODE_JMPZ, label);
     }
 }
 
@@ -110,7 +778,7 @@ void compile(compiler* compiler, void* ast_node)
     int element_line = ((Element*)ast_node)->line;
 
     size_t symbol_id = 0;
-    size_t arr_offset, alloc_size, aligned_target_addr;
+    size_t arr_offset;
 
     if (element_supertype == Statement)
     {
@@ -120,6 +788,8 @@ void compile(compiler* compiler, void* ast_node)
                 void** statement_ptrs = (void**)((char*)(ast_node) + sizeof(StatementList));
                 for (size_t i = 0; i < ((StatementList*)(ast_node))->size; i++)
                 {
+                    insert_uint32_t_array(&compiler->statement_lines, ((Element*)(*statement_ptrs))->line);
+                    insert_uint32_t_array(&compiler->statement_addrs, compiler->temp_code.used);
                     compile(compiler, *statement_ptrs++);
                 }
                 break;
@@ -129,14 +799,12 @@ void compile(compiler* compiler, void* ast_node)
 
                 if (((Print*)ast_node)->break_line)
                 {
-                    ADD_INSTRUCTION(0x81);
-                    ADD_INSTRUCTION_PADDING(3);
+                    ADD_INSTRUCTION(OPCODE_PRINTLN);
                 }
 
                 else
                 {
-                    ADD_INSTRUCTION(0x80);
-                    ADD_INSTRUCTION_PADDING(3);
+                    ADD_INSTRUCTION(OPCODE_PRINT);
                 }
 
                 break;
@@ -144,18 +812,28 @@ void compile(compiler* compiler, void* ast_node)
             case If_stmt:
                 If* if_stmt = ((If*)ast_node);
 
-                compile(compiler, if_stmt->condition);
+                // If the condition is a constant, only the branch that would be taken is compiled
+                if (CHECK_ELEMENT_TYPE(if_stmt->condition, Bool_expr) && CHECK_ELEMENT_SUPERTYPE(if_stmt->condition, Expression))
+                {
+                    void* taken_branch = ((Bool*)if_stmt->condition)->value ? if_stmt->then_branch : if_stmt->else_branch;
+                    if (taken_branch != NULL)
+                    {
+                        compiler->scope_depth += 1;
+                        compile(compiler, taken_branch);
+                        destroy_block(compiler);
+                    }
+                    break;
+                }
+
                 GENERATE_LABEL_ID(else_label);
                 GENERATE_LABEL_ID(exit_label); 
-                ADD_INSTRUCTION(0x41); 
-                ADD_LABEL_ID(else_label);
+                compile_conditional_jump(compiler, if_stmt->condition, 0, else_label, 0);
 
                 compiler->scope_depth += 1;
                 compile(compiler, if_stmt->then_branch);
                 destroy_block(compiler);
 
-                ADD_INSTRUCTION(0x40);
-                ADD_LABEL_ID(exit_label); 
+                ADD_JUMP(OPCODE_JMP, exit_label);
 
                 SET_LABEL_ADDR(else_label);
                 if (if_stmt->else_branch != NULL)
@@ -171,20 +849,72 @@ void compile(compiler* compiler, void* ast_node)
             case While_stmt:
                 While* while_stmt = ((While*)ast_node);
 
+                // Loops whose condition is constantly false are never entered, while the ones
+                // whose condition is constantly true do not need to test it
+                int is_constant_condition = CHECK_ELEMENT_TYPE(while_stmt->condition, Bool_expr) && CHECK_ELEMENT_SUPERTYPE(while_stmt->condition, Expression);
+                if (is_constant_condition && !((Bool*)while_stmt->condition)->value)
+                {
+                    break;
+                }
+
                 GENERATE_LABEL_ID(while_begin_label);
                 GENERATE_LABEL_ID(while_end_label);
 
-                SET_LABEL_ADDR(while_begin_label);
-                compile(compiler, while_stmt->condition);
-                ADD_INSTRUCTION(0x41);
-                ADD_LABEL_ID(while_end_label);
+                if (!compiler->optimize)
+                {
+                    SET_LABEL_ADDR(while_begin_label);
+                    if (!is_constant_condition)
+                    {
+                        compile(compiler, while_stmt->condition);
+                        ADD_JUMP(OPCODE_JMPZ, while_end_label);
+                    }
+
+                    compiler->scope_depth += 1;
+                    compile(compiler, while_stmt->statements);
+                    destroy_block(compiler);
+
+                    ADD_JUMP(OPCODE_JMP, while_begin_label);
+
+                    SET_LABEL_ADDR(while_end_label);
+                    break;
+                }
 
+                // Otherwise, the loop is rotated so that the condition is tested once before entering it,
+                // and then only at the bottom of each iteration, with a single conditional jump:
+                //
+                //      <condition>  JMPZ end
+                //      <loop invariants>
+                // begin:
+                //      <statements>
+                //      <condition>  JMPNZ begin
+                //      <pop loop invariants>
+                // end:
+                if (!is_constant_condition)
+                {
+                    compile_conditional_jump(compiler, while_stmt->condition, 0, while_end_label, 0);
+                }
+
+                size_t outer_hoisted_exprs = compiler->hoisted_exprs.used;
+                compiler->scope_depth += 1;
+                hoist_while_invariants(compiler, while_stmt, is_constant_condition);
+
+                SET_LABEL_ADDR(while_begin_label);
                 compiler->scope_depth += 1;
                 compile(compiler, while_stmt->statements);
                 destroy_block(compiler);
 
-                ADD_INSTRUCTION(0x40);
-                ADD_LABEL_ID(while_begin_label);
+                if (!is_constant_condition)
+                {
+                    compile_conditional_jump(compiler, while_stmt->condition, 1, while_begin_label, 0);
+                }
+                else
+                {
+                    ADD_JUMP(OPCODE_JMP, while_begin_label);
+                }
+
+                compiler->hoisted_exprs.used = outer_hoisted_exprs;
+                compiler->hoisted_locals.used = outer_hoisted_exprs;
+                destroy_block(compiler);
 
                 SET_LABEL_ADDR(while_end_label);
                 break; 
@@ -195,34 +925,36 @@ void compile(compiler* compiler, void* ast_node)
 
                 compile(compiler, assign_stmt->rhs);
 
-                if (find_local_symbol(compiler, &lhs_identifier->name, &symbol_id) == -1 && hashmap_get(&compiler->symbols, &lhs_identifier->name, &symbol_id) == -1)
+                // Local assignments always store into the current scope, declaring the local there if needed.
+                // Other assignments store into the innermost variable with their name, and only declare
+                // a new one when there is none
+                if (assign_stmt->is_local && compiler->scope_depth > 0)
                 {
-                    if (compiler->scope_depth == 0)
+                    if (find_local_symbol(compiler, &lhs_identifier->name, &symbol_id) != -1 && compiler->local_symbol_depths.data[symbol_id] == compiler->scope_depth)
                     {
-                        hashmap_set(&compiler->symbols, lhs_identifier->name, compiler->num_symbols);
-                        symbol_id = compiler->num_symbols++;
-                        ADD_INSTRUCTION(0x21);
-                        ADD_LABEL_ID(symbol_id);
+                        ADD_INSTRUCTION_OPERAND(OPCODE_LSTORE, symbol_id);
                     }
                     else
                     {
-                        insert_string_array(&compiler->local_symbol_names, lhs_identifier->name);
-                        insert_uint32_t_array(&compiler->local_symbol_depths, compiler->scope_depth);
-                        symbol_id = compiler->num_local_symbols++;
+                        declare_local_symbol(compiler, lhs_identifier->name);
                     }
                 }
+                else if (find_local_symbol(compiler, &lhs_identifier->name, &symbol_id) != -1)
+                {
+                    ADD_INSTRUCTION_OPERAND(OPCODE_LSTORE, symbol_id);
+                }
+                else if (hashmap_get(&compiler->symbols, &lhs_identifier->name, &symbol_id) != -1)
+                {
+                    ADD_INSTRUCTION_OPERAND(OPCODE_GSTORE, symbol_id);
+                }
+                else if (compiler->scope_depth == 0)
+                {
+                    symbol_id = declare_global_symbol(compiler, lhs_identifier->name);
+                    ADD_INSTRUCTION_OPERAND(OPCODE_GSTORE, symbol_id);
+                }
                 else
                 {
-                    if (hashmap_get(&compiler->symbols, &lhs_identifier->name, &symbol_id) != -1)
-                    {
-                        ADD_INSTRUCTION(0x21);
-                        ADD_LABEL_ID(symbol_id);
-                    }
-                    else
-                    {
-                        ADD_INSTRUCTION(0x31);
-                        ADD_LABEL_ID(symbol_id);
-                    }
+                    declare_local_symbol(compiler, lhs_identifier->name);
                 }
 
                 break;
@@ -231,41 +963,29 @@ void compile(compiler* compiler, void* ast_node)
 
     else if (element_supertype == Expression)
     {
+        // Loop invariants are computed before the loop, and only need to be loaded from their local
+        if (find_hoisted_expression(compiler, ast_node, &symbol_id) != -1)
+        {
+            ADD_INSTRUCTION_OPERAND(OPCODE_LLOAD, symbol_id);
+            return;
+        }
+
         switch (element_type)
         {
             case Integer_expr:
-                int int_val = ((Integer*)ast_node)->value;
-                ADD_INSTRUCTION(0x01);
-                ADD_ALIGNED_CONSTANT(int, &int_val, sizeof(int), alignof(int));
-                ADD_LAST_CONSTANT_OFFSET;
+                ADD_INSTRUCTION_OPERAND(OPCODE_IPUSH, add_literal_constant(compiler, ast_node));
                 break;
 
             case Float_expr:
-                double double_val = ((Float*)ast_node)->value;
-                ADD_INSTRUCTION(0x02);
-                ADD_ALIGNED_CONSTANT(double, &double_val, sizeof(double), alignof(double));
-                ADD_LAST_CONSTANT_OFFSET;
+                ADD_INSTRUCTION_OPERAND(OPCODE_FPUSH, add_literal_constant(compiler, ast_node));
                 break;
 
-
             case Bool_expr:
-                char bool_val = ((Bool*)ast_node)->value;
-                ADD_INSTRUCTION(0x03);
-                ADD_ALIGNED_CONSTANT(char, &bool_val, sizeof(char), alignof(char));
-                ADD_LAST_CONSTANT_OFFSET;
+                ADD_INSTRUCTION_OPERAND(OPCODE_BPUSH, add_literal_constant(compiler, ast_node));
                 break;
 
             case String_expr:
-                string_type string_val = ((String*)ast_node)->value;
-                ADD_INSTRUCTION(0x04);
-                ADD_ALIGNED_CONSTANT(int, &string_val.length, sizeof(int), alignof(int));
-                ADD_LAST_CONSTANT_OFFSET;
-
-                arr_offset = allocate_vsd_array(&compiler->temp_constants, string_val.length);
-                for (int i = 0; i < string_val.length; i++)
-                {
-                    *(((char*)compiler->temp_constants.data) + arr_offset + i) = *(string_val.string_value + i); 
-                }
+                ADD_INSTRUCTION_OPERAND(OPCODE_SPUSH, add_literal_constant(compiler, ast_node));
                 break;
 
             case Identifier_expr:
@@ -273,15 +993,13 @@ void compile(compiler* compiler, void* ast_node)
 
                 if (find_local_symbol(compiler, &identifier_expr->name, &symbol_id) != -1)
                 {
-                    ADD_INSTRUCTION(0x30);
-                    ADD_LABEL_ID(symbol_id);
+                    ADD_INSTRUCTION_OPERAND(OPCODE_LLOAD, symbol_id);
                     break;
                 }
 
                 if (hashmap_get(&compiler->symbols, &identifier_expr->name, &symbol_id) != -1)
                 {
-                    ADD_INSTRUCTION(0x20);
-                    ADD_LABEL_ID(symbol_id);
+                    ADD_INSTRUCTION_OPERAND(OPCODE_GLOAD, symbol_id);
                     break;
                 }
 
@@ -300,95 +1018,54 @@ void compile(compiler* compiler, void* ast_node)
                 switch (unop_op) 
                 {
                     case TOK_MINUS:
-                        ADD_INSTRUCTION(0x16);
-                        ADD_INSTRUCTION_PADDING(3);
+                        ADD_INSTRUCTION(OPCODE_NUMNEG);
                         break;
 
                     case TOK_NOT:
-                        ADD_INSTRUCTION(0x17);
-                        ADD_INSTRUCTION_PADDING(3);
+                        ADD_INSTRUCTION(OPCODE_BOOLNEG);
                         break;
                 }
                 break;
 
             case BinOp_expr:
-                compile(compiler, ((BinOp*)ast_node)->left);
-                compile(compiler, ((BinOp*)ast_node)->right);
-                token_type binop_op = ((BinOp*)ast_node)->op;
-
-                switch (binop_op)
+                // Squares are computed with a single multiplication, which gives the same result as pow()
+                // for both integers and floats (and fails for the same operand types)
+                if (is_square(compiler, (BinOp*)ast_node))
                 {
-                    case TOK_PLUS:
-                        ADD_INSTRUCTION(0x10);
-                        ADD_INSTRUCTION_PADDING(3);
-                        break;
-
-                    case TOK_MINUS:
-                        ADD_INSTRUCTION(0x11);
-                        ADD_INSTRUCTION_PADDING(3);
-                        break;
-
-                    case TOK_STAR:
-                        ADD_INSTRUCTION(0x12);
-                        ADD_INSTRUCTION_PADDING(3);
-                        break;
-
-                    case TOK_SLASH:
-                        ADD_INSTRUCTION(0x13);
-                        ADD_INSTRUCTION_PADDING(3);
-                        break;
-
-                    case TOK_OR:
-                        ADD_INSTRUCTION(0x14);
-                        ADD_INSTRUCTION_PADDING(3);
-                        break;
-
-                    case TOK_AND:
-                        ADD_INSTRUCTION(0x15);
-                        ADD_INSTRUCTION_PADDING(3);
-                        break;
-
-                    case TOK_CARET:
-                        ADD_INSTRUCTION(0x18);
-                        ADD_INSTRUCTION_PADDING(3);
-                        break;
-
-                    case TOK_MOD:
-                        ADD_INSTRUCTION(0x19);
-                        ADD_INSTRUCTION_PADDING(3);
-                        break;
-
-                    case TOK_EQEQ:
-                        ADD_INSTRUCTION(0x1A);
-                        ADD_INSTRUCTION_PADDING(3);
-                        break;
-
-                    case TOK_NE:
-                        ADD_INSTRUCTION(0x1B);
-                        ADD_INSTRUCTION_PADDING(3);
-                        break;
-
-                    case TOK_GT:
-                        ADD_INSTRUCTION(0x1C);
-                        ADD_INSTRUCTION_PADDING(3);
-                        break;
-
-                    case TOK_GE:
-                        ADD_INSTRUCTION(0x1D);
-                        ADD_INSTRUCTION_PADDING(3);
-                        break;
+                    uint8_t operand_type = GET_STATIC_TYPE(((BinOp*)ast_node)->left);
+                    compile(compiler, ((BinOp*)ast_node)->left);
+                    ADD_INSTRUCTION(OPCODE_DUP);
+                    ADD_INSTRUCTION(select_typed_opcode(OPCODE_MUL, operand_type, operand_type));
+                    break;
+                }
 
-                    case TOK_LT:
-                        ADD_INSTRUCTION(0x1E);
-                        ADD_INSTRUCTION_PADDING(3);
-                        break;
+                uint8_t shift_opcode, shift;
+                void* shifted_operand = get_shifted_operand(compiler, (BinOp*)ast_node, &shift_opcode, &shift);
+                if (shifted_operand != NULL)
+                {
+                    compile(compiler, shifted_operand);
+                    ADD_INSTRUCTION_SHIFT(shift_opcode, shift);
+                    break;
+                }
 
-                    case TOK_LE:
-                        ADD_INSTRUCTION(0x1F);
-                        ADD_INSTRUCTION_PADDING(3);
-                        break;
+                // The value of `and` and `or` is only materialized when it is not used as a condition
+                if (((BinOp*)ast_node)->op == TOK_AND || ((BinOp*)ast_node)->op == TOK_OR)
+                {
+                    GENERATE_LABEL_ID(false_label);
+                    GENERATE_LABEL_ID(exit_label);
+                    compile_conditional_jump(compiler, ast_node, 0, false_label, 0);
+                    ADD_INSTRUCTION_OPERAND(OPCODE_BPUSH, add_bool_constant(compiler, 1));
+                    ADD_JUMP(OPCODE_JMP, exit_label);
+                    SET_LABEL_ADDR(false_label);
+                    ADD_INSTRUCTION_OPERAND(OPCODE_BPUSH, add_bool_constant(compiler, 0));
+                    SET_LABEL_ADDR(exit_label);
+                    break;
                 }
-                
+
+                compile(compiler, ((BinOp*)ast_node)->left);
+                compile(compiler, ((BinOp*)ast_node)->right);
+                uint8_t binop_opcode = get_binop_opcode(((BinOp*)ast_node)->op);
+                ADD_INSTRUCTION(select_typed_opcode(binop_opcode, GET_STATIC_TYPE(((BinOp*)ast_node)->left), GET_STATIC_TYPE(((BinOp*)ast_node)->right)));
                 break;
         }
     }
@@ -399,6 +1076,24 @@ void compile(compiler* compiler, void* ast_node)
     }
 }
 
+// Print the raw bytes of an instruction (padded to the longest possible instruction), followed by its name
+void print_instruction_bytes(const unsigned char* instruction, uint32_t length, const char* color, const char* name)
+{
+    printf("            %s", color);
+    for (uint32_t i = 0; i < 6; i++)
+    {
+        if (i < length)
+        {
+            printf("%02X ", instruction[i]);
+        }
+        else
+        {
+            printf("   ");
+        }
+    }
+    printf("   %*s", 15, name);
+}
+
 void print_code(compiler* compiler)
 {
     // Print constants section
@@ -421,463 +1116,309 @@ void print_code(compiler* compiler)
         idx += 1;
     }
 
+    // Print text section. Addresses are relative to the start of the section, as jump targets are
     printf("\n\nPROGRAM TEXT SECTION:\n\n");
-    idx = compiler->constants_size + 8;
-    while (idx < compiler->program.used)
+    const unsigned char* constants = (unsigned char*) compiler->program.data + 8;
+    const unsigned char* code = constants + compiler->constants_size;
+    uint32_t text_size = compiler->program.used - 8 - compiler->constants_size;
+    idx = 0;
+    while (idx < text_size)
     {
-        uint32_t opcode = *(uint32_t*)((char*) compiler->program.data + idx);
+        const unsigned char* instruction = code + idx;
+        uint32_t length = get_instruction_length(instruction);
+        int wide = (instruction[0] == OPCODE_WIDE);
+        uint8_t opcode = instruction[wide];
+        uint32_t operand = 0;
+
+        if (get_operand_kind(opcode) == OPERAND_INDEX)
+        {
+            operand = wide ? READ_U32(instruction + 2) : READ_U16(instruction + 1);
+        }
+        else if (get_operand_kind(opcode) == OPERAND_ADDRESS)
+        {
+            operand = READ_U32(instruction + 1);
+        }
+        else if (get_operand_kind(opcode) == OPERAND_SHIFT)
+        {
+            operand = instruction[1];
+        }
+
         printf("\e[0;33m(0x%08X)\e[0;37m  ", idx);
-        switch (opcode & 0xFF)
+        switch (opcode)
         {
-            case 0x00:
-                printf("            \e[0;34m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "PUSH_NONE"
-                );
-                idx += 4;
-                break;
-
-            case 0x01:
-                printf("            \e[0;34m%02X %02X %02X %02X    %*s    \e[0;33m@0x%02X%02X%02X    \e[0;32m(%d)\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "PUSH_INTEGER",
-                    (opcode >> 24) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >>  8) & 0xFF,
-                    *(int*)((char*) compiler->program.data + 8 + (opcode >> 8))
-                );
-                idx += 4;
-                break;
-
-            case 0x02:
-                printf("            \e[0;34m%02X %02X %02X %02X    %*s    \e[0;33m@0x%02X%02X%02X    \e[0;32m(%f)\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "PUSH_FLOAT",
-                    (opcode >> 24) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >>  8) & 0xFF,
-                    *(double*)((char*) compiler->program.data + 8 + (opcode >> 8))
-                );
-                idx += 4;
-                break;
-
-            case 0x03:
-                printf("            \e[0;34m%02X %02X %02X %02X    %*s    \e[0;33m@0x%02X%02X%02X    \e[0;32m(%s)\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "PUSH_BOOL",
-                    (opcode >> 24) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >>  8) & 0xFF,
-                    ((char)*((char*) compiler->program.data + 8 + (opcode >> 8))) ? "true" : "false"
-                );
-                idx += 4;
-                break;
-
-            case 0x04:
-                printf("            \e[0;34m%02X %02X %02X %02X    %*s    \e[0;33m@0x%02X%02X%02X    \e[0;32m(%d bytes of string)\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "PUSH_STRING",
-                    (opcode >> 24) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >>  8) & 0xFF,
-                    *(int*)((char*) compiler->program.data + 8 + (opcode >> 8))
-                );
-                idx += 4;
-                break;
-
-            case 0x08:
-                printf("            \e[0;34m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "POP"
-                );
-                idx += 4;
-                break;
-
-            case 0x10:
-                printf("            \e[0;36m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "ADD"
-                );
-                idx += 4;
-                break;
-
-            case 0x11:
-                printf("            \e[0;36m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "SUB"
-                );
-                idx += 4;
-                break;
-
-
-            case 0x12:
-                printf("            \e[0;36m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "MUL"
-                );
-                idx += 4;
-                break;
-
-
-            case 0x13:
-                printf("            \e[0;36m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "DIV"
-                );
-                idx += 4;
-                break;
-
-
-            case 0x14:
-                printf("            \e[0;36m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "OR"
-                );
-                idx += 4;
-                break;
-
-
-            case 0x15:
-                printf("            \e[0;36m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "AND"
-                );
-                idx += 4;
-                break;
-
-
-            case 0x16:
-                printf("            \e[0;36m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "NUMNEG"
-                );
-                idx += 4;
-                break;
-
-
-            case 0x17:
-                printf("            \e[0;36m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "BOOLNEG"
-                );
-                idx += 4;
-                break;
-
-
-            case 0x18:
-                printf("            \e[0;36m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "EXP"
-                );
-                idx += 4;
-                break;
-
-
-            case 0x19:
-                printf("            \e[0;36m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "MOD"
-                );
-                idx += 4;
-                break;
-
-
-            case 0x1A:
-                printf("            \e[0;36m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "EQ"
-                );
-                idx += 4;
-                break;
-
-
-            case 0x1B:
-                printf("            \e[0;36m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "NE"
-                );
-                idx += 4;
-                break;
-
-
-            case 0x1C:
-                printf("            \e[0;36m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "GT"
-                );
-                idx += 4;
-                break;
-
-
-            case 0x1D:
-                printf("            \e[0;36m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "GE"
-                );
-                idx += 4;
-                break;
-
-
-            case 0x1E:
-                printf("            \e[0;36m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "LT"
-                );
-                idx += 4;
-                break;
-
-
-            case 0x1F:
-                printf("            \e[0;36m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "LE"
-                );
-                idx += 4;
-                break;
-
-            case 0x80:
-                printf("            \e[0;37m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "PRINT"
-                );
-                idx += 4;
-                break;
-
-
-            case 0x81:
-                printf("            \e[0;37m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "PRINTLN"
-                );
-                idx += 4;
-                break;
-
-            case 0x69:
-                printf("            \e[0;31m%02X %02X %02X %02X    %*s\e[0;37m\n", 
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "HALT"
-                );
-                idx += 4;
-                break;
-
-            case 0x41:
-                printf("            \e[0;35m%02X %02X %02X %02X    %*s    \e[0;33m@0x%02X%02X%02X    \e[0;37m\n",
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "JMPZ",
-                    (opcode >> 24) & 0xFF,
-                    (opcode >> 16) & 0xFF,
-                    (opcode >>  8) & 0xFF
-                );
-                idx += 4;
-                break;
-
-            case 0x40:
-                printf("            \e[0;35m%02X %02X %02X %02X    %*s    \e[0;33m@0x%02X%02X%02X    \e[0;37m\n",
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "JMP",
-                    (opcode >> 24) & 0xFF,
-                    (opcode >> 16) & 0xFF,
-                    (opcode >>  8) & 0xFF
-                );
-                idx += 4;
-                break;
-
-            case 0x20:
-                printf("            \e[0;34m%02X %02X %02X %02X    %*s    \e[0;32m$%d    \e[0;37m\n",
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "LOAD_GLOBAL",
-                    opcode >>  8
-                );
-                idx += 4;
-                break;
-
-            case 0x21:
-                printf("            \e[0;34m%02X %02X %02X %02X    %*s    \e[0;32m$%d    \e[0;37m\n",
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "STORE_GLOBAL",
-                    opcode >>  8
-                );
-                idx += 4;
-                break;
-
-            case 0x30:
-                printf("            \e[0;34m%02X %02X %02X %02X    %*s    \e[0;32m$%d    \e[0;37m\n",
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "LOAD_LOCAL",
-                    opcode >>  8
-                );
-                idx += 4;
-                break;
-
-            case 0x31:
-                printf("            \e[0;34m%02X %02X %02X %02X    %*s    \e[0;32m$%d    \e[0;37m\n",
-                    (opcode >>  0) & 0xFF,
-                    (opcode >>  8) & 0xFF, 
-                    (opcode >> 16) & 0xFF,
-                    (opcode >> 24) & 0xFF,
-                    15,
-                    "STORE_LOCAL",
-                    opcode >>  8
-                );
-                idx += 4;
+            case OPCODE_NPUSH:
+                print_instruction_bytes(instruction, length, "\e[0;34m", "PUSH_NONE");
+                printf("\e[0;37m\n");
+                break;
+
+            case OPCODE_IPUSH:
+                print_instruction_bytes(instruction, length, "\e[0;34m", "PUSH_INTEGER");
+                printf("    \e[0;33m@0x%06X    \e[0;32m(%d)\e[0;37m\n", operand, *(int*)(constants + operand));
+                break;
+
+            case OPCODE_FPUSH:
+                print_instruction_bytes(instruction, length, "\e[0;34m", "PUSH_FLOAT");
+                printf("    \e[0;33m@0x%06X    \e[0;32m(%f)\e[0;37m\n", operand, *(double*)(constants + operand));
+                break;
+
+            case OPCODE_BPUSH:
+                print_instruction_bytes(instruction, length, "\e[0;34m", "PUSH_BOOL");
+                printf("    \e[0;33m@0x%06X    \e[0;32m(%s)\e[0;37m\n", operand, *(char*)(constants + operand) ? "true" : "false");
+                break;
+
+            case OPCODE_SPUSH:
+                print_instruction_bytes(instruction, length, "\e[0;34m", "PUSH_STRING");
+                printf("    \e[0;33m@0x%06X    \e[0;32m(%d bytes of string)\e[0;37m\n", operand, *(int*)(constants + operand));
+                break;
+
+            case OPCODE_POP:
+                print_instruction_bytes(instruction, length, "\e[0;34m", "POP");
+                printf("\e[0;37m\n");
+                break;
+
+            case OPCODE_DUP:
+                print_instruction_bytes(instruction, length, "\e[0;34m", "DUP");
+                printf("\e[0;37m\n");
+                break;
+
+            case OPCODE_ADD:     print_instruction_bytes(instruction, length, "\e[0;36m", "ADD");     printf("\e[0;37m\n"); break;
+            case OPCODE_SUB:     print_instruction_bytes(instruction, length, "\e[0;36m", "SUB");     printf("\e[0;37m\n"); break;
+            case OPCODE_MUL:     print_instruction_bytes(instruction, length, "\e[0;36m", "MUL");     printf("\e[0;37m\n"); break;
+            case OPCODE_DIV:     print_instruction_bytes(instruction, length, "\e[0;36m", "DIV");     printf("\e[0;37m\n"); break;
+            case OPCODE_OR:      print_instruction_bytes(instruction, length, "\e[0;36m", "OR");      printf("\e[0;37m\n"); break;
+            case OPCODE_AND:     print_instruction_bytes(instruction, length, "\e[0;36m", "AND");     printf("\e[0;37m\n"); break;
+            case OPCODE_NUMNEG:  print_instruction_bytes(instruction, length, "\e[0;36m", "NUMNEG");  printf("\e[0;37m\n"); break;
+            case OPCODE_BOOLNEG: print_instruction_bytes(instruction, length, "\e[0;36m", "BOOLNEG"); printf("\e[0;37m\n"); break;
+            case OPCODE_EXP:     print_instruction_bytes(instruction, length, "\e[0;36m", "EXP");     printf("\e[0;37m\n"); break;
+            case OPCODE_MOD:     print_instruction_bytes(instruction, length, "\e[0;36m", "MOD");     printf("\e[0;37m\n"); break;
+            case OPCODE_EQ:      print_instruction_bytes(instruction, length, "\e[0;36m", "EQ");      printf("\e[0;37m\n"); break;
+            case OPCODE_NE:      print_instruction_bytes(instruction, length, "\e[0;36m", "NE");      printf("\e[0;37m\n"); break;
+            case OPCODE_GT:      print_instruction_bytes(instruction, length, "\e[0;36m", "GT");      printf("\e[0;37m\n"); break;
+            case OPCODE_GE:      print_instruction_bytes(instruction, length, "\e[0;36m", "GE");      printf("\e[0;37m\n"); break;
+            case OPCODE_LT:      print_instruction_bytes(instruction, length, "\e[0;36m", "LT");      printf("\e[0;37m\n"); break;
+            case OPCODE_LE:      print_instruction_bytes(instruction, length, "\e[0;36m", "LE");      printf("\e[0;37m\n"); break;
+            case OPCODE_IADD:    print_instruction_bytes(instruction, length, "\e[0;36m", "IADD");    printf("\e[0;37m\n"); break;
+            case OPCODE_ISUB:    print_instruction_bytes(instruction, length, "\e[0;36m", "ISUB");    printf("\e[0;37m\n"); break;
+            case OPCODE_IMUL:    print_instruction_bytes(instruction, length, "\e[0;36m", "IMUL");    printf("\e[0;37m\n"); break;
+            case OPCODE_IDIV:    print_instruction_bytes(instruction, length, "\e[0;36m", "IDIV");    printf("\e[0;37m\n"); break;
+            case OPCODE_IMOD:    print_instruction_bytes(instruction, length, "\e[0;36m", "IMOD");    printf("\e[0;37m\n"); break;
+            case OPCODE_IEQ:     print_instruction_bytes(instruction, length, "\e[0;36m", "IEQ");     printf("\e[0;37m\n"); break;
+            case OPCODE_INE:     print_instruction_bytes(instruction, length, "\e[0;36m", "INE");     printf("\e[0;37m\n"); break;
+            case OPCODE_IGT:     print_instruction_bytes(instruction, length, "\e[0;36m", "IGT");     printf("\e[0;37m\n"); break;
+            case OPCODE_IGE:     print_instruction_bytes(instruction, length, "\e[0;36m", "IGE");     printf("\e[0;37m\n"); break;
+            case OPCODE_ILT:     print_instruction_bytes(instruction, length, "\e[0;36m", "ILT");     printf("\e[0;37m\n"); break;
+            case OPCODE_ILE:     print_instruction_bytes(instruction, length, "\e[0;36m", "ILE");     printf("\e[0;37m\n"); break;
+            case OPCODE_FADD:    print_instruction_bytes(instruction, length, "\e[0;36m", "FADD");    printf("\e[0;37m\n"); break;
+            case OPCODE_FSUB:    print_instruction_bytes(instruction, length, "\e[0;36m", "FSUB");    printf("\e[0;37m\n"); break;
+            case OPCODE_FMUL:    print_instruction_bytes(instruction, length, "\e[0;36m", "FMUL");    printf("\e[0;37m\n"); break;
+            case OPCODE_FDIV:    print_instruction_bytes(instruction, length, "\e[0;36m", "FDIV");    printf("\e[0;37m\n"); break;
+            case OPCODE_FMOD:    print_instruction_bytes(instruction, length, "\e[0;36m", "FMOD");    printf("\e[0;37m\n"); break;
+            case OPCODE_FEQ:     print_instruction_bytes(instruction, length, "\e[0;36m", "FEQ");     printf("\e[0;37m\n"); break;
+            case OPCODE_FNE:     print_instruction_bytes(instruction, length, "\e[0;36m", "FNE");     printf("\e[0;37m\n"); break;
+            case OPCODE_FGT:     print_instruction_bytes(instruction, length, "\e[0;36m", "FGT");     printf("\e[0;37m\n"); break;
+            case OPCODE_FGE:     print_instruction_bytes(instruction, length, "\e[0;36m", "FGE");     printf("\e[0;37m\n"); break;
+            case OPCODE_FLT:     print_instruction_bytes(instruction, length, "\e[0;36m", "FLT");     printf("\e[0;37m\n"); break;
+            case OPCODE_FLE:     print_instruction_bytes(instruction, length, "\e[0;36m", "FLE");     printf("\e[0;37m\n"); break;
+
+            case OPCODE_ISHL:
+                print_instruction_bytes(instruction, length, "\e[0;36m", "ISHL");
+                printf("    \e[0;32m%d\e[0;37m\n", operand);
+                break;
+
+            case OPCODE_ISHR:
+                print_instruction_bytes(instruction, length, "\e[0;36m", "ISHR");
+                printf("    \e[0;32m%d\e[0;37m\n", operand);
+                break;
+
+            case OPCODE_IMASK:
+                print_instruction_bytes(instruction, length, "\e[0;36m", "IMASK");
+                printf("    \e[0;32m%d\e[0;37m\n", operand);
+                break;
+
+            case OPCODE_PRINT:
+                print_instruction_bytes(instruction, length, "\e[0;37m", "PRINT");
+                printf("\e[0;37m\n");
+                break;
+
+            case OPCODE_PRINTLN:
+                print_instruction_bytes(instruction, length, "\e[0;37m", "PRINTLN");
+                printf("\e[0;37m\n");
+                break;
+
+            case OPCODE_HALT:
+                print_instruction_bytes(instruction, length, "\e[0;31m", "HALT");
+                printf("\e[0;37m\n");
+                break;
+
+            case OPCODE_JMPZ:
+                print_instruction_bytes(instruction, length, "\e[0;35m", "JMPZ");
+                printf("    \e[0;33m@0x%08X    \e[0;37m\n", operand);
+                break;
+
+            case OPCODE_JMPNZ:
+                print_instruction_bytes(instruction, length, "\e[0;35m", "JMPNZ");
+                printf("    \e[0;33m@0x%08X    \e[0;37m\n", operand);
+                break;
+
+            case OPCODE_JMPF:
+                print_instruction_bytes(instruction, length, "\e[0;35m", "JMPF");
+                printf("    \e[0;33m@0x%08X    \e[0;37m\n", operand);
+                break;
+
+            case OPCODE_JMPT:
+                print_instruction_bytes(instruction, length, "\e[0;35m", "JMPT");
+                printf("    \e[0;33m@0x%08X    \e[0;37m\n", operand);
+                break;
+
+            case OPCODE_JMP:
+                print_instruction_bytes(instruction, length, "\e[0;35m", "JMP");
+                printf("    \e[0;33m@0x%08X    \e[0;37m\n", operand);
+                break;
+
+            case OPCODE_JMP_IEQ:
+                print_instruction_bytes(instruction, length, "\e[0;35m", "JMP_IEQ");
+                printf("    \e[0;33m@0x%08X    \e[0;37m\n", operand);
+                break;
+
+            case OPCODE_JMP_INE:
+                print_instruction_bytes(instruction, length, "\e[0;35m", "JMP_INE");
+                printf("    \e[0;33m@0x%08X    \e[0;37m\n", operand);
+                break;
+
+            case OPCODE_JMP_IGT:
+                print_instruction_bytes(instruction, length, "\e[0;35m", "JMP_IGT");
+                printf("    \e[0;33m@0x%08X    \e[0;37m\n", operand);
+                break;
+
+            case OPCODE_JMP_IGE:
+                print_instruction_bytes(instruction, length, "\e[0;35m", "JMP_IGE");
+                printf("    \e[0;33m@0x%08X    \e[0;37m\n", operand);
+                break;
+
+            case OPCODE_JMP_ILT:
+                print_instruction_bytes(instruction, length, "\e[0;35m", "JMP_ILT");
+                printf("    \e[0;33m@0x%08X    \e[0;37m\n", operand);
+                break;
+
+            case OPCODE_JMP_ILE:
+                print_instruction_bytes(instruction, length, "\e[0;35m", "JMP_ILE");
+                printf("    \e[0;33m@0x%08X    \e[0;37m\n", operand);
+                break;
+
+            case OPCODE_GLOAD:
+                print_instruction_bytes(instruction, length, "\e[0;34m", "LOAD_GLOBAL");
+                printf("    \e[0;32m$%d    \e[0;37m\n", operand);
+                break;
+
+            case OPCODE_GSTORE:
+                print_instruction_bytes(instruction, length, "\e[0;34m", "STORE_GLOBAL");
+                printf("    \e[0;32m$%d    \e[0;37m\n", operand);
+                break;
+
+            case OPCODE_LLOAD:
+                print_instruction_bytes(instruction, length, "\e[0;34m", "LOAD_LOCAL");
+                printf("    \e[0;32m$%d    \e[0;37m\n", operand);
+                break;
+
+            case OPCODE_LSTORE:
+                print_instruction_bytes(instruction, length, "\e[0;34m", "STORE_LOCAL");
+                printf("    \e[0;32m$%d    \e[0;37m\n", operand);
                 break;
 
             default:
                 PRINT_ERROR_AND_QUIT("Unrecognized opcode %02X", opcode);
         }
+
+        idx += length;
     }
 }
 
+// Replace the label IDs in jump instructions with the text address of their labels
 void solve_label_addrs(compiler* compiler)
 {
-    uint32_t idx = compiler->constants_size + 8;
-    while (idx < compiler->program.used)
+    unsigned char* code = (unsigned char*) compiler->program.data + 8 + compiler->constants_size + compiler->text_base;
+    for (size_t i = 0; i < compiler->jump_addrs.used; i++)
     {
-        uint32_t instruction = *(uint32_t*)((char*) compiler->program.data + idx);
-        uint32_t opcode = instruction & 0xFF;
-
-        if (opcode == 0x40 || opcode == 0x41)
-        {
-            uint32_t target_addr = compiler->label_addrs.data[instruction >> 8] + 8 + compiler->temp_constants.used;
-            *(uint32_t*)((char*) compiler->program.data + idx) = opcode | (target_addr << 8);
-        }
-
-        idx += 4;
+        unsigned char* operand = code + compiler->jump_addrs.data[i] + 1;
+        uint32_t target_addr = compiler->text_base + compiler->label_addrs.data[READ_U32(operand)];
+        WRITE_U32(operand, target_addr);
     }
 }
 
-unsigned char* compile_code(compiler* compiler, void* ast_node)
+// Compile the code of an AST into temp_constants and temp_code, with constant addresses starting at
+// constants_base and label addresses relative to the start of temp_code
+static void generate_code(compiler* compiler, void* ast_node)
 {
     size_t arr_offset;
 
-    init_vsd_array(&compiler->temp_constants, 0);
-    init_vsd_array(&compiler->temp_code, 0);
+    clear_vsd_array(&compiler->temp_constants);
+    clear_vsd_array(&compiler->temp_code);
+    clear_hashmap(&compiler->int_constants);
+    clear_hashmap(&compiler->float_constants);
+    clear_hashmap(&compiler->bool_constants);
+    clear_hashmap(&compiler->string_constants);
+    compiler->label_addrs.used = 0;
+    compiler->jump_addrs.used = 0;
+    compiler->hoisted_exprs.used = 0;
+    compiler->hoisted_locals.used = 0;
+    compiler->statement_lines.used = 0;
+    compiler->statement_addrs.used = 0;
+
+    // Nothing is left of the locals of a previous compilation, even if it stopped in the middle of a block
+    clear_hashmap(&compiler->local_symbols);
+    compiler->local_symbol_names.used = 0;
+    compiler->local_symbol_depths.used = 0;
+    compiler->local_symbol_shadows.used = 0;
+    compiler->num_local_symbols = 0;
+    compiler->scope_depth = 0;
+
+    if (compiler->use_ir)
+    {
+        ir_program program;
+        init_ir_program(&program);
+        build_ir(&program, compiler, ast_node);
+        if (compiler->optimize)
+            optimize_ir(&program);
+        if (compiler->print_ir)
+            print_ir(&program);
+
+        generate_ir_code(compiler, &program);
+        free_ir_program(&program);
+    }
+    else
+    {
+        size_t num_nodes = collect_constants(compiler, ast_node, alignof(double));
+        collect_constants(compiler, ast_node, alignof(int));
+        collect_constants(compiler, ast_node, alignof(char));
 
-    compile(compiler, ast_node);
-    ADD_INSTRUCTION(0x69);
+        // Most nodes compile to a single instruction with a 16-bit operand, so the text is allocated
+        // upfront for as many of them
+        reserve_vsd_array(&compiler->temp_code, num_nodes * 3);
+
+        compile(compiler, ast_node);
+        ADD_INSTRUCTION(OPCODE_HALT);
+    }
+
+    if (compiler->optimize && compiler->peephole)
+        peephole_optimize(compiler);
+
+    // The text section is not aligned, as instructions are decoded byte by byte. However, the
+    // constants section keeps being padded to a multiple of 4 bytes
     size_t alloc_size = ((compiler->temp_constants.used + 4 - 1) / 4 * 4) - compiler->temp_constants.used;
     allocate_vsd_array(&compiler->temp_constants, alloc_size);
 
+    for (size_t i = 0; i < compiler->statement_addrs.used; i++)
+    {
+        compiler->statement_addrs.data[i] += compiler->text_base;
+    }
+}
+
+unsigned char* compile_code(compiler* compiler, void* ast_node)
+{
+    compiler->constants_base = 0;
+    compiler->text_base = 0;
+    generate_code(compiler, ast_node);
+
     // Even though the constants_size value is only 4 bytes, 8 are allocated in order not to break the
     // alignment of any of the other values (as doubles, the most strictly aligned, have an alignment of 8)
     allocate_vsd_array(&compiler->program, 8 + compiler->temp_constants.used + compiler->temp_code.used);
@@ -890,8 +1431,55 @@ unsigned char* compile_code(compiler* compiler, void* ast_node)
     // Replace previously generated labels with their definitive values
     solve_label_addrs(compiler);
 
-    free_vsd_array(&compiler->temp_constants);
-    free_vsd_array(&compiler->temp_code);
+    return compiler->program.data;
+}
+
+unsigned char* append_code(compiler* compiler, void* ast_node)
+{
+    if (compiler->program.used == 0)
+        return compile_code(compiler, ast_node);
+
+    // The new constants go after the old ones, keeping the alignment of doubles, and the new text
+    // replaces the HALT which ends the old one
+    uint32_t old_constants_size = compiler->constants_size;
+    uint32_t old_text_size = compiler->program.used - 8 - old_constants_size;
+    compiler->constants_base = (old_constants_size + alignof(double) - 1) / alignof(double) * alignof(double);
+    compiler->text_base = old_text_size - 1;
+    generate_code(compiler, ast_node);
+
+    uint32_t constants_size = compiler->constants_base + compiler->temp_constants.used;
+    vsd_array program;
+    init_vsd_array(&program, 8 + constants_size + compiler->text_base + compiler->temp_code.used);
+    allocate_vsd_array(&program, 8 + constants_size + compiler->text_base + compiler->temp_code.used);
+
+    unsigned char* data = program.data;
+    const unsigned char* old_data = compiler->program.data;
+    memset(data, 0, 8 + constants_size);
+    *(uint32_t*)data = constants_size;
+    memcpy(data + 8, old_data + 8, old_constants_size);
+    memcpy(data + 8 + compiler->constants_base, compiler->temp_constants.data, compiler->temp_constants.used);
+    memcpy(data + 8 + constants_size, old_data + 8 + old_constants_size, compiler->text_base);
+    memcpy(data + 8 + constants_size + compiler->text_base, compiler->temp_code.data, compiler->temp_code.used);
+
+    free_vsd_array(&compiler->program);
+    compiler->program = program;
+    compiler->constants_size = constants_size;
+
+    solve_label_addrs(compiler);
 
     return compiler->program.data;
 }
+
+// Forget the globals declared after the first num_symbols of them, as when the code declaring them
+// fails to compile
+void forget_symbols(compiler* compiler, uint32_t num_symbols)
+{
+    for (uint32_t i = num_symbols; i < compiler->num_symbols; i++)
+    {
+        hashmap_remove(&compiler->symbols, &compiler->symbol_names.data[i]);
+        free(compiler->symbol_names.data[i].string_value);
+    }
+
+    compiler->symbol_names.used = num_symbols;
+    compiler->num_symbols = num_symbols;
+}
@@ -2,9 +2,58 @@
 
 #include "arrays.h"
 #include "hashmap.h"
+#include "tokens.h"
 
 #include <stdint.h>
 
+// Instructions are emitted into temp_code through these macros, which expect the compiler and a size_t
+// arr_offset to be in scope. The code generator of the IR (see ir.h) emits its code through them too
+#define ADD_INSTRUCTION(opcode) do { \
+    arr_offset = allocate_vsd_array(&compiler->temp_code, 1); \
+    *((unsigned char*)(compiler->temp_code.data) + arr_offset) = opcode; \
+} while(0)
+
+// Operands are stored as 16-bit little-endian values. Operands which do not fit in 16 bits are
+// stored in 32 bits, and the instruction is preceded by the WIDE prefix
+#define ADD_INSTRUCTION_OPERAND(opcode, operand) do { \
+    if ((operand) > 0xFFFF) \
+    { \
+        arr_offset = allocate_vsd_array(&compiler->temp_code, 6); \
+        *((unsigned char*)(compiler->temp_code.data) + arr_offset + 0) = OPCODE_WIDE; \
+        *((unsigned char*)(compiler->temp_code.data) + arr_offset + 1) = opcode; \
+        WRITE_U32((unsigned char*)(compiler->temp_code.data) + arr_offset + 2, operand); \
+    } \
+    else \
+    { \
+        arr_offset = allocate_vsd_array(&compiler->temp_code, 3); \
+        *((unsigned char*)(compiler->temp_code.data) + arr_offset + 0) = opcode; \
+        WRITE_U16((unsigned char*)(compiler->temp_code.data) + arr_offset + 1, operand); \
+    } \
+} while(0)
+
+// Shifts carry their 8-bit operand right after the opcode
+#define ADD_INSTRUCTION_SHIFT(opcode, shift) do { \
+    arr_offset = allocate_vsd_array(&compiler->temp_code, 2); \
+    *((unsigned char*)(compiler->temp_code.data) + arr_offset + 0) = opcode; \
+    *((unsigned char*)(compiler->temp_code.data) + arr_offset + 1) = shift; \
+} while(0)
+
+// Jumps always carry a 32-bit operand. While compiling, this operand holds the label ID, which
+// is replaced by the actual text address of the label in solve_label_addrs. Jumps are recorded
+// as they are emitted, so that they can be patched without scanning the text again
+#define ADD_JUMP(opcode, label) do { \
+    arr_offset = allocate_vsd_array(&compiler->temp_code, 5); \
+    *((unsigned char*)(compiler->temp_code.data) + arr_offset) = opcode; \
+    WRITE_U32((unsigned char*)(compiler->temp_code.data) + arr_offset + 1, label); \
+    insert_uint32_t_array(&compiler->jump_addrs, arr_offset); \
+} while(0)
+
+#define GENERATE_LABEL_ID(name) \
+    uint32_t name = compiler->label_addrs.used; \
+    insert_label_addr_array(&compiler->label_addrs, -1)
+
+#define SET_LABEL_ADDR(label) compiler->label_addrs.data[label] = compiler->temp_code.used
+
 typedef struct compiler
 {
     vsd_array temp_constants;
@@ -13,15 +62,55 @@ typedef struct compiler
 
     label_addr_array label_addrs;
 
+    // Text address of every jump, whose operand is patched with the address of its label once it is known
+    uint32_t_array jump_addrs;
+
+    // Address of each constant already in temp_constants, by type, with the bytes of its value as the key
+    hashmap int_constants;
+    hashmap float_constants;
+    hashmap bool_constants;
+    hashmap string_constants;
+
+    // Globals, numbered in declaration order. Their names are copies owned by the compiler
     hashmap symbols;
+    string_array symbol_names;
     uint32_t num_symbols;
 
+    // Locals live in stack slots, in declaration order. Each name resolves through local_symbols to the
+    // innermost visible slot declared with it, and the slot keeps the one it shadows, to be visible again
+    // once the slot goes out of scope
+    hashmap local_symbols;
     string_array local_symbol_names;
     uint32_t_array local_symbol_depths;
+    uint32_t_array local_symbol_shadows;
     uint32_t num_local_symbols;
 
+    // Loop invariant expressions computed before the loops being compiled, and the hidden local
+    // holding the value of each of them
+    expression_array hoisted_exprs;
+    uint32_t_array hoisted_locals;
+
+    // Source line and text address of every compiled statement, in code order
+    uint32_t_array statement_lines;
+    uint32_t_array statement_addrs;
+
     uint32_t constants_size;
     uint32_t scope_depth;
+
+    // Where the constants and the text being compiled start in the program, which is not at the start
+    // when they are appended to the previous program
+    uint32_t constants_base;
+    uint32_t text_base;
+
+    // Whether loops are optimized and the generated text goes through the peephole optimizer, unless
+    // peephole is unset
+    char optimize;
+    char peephole;
+
+    // Whether code is generated through the SSA IR (see ir.h), whose passes run when optimize is set,
+    // and whether the IR is printed
+    char use_ir;
+    char print_ir;
 } compiler;
 
 void init_compiler(compiler* compiler);
@@ -30,3 +119,22 @@ void destroy_compiler(compiler* compiler);
 void print_code(compiler* compiler);
 
 unsigned char* compile_code(compiler* compiler, void* ast_node);
+
+// Compile code which continues the program compiled so far, seeing its globals. Its constants are added
+// after the ones of the program, and its text replaces the HALT which ends the program, so that running
+// the new program from text_base runs only the new code
+unsigned char* append_code(compiler* compiler, void* ast_node);
+void forget_symbols(compiler* compiler, uint32_t num_symbols);
+
+// Declare a global, numbered after the ones already declared
+uint32_t declare_global_symbol(compiler* compiler, string_type name);
+
+void collect_loop_assignments(void* node, hashmap* assigned, int* has_calls);
+
+uint32_t add_constant(compiler* compiler, hashmap* pool, string_type value, const void* header, size_t header_size, size_t align);
+uint32_t add_bool_constant(compiler* compiler, char value);
+
+uint8_t get_binop_opcode(token_type op);
+uint8_t select_typed_opcode(uint8_t opcode, uint8_t lhs_type, uint8_t rhs_type);
+uint8_t select_shift_opcode(token_type op, uint8_t lhs_type, int rhs_value, uint8_t* shift);
+uint8_t negate_comparison(uint8_t opcode);
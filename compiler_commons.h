@@ -4,7 +4,18 @@
 #include "string_type.h"
 #include "hashmap.h"
 
-#define STACK_SIZE 1024
+// Environments of the interpreter are allocated when first needed, and the number of nested ones is
+// only limited so that runaway recursion fails with an error. As the closure-compiled engine recurses on
+// the process stack (see closure.h), it also stops entering environments once it has used that much of it
+#define ENV_POOL_INITIAL_SIZE 16
+#define ENV_MAX_DEPTH (1 << 20)
+#define INTERPRETER_STACK_LIMIT (6 * 1024 * 1024)
+
+// Bytes left behind in an environment by values which did not fit where the old ones were, past which
+// they are reclaimed as soon as they are also more than half of its memory
+#define ENV_DEAD_BYTES_LIMIT 4096
+
+#define EMPTY_SLOT ((size_t)-1)
 
 typedef enum
 {
@@ -28,23 +39,39 @@ typedef enum environment_type
     ENV_BLOCK
 } environment_type;
 
+// Variables which the environment of a block can hold, each with its own slot (see resolver.h)
+typedef struct scope_layout
+{
+    hashmap slots;
+    int num_slots;
+} scope_layout;
+
 struct environment
 {
+    // Offset of every variable in variables_memory, by slot, or EMPTY_SLOT if the variable is not set.
+    // The first slots are the ones of the layout of the block, and the others are given out by name, in
+    // variables, to variables the layout does not know about
+    const scope_layout* layout;
+    size_t* slots;
+    int num_slots;
+    int slots_capacity;
+
+    // Bytes given to the variable of every slot, which its next values reuse when they fit (see state.c)
+    size_t* slot_sizes;
+
     hashmap variables;
     vsd_array variables_memory;
+
+    // Bytes of variables_memory which no variable uses anymore, and the memories it grew out of while
+    // values being evaluated could still point to them, until the call which owns the environment is back
+    size_t dead_bytes;
+    void* retired_memory;
+
     hashmap functions;
     environment* parent;
     environment_type type;
 };
 
-typedef struct
-{
-    vss_array memory;
-    environment environ_stack[STACK_SIZE];
-    int stack_index;
-    int is_returning;
-} interpreter;
-
 static string_type ret_var = { .string_value = "(ret)", .length = 5 };
 
 typedef struct
@@ -67,3 +94,49 @@ typedef struct
 
 
 size_t get_value_size(expression_result value);
+
+// Node being run by the tree-walking interpreter, which keeps the nodes it runs on a stack of its own
+// instead of recursing. Phase tells how far the node got, as it is resumed each time a child is done
+typedef struct interpreter_task
+{
+    void* node;
+    environment* env;
+    int phase;
+
+    // Next statement or argument to run
+    size_t index;
+
+    // Environment the node entered, with the function it calls and whether the call is memoized, and the
+    // values a loop keeps between its iterations
+    environment* inner_env;
+    void* callee;
+    int is_memoized;
+    expression_result saved[3];
+} interpreter_task;
+
+MAKE_FSD_ARRAY_HEADERS(interpreter_task, task)
+MAKE_FSD_ARRAY_HEADERS(expression_result, result)
+
+typedef struct
+{
+    vss_array memory;
+
+    // Nodes being run, innermost last, and values of the expressions evaluated which were not used yet
+    // (see interpreter.c)
+    task_array tasks;
+    result_array values;
+
+    // Environments of the blocks being run, the main one first. Each one is allocated on its own, as
+    // functions and nested environments point to them, and the ones past stack_index are kept for reuse
+    environment** environ_stack;
+    int stack_capacity;
+    int num_environments;
+    int stack_index;
+
+    // Address of the process stack when the program started running, or NULL before
+    char* stack_base;
+    int is_returning;
+
+    // Results of calls to pure functions, or NULL if they are not memoized (see memo.h)
+    struct memo_cache* memo;
+} interpreter;
@@ -0,0 +1,72 @@
+#include "errors.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "utils.h"
+
+// Innermost error handler of each thread
+static THREAD_LOCAL error_handler* current_handler = NULL;
+
+void push_error_handler(error_handler* handler)
+{
+    handler->previous = current_handler;
+    handler->message[0] = '\0';
+    current_handler = handler;
+}
+
+void pop_error_handler(error_handler* handler)
+{
+    current_handler = handler->previous;
+}
+
+void raise_error(error_kind kind, int line, int column, const char* format, ...)
+{
+    char message[ERROR_MESSAGE_SIZE];
+    int prefix_length = 0;
+
+    switch (kind)
+    {
+        case ERROR_GENERAL:
+            prefix_length = snprintf(message, ERROR_MESSAGE_SIZE, "General compiler error: ");
+            break;
+
+        case ERROR_SYNTAX:
+            prefix_length = snprintf(message, ERROR_MESSAGE_SIZE, "Syntax error [line %d]: ", line);
+            break;
+
+        case ERROR_LEXER:
+            prefix_length = snprintf(message, ERROR_MESSAGE_SIZE, "Lexer error [line %d, column %d]: ", line, column);
+            break;
+
+        case ERROR_INTERPRETER:
+            prefix_length = snprintf(message, ERROR_MESSAGE_SIZE, "Interpreter error [line %d]: ", line);
+            break;
+
+        case ERROR_COMPILER:
+            prefix_length = snprintf(message, ERROR_MESSAGE_SIZE, "Compiler error [line %d]: ", line);
+            break;
+
+        case ERROR_VM:
+            prefix_length = snprintf(message, ERROR_MESSAGE_SIZE, "VM runtime error [line %d]: ", line);
+            break;
+    }
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message + prefix_length, ERROR_MESSAGE_SIZE - prefix_length, format, args);
+    va_end(args);
+
+    if (current_handler)
+    {
+        error_handler* handler = current_handler;
+        current_handler = handler->previous;
+        handler->kind = kind;
+        snprintf(handler->message, ERROR_MESSAGE_SIZE, "%s", message);
+        longjmp(handler->jump_buffer, 1);
+    }
+
+    printf("%s\n%s%s", KRED, message, KNRM);
+    exit(1);
+}
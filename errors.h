@@ -0,0 +1,40 @@
+#pragma once
+
+#include <setjmp.h>
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#define NO_RETURN __declspec(noreturn)
+#else
+#define THREAD_LOCAL _Thread_local
+#define NO_RETURN _Noreturn
+#endif
+
+#define ERROR_MESSAGE_SIZE 1024
+
+typedef enum error_kind
+{
+    ERROR_GENERAL,
+    ERROR_SYNTAX,
+    ERROR_LEXER,
+    ERROR_INTERPRETER,
+    ERROR_COMPILER,
+    ERROR_VM
+} error_kind;
+
+// Errors are raised through raise_error. If the current thread has installed an error handler,
+// the handler is uninstalled, the error message is stored in it and execution jumps back to the
+// setjmp of its jump_buffer. Otherwise, the error is printed and the process exits, as the
+// standalone executable expects.
+typedef struct error_handler
+{
+    jmp_buf jump_buffer;
+    error_kind kind;
+    char message[ERROR_MESSAGE_SIZE];
+    struct error_handler* previous;
+} error_handler;
+
+void push_error_handler(error_handler* handler);
+void pop_error_handler(error_handler* handler);
+
+NO_RETURN void raise_error(error_kind kind, int line, int column, const char* format, ...);
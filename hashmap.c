@@ -5,6 +5,10 @@
 
 #include "utils.h"
 
+// Average number of elements per bucket above which the number of buckets is doubled, instead of
+// growing the buckets themselves
+#define MAX_LOAD_FACTOR 4
+
 void init_hashmap(hashmap* hm, int n_buckets, int bucket_capacity)
 {
     if (n_buckets <= 0 || bucket_capacity <= 0)
@@ -19,6 +23,7 @@ void init_hashmap(hashmap* hm, int n_buckets, int bucket_capacity)
 
     hm->bucket_capacity = bucket_capacity;
     hm->n_buckets = n_buckets;
+    hm->n_elements = 0;
 }
 
 void clear_hashmap(hashmap* hm)
@@ -27,6 +32,7 @@ void clear_hashmap(hashmap* hm)
     {
         hm->bucket_element_count[i] = 0;
     }
+    hm->n_elements = 0;
 }
 
 void free_hashmap(hashmap* hm)
@@ -36,6 +42,58 @@ void free_hashmap(hashmap* hm)
 
     hm->bucket_capacity = 0;
     hm->n_buckets = 0;
+    hm->n_elements = 0;
+}
+
+// Add an element which is not in the hashmap yet (and expand the buckets if necessary). Elements are
+// laid out as hash + (i * n_buckets), so growing the buckets keeps them in place
+static void insert_entry(hashmap* hm, string_type key, size_t value, unsigned int hash)
+{
+    int bucket_usage = hm->bucket_element_count[hash];
+    if (bucket_usage >= hm->bucket_capacity)
+    {
+        hm->bucket_capacity = (int) (hm->bucket_capacity * 1.7) + 1;
+        void* temp = realloc(hm->bucket_elements, sizeof(hm_entry) * hm->n_buckets * hm->bucket_capacity);
+        if (temp == NULL)
+        {
+            PRINT_ERROR_AND_QUIT("Failed to reallocate hashmap bucket!\n");
+        }
+        hm->bucket_elements = temp;
+    }
+
+    hm_entry* bucket = &hm->bucket_elements[hash + (bucket_usage * hm->n_buckets)];
+    bucket->key = key;
+    bucket->value = value;
+
+    hm->bucket_element_count[hash]++;
+    hm->n_elements++;
+}
+
+// Double the number of buckets, so that lookups keep scanning only a few elements as the hashmap grows
+static void rehash(hashmap* hm)
+{
+    hashmap old = *hm;
+
+    hm->n_buckets = old.n_buckets * 2;
+    hm->n_elements = 0;
+    hm->bucket_element_count = calloc(hm->n_buckets, sizeof(int));
+    hm->bucket_elements = malloc(sizeof(hm_entry) * hm->n_buckets * hm->bucket_capacity);
+    if (hm->bucket_element_count == NULL || hm->bucket_elements == NULL)
+    {
+        PRINT_ERROR_AND_QUIT("Failed to reallocate hashmap buckets!\n");
+    }
+
+    for (int i = 0; i < old.n_buckets; i++)
+    {
+        for (int j = 0; j < old.bucket_element_count[i]; j++)
+        {
+            hm_entry* entry = &old.bucket_elements[i + (j * old.n_buckets)];
+            insert_entry(hm, entry->key, entry->value, string_hash(&entry->key) % hm->n_buckets);
+        }
+    }
+
+    free(old.bucket_elements);
+    free(old.bucket_element_count);
 }
 
 void hashmap_set(hashmap* hm, string_type key, size_t value)
@@ -46,7 +104,7 @@ void hashmap_set(hashmap* hm, string_type key, size_t value)
     // If the element exists, replace it with new value. Otherwise, add it to the hashmap
     for (int i = 0; i < bucket_usage; i++)
     {
-        unsigned int element_idx = hash + (i * hm->bucket_capacity);
+        unsigned int element_idx = hash + (i * hm->n_buckets);
         if (string_comparison(&hm->bucket_elements[element_idx].key, &key, COMPARE_EQ))
         {
             hm->bucket_elements[element_idx].value = value;
@@ -54,23 +112,15 @@ void hashmap_set(hashmap* hm, string_type key, size_t value)
         }
     }
 
-    // No matching elements were found. Add the element (and expand the table if necessary)
-    if (bucket_usage >= hm->bucket_capacity)
+    // No matching elements were found. Add the element, spreading the elements over more buckets first
+    // if there are already too many of them
+    if (bucket_usage >= hm->bucket_capacity && hm->n_elements >= hm->n_buckets * MAX_LOAD_FACTOR)
     {
-        hm->bucket_capacity = (int) (hm->bucket_capacity * 1.7);
-        void* temp = realloc(hm->bucket_elements, sizeof(hm_entry) * hm->n_buckets * hm->bucket_capacity);
-        if (temp == NULL)
-        {
-            PRINT_ERROR_AND_QUIT("Failed to reallocate hashmap bucket!\n");
-        }
-        hm->bucket_elements = temp;
+        rehash(hm);
+        hash = string_hash(&key) % hm->n_buckets;
     }
 
-    hm_entry* bucket = &hm->bucket_elements[hash + (bucket_usage * hm->bucket_capacity)];
-    bucket->key = key;
-    bucket->value = value;
-
-    hm->bucket_element_count[hash]++;
+    insert_entry(hm, key, value, hash);
 }
 
 int hashmap_get(const hashmap* hm, const string_type* key, size_t* value)
@@ -81,7 +131,7 @@ int hashmap_get(const hashmap* hm, const string_type* key, size_t* value)
     // If the element exists, return it. Otherwise, show an error
     for (int i = 0; i < bucket_usage; i++)
     {
-        unsigned int element_idx = hash + (i * hm->bucket_capacity);
+        unsigned int element_idx = hash + (i * hm->n_buckets);
         if (string_comparison(&hm->bucket_elements[element_idx].key, key, COMPARE_EQ))
         {
             *value = hm->bucket_elements[element_idx].value;
@@ -90,4 +140,23 @@ int hashmap_get(const hashmap* hm, const string_type* key, size_t* value)
     }
 
     return -1;
-}
\ No newline at end of file
+}
+
+// Remove an element, if it is in the hashmap. The last element of its bucket takes its place
+void hashmap_remove(hashmap* hm, const string_type* key)
+{
+    unsigned int hash = string_hash(key) % hm->n_buckets;
+    int bucket_usage = hm->bucket_element_count[hash];
+
+    for (int i = 0; i < bucket_usage; i++)
+    {
+        unsigned int element_idx = hash + (i * hm->n_buckets);
+        if (string_comparison(&hm->bucket_elements[element_idx].key, key, COMPARE_EQ))
+        {
+            hm->bucket_elements[element_idx] = hm->bucket_elements[hash + ((bucket_usage - 1) * hm->n_buckets)];
+            hm->bucket_element_count[hash]--;
+            hm->n_elements--;
+            return;
+        }
+    }
+}
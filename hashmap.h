@@ -15,6 +15,7 @@ typedef struct hashmap
 {
     int n_buckets;
     int bucket_capacity;
+    int n_elements;
     int* bucket_element_count;
     hm_entry* bucket_elements;
 } hashmap;
@@ -25,3 +26,4 @@ void free_hashmap(hashmap* hm);
 
 void hashmap_set(hashmap* hm, string_type key, size_t value);
 int hashmap_get(const hashmap* hm, const string_type* key, size_t* value);
+void hashmap_remove(hashmap* hm, const string_type* key);
@@ -0,0 +1,789 @@
+#include "inliner.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "model.h"
+#include "utils.h"
+
+// Largest body, in AST nodes, of the functions which are inlined, and largest copy of one at a call
+// site (the statements following a return are copied to every branch which does not return)
+#define INLINE_MAX_BODY_NODES 64
+#define INLINE_MAX_COPY_NODES 256
+
+#define IS_STATEMENT_OF_TYPE(node, type) (CHECK_ELEMENT_SUPERTYPE(node, Statement) && CHECK_ELEMENT_TYPE(node, type))
+
+MAKE_FSD_ARRAY_FUNCTIONS(void*, node)
+
+// Statements of the body which run after the ones being copied, once those fall through
+typedef struct continuation
+{
+    void** statements;
+    size_t num_statements;
+    const struct continuation* next;
+} continuation;
+
+// Call being inlined, with the variables taking the place of the parameters and of the result
+typedef struct call_site
+{
+    const FuncDecl* func_decl;
+    string_type* variables;
+    string_type result;
+    size_t num_copied_nodes;
+} call_site;
+
+void init_inliner(inliner* inliner)
+{
+    init_node_array(&inliner->nodes, 64);
+    init_string_array(&inliner->names, 16);
+    init_hashmap(&inliner->declaration_counts, 16, 4);
+    init_hashmap(&inliner->local_names, 64, 4);
+    init_hashmap(&inliner->functions, 16, 4);
+    inliner->depth = 0;
+    inliner->num_sites = 0;
+}
+
+void destroy_inliner(inliner* inliner)
+{
+    for (size_t i = 0; i < inliner->nodes.used; i++)
+    {
+        free(inliner->nodes.data[i]);
+    }
+
+    for (size_t i = 0; i < inliner->names.used; i++)
+    {
+        free(inliner->names.data[i].string_value);
+    }
+
+    free_node_array(&inliner->nodes);
+    free_string_array(&inliner->names);
+    free_hashmap(&inliner->declaration_counts);
+    free_hashmap(&inliner->local_names);
+    free_hashmap(&inliner->functions);
+}
+
+static void* allocate_node(inliner* inliner, size_t size)
+{
+    void* node = malloc(size);
+    if (node == NULL)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot allocate memory for an inlined function\n");
+    }
+
+    insert_node_array(&inliner->nodes, node);
+    return node;
+}
+
+// Name of the variable holding a parameter (or the result, if param is NULL) of a function at a call
+// site. Dots and hashes cannot appear in identifiers, so it never clashes with the names of the program
+static string_type make_name(inliner* inliner, string_type function_name, const string_type* param, uint32_t site_id)
+{
+    size_t size = function_name.length + (param ? param->length : 0) + 16;
+    char* name = malloc(size);
+    if (name == NULL)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot allocate memory for an inlined function\n");
+    }
+
+    int length = param
+        ? snprintf(name, size, "%.*s.%.*s#%u", function_name.length, function_name.string_value, param->length, param->string_value, site_id)
+        : snprintf(name, size, "%.*s#%u", function_name.length, function_name.string_value, site_id);
+
+    string_type result = { .string_value = name, .length = length };
+    insert_string_array(&inliner->names, result);
+    return result;
+}
+
+// New nodes point to each other directly, so they are built with no AST base
+static Identifier* new_identifier(inliner* inliner, string_type name, int line)
+{
+    Identifier* identifier = allocate_node(inliner, sizeof(Identifier));
+    init_Identifier(identifier, name.string_value, name.length, line);
+    return identifier;
+}
+
+static Assignment* new_assignment(inliner* inliner, string_type name, void* rhs, int line)
+{
+    Assignment* assignment = allocate_node(inliner, sizeof(Assignment));
+    init_Assignment(assignment, (size_t)new_identifier(inliner, name, line), (size_t)rhs, 0, NULL, line);
+    return assignment;
+}
+
+static StatementList* new_statement_list(inliner* inliner, statement_array* statements, int line)
+{
+    StatementList* statement_list = allocate_node(inliner, sizeof(StatementList) + statements->used * sizeof(void*));
+    init_StatementList(statement_list, statements, NULL, line);
+    return statement_list;
+}
+
+static int find_param(const FuncDecl* func_decl, const string_type* name)
+{
+    const string_type* param_ptrs = (const string_type*)((const char*)func_decl + sizeof(FuncDecl));
+    for (size_t i = 0; i < func_decl->num_params; i++)
+    {
+        if (string_comparison(name, &param_ptrs[i], COMPARE_EQ))
+            return (int)i;
+    }
+
+    return -1;
+}
+
+// Count the declarations of every function, and find the names which might refer to a local variable:
+// parameters, and variables assigned inside a block or a function, which are local to it unless they
+// already exist outside
+static void collect_declarations(inliner* inliner, void* node, int depth)
+{
+    if (node == NULL || !CHECK_ELEMENT_SUPERTYPE(node, Statement))
+        return;
+
+    size_t count;
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case StatementList_stmt:
+            void** statement_ptrs = (void**)((char*)(node) + sizeof(StatementList));
+            for (size_t i = 0; i < ((StatementList*)(node))->size; i++)
+            {
+                collect_declarations(inliner, statement_ptrs[i], depth);
+            }
+            break;
+
+        case If_stmt:
+            collect_declarations(inliner, ((If*)node)->then_branch, depth + 1);
+            collect_declarations(inliner, ((If*)node)->else_branch, depth + 1);
+            break;
+
+        case While_stmt:
+            collect_declarations(inliner, ((While*)node)->statements, depth + 1);
+            break;
+
+        case For_stmt:
+            collect_declarations(inliner, ((For*)node)->initial_assignment, depth + 1);
+            collect_declarations(inliner, ((For*)node)->statements, depth + 1);
+            break;
+
+        case Assignment_stmt:
+            Assignment* assign_stmt = (Assignment*)node;
+            if (depth > 0 || assign_stmt->is_local)
+            {
+                hashmap_set(&inliner->local_names, ((Identifier*)assign_stmt->lhs)->name, 1);
+            }
+            break;
+
+        case FuncDecl_stmt:
+            FuncDecl* func_decl = (FuncDecl*)node;
+            if (hashmap_get(&inliner->declaration_counts, &func_decl->name, &count) == -1)
+                count = 0;
+            hashmap_set(&inliner->declaration_counts, func_decl->name, count + 1);
+
+            string_type* param_ptrs = (string_type*)((char*)func_decl + sizeof(FuncDecl));
+            for (size_t i = 0; i < func_decl->num_params; i++)
+            {
+                hashmap_set(&inliner->local_names, param_ptrs[i], 1);
+            }
+            collect_declarations(inliner, func_decl->statements, depth + 1);
+            break;
+    }
+}
+
+static size_t count_nodes(const void* node)
+{
+    if (node == NULL)
+        return 0;
+
+    if (CHECK_ELEMENT_SUPERTYPE(node, Expression))
+    {
+        switch (GET_ELEMENT_TYPE(node))
+        {
+            case Grouping_expr:
+                return 1 + count_nodes(((Grouping*)node)->expression);
+
+            case UnOp_expr:
+                return 1 + count_nodes(((UnOp*)node)->operand);
+
+            case BinOp_expr:
+                return 1 + count_nodes(((BinOp*)node)->left) + count_nodes(((BinOp*)node)->right);
+
+            case FuncCall_expr:
+                void** args_ptrs = (void**)((char*)node + sizeof(FuncCall));
+                size_t num_arg_nodes = 0;
+                for (size_t i = 0; i < ((FuncCall*)node)->num_args; i++)
+                {
+                    num_arg_nodes += count_nodes(args_ptrs[i]);
+                }
+                return 1 + num_arg_nodes;
+
+            default:
+                return 1;
+        }
+    }
+
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case StatementList_stmt:
+            void** statement_ptrs = (void**)((char*)(node) + sizeof(StatementList));
+            size_t num_statement_nodes = 0;
+            for (size_t i = 0; i < ((StatementList*)(node))->size; i++)
+            {
+                num_statement_nodes += count_nodes(statement_ptrs[i]);
+            }
+            return 1 + num_statement_nodes;
+
+        case Print_stmt:
+            return 1 + count_nodes(((Print*)node)->expression);
+
+        case If_stmt:
+            return 1 + count_nodes(((If*)node)->condition) + count_nodes(((If*)node)->then_branch) + count_nodes(((If*)node)->else_branch);
+
+        case While_stmt:
+            return 1 + count_nodes(((While*)node)->condition) + count_nodes(((While*)node)->statements);
+
+        case Assignment_stmt:
+            return 1 + count_nodes(((Assignment*)node)->lhs) + count_nodes(((Assignment*)node)->rhs);
+
+        case For_stmt:
+            For* for_stmt = (For*)node;
+            return 1 + count_nodes(for_stmt->initial_assignment) + count_nodes(for_stmt->stop) + count_nodes(for_stmt->step) + count_nodes(for_stmt->statements);
+
+        case FuncDecl_stmt:
+            return 1 + count_nodes(((FuncDecl*)node)->statements);
+
+        case Return_stmt:
+            return 1 + count_nodes(((Return*)node)->expression);
+
+        default:
+            return 1;
+    }
+}
+
+// Whether an element of the body of a function can be copied to its call sites: it has no effects
+// besides assigning parameters, it only reads parameters and globals, and it does not return from
+// inside a loop
+static int can_copy(const inliner* inliner, const FuncDecl* func_decl, const void* node, int in_loop)
+{
+    if (node == NULL)
+        return 1;
+
+    size_t unused;
+    if (CHECK_ELEMENT_SUPERTYPE(node, Expression))
+    {
+        switch (GET_ELEMENT_TYPE(node))
+        {
+            case Identifier_expr:
+                const string_type* name = &((Identifier*)node)->name;
+                return find_param(func_decl, name) != -1 || hashmap_get(&inliner->local_names, name, &unused) == -1;
+
+            case Grouping_expr:
+                return can_copy(inliner, func_decl, ((Grouping*)node)->expression, in_loop);
+
+            case UnOp_expr:
+                return can_copy(inliner, func_decl, ((UnOp*)node)->operand, in_loop);
+
+            case BinOp_expr:
+                return can_copy(inliner, func_decl, ((BinOp*)node)->left, in_loop)
+                    && can_copy(inliner, func_decl, ((BinOp*)node)->right, in_loop);
+
+            case FuncCall_expr:
+                return 0;
+
+            default:
+                return 1;
+        }
+    }
+
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case StatementList_stmt:
+            void** statement_ptrs = (void**)((char*)(node) + sizeof(StatementList));
+            for (size_t i = 0; i < ((StatementList*)(node))->size; i++)
+            {
+                if (!can_copy(inliner, func_decl, statement_ptrs[i], in_loop))
+                    return 0;
+            }
+            return 1;
+
+        case If_stmt:
+            return can_copy(inliner, func_decl, ((If*)node)->condition, in_loop)
+                && can_copy(inliner, func_decl, ((If*)node)->then_branch, in_loop)
+                && can_copy(inliner, func_decl, ((If*)node)->else_branch, in_loop);
+
+        case While_stmt:
+            return can_copy(inliner, func_decl, ((While*)node)->condition, 1)
+                && can_copy(inliner, func_decl, ((While*)node)->statements, 1);
+
+        case Assignment_stmt:
+            Assignment* assign_stmt = (Assignment*)node;
+            return !assign_stmt->is_local
+                && find_param(func_decl, &((Identifier*)assign_stmt->lhs)->name) != -1
+                && can_copy(inliner, func_decl, assign_stmt->rhs, in_loop);
+
+        case Return_stmt:
+            return !in_loop && can_copy(inliner, func_decl, ((Return*)node)->expression, in_loop);
+
+        // Printing, declaring functions and for loops (which assign their iterator) are effects
+        default:
+            return 0;
+    }
+}
+
+// Whether a statement returns on every path through it
+static int always_returns(const void* node)
+{
+    if (node == NULL || !CHECK_ELEMENT_SUPERTYPE(node, Statement))
+        return 0;
+
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case StatementList_stmt:
+            void** statement_ptrs = (void**)((char*)(node) + sizeof(StatementList));
+            for (size_t i = 0; i < ((StatementList*)(node))->size; i++)
+            {
+                if (always_returns(statement_ptrs[i]))
+                    return 1;
+            }
+            return 0;
+
+        case If_stmt:
+            return always_returns(((If*)node)->then_branch) && always_returns(((If*)node)->else_branch);
+
+        case Return_stmt:
+            return 1;
+
+        default:
+            return 0;
+    }
+}
+
+// Whether a statement returns on some path through it. Loops never do in inlined functions
+static int contains_return(const void* node)
+{
+    if (node == NULL || !CHECK_ELEMENT_SUPERTYPE(node, Statement))
+        return 0;
+
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case StatementList_stmt:
+            void** statement_ptrs = (void**)((char*)(node) + sizeof(StatementList));
+            for (size_t i = 0; i < ((StatementList*)(node))->size; i++)
+            {
+                if (contains_return(statement_ptrs[i]))
+                    return 1;
+            }
+            return 0;
+
+        case If_stmt:
+            return contains_return(((If*)node)->then_branch) || contains_return(((If*)node)->else_branch);
+
+        case Return_stmt:
+            return 1;
+
+        default:
+            return 0;
+    }
+}
+
+static int can_inline_function(const inliner* inliner, const FuncDecl* func_decl)
+{
+    size_t count;
+    return hashmap_get(&inliner->declaration_counts, &func_decl->name, &count) != -1 && count == 1
+        && count_nodes(func_decl->statements) <= INLINE_MAX_BODY_NODES
+        && can_copy(inliner, func_decl, func_decl->statements, 0)
+        && always_returns(func_decl->statements);
+}
+
+// Copy an element of the body of a function, reading and assigning the variables of the call site
+// instead of the parameters
+static void* copy_node(inliner* inliner, call_site* site, const void* node)
+{
+    if (node == NULL)
+        return NULL;
+
+    size_t size = element_size((const Element*)node);
+    void* copy = allocate_node(inliner, size);
+    memcpy(copy, node, size);
+    site->num_copied_nodes++;
+
+    if (CHECK_ELEMENT_SUPERTYPE(node, Expression))
+    {
+        switch (GET_ELEMENT_TYPE(node))
+        {
+            case Identifier_expr:
+                int param = find_param(site->func_decl, &((Identifier*)node)->name);
+                if (param != -1)
+                {
+                    ((Identifier*)copy)->name = site->variables[param];
+                }
+                break;
+
+            case Grouping_expr:
+                ((Grouping*)copy)->expression = copy_node(inliner, site, ((Grouping*)node)->expression);
+                break;
+
+            case UnOp_expr:
+                ((UnOp*)copy)->operand = copy_node(inliner, site, ((UnOp*)node)->operand);
+                break;
+
+            case BinOp_expr:
+                ((BinOp*)copy)->left = copy_node(inliner, site, ((BinOp*)node)->left);
+                ((BinOp*)copy)->right = copy_node(inliner, site, ((BinOp*)node)->right);
+                break;
+        }
+        return copy;
+    }
+
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case StatementList_stmt:
+            void** statement_ptrs = (void**)((char*)(copy) + sizeof(StatementList));
+            for (size_t i = 0; i < ((StatementList*)(copy))->size; i++)
+            {
+                statement_ptrs[i] = copy_node(inliner, site, statement_ptrs[i]);
+            }
+            break;
+
+        case If_stmt:
+            ((If*)copy)->condition = copy_node(inliner, site, ((If*)node)->condition);
+            ((If*)copy)->then_branch = copy_node(inliner, site, ((If*)node)->then_branch);
+            ((If*)copy)->else_branch = copy_node(inliner, site, ((If*)node)->else_branch);
+            break;
+
+        case While_stmt:
+            ((While*)copy)->condition = copy_node(inliner, site, ((While*)node)->condition);
+            ((While*)copy)->statements = copy_node(inliner, site, ((While*)node)->statements);
+            break;
+
+        case Assignment_stmt:
+            ((Assignment*)copy)->lhs = copy_node(inliner, site, ((Assignment*)node)->lhs);
+            ((Assignment*)copy)->rhs = copy_node(inliner, site, ((Assignment*)node)->rhs);
+            break;
+    }
+    return copy;
+}
+
+static void copy_statements(inliner* inliner, call_site* site, void** statements, size_t num_statements, const continuation* next, statement_array* copies);
+
+// Copy a branch of an if which returns on some path, followed by the statements after the if
+static StatementList* copy_branch(inliner* inliner, call_site* site, void* branch, const continuation* next, int line)
+{
+    statement_array copies;
+    init_statement_array(&copies, 8);
+    if (branch != NULL)
+    {
+        void** statement_ptrs = (void**)((char*)(branch) + sizeof(StatementList));
+        copy_statements(inliner, site, statement_ptrs, ((StatementList*)branch)->size, next, &copies);
+    }
+    else
+    {
+        copy_statements(inliner, site, NULL, 0, next, &copies);
+    }
+
+    StatementList* statement_list = new_statement_list(inliner, &copies, line);
+    free_statement_array(&copies);
+    return statement_list;
+}
+
+// Copy statements of the body of a function, and the ones which run after them until the function
+// returns. Returns become assignments to the result, and nothing follows them
+static void copy_statements(inliner* inliner, call_site* site, void** statements, size_t num_statements, const continuation* next, statement_array* copies)
+{
+    // Copies which grow too large are dropped by the caller anyway
+    if (site->num_copied_nodes > INLINE_MAX_COPY_NODES)
+        return;
+
+    for (size_t i = 0; i < num_statements; i++)
+    {
+        void* statement = statements[i];
+        int line = GET_ELEMENT_LINE(statement);
+        if (IS_STATEMENT_OF_TYPE(statement, Return_stmt))
+        {
+            void* result = copy_node(inliner, site, ((Return*)statement)->expression);
+            insert_statement_array(copies, (size_t)new_assignment(inliner, site->result, result, line));
+            return;
+        }
+
+        if (IS_STATEMENT_OF_TYPE(statement, If_stmt) && contains_return(statement))
+        {
+            If* if_stmt = (If*)statement;
+            continuation rest = { statements + i + 1, num_statements - i - 1, next };
+
+            If* copy = allocate_node(inliner, sizeof(If));
+            memcpy(copy, if_stmt, sizeof(If));
+            site->num_copied_nodes++;
+            copy->condition = copy_node(inliner, site, if_stmt->condition);
+            copy->then_branch = copy_branch(inliner, site, if_stmt->then_branch, &rest, line);
+            copy->else_branch = copy_branch(inliner, site, if_stmt->else_branch, &rest, line);
+            insert_statement_array(copies, (size_t)copy);
+            return;
+        }
+
+        insert_statement_array(copies, (size_t)copy_node(inliner, site, statement));
+    }
+
+    if (next != NULL)
+    {
+        copy_statements(inliner, site, next->statements, next->num_statements, next->next, copies);
+    }
+}
+
+// Replace a call by a copy of the body of the function, which is added to the list of statements.
+// Returns the expression which must take the place of the call
+static void* inline_call(inliner* inliner, FuncCall* func_call, const FuncDecl* func_decl, statement_array* statements)
+{
+    uint32_t site_id = ++inliner->num_sites;
+    int line = GET_ELEMENT_LINE(func_call);
+    call_site site = { .func_decl = func_decl, .num_copied_nodes = 0 };
+    site.variables = malloc(func_decl->num_params * sizeof(string_type) + 1);
+    if (site.variables == NULL)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot allocate memory for an inlined function\n");
+    }
+
+    // Arguments are evaluated in order, before the body
+    statement_array copies;
+    init_statement_array(&copies, 16);
+    void** args_ptrs = (void**)((char*)func_call + sizeof(FuncCall));
+    string_type* param_ptrs = (string_type*)((char*)func_decl + sizeof(FuncDecl));
+    for (size_t i = 0; i < func_decl->num_params; i++)
+    {
+        site.variables[i] = make_name(inliner, func_decl->name, &param_ptrs[i], site_id);
+        insert_statement_array(&copies, (size_t)new_assignment(inliner, site.variables[i], args_ptrs[i], line));
+    }
+
+    void* result;
+    StatementList* body = (StatementList*)func_decl->statements;
+    void** body_ptrs = (void**)((char*)(body) + sizeof(StatementList));
+    if (body->size == 1 && IS_STATEMENT_OF_TYPE(body_ptrs[0], Return_stmt))
+    {
+        result = copy_node(inliner, &site, ((Return*)body_ptrs[0])->expression);
+    }
+    else
+    {
+        // The result is declared where the call is, as returns may assign it from inside blocks
+        site.result = make_name(inliner, func_decl->name, NULL, site_id);
+        Integer* initial_value = allocate_node(inliner, sizeof(Integer));
+        init_Integer(initial_value, 0, line);
+        insert_statement_array(&copies, (size_t)new_assignment(inliner, site.result, initial_value, line));
+
+        copy_statements(inliner, &site, body_ptrs, body->size, NULL, &copies);
+        result = new_identifier(inliner, site.result, line);
+    }
+
+    if (site.num_copied_nodes > INLINE_MAX_COPY_NODES)
+    {
+        result = func_call;
+    }
+    else
+    {
+        for (size_t i = 0; i < copies.used; i++)
+        {
+            insert_statement_array(statements, copies.data[i]);
+        }
+    }
+
+    free_statement_array(&copies);
+    free(site.variables);
+    return result;
+}
+
+static const FuncDecl* find_inlined_function(const inliner* inliner, const FuncCall* func_call)
+{
+    size_t func_decl;
+    if (hashmap_get(&inliner->functions, &func_call->name, &func_decl) == -1
+        || ((FuncDecl*)func_decl)->num_params != func_call->num_args)
+    {
+        return NULL;
+    }
+
+    return (const FuncDecl*)func_decl;
+}
+
+static int contains_call(const void* node)
+{
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case Grouping_expr:
+            return contains_call(((Grouping*)node)->expression);
+
+        case UnOp_expr:
+            return contains_call(((UnOp*)node)->operand);
+
+        case BinOp_expr:
+            return contains_call(((BinOp*)node)->left) || contains_call(((BinOp*)node)->right);
+
+        case FuncCall_expr:
+            return 1;
+
+        default:
+            return 0;
+    }
+}
+
+// Whether every call in an expression can be inlined, so that moving the bodies before the statement
+// holding it changes nothing
+static int can_inline_calls(const inliner* inliner, const void* node)
+{
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case Grouping_expr:
+            return can_inline_calls(inliner, ((Grouping*)node)->expression);
+
+        case UnOp_expr:
+            return can_inline_calls(inliner, ((UnOp*)node)->operand);
+
+        // The right operand of logic operators might not be evaluated
+        case BinOp_expr:
+            BinOp* binop = (BinOp*)node;
+            if (binop->op == TOK_AND || binop->op == TOK_OR)
+                return can_inline_calls(inliner, binop->left) && !contains_call(binop->right);
+
+            return can_inline_calls(inliner, binop->left) && can_inline_calls(inliner, binop->right);
+
+        case FuncCall_expr:
+            if (find_inlined_function(inliner, node) == NULL)
+                return 0;
+
+            void** args_ptrs = (void**)((char*)node + sizeof(FuncCall));
+            for (size_t i = 0; i < ((FuncCall*)node)->num_args; i++)
+            {
+                if (!can_inline_calls(inliner, args_ptrs[i]))
+                    return 0;
+            }
+            return 1;
+
+        default:
+            return 1;
+    }
+}
+
+// Inline the calls of an expression, innermost first, returning the node which must take its place
+static void* inline_calls(inliner* inliner, void* node, statement_array* statements)
+{
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case Grouping_expr:
+            ((Grouping*)node)->expression = inline_calls(inliner, ((Grouping*)node)->expression, statements);
+            return node;
+
+        case UnOp_expr:
+            ((UnOp*)node)->operand = inline_calls(inliner, ((UnOp*)node)->operand, statements);
+            return node;
+
+        case BinOp_expr:
+            ((BinOp*)node)->left = inline_calls(inliner, ((BinOp*)node)->left, statements);
+            ((BinOp*)node)->right = inline_calls(inliner, ((BinOp*)node)->right, statements);
+            return node;
+
+        case FuncCall_expr:
+            void** args_ptrs = (void**)((char*)node + sizeof(FuncCall));
+            for (size_t i = 0; i < ((FuncCall*)node)->num_args; i++)
+            {
+                args_ptrs[i] = inline_calls(inliner, args_ptrs[i], statements);
+            }
+            return inline_call(inliner, node, find_inlined_function(inliner, node), statements);
+
+        default:
+            return node;
+    }
+}
+
+static void* inline_expression(inliner* inliner, void* node, statement_array* statements)
+{
+    return can_inline_calls(inliner, node) ? inline_calls(inliner, node, statements) : node;
+}
+
+static void* inline_block(inliner* inliner, void* node);
+
+// Inline the calls of a statement, adding it to a list of statements, after the bodies of the calls
+static void inline_statement(inliner* inliner, void* node, statement_array* statements)
+{
+    // Calls whose value is discarded are left alone
+    if (!CHECK_ELEMENT_SUPERTYPE(node, Statement))
+    {
+        insert_statement_array(statements, (size_t)node);
+        return;
+    }
+
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case Print_stmt:
+            ((Print*)node)->expression = inline_expression(inliner, ((Print*)node)->expression, statements);
+            break;
+
+        case Assignment_stmt:
+            ((Assignment*)node)->rhs = inline_expression(inliner, ((Assignment*)node)->rhs, statements);
+            break;
+
+        case Return_stmt:
+            ((Return*)node)->expression = inline_expression(inliner, ((Return*)node)->expression, statements);
+            break;
+
+        case If_stmt:
+            If* if_stmt = (If*)node;
+            if_stmt->condition = inline_expression(inliner, if_stmt->condition, statements);
+            inliner->depth++;
+            if_stmt->then_branch = inline_block(inliner, if_stmt->then_branch);
+            if (if_stmt->else_branch != NULL)
+            {
+                if_stmt->else_branch = inline_block(inliner, if_stmt->else_branch);
+            }
+            inliner->depth--;
+            break;
+
+        // The condition and bounds of loops are left alone, as they are evaluated in the loop
+        case While_stmt:
+            inliner->depth++;
+            ((While*)node)->statements = inline_block(inliner, ((While*)node)->statements);
+            inliner->depth--;
+            break;
+
+        case For_stmt:
+            inliner->depth++;
+            ((For*)node)->statements = inline_block(inliner, ((For*)node)->statements);
+            inliner->depth--;
+            break;
+
+        // Functions are only inlined after their declaration, which must be at the top level, so that
+        // they are known to be declared by the time any call is made
+        case FuncDecl_stmt:
+            FuncDecl* func_decl = (FuncDecl*)node;
+            inliner->depth++;
+            func_decl->statements = inline_block(inliner, func_decl->statements);
+            inliner->depth--;
+
+            if (inliner->depth == 0 && can_inline_function(inliner, func_decl))
+            {
+                hashmap_set(&inliner->functions, func_decl->name, (size_t)func_decl);
+            }
+            break;
+    }
+
+    insert_statement_array(statements, (size_t)node);
+}
+
+// Inline the calls of a list of statements. The list is replaced if copies were added to it
+static void* inline_block(inliner* inliner, void* node)
+{
+    StatementList* statement_list = (StatementList*)node;
+    void** statement_ptrs = (void**)((char*)(node) + sizeof(StatementList));
+
+    statement_array statements;
+    init_statement_array(&statements, statement_list->size + 1);
+    for (size_t i = 0; i < statement_list->size; i++)
+    {
+        inline_statement(inliner, statement_ptrs[i], &statements);
+    }
+
+    if (statements.used != statement_list->size)
+    {
+        node = new_statement_list(inliner, &statements, GET_ELEMENT_LINE(statement_list));
+    }
+
+    free_statement_array(&statements);
+    return node;
+}
+
+void* inline_functions(inliner* inliner, void* ast_node)
+{
+    collect_declarations(inliner, ast_node, 0);
+    inliner->depth = 0;
+    return inline_block(inliner, ast_node);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "array_generics.h"
+#include "arrays.h"
+#include "hashmap.h"
+
+// Function inliner. It runs first in the AST optimizer, replacing calls to small functions with a copy
+// of their body, so that neither the call nor the environment it would create is paid for at runtime.
+
+// Each call site gets its own copy of the function: parameters become variables named after the call
+// site, assigned the arguments right before the statement holding the call, and the body follows them,
+// with each return turned into an assignment to the variable holding the result. The statements which
+// follow a return inside an if are moved into the branches which do not return, so that the copy ends
+// wherever the function would have returned. A body which is a single return becomes an expression.
+
+// As the body is moved before the statement holding the call, a function is only inlined when doing so
+// cannot change what the program does. It must:
+// - Be declared once, at the top level of the program, and be called after that declaration.
+// - Be small, and return a value on every path, never from inside a loop.
+// - Have no effects besides computing its result: it calls no functions, prints nothing, and assigns
+//   only its parameters.
+// - Only read its parameters and global variables which are never shadowed by local ones.
+// Calls are not inlined in loop conditions, which are evaluated again on every iteration, nor where
+// they might not be evaluated at all (the right operand of `and` and `or`), nor in statements which call
+// other functions, as their effects would be reordered.
+
+MAKE_FSD_ARRAY_HEADERS(void*, node)
+
+typedef struct inliner
+{
+    // Nodes built by the inliner. The AST points to them, so they live until the inliner is destroyed
+    node_array nodes;
+
+    // Names of the variables introduced for the call sites, owned by the inliner as well
+    string_array names;
+
+    // Number of times each function is declared, and names which might refer to a local variable
+    hashmap declaration_counts;
+    hashmap local_names;
+
+    // Functions which can be inlined, among the ones declared before the statement being visited
+    hashmap functions;
+
+    // Number of blocks enclosing the statement being visited, and number of call sites inlined so far
+    int depth;
+    uint32_t num_sites;
+} inliner;
+
+void init_inliner(inliner* inliner);
+void destroy_inliner(inliner* inliner);
+
+// Inline every call which can be, returning the node which must replace the given AST
+void* inline_functions(inliner* inliner, void* ast_node);
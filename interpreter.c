@@ -2,677 +2,1137 @@
 
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
 
+#include "memo.h"
 #include "model.h"
 #include "types.h"
 #include "utils.h"
 #include "state.h"
 
-#define CHECK_STACK_OVERFLOW do {if (interpreter->stack_index == (STACK_SIZE - 1)) {PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Environment stack overflow.\n");}} while(0)
-#define STOP_IF_RETURNING do {if (interpreter->is_returning) return (expression_result) {.type = NONE}; } while(0)
-#define BREAK_IF_RETURNING if (interpreter->is_returning) break 
+MAKE_FSD_ARRAY_FUNCTIONS(interpreter_task, task)
+MAKE_FSD_ARRAY_FUNCTIONS(expression_result, result)
 
-#ifdef _WIN32
-#include <Windows.h>
-#endif
+// Layout of the environment in which a block runs (see resolver.h)
+static const scope_layout* get_layout(const void* block)
+{
+    return (block != NULL && GET_ELEMENT_TYPE(block) == StatementList_stmt) ? ((const StatementList*)block)->layout : NULL;
+}
+
+// Enter a new environment to run a block, allocating it if no environment this deep was entered before
+environment* push_environment(interpreter* interpreter, environment* parent, environment_type type, const void* block, int line)
+{
+    char stack_top;
+    size_t stack_used = (interpreter->stack_base == NULL) ? 0
+        : (size_t)llabs((long long)((uintptr_t)interpreter->stack_base - (uintptr_t)&stack_top));
+    if (interpreter->stack_index == ENV_MAX_DEPTH - 1 || stack_used > INTERPRETER_STACK_LIMIT)
+    {
+        PRINT_INTERPRETER_ERROR_AND_QUIT(line, "Environment stack overflow.\n");
+    }
+
+    interpreter->stack_index += 1;
+    if (interpreter->stack_index == interpreter->num_environments)
+    {
+        if (interpreter->num_environments == interpreter->stack_capacity)
+        {
+            interpreter->stack_capacity *= 2;
+            void* temp = realloc(interpreter->environ_stack, interpreter->stack_capacity * sizeof(environment*));
+            if (temp == NULL)
+            {
+                PRINT_ERROR_AND_QUIT("Cannot allocate memory for the environment stack\n");
+            }
+            interpreter->environ_stack = temp;
+        }
+
+        environment* new_env = malloc(sizeof(environment));
+        if (new_env == NULL)
+        {
+            PRINT_ERROR_AND_QUIT("Cannot allocate memory for an environment\n");
+        }
+        init_environment(new_env, NULL);
+        interpreter->environ_stack[interpreter->num_environments++] = new_env;
+    }
+
+    environment* env = interpreter->environ_stack[interpreter->stack_index];
+    set_environment_parent(env, parent);
+    set_environment_layout(env, get_layout(block));
+    env->type = type;
+    return env;
+}
+
+// Leave the innermost environment. Once the stack is much shallower than it has been, the environments
+// past twice its depth are freed, so that a deep recursion does not hold on to its memory afterwards
+void pop_environment(interpreter* interpreter)
+{
+    clear_environment(interpreter->environ_stack[interpreter->stack_index]);
+    interpreter->stack_index -= 1;
+
+    while (interpreter->num_environments > 2 * (interpreter->stack_index + 1) + ENV_POOL_INITIAL_SIZE)
+    {
+        environment* idle_env = interpreter->environ_stack[--interpreter->num_environments];
+        free_environment(idle_env);
+        free(idle_env);
+    }
+}
 
 void init_interpreter(interpreter* interpreter)
 {
     init_vss_array(&interpreter->memory, 65535);
-    for (int i = 0; i < STACK_SIZE; i++)
+    init_task_array(&interpreter->tasks, 64);
+    init_result_array(&interpreter->values, 64);
+    interpreter->environ_stack = malloc(ENV_POOL_INITIAL_SIZE * sizeof(environment*));
+    if (interpreter->environ_stack == NULL)
     {
-        init_environment(&interpreter->environ_stack[i], NULL);
+        PRINT_ERROR_AND_QUIT("Cannot allocate memory for the environment stack\n");
     }
-    interpreter->stack_index = 0;
-    interpreter->environ_stack[0].type = ENV_MAIN;
+    interpreter->stack_capacity = ENV_POOL_INITIAL_SIZE;
+    interpreter->num_environments = 0;
+    interpreter->stack_index = -1;
+    interpreter->stack_base = NULL;
+    push_environment(interpreter, NULL, ENV_MAIN, NULL, 0);
     interpreter->is_returning = 0;
+    interpreter->memo = NULL;
 }
 
 void free_interpreter(interpreter* interpreter)
 {
     free_vss_array(&interpreter->memory);
-    for (int i = 0; i < STACK_SIZE; i++)
+    free_task_array(&interpreter->tasks);
+    free_result_array(&interpreter->values);
+    for (int i = 0; i < interpreter->num_environments; i++)
     {
-        free_environment(&interpreter->environ_stack[i]);
+        free_environment(interpreter->environ_stack[i]);
+        free(interpreter->environ_stack[i]);
     }
+    free(interpreter->environ_stack);
 }
 
-expression_result interpret(interpreter* interpreter, void* ast_node, environment* env)
+// Arithmetic and comparisons between two values, for all the operators but the logic ones, which do not
+// always evaluate their right operand
+expression_result interpret_binary_operation(interpreter* interpreter, token_type op, expression_result lhs, expression_result rhs, int element_line)
 {
-    int element_type = GET_ELEMENT_TYPE(ast_node);
-    int element_supertype = GET_ELEMENT_SUPERTYPE(ast_node);
-    int element_line = ((Element*)ast_node)->line;
-    
-#ifdef _WIN32
-    __try
+    switch (op)
     {
-#endif
-    
-    if (element_supertype == Statement)
-    {
-        switch (element_type)
-        {
-            case StatementList_stmt:
-                void** statement_ptrs = (void**)((char*)(ast_node) + sizeof(StatementList));
-                for (size_t i = 0; i < ((StatementList*)(ast_node))->size; i++)
+        case TOK_PLUS:
+            // Case 1 for addition: both are integers. Return an integer
+            if (lhs.type == INT_VALUE && rhs.type == INT_VALUE)
+            {
+                return (expression_result) {.type = INT_VALUE, .value.int_value = lhs.value.int_value + rhs.value.int_value};
+            }
+
+            // Case 2 for addition: one value is a float. Return a float
+            if (lhs.type == FLOAT_VALUE && (rhs.type == FLOAT_VALUE || rhs.type == INT_VALUE))
+            {
+                return (expression_result) {.type = FLOAT_VALUE, .value.float_value = lhs.value.float_value + ((rhs.type == FLOAT_VALUE) ? rhs.value.float_value : (double) (rhs.value.int_value))};
+            }
+
+            if (rhs.type == FLOAT_VALUE && (lhs.type == FLOAT_VALUE || lhs.type == INT_VALUE))
+            {
+                return (expression_result) {.type = FLOAT_VALUE, .value.float_value = ((lhs.type == FLOAT_VALUE) ? lhs.value.float_value : (double) (lhs.value.int_value)) + rhs.value.float_value };
+            }
+
+            // Case 3 for addition: one value is a string. Cast the other to string
+            if (lhs.type == STRING_VALUE || rhs.type == STRING_VALUE)
+            {
+                return (expression_result) {.type = STRING_VALUE, .value.string_value = string_addition(&interpreter->memory, cast_to_string(&interpreter->memory, lhs), cast_to_string(&interpreter->memory, rhs))};
+            }
+
+            // Otherwise, this is an unsupported operation. Error-out
+            PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported operation '%s' between '%s' and '%s'\n", token_symbols[op], type_names[lhs.type], type_names[rhs.type]);
+
+        case TOK_MINUS:
+            // Case 1 for subtraction: both are integers. Return an integer
+            if (lhs.type == INT_VALUE && rhs.type == INT_VALUE)
+            {
+                return (expression_result) {.type = INT_VALUE, .value.int_value = lhs.value.int_value - rhs.value.int_value};
+            }
+
+            // Case 2 for subtraction: one value is a float. Return a float
+            if (lhs.type == FLOAT_VALUE && (rhs.type == FLOAT_VALUE || rhs.type == INT_VALUE))
+            {
+                return (expression_result) {.type = FLOAT_VALUE, .value.float_value = lhs.value.float_value - ((rhs.type == FLOAT_VALUE) ? rhs.value.float_value : (double) (rhs.value.int_value))};
+            }
+
+            if (rhs.type == FLOAT_VALUE && (lhs.type == FLOAT_VALUE || lhs.type == INT_VALUE))
+            {
+                return (expression_result) {.type = FLOAT_VALUE, .value.float_value = ((lhs.type == FLOAT_VALUE) ? lhs.value.float_value : (double) (lhs.value.int_value)) - rhs.value.float_value};
+            }
+
+            // Otherwise, this is an unsupported operation. Error-out
+            PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported operation '%s' between '%s' and '%s'\n", token_symbols[op], type_names[lhs.type], type_names[rhs.type]);
+
+        case TOK_STAR:
+            // Case 1 for multiplication: both are integers. Return an integer
+            if (lhs.type == INT_VALUE && rhs.type == INT_VALUE)
+            {
+                return (expression_result) {.type = INT_VALUE, .value.int_value = lhs.value.int_value * rhs.value.int_value};
+            }
+
+            // Case 2 for multiplication: one value is a float. Return a float
+            if (lhs.type == FLOAT_VALUE && (rhs.type == FLOAT_VALUE || rhs.type == INT_VALUE))
+            {
+                return (expression_result) {.type = FLOAT_VALUE, .value.float_value = lhs.value.float_value * ((rhs.type == FLOAT_VALUE) ? rhs.value.float_value : (double) (rhs.value.int_value))};
+            }
+
+            if (rhs.type == FLOAT_VALUE && (lhs.type == FLOAT_VALUE || lhs.type == INT_VALUE))
+            {
+                return (expression_result) {.type = FLOAT_VALUE, .value.float_value = ((lhs.type == FLOAT_VALUE) ? lhs.value.float_value : (double) (lhs.value.int_value)) * rhs.value.float_value};
+            }
+
+            // Otherwise, this is an unsupported operation. Error-out
+            PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported operation '%s' between '%s' and '%s'\n", token_symbols[op], type_names[lhs.type], type_names[rhs.type]);
+
+        case TOK_SLASH:
+            // Case 1 for division: both are integers. Return an integer
+            if (lhs.type == INT_VALUE && rhs.type == INT_VALUE)
+            {
+                if (rhs.value.int_value == 0)
                 {
-                    interpret(interpreter, *statement_ptrs++, env);
-                    clear_vss_array(&interpreter->memory);
-                    STOP_IF_RETURNING;
+                    PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Division by zero\n");
                 }
+                return (expression_result) {.type = INT_VALUE, .value.int_value = lhs.value.int_value / rhs.value.int_value};
+            }
 
-                return (expression_result) {.type = NONE};
-
-            case Print_stmt:
-                Print* print_stmt = ast_node;
-                expression_result result = interpret(interpreter, print_stmt->expression, env);
-                string_type result_str = cast_to_string(&interpreter->memory, result);
-                printf("%.*s", result_str.length, result_str.string_value);
-                if (print_stmt->break_line)
+            // Case 2 for division: one value is a float. Return a float
+            if (lhs.type == FLOAT_VALUE && (rhs.type == FLOAT_VALUE || rhs.type == INT_VALUE))
+            {
+                if (((rhs.type == FLOAT_VALUE) ? rhs.value.float_value : (double) (rhs.value.int_value)) == 0.0)
                 {
-                    printf("\n");
+                    PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Division by zero\n");
                 }
+                return (expression_result) {.type = FLOAT_VALUE, .value.float_value = lhs.value.float_value / ((rhs.type == FLOAT_VALUE) ? rhs.value.float_value : (double) (rhs.value.int_value))};
+            }
 
-                return (expression_result) {.type = NONE};
-
-            case If_stmt:
-                If* if_stmt = ast_node;
-                expression_result test_result = interpret(interpreter, if_stmt->condition, env);
-                if (test_result.type != BOOL_VALUE)
-                {
-                    PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Condition test is not boolean\n");
-                }
-
-                if (test_result.value.bool_value)
+            if (rhs.type == FLOAT_VALUE && (lhs.type == FLOAT_VALUE || lhs.type == INT_VALUE))
+            {
+                if (rhs.value.float_value == 0)
                 {
-                    CHECK_STACK_OVERFLOW;
-                    interpreter->stack_index += 1;
-                    set_environment_parent(&interpreter->environ_stack[interpreter->stack_index], env);
-                    interpreter->environ_stack[interpreter->stack_index].type = ENV_BLOCK;
-                    interpret(interpreter, if_stmt->then_branch, &interpreter->environ_stack[interpreter->stack_index]);
-                    clear_environment(&interpreter->environ_stack[interpreter->stack_index]);
-                    interpreter->stack_index -= 1;
+                    PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Division by zero\n");
                 }
-                else if(if_stmt->else_branch != NULL)
-                {
-                    CHECK_STACK_OVERFLOW;
-                    interpreter->stack_index += 1;
-                    set_environment_parent(&interpreter->environ_stack[interpreter->stack_index], env);
-                    interpreter->environ_stack[interpreter->stack_index].type = ENV_BLOCK;
-                    interpret(interpreter, if_stmt->else_branch, &interpreter->environ_stack[interpreter->stack_index]);
-                    clear_environment(&interpreter->environ_stack[interpreter->stack_index]);
-                    interpreter->stack_index -= 1;
-                }
-
-                return (expression_result) {.type = NONE};
+                return (expression_result) {.type = FLOAT_VALUE, .value.float_value = ((lhs.type == FLOAT_VALUE) ? lhs.value.float_value : (double) (lhs.value.int_value)) / rhs.value.float_value};
+            }
+
+            // Otherwise, this is an unsupported operation. Error-out
+            PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported operation '%s' between '%s' and '%s'\n", token_symbols[op], type_names[lhs.type], type_names[rhs.type]);
+
+        case TOK_MOD:
+            // Case 1 for modulus: both are integers. Return an integer
+            if (lhs.type == INT_VALUE && rhs.type == INT_VALUE)
+            {
+                return (expression_result) {.type = INT_VALUE, .value.int_value = lhs.value.int_value % rhs.value.int_value};
+            }
+
+            // Case 2 for modulus: one value is a float. Return a float
+            if (lhs.type == FLOAT_VALUE && (rhs.type == FLOAT_VALUE || rhs.type == INT_VALUE))
+            {
+                return (expression_result) {.type = FLOAT_VALUE, .value.float_value = fmod(lhs.value.float_value, (rhs.type == FLOAT_VALUE) ? rhs.value.float_value : (double) (rhs.value.int_value))};
+            }
+
+            if (rhs.type == FLOAT_VALUE && (lhs.type == FLOAT_VALUE || lhs.type == INT_VALUE))
+            {
+                return (expression_result) {.type = FLOAT_VALUE, .value.float_value = fmod((lhs.type == FLOAT_VALUE) ? lhs.value.float_value : (double) (lhs.value.int_value), rhs.value.float_value)};
+            }
+
+            // Otherwise, this is an unsupported operation. Error-out
+            PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported operation '%s' between '%s' and '%s'\n", token_symbols[op], type_names[lhs.type], type_names[rhs.type]);
+
+        case TOK_CARET:
+            // Case 1 for exponentiation: both are integers. Return an integer
+            if (lhs.type == INT_VALUE && rhs.type == INT_VALUE)
+            {
+                return (expression_result) {.type = INT_VALUE, .value.int_value = int_pow(lhs.value.int_value , rhs.value.int_value)};
+            }
+
+            // Case 2 for exponentiation: one value is a float. Return a float
+            if (lhs.type == FLOAT_VALUE && (rhs.type == FLOAT_VALUE || rhs.type == INT_VALUE))
+            {
+                return (expression_result) {.type = FLOAT_VALUE, .value.float_value = float_pow(lhs.value.float_value, (rhs.type == FLOAT_VALUE) ? rhs.value.float_value : (double) (rhs.value.int_value))};
+            }
+
+            if (rhs.type == FLOAT_VALUE && (lhs.type == FLOAT_VALUE || lhs.type == INT_VALUE))
+            {
+                return (expression_result) {.type = FLOAT_VALUE, .value.float_value = float_pow((lhs.type == FLOAT_VALUE) ? lhs.value.float_value : (double) (lhs.value.int_value), rhs.value.float_value)};
+            }
+
+            // Otherwise, this is an unsupported operation. Error-out
+            PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported operation '%s' between '%s' and '%s'\n", token_symbols[op], type_names[lhs.type], type_names[rhs.type]);
+
+        // Comparison operations. All behave similarly: if both operands are numbers or bools, their values are compared.
+        // If they are strings, they are compared lexicographically and by length, like Python.
+        case TOK_GT:
+            if ((lhs.type == INT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == BOOL_VALUE))
+            {
+                int converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : lhs.value.bool_value;
+                int converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : rhs.value.bool_value;
+                return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left > converted_val_right};
+            }
+
+            if ((lhs.type == INT_VALUE || lhs.type == FLOAT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == FLOAT_VALUE || rhs.type == BOOL_VALUE))
+            {
+                double converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : (lhs.type == FLOAT_VALUE) ? lhs.value.float_value : lhs.value.bool_value;
+                double converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : (rhs.type == FLOAT_VALUE) ? rhs.value.float_value : rhs.value.bool_value;
+                return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left > converted_val_right};
+            }
+
+            if (lhs.type == STRING_VALUE && rhs.type == STRING_VALUE)
+            {
+                return (expression_result) {.type = BOOL_VALUE, .value.bool_value = string_comparison(&lhs.value.string_value, &rhs.value.string_value, COMPARE_GT)};
+            }
+
+            // Otherwise, this is an unsupported operation. Error-out
+            PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported operation '%s' between '%s' and '%s'\n", token_symbols[op], type_names[lhs.type], type_names[rhs.type]);
+
+        case TOK_LT:
+            if ((lhs.type == INT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == BOOL_VALUE))
+            {
+                int converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : lhs.value.bool_value;
+                int converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : rhs.value.bool_value;
+                return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left < converted_val_right};
+            }
+
+            if ((lhs.type == INT_VALUE || lhs.type == FLOAT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == FLOAT_VALUE || rhs.type == BOOL_VALUE))
+            {
+                double converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : (lhs.type == FLOAT_VALUE) ? lhs.value.float_value : lhs.value.bool_value;
+                double converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : (rhs.type == FLOAT_VALUE) ? rhs.value.float_value : rhs.value.bool_value;
+                return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left < converted_val_right};
+            }
+
+            if (lhs.type == STRING_VALUE && rhs.type == STRING_VALUE)
+            {
+                return (expression_result) {.type = BOOL_VALUE, .value.bool_value = string_comparison(&lhs.value.string_value, &rhs.value.string_value, COMPARE_LT)};
+            }
+
+            // Otherwise, this is an unsupported operation. Error-out
+            PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported operation '%s' between '%s' and '%s'\n", token_symbols[op], type_names[lhs.type], type_names[rhs.type]);
+
+        case TOK_GE:
+            if ((lhs.type == INT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == BOOL_VALUE))
+            {
+                int converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : lhs.value.bool_value;
+                int converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : rhs.value.bool_value;
+                return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left >= converted_val_right};
+            }
+
+            if ((lhs.type == INT_VALUE || lhs.type == FLOAT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == FLOAT_VALUE || rhs.type == BOOL_VALUE))
+            {
+                double converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : (lhs.type == FLOAT_VALUE) ? lhs.value.float_value : lhs.value.bool_value;
+                double converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : (rhs.type == FLOAT_VALUE) ? rhs.value.float_value : rhs.value.bool_value;
+                return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left >= converted_val_right};
+            }
+
+            if (lhs.type == STRING_VALUE && rhs.type == STRING_VALUE)
+            {
+                return (expression_result) {.type = BOOL_VALUE, .value.bool_value = string_comparison(&lhs.value.string_value, &rhs.value.string_value, COMPARE_GE)};
+            }
+
+            // Otherwise, this is an unsupported operation. Error-out
+            PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported operation '%s' between '%s' and '%s'\n", token_symbols[op], type_names[lhs.type], type_names[rhs.type]);
+
+        case TOK_LE:
+            if ((lhs.type == INT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == BOOL_VALUE))
+            {
+                int converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : lhs.value.bool_value;
+                int converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : rhs.value.bool_value;
+                return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left <= converted_val_right};
+            }
+
+            if ((lhs.type == INT_VALUE || lhs.type == FLOAT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == FLOAT_VALUE || rhs.type == BOOL_VALUE))
+            {
+                double converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : (lhs.type == FLOAT_VALUE) ? lhs.value.float_value : lhs.value.bool_value;
+                double converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : (rhs.type == FLOAT_VALUE) ? rhs.value.float_value : rhs.value.bool_value;
+                return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left <= converted_val_right};
+            }
+
+            if (lhs.type == STRING_VALUE && rhs.type == STRING_VALUE)
+            {
+                return (expression_result) {.type = BOOL_VALUE, .value.bool_value = string_comparison(&lhs.value.string_value, &rhs.value.string_value, COMPARE_LE)};
+            }
+
+            // Otherwise, this is an unsupported operation. Error-out
+            PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported operation '%s' between '%s' and '%s'\n", token_symbols[op], type_names[lhs.type], type_names[rhs.type]);
+
+        case TOK_EQEQ:
+            if ((lhs.type == INT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == BOOL_VALUE))
+            {
+                int converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : lhs.value.bool_value;
+                int converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : rhs.value.bool_value;
+                return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left == converted_val_right};
+            }
+
+            if ((lhs.type == INT_VALUE || lhs.type == FLOAT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == FLOAT_VALUE || rhs.type == BOOL_VALUE))
+            {
+                double converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : (lhs.type == FLOAT_VALUE) ? lhs.value.float_value : lhs.value.bool_value;
+                double converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : (rhs.type == FLOAT_VALUE) ? rhs.value.float_value : rhs.value.bool_value;
+                return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left == converted_val_right};
+            }
+
+            if (lhs.type == STRING_VALUE && rhs.type == STRING_VALUE)
+            {
+                return (expression_result) {.type = BOOL_VALUE, .value.bool_value = string_comparison(&lhs.value.string_value, &rhs.value.string_value, COMPARE_EQ)};
+            }
+
+            // Otherwise, we are comparing non-comparable types. Return false
+            return false_expression;
+
+        case TOK_NE:
+            if ((lhs.type == INT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == BOOL_VALUE))
+            {
+                int converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : lhs.value.bool_value;
+                int converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : rhs.value.bool_value;
+                return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left != converted_val_right};
+            }
+
+            if ((lhs.type == INT_VALUE || lhs.type == FLOAT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == FLOAT_VALUE || rhs.type == BOOL_VALUE))
+            {
+                double converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : (lhs.type == FLOAT_VALUE) ? lhs.value.float_value : lhs.value.bool_value;
+                double converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : (rhs.type == FLOAT_VALUE) ? rhs.value.float_value : rhs.value.bool_value;
+                return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left != converted_val_right};
+            }
+
+            if (lhs.type == STRING_VALUE && rhs.type == STRING_VALUE)
+            {
+                return (expression_result) {.type = BOOL_VALUE, .value.bool_value = string_comparison(&lhs.value.string_value, &rhs.value.string_value, COMPARE_NE)};
+            }
+
+            // Otherwise, we are comparing non-comparable types. Return true
+            return true_expression;
+
+        default:
+            PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unknown binary operation '%s'\n", token_symbols[op]);
+    }
+}
 
-            case While_stmt:
-                While* while_stmt = ast_node;
-                expression_result while_test_result = interpret(interpreter, while_stmt->condition, env);
-                if (while_test_result.type != BOOL_VALUE)
-                {
-                    PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Condition test is not boolean\n");
-                }
+expression_result interpret_unary_operation(token_type op, expression_result operand, int element_line)
+{
+    switch (op)
+    {
+        case TOK_PLUS:
+            // Unary plus is only supported for ints and floats.
+            if (operand.type == INT_VALUE || operand.type == FLOAT_VALUE)
+            {
+                return operand;
+            }
+
+            PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported unary operation '%s' for '%s'\n", token_symbols[op], type_names[operand.type]);
+
+        case TOK_MINUS:
+            // Unary minus is only supported for ints and floats.
+            if (operand.type == INT_VALUE)
+            {
+                return (expression_result) {.type = INT_VALUE, .value.int_value = -operand.value.int_value};
+            }
+            if (operand.type == FLOAT_VALUE)
+            {
+                return (expression_result) {.type = FLOAT_VALUE, .value.float_value = -operand.value.float_value};
+            }
+
+            PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported unary operation '%s' for '%s'\n", token_symbols[op], type_names[operand.type]);
+
+        case TOK_NOT:
+            // Unary not is only supported for bools
+            if (operand.type == BOOL_VALUE)
+            {
+                return (expression_result) {.type = BOOL_VALUE, .value.bool_value = !operand.value.bool_value};
+            }
+
+            PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported unary operation '%s' for '%s'\n", token_symbols[op], type_names[operand.type]);
+
+        default:
+            PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unknown unary operation '%s'\n", token_symbols[op]);
+    }
+}
 
-                CHECK_STACK_OVERFLOW;
-                interpreter->stack_index += 1;
-                set_environment_parent(&interpreter->environ_stack[interpreter->stack_index], env);
-                interpreter->environ_stack[interpreter->stack_index].type = ENV_BLOCK;
-                while(while_test_result.value.bool_value)
-                {
-                    interpret(interpreter, while_stmt->statements, &interpreter->environ_stack[interpreter->stack_index]);
-                    BREAK_IF_RETURNING;
-                    while_test_result = interpret(interpreter, while_stmt->condition, env);
-                }
-                clear_environment(&interpreter->environ_stack[interpreter->stack_index]);
-                interpreter->stack_index -= 1;
-
-                return (expression_result) {.type = NONE};
-
-            case For_stmt:
-                For* for_stmt = ast_node;
-                CHECK_STACK_OVERFLOW;
-                interpreter->stack_index += 1;
-                set_environment_parent(&interpreter->environ_stack[interpreter->stack_index], env);
-                interpreter->environ_stack[interpreter->stack_index].type = ENV_BLOCK;
-            
-                interpret(interpreter, for_stmt->initial_assignment, &interpreter->environ_stack[interpreter->stack_index]);
-                Identifier* iterator_identifier = (Identifier*)(((Assignment*)for_stmt->initial_assignment)->lhs);
-                expression_result iterator = get_variable(&interpreter->environ_stack[interpreter->stack_index], iterator_identifier->name, element_line);
-                expression_result stop_value = interpret(interpreter, for_stmt->stop, &interpreter->environ_stack[interpreter->stack_index]);
-                expression_result step_value = (expression_result) {.type = NONE};
-
-                if (for_stmt->step != NULL)
-                {
-                    step_value = interpret(interpreter, for_stmt->step, &interpreter->environ_stack[interpreter->stack_index]);
-                    if (step_value.type != INT_VALUE)
-                    {
-                        PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "For step value must be an integer.");
-                    }
-                }
-            
-                if (stop_value.type != INT_VALUE)
-                {
-                    PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "For stop value must be an integer.");
-                }
+// Operations between two integers or two floats which can be computed directly. Returns 0 for the other
+// operators, and for divisions by zero, which are errors
+static inline int int_operation(token_type op, integer_type lhs, integer_type rhs, expression_result* result)
+{
+    switch (op)
+    {
+        case TOK_PLUS:  *result = (expression_result) {.type = INT_VALUE, .value.int_value = lhs + rhs}; return 1;
+        case TOK_MINUS: *result = (expression_result) {.type = INT_VALUE, .value.int_value = lhs - rhs}; return 1;
+        case TOK_STAR:  *result = (expression_result) {.type = INT_VALUE, .value.int_value = lhs * rhs}; return 1;
+        case TOK_SLASH: if (rhs == 0) return 0; *result = (expression_result) {.type = INT_VALUE, .value.int_value = lhs / rhs}; return 1;
+        case TOK_MOD:   if (rhs == 0) return 0; *result = (expression_result) {.type = INT_VALUE, .value.int_value = lhs % rhs}; return 1;
+        case TOK_GT:    *result = (expression_result) {.type = BOOL_VALUE, .value.bool_value = lhs > rhs}; return 1;
+        case TOK_LT:    *result = (expression_result) {.type = BOOL_VALUE, .value.bool_value = lhs < rhs}; return 1;
+        case TOK_GE:    *result = (expression_result) {.type = BOOL_VALUE, .value.bool_value = lhs >= rhs}; return 1;
+        case TOK_LE:    *result = (expression_result) {.type = BOOL_VALUE, .value.bool_value = lhs <= rhs}; return 1;
+        case TOK_EQEQ:  *result = (expression_result) {.type = BOOL_VALUE, .value.bool_value = lhs == rhs}; return 1;
+        case TOK_NE:    *result = (expression_result) {.type = BOOL_VALUE, .value.bool_value = lhs != rhs}; return 1;
+        default:        return 0;
+    }
+}
 
-                if (iterator.type != INT_VALUE)
-                {
-                    PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "For iterator must be an integer.");
-                }
-            
-                while(iterator.value.int_value <= stop_value.value.int_value)
-                {
-                    interpret(interpreter, for_stmt->statements, &interpreter->environ_stack[interpreter->stack_index]);
-                    BREAK_IF_RETURNING;
-                    int step = (for_stmt->step != NULL) ? step_value.value.int_value : 1;
-                    expression_result new_iter_value = (expression_result) {.type = INT_VALUE, .value.int_value = iterator.value.int_value + step};
-                    set_variable(&interpreter->environ_stack[interpreter->stack_index], iterator_identifier->name, new_iter_value, false);
-                    iterator = get_variable(&interpreter->environ_stack[interpreter->stack_index], iterator_identifier->name, element_line);
-                }
-            
-                clear_environment(&interpreter->environ_stack[interpreter->stack_index]);
-                interpreter->stack_index -= 1;
+static inline int float_operation(token_type op, float_type lhs, float_type rhs, expression_result* result)
+{
+    switch (op)
+    {
+        case TOK_PLUS:  *result = (expression_result) {.type = FLOAT_VALUE, .value.float_value = lhs + rhs}; return 1;
+        case TOK_MINUS: *result = (expression_result) {.type = FLOAT_VALUE, .value.float_value = lhs - rhs}; return 1;
+        case TOK_STAR:  *result = (expression_result) {.type = FLOAT_VALUE, .value.float_value = lhs * rhs}; return 1;
+        case TOK_SLASH: if (rhs == 0) return 0; *result = (expression_result) {.type = FLOAT_VALUE, .value.float_value = lhs / rhs}; return 1;
+        case TOK_MOD:   *result = (expression_result) {.type = FLOAT_VALUE, .value.float_value = fmod(lhs, rhs)}; return 1;
+        case TOK_GT:    *result = (expression_result) {.type = BOOL_VALUE, .value.bool_value = lhs > rhs}; return 1;
+        case TOK_LT:    *result = (expression_result) {.type = BOOL_VALUE, .value.bool_value = lhs < rhs}; return 1;
+        case TOK_GE:    *result = (expression_result) {.type = BOOL_VALUE, .value.bool_value = lhs >= rhs}; return 1;
+        case TOK_LE:    *result = (expression_result) {.type = BOOL_VALUE, .value.bool_value = lhs <= rhs}; return 1;
+        case TOK_EQEQ:  *result = (expression_result) {.type = BOOL_VALUE, .value.bool_value = lhs == rhs}; return 1;
+        case TOK_NE:    *result = (expression_result) {.type = BOOL_VALUE, .value.bool_value = lhs != rhs}; return 1;
+        default:        return 0;
+    }
+}
 
-                return (expression_result) {.type = NONE};
+// Binary operations specialize on the types of their operands. The first evaluation records whether both
+// were integers or both floats, and later ones only check that the operands still have those types before
+// computing the result directly. When the check fails, the operation falls back to the generic one for good
+static inline expression_result interpret_specialized_operation(interpreter* interpreter, BinOp* binop, expression_result lhs, expression_result rhs, int element_line)
+{
+    expression_result result;
+    switch (binop->specialization)
+    {
+        case BINOP_INT_INT:
+            if (lhs.type == INT_VALUE && rhs.type == INT_VALUE && int_operation(binop->op, lhs.value.int_value, rhs.value.int_value, &result))
+                return result;
+            break;
+
+        case BINOP_FLOAT_FLOAT:
+            if (lhs.type == FLOAT_VALUE && rhs.type == FLOAT_VALUE && float_operation(binop->op, lhs.value.float_value, rhs.value.float_value, &result))
+                return result;
+            break;
+
+        case BINOP_UNSPECIALIZED:
+            if (lhs.type == INT_VALUE && rhs.type == INT_VALUE && int_operation(binop->op, lhs.value.int_value, rhs.value.int_value, &result))
+            {
+                binop->specialization = BINOP_INT_INT;
+                return result;
+            }
+            if (lhs.type == FLOAT_VALUE && rhs.type == FLOAT_VALUE && float_operation(binop->op, lhs.value.float_value, rhs.value.float_value, &result))
+            {
+                binop->specialization = BINOP_FLOAT_FLOAT;
+                return result;
+            }
+            break;
+    }
 
-            case Assignment_stmt:
-                Assignment* assignment_stmt = ast_node;
-                Identifier* lhs_identifier = assignment_stmt->lhs;
-                expression_result rhs_result = interpret(interpreter, assignment_stmt->rhs, env);
-                set_variable(env, lhs_identifier->name, rhs_result, assignment_stmt->is_local);
+    binop->specialization = BINOP_GENERIC;
+    return interpret_binary_operation(interpreter, binop->op, lhs, rhs, element_line);
+}
 
-                return (expression_result) {.type = NONE};
+#define PUSH_VALUE(result) push_value(interpreter, (result))
+#define POP_VALUE() (interpreter->values.data[--interpreter->values.used])
+#define TOP_VALUE() (interpreter->values.data[interpreter->values.used - 1])
+#define FINISH_TASK() (interpreter->tasks.used -= 1)
 
-            case FuncDecl_stmt:
-                FuncDecl* func_decl_stmt = ast_node;
-                if (set_function(env, func_decl_stmt->name, (function) {.addr = (size_t)func_decl_stmt, .env = env}) == -1)
-                {
-                    PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Function %.*s was already declared.", func_decl_stmt->name.length, func_decl_stmt->name.string_value);
-                }
+static inline void push_value(interpreter* interpreter, expression_result value)
+{
+    if (interpreter->values.used == interpreter->values.size)
+    {
+        insert_result_array(&interpreter->values, value);
+        return;
+    }
+    interpreter->values.data[interpreter->values.used++] = value;
+}
 
-                return (expression_result) {.type = NONE};
-            
-            case FuncCall_expr:
-                // Get function name (and check if it was declared)
-                FuncCall* func_call_stmt = ast_node;
-                function func = get_function(env, func_call_stmt->name, element_line);
-                FuncDecl* func_decl = (FuncDecl*)func.addr;
+// Whether an expression contains no calls, which is cached in binary operations
+static int is_direct(void* node)
+{
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case FuncCall_expr:
+            return 0;
 
-                // Check number of arguments of call and declaration
-                if (func_call_stmt->num_args != func_decl->num_params)
-                {
-                    PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Function %.*s was declared with %lu parameters, but %lu arguments were given", func_decl->name.length, func_decl->name.string_value, func_decl->num_params, func_call_stmt->num_args);
-                }
+        case BinOp_expr:
+            BinOp* binop = node;
+            if (binop->has_calls == -1)
+            {
+                binop->has_calls = !is_direct(binop->left) || !is_direct(binop->right);
+            }
+            return !binop->has_calls;
 
-                // Evaluate arguments, and add them to the function environment 
-                CHECK_STACK_OVERFLOW;
-                interpreter->stack_index += 1;
-                set_environment_parent(&interpreter->environ_stack[interpreter->stack_index], func.env);
-                interpreter->environ_stack[interpreter->stack_index].type = ENV_FUNC;
+        case UnOp_expr:
+            return is_direct(((UnOp*)node)->operand);
 
-                void** expression_ptrs = (void**)((char*)(func_call_stmt) + sizeof(FuncCall));
-                string_type* param_ptrs = (string_type*)((char*)(func_decl) + sizeof(FuncDecl));
-                for (size_t i = 0; i < func_call_stmt->num_args; i++)
-                {
-                     expression_result arg = interpret(interpreter, *expression_ptrs++, env);
-                     string_type param = *param_ptrs++;
-                     set_variable(&interpreter->environ_stack[interpreter->stack_index], param, arg, true);
-                }
+        case Grouping_expr:
+            return is_direct(((Grouping*)node)->expression);
 
-                // All is ready -- interpret the function!
-                interpret(interpreter, func_decl->statements, &interpreter->environ_stack[interpreter->stack_index]);
-                interpreter->is_returning = 0;
-            
-                clear_environment(&interpreter->environ_stack[interpreter->stack_index]);
-                interpreter->stack_index -= 1;
-                return (expression_result) {.type = NONE};
-
-            case Return_stmt:
-                Return* return_stmt = ast_node;
-                expression_result retval = interpret(interpreter, return_stmt->expression, env);
-                interpreter->is_returning = 1;
-                set_return(env, retval, element_line);
-                return (expression_result) {.type = NONE};
-            
-            default:
-                PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unknown statement type ID %d\n", element_type);
-        }
+        default:
+            return 1;
     }
+}
 
-    if (element_supertype == Expression)
+// Evaluate an expression which contains no calls. It recurses on the operands, but only as deep as the
+// expression is nested in the source of the program, which the parser recursed on already
+static expression_result evaluate(interpreter* interpreter, void* node, environment* env)
+{
+    int element_line = GET_ELEMENT_LINE(node);
+    switch (GET_ELEMENT_TYPE(node))
     {
-        switch (element_type)
-        {            
-            case Integer_expr:
-                return (expression_result) {.type = INT_VALUE, .value.int_value = ((Integer*)ast_node)->value};
-        
-            case Float_expr:
-                return (expression_result) {.type = FLOAT_VALUE, .value.float_value = ((Float*)ast_node)->value};
-
-            case Bool_expr:
-                return ((Bool*)ast_node)->value ? true_expression : false_expression;
-
-            case String_expr:
-                return (expression_result) {.type = STRING_VALUE, .value.string_value = ((String*)ast_node)->value};
-
-            case Identifier_expr:
-                return get_variable(env, ((Identifier*)ast_node)->name, element_line);
-        
-            case BinOp_expr:
-                expression_result lhs = interpret(interpreter, ((BinOp*)ast_node)->left, env);
-                token_type binop_op = ((BinOp*)ast_node)->op;
+        case Integer_expr:
+            return (expression_result) {.type = INT_VALUE, .value.int_value = ((Integer*)node)->value};
 
-                // Logic operand shortcuts
-                if (binop_op == TOK_AND)
-                {
-                    if (cast_to_bool(&interpreter->memory, lhs))
-                    {
-                        return interpret(interpreter, ((BinOp*)ast_node)->right, env);
-                    }
-                    return lhs;
-                }
+        case Float_expr:
+            return (expression_result) {.type = FLOAT_VALUE, .value.float_value = ((Float*)node)->value};
 
-                if (binop_op == TOK_OR)
-                {
-                    if (cast_to_bool(&interpreter->memory, lhs))
-                    {
-                        return lhs;
-                    }
-                    return interpret(interpreter, ((BinOp*)ast_node)->right, env);
-                }
-                
-                expression_result rhs = interpret(interpreter, ((BinOp*)ast_node)->right, env);
-                switch (binop_op)
-                {
-                    case TOK_PLUS:
-                        // Case 1 for addition: both are integers. Return an integer
-                        if (lhs.type == INT_VALUE && rhs.type == INT_VALUE)
-                        {
-                            return (expression_result) {.type = INT_VALUE, .value.int_value = lhs.value.int_value + rhs.value.int_value};
-                        }
+        case Bool_expr:
+            return ((Bool*)node)->value ? true_expression : false_expression;
 
-                        // Case 2 for addition: one value is a float. Return a float
-                        if (lhs.type == FLOAT_VALUE && (rhs.type == FLOAT_VALUE || rhs.type == INT_VALUE))
-                        {
-                            return (expression_result) {.type = FLOAT_VALUE, .value.float_value = lhs.value.float_value + ((rhs.type == FLOAT_VALUE) ? rhs.value.float_value : (double) (rhs.value.int_value))};
-                        }
+        case String_expr:
+            return (expression_result) {.type = STRING_VALUE, .value.string_value = ((String*)node)->value};
 
-                        if (rhs.type == FLOAT_VALUE && (lhs.type == FLOAT_VALUE || lhs.type == INT_VALUE))
-                        {
-                            return (expression_result) {.type = FLOAT_VALUE, .value.float_value = ((lhs.type == FLOAT_VALUE) ? lhs.value.float_value : (double) (lhs.value.int_value)) + rhs.value.float_value };
-                        }
+        case Identifier_expr:
+            Identifier* identifier = node;
+            return get_variable_at(env, identifier->scope_depth, identifier->slot, identifier->name, element_line);
 
-                        // Case 3 for addition: one value is a string. Cast the other to string
-                        if (lhs.type == STRING_VALUE || rhs.type == STRING_VALUE)
-                        {
-                            return (expression_result) {.type = STRING_VALUE, .value.string_value = string_addition(&interpreter->memory, cast_to_string(&interpreter->memory, lhs), cast_to_string(&interpreter->memory, rhs))};
-                        }
+        case BinOp_expr:
+            BinOp* binop = node;
+            expression_result lhs = evaluate(interpreter, binop->left, env);
 
-                        // Otherwise, this is an unsupported operation. Error-out
-                        PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported operation '%s' between '%s' and '%s'\n", token_symbols[binop_op], type_names[lhs.type], type_names[rhs.type]);
+            // Logic operand shortcuts
+            if (binop->op == TOK_AND)
+            {
+                return cast_to_bool(&interpreter->memory, lhs) ? evaluate(interpreter, binop->right, env) : lhs;
+            }
 
-                    case TOK_MINUS:
-                        // Case 1 for subtraction: both are integers. Return an integer
-                        if (lhs.type == INT_VALUE && rhs.type == INT_VALUE)
-                        {
-                            return (expression_result) {.type = INT_VALUE, .value.int_value = lhs.value.int_value - rhs.value.int_value};
-                        }
+            if (binop->op == TOK_OR)
+            {
+                return cast_to_bool(&interpreter->memory, lhs) ? lhs : evaluate(interpreter, binop->right, env);
+            }
 
-                        // Case 2 for subtraction: one value is a float. Return a float
-                        if (lhs.type == FLOAT_VALUE && (rhs.type == FLOAT_VALUE || rhs.type == INT_VALUE))
-                        {
-                            return (expression_result) {.type = FLOAT_VALUE, .value.float_value = lhs.value.float_value - ((rhs.type == FLOAT_VALUE) ? rhs.value.float_value : (double) (rhs.value.int_value))};
-                        }
+            expression_result rhs = evaluate(interpreter, binop->right, env);
+            return interpret_specialized_operation(interpreter, binop, lhs, rhs, element_line);
 
-                        if (rhs.type == FLOAT_VALUE && (lhs.type == FLOAT_VALUE || lhs.type == INT_VALUE))
-                        {
-                            return (expression_result) {.type = FLOAT_VALUE, .value.float_value = ((lhs.type == FLOAT_VALUE) ? lhs.value.float_value : (double) (lhs.value.int_value)) - rhs.value.float_value};
-                        }
+        case UnOp_expr:
+            expression_result operand = evaluate(interpreter, ((UnOp*)node)->operand, env);
+            return interpret_unary_operation(((UnOp*)node)->op, operand, element_line);
 
-                        // Otherwise, this is an unsupported operation. Error-out
-                        PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported operation '%s' between '%s' and '%s'\n", token_symbols[binop_op], type_names[lhs.type], type_names[rhs.type]);
+        case Grouping_expr:
+            return evaluate(interpreter, ((Grouping*)node)->expression, env);
 
-                    case TOK_STAR:
-                        // Case 1 for multiplication: both are integers. Return an integer
-                        if (lhs.type == INT_VALUE && rhs.type == INT_VALUE)
-                        {
-                            return (expression_result) {.type = INT_VALUE, .value.int_value = lhs.value.int_value * rhs.value.int_value};
-                        }
+        default:
+            PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unknown expression type ID %d\n", GET_ELEMENT_TYPE(node));
+    }
+}
 
-                        // Case 2 for multiplication: one value is a float. Return a float
-                        if (lhs.type == FLOAT_VALUE && (rhs.type == FLOAT_VALUE || rhs.type == INT_VALUE))
-                        {
-                            return (expression_result) {.type = FLOAT_VALUE, .value.float_value = lhs.value.float_value * ((rhs.type == FLOAT_VALUE) ? rhs.value.float_value : (double) (rhs.value.int_value))};
-                        }
+// Only the fields every node starts from are set, the others are set by the nodes which use them
+static interpreter_task* new_task(interpreter* interpreter, void* node, environment* env)
+{
+    if (interpreter->tasks.used == interpreter->tasks.size)
+    {
+        insert_task_array(&interpreter->tasks, (interpreter_task) {0});
+        interpreter->tasks.used -= 1;
+    }
 
-                        if (rhs.type == FLOAT_VALUE && (lhs.type == FLOAT_VALUE || lhs.type == INT_VALUE))
-                        {
-                            return (expression_result) {.type = FLOAT_VALUE, .value.float_value = ((lhs.type == FLOAT_VALUE) ? lhs.value.float_value : (double) (lhs.value.int_value)) * rhs.value.float_value};
-                        }
+    interpreter_task* task = &interpreter->tasks.data[interpreter->tasks.used++];
+    task->node = node;
+    task->env = env;
+    task->phase = 0;
+    task->index = 0;
+    return task;
+}
 
-                        // Otherwise, this is an unsupported operation. Error-out
-                        PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported operation '%s' between '%s' and '%s'\n", token_symbols[binop_op], type_names[lhs.type], type_names[rhs.type]);
+static void print_value(interpreter* interpreter, const Print* print_stmt, expression_result result)
+{
+    string_type result_str = cast_to_string(&interpreter->memory, result);
+    printf("%.*s", result_str.length, result_str.string_value);
+    if (print_stmt->break_line)
+    {
+        printf("\n");
+    }
+}
 
-                    case TOK_SLASH:
-                        // Case 1 for division: both are integers. Return an integer
-                        if (lhs.type == INT_VALUE && rhs.type == INT_VALUE)
-                        {
-                            if (rhs.value.int_value == 0)
-                            {
-                                PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Division by zero\n");
-                            }
-                            return (expression_result) {.type = INT_VALUE, .value.int_value = lhs.value.int_value / rhs.value.int_value};
-                        }
+static void assign_value(const Assignment* assignment_stmt, environment* env, expression_result result)
+{
+    const Identifier* lhs_identifier = assignment_stmt->lhs;
+    set_variable_at(env, lhs_identifier->scope_depth, lhs_identifier->slot, lhs_identifier->name, result, assignment_stmt->is_local);
+}
 
-                        // Case 2 for division: one value is a float. Return a float
-                        if (lhs.type == FLOAT_VALUE && (rhs.type == FLOAT_VALUE || rhs.type == INT_VALUE))
-                        {
-                            if (((rhs.type == FLOAT_VALUE) ? rhs.value.float_value : (double) (rhs.value.int_value)) == 0.0)
-                            {
-                                PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Division by zero\n");
-                            }
-                            return (expression_result) {.type = FLOAT_VALUE, .value.float_value = lhs.value.float_value / ((rhs.type == FLOAT_VALUE) ? rhs.value.float_value : (double) (rhs.value.int_value))};
-                        }
+static void return_value(interpreter* interpreter, const Return* return_stmt, environment* env, expression_result result)
+{
+    interpreter->is_returning = 1;
+    set_return(env, result, GET_ELEMENT_LINE(return_stmt));
+}
 
-                        if (rhs.type == FLOAT_VALUE && (lhs.type == FLOAT_VALUE || lhs.type == INT_VALUE))
-                        {
-                            if (rhs.value.float_value == 0)
-                            {
-                                PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Division by zero\n");
-                            }
-                            return (expression_result) {.type = FLOAT_VALUE, .value.float_value = ((lhs.type == FLOAT_VALUE) ? lhs.value.float_value : (double) (lhs.value.int_value)) / rhs.value.float_value};
-                        }
+// Run the statements which do not need to wait for a call right away. Returns 0 if the statement needs a
+// task, and 1 if it is done or pushed the tasks it needs itself
+static int run_statement(interpreter* interpreter, void* node, environment* env)
+{
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        // Conditions which let the if run no branch are common enough to spare it a task. Otherwise it goes
+        // on from the condition it tested
+        case If_stmt:
+            If* if_stmt = node;
+            if (!is_direct(if_stmt->condition))
+                return 0;
+
+            expression_result test_result = evaluate(interpreter, if_stmt->condition, env);
+            if (test_result.type == BOOL_VALUE && !test_result.value.bool_value && if_stmt->else_branch == NULL)
+                return 1;
+
+            PUSH_VALUE(test_result);
+            new_task(interpreter, node, env)->phase = 1;
+            return 1;
+
+        case Print_stmt:
+            if (!is_direct(((Print*)node)->expression))
+                return 0;
+            print_value(interpreter, node, evaluate(interpreter, ((Print*)node)->expression, env));
+            return 1;
+
+        case Assignment_stmt:
+            if (!is_direct(((Assignment*)node)->rhs))
+                return 0;
+            assign_value(node, env, evaluate(interpreter, ((Assignment*)node)->rhs, env));
+            return 1;
+
+        case Return_stmt:
+            if (!is_direct(((Return*)node)->expression))
+                return 0;
+            return_value(interpreter, node, env, evaluate(interpreter, ((Return*)node)->expression, env));
+            return 1;
+
+        case FuncDecl_stmt:
+            FuncDecl* func_decl_stmt = node;
+            if (set_function(env, func_decl_stmt->name, (function) {.addr = (size_t)func_decl_stmt, .env = env}) == -1)
+            {
+                PRINT_INTERPRETER_ERROR_AND_QUIT(GET_ELEMENT_LINE(node), "Function %.*s was already declared.", func_decl_stmt->name.length, func_decl_stmt->name.string_value);
+            }
+            return 1;
+
+        default:
+            return 0;
+    }
+}
 
-                        // Otherwise, this is an unsupported operation. Error-out
-                        PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported operation '%s' between '%s' and '%s'\n", token_symbols[binop_op], type_names[lhs.type], type_names[rhs.type]);
+// Run a node next. Expressions without calls, and the statements which only need those, run right away
+// instead, as nothing else would run before them. Returns 0 if the node is done, and 1 if it waits on the
+// task stack
+static int push_task(interpreter* interpreter, void* node, environment* env)
+{
+    if (CHECK_ELEMENT_SUPERTYPE(node, Expression))
+    {
+        if (is_direct(node))
+        {
+            PUSH_VALUE(evaluate(interpreter, node, env));
+            return 0;
+        }
+    }
+    else
+    {
+        size_t num_tasks = interpreter->tasks.used;
+        if (run_statement(interpreter, node, env))
+            return interpreter->tasks.used > num_tasks;
+    }
 
-                    case TOK_MOD:
-                        // Case 1 for modulus: both are integers. Return an integer
-                        if (lhs.type == INT_VALUE && rhs.type == INT_VALUE)
-                        {
-                            return (expression_result) {.type = INT_VALUE, .value.int_value = lhs.value.int_value % rhs.value.int_value};
-                        }
+    new_task(interpreter, node, env);
+    return 1;
+}
 
-                        // Case 2 for modulus: one value is a float. Return a float
-                        if (lhs.type == FLOAT_VALUE && (rhs.type == FLOAT_VALUE || rhs.type == INT_VALUE))
-                        {
-                            return (expression_result) {.type = FLOAT_VALUE, .value.float_value = fmod(lhs.value.float_value, (rhs.type == FLOAT_VALUE) ? rhs.value.float_value : (double) (rhs.value.int_value))};
-                        }
+// Calls evaluate their arguments one by one into the environment of the function, and keep them on the
+// value stack until the call ends, as memoized calls look them up and store them along with the result.
+// Calls which are statements drop their result and are never memoized
+static void run_call(interpreter* interpreter, interpreter_task* task, int is_expression)
+{
+    FuncCall* func_call_stmt = task->node;
+    int element_line = GET_ELEMENT_LINE(func_call_stmt);
+    FuncDecl* func_decl;
+    expression_result ret = (expression_result) {.type = NONE};
 
-                        if (rhs.type == FLOAT_VALUE && (lhs.type == FLOAT_VALUE || lhs.type == INT_VALUE))
-                        {
-                            return (expression_result) {.type = FLOAT_VALUE, .value.float_value = fmod((lhs.type == FLOAT_VALUE) ? lhs.value.float_value : (double) (lhs.value.int_value), rhs.value.float_value)};
-                        }
+    switch (task->phase)
+    {
+        // Get function name (and check if it was declared)
+        case 0:
+            function func = get_function(task->env, func_call_stmt->name, element_line);
+            func_decl = (FuncDecl*)func.addr;
+
+            // Check number of arguments of call and declaration
+            if (func_call_stmt->num_args != func_decl->num_params)
+            {
+                PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Function %.*s was declared with %lu parameters, but %lu arguments were given", func_decl->name.length, func_decl->name.string_value, func_decl->num_params, func_call_stmt->num_args);
+            }
+
+            task->callee = func_decl;
+            task->inner_env = push_environment(interpreter, func.env, ENV_FUNC, func_decl->statements, element_line);
+            task->is_memoized = is_expression && interpreter->memo != NULL && func_decl->is_pure && func_call_stmt->num_args <= MEMO_MAX_ARGS;
+            task->phase = 1;
+            // fall through
+
+        // Evaluate arguments, and add them to the function environment
+        case 1:
+            func_decl = task->callee;
+            void** expression_ptrs = (void**)((char*)(func_call_stmt) + sizeof(FuncCall));
+            string_type* param_ptrs = (string_type*)((char*)(func_decl) + sizeof(FuncDecl));
+            while (1)
+            {
+                if (task->index > 0)
+                {
+                    set_variable(task->inner_env, param_ptrs[task->index - 1], TOP_VALUE(), true);
+                }
+                if (task->index == func_call_stmt->num_args)
+                    break;
+                if (push_task(interpreter, expression_ptrs[task->index++], task->env))
+                    return;
+            }
+
+            // All is ready -- interpret the function, unless its result is known already!
+            expression_result* args = &interpreter->values.data[interpreter->values.used - func_call_stmt->num_args];
+            if (!task->is_memoized || !memo_lookup(interpreter->memo, func_decl, args, func_call_stmt->num_args, &ret))
+            {
+                task->phase = 2;
+                push_task(interpreter, func_decl->statements, task->inner_env);
+                return;
+            }
+            break;
+
+        case 2:
+            func_decl = task->callee;
+            if (is_expression && interpreter->is_returning)
+            {
+                ret = get_variable(task->env, ret_var, element_line);
+            }
+            if (task->is_memoized)
+            {
+                memo_store(interpreter->memo, func_decl, &interpreter->values.data[interpreter->values.used - func_call_stmt->num_args], func_call_stmt->num_args, ret);
+            }
+            interpreter->is_returning = 0;
+            break;
+    }
 
-                        // Otherwise, this is an unsupported operation. Error-out
-                        PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported operation '%s' between '%s' and '%s'\n", token_symbols[binop_op], type_names[lhs.type], type_names[rhs.type]);
-                    
-                    case TOK_CARET:
-                        // Case 1 for exponentiation: both are integers. Return an integer
-                        if (lhs.type == INT_VALUE && rhs.type == INT_VALUE)
-                        {
-                            return (expression_result) {.type = INT_VALUE, .value.int_value = int_pow(lhs.value.int_value , rhs.value.int_value)};
-                        }
+    interpreter->values.used -= func_call_stmt->num_args;
+    pop_environment(interpreter);
+    FINISH_TASK();
+    if (is_expression)
+    {
+        PUSH_VALUE(ret);
+    }
+}
+
+// Nodes are run from a stack of tasks instead of recursing, so that how deep programs can recurse does not
+// depend on the process stack. A node pushes the children it needs as tasks, and is resumed at its next
+// phase once they are done, or goes on right away if their values are ready. Expressions leave their value
+// on the value stack, where the node which needs it takes it
+expression_result interpret(interpreter* interpreter, void* ast_node, environment* env)
+{
+    size_t tasks_base = interpreter->tasks.used;
+    size_t values_base = interpreter->values.used;
+    push_task(interpreter, ast_node, env);
 
-                        // Case 2 for exponentiation: one value is a float. Return a float
-                        if (lhs.type == FLOAT_VALUE && (rhs.type == FLOAT_VALUE || rhs.type == INT_VALUE))
+    while (interpreter->tasks.used > tasks_base)
+    {
+        interpreter_task* task = &interpreter->tasks.data[interpreter->tasks.used - 1];
+        void* node = task->node;
+        int element_type = GET_ELEMENT_TYPE(node);
+        int element_line = ((Element*)node)->line;
+
+        if (GET_ELEMENT_SUPERTYPE(node) == Statement)
+        {
+            switch (element_type)
+            {
+                // The index is the next statement to run. Statements run one after the other until one waits
+                case StatementList_stmt:
+                    void** statement_ptrs = (void**)((char*)(node) + sizeof(StatementList));
+                    int is_waiting = 0;
+                    while (!is_waiting)
+                    {
+                        if (task->index > 0)
                         {
-                            return (expression_result) {.type = FLOAT_VALUE, .value.float_value = pow(lhs.value.float_value, (rhs.type == FLOAT_VALUE) ? rhs.value.float_value : (double) (rhs.value.int_value))};
+                            clear_vss_array(&interpreter->memory);
                         }
 
-                        if (rhs.type == FLOAT_VALUE && (lhs.type == FLOAT_VALUE || lhs.type == INT_VALUE))
+                        if (task->index == ((StatementList*)node)->size || (task->index > 0 && interpreter->is_returning))
                         {
-                            return (expression_result) {.type = FLOAT_VALUE, .value.float_value = pow((lhs.type == FLOAT_VALUE) ? lhs.value.float_value : (double) (lhs.value.int_value), rhs.value.float_value)};
+                            FINISH_TASK();
+                            break;
                         }
 
-                        // Otherwise, this is an unsupported operation. Error-out
-                        PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported operation '%s' between '%s' and '%s'\n", token_symbols[binop_op], type_names[lhs.type], type_names[rhs.type]);
+                        is_waiting = push_task(interpreter, statement_ptrs[task->index++], task->env);
+                    }
+                    break;
 
-                    // Comparison operations. All behave similarly: if both operands are numbers or bools, their values are compared.
-                    // If they are strings, they are compared lexicographically and by length, like Python.
-                    case TOK_GT:
-                        if ((lhs.type == INT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == BOOL_VALUE))
-                        {
-                            int converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : lhs.value.bool_value;
-                            int converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : rhs.value.bool_value;
-                            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left > converted_val_right};
-                        }
-                        
-                        if ((lhs.type == INT_VALUE || lhs.type == FLOAT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == FLOAT_VALUE || rhs.type == BOOL_VALUE))
-                        {
-                            double converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : (lhs.type == FLOAT_VALUE) ? lhs.value.float_value : lhs.value.bool_value;
-                            double converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : (rhs.type == FLOAT_VALUE) ? rhs.value.float_value : rhs.value.bool_value;
-                            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left > converted_val_right};
-                        }
+                case Print_stmt:
+                    Print* print_stmt = node;
+                    if (task->phase == 0)
+                    {
+                        task->phase = 1;
+                        if (push_task(interpreter, print_stmt->expression, task->env))
+                            continue;
+                    }
 
-                        if (lhs.type == STRING_VALUE && rhs.type == STRING_VALUE)
-                        {
-                            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = string_comparison(&lhs.value.string_value, &rhs.value.string_value, COMPARE_GT)};
-                        }
+                    print_value(interpreter, print_stmt, POP_VALUE());
+                    FINISH_TASK();
+                    break;
 
-                        // Otherwise, this is an unsupported operation. Error-out
-                        PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported operation '%s' between '%s' and '%s'\n", token_symbols[binop_op], type_names[lhs.type], type_names[rhs.type]);
+                case If_stmt:
+                    If* if_stmt = node;
+                    if (task->phase == 0)
+                    {
+                        task->phase = 1;
+                        if (push_task(interpreter, if_stmt->condition, task->env))
+                            continue;
+                    }
 
-                    case TOK_LT:
-                        if ((lhs.type == INT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == BOOL_VALUE))
-                        {
-                            int converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : lhs.value.bool_value;
-                            int converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : rhs.value.bool_value;
-                            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left < converted_val_right};
-                        }
-                        
-                        if ((lhs.type == INT_VALUE || lhs.type == FLOAT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == FLOAT_VALUE || rhs.type == BOOL_VALUE))
+                    if (task->phase == 1)
+                    {
+                        expression_result test_result = POP_VALUE();
+                        if (test_result.type != BOOL_VALUE)
                         {
-                            double converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : (lhs.type == FLOAT_VALUE) ? lhs.value.float_value : lhs.value.bool_value;
-                            double converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : (rhs.type == FLOAT_VALUE) ? rhs.value.float_value : rhs.value.bool_value;
-                            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left < converted_val_right};
+                            PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Condition test is not boolean\n");
                         }
 
-                        if (lhs.type == STRING_VALUE && rhs.type == STRING_VALUE)
+                        void* branch = test_result.value.bool_value ? if_stmt->then_branch : if_stmt->else_branch;
+                        if (branch == NULL)
                         {
-                            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = string_comparison(&lhs.value.string_value, &rhs.value.string_value, COMPARE_LT)};
+                            FINISH_TASK();
+                            break;
                         }
 
-                        // Otherwise, this is an unsupported operation. Error-out
-                        PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported operation '%s' between '%s' and '%s'\n", token_symbols[binop_op], type_names[lhs.type], type_names[rhs.type]);
-                        
-                    case TOK_GE:
-                        if ((lhs.type == INT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == BOOL_VALUE))
-                        {
-                            int converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : lhs.value.bool_value;
-                            int converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : rhs.value.bool_value;
-                            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left >= converted_val_right};
-                        }
-                        
-                        if ((lhs.type == INT_VALUE || lhs.type == FLOAT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == FLOAT_VALUE || rhs.type == BOOL_VALUE))
-                        {
-                            double converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : (lhs.type == FLOAT_VALUE) ? lhs.value.float_value : lhs.value.bool_value;
-                            double converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : (rhs.type == FLOAT_VALUE) ? rhs.value.float_value : rhs.value.bool_value;
-                            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left >= converted_val_right};
-                        }
+                        task->phase = 2;
+                        if (push_task(interpreter, branch, push_environment(interpreter, task->env, ENV_BLOCK, branch, element_line)))
+                            continue;
+                    }
 
-                        if (lhs.type == STRING_VALUE && rhs.type == STRING_VALUE)
-                        {
-                            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = string_comparison(&lhs.value.string_value, &rhs.value.string_value, COMPARE_GE)};
-                        }
+                    pop_environment(interpreter);
+                    FINISH_TASK();
+                    break;
 
-                        // Otherwise, this is an unsupported operation. Error-out
-                        PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported operation '%s' between '%s' and '%s'\n", token_symbols[binop_op], type_names[lhs.type], type_names[rhs.type]);
+                // The condition is tested in the enclosing environment, and the body runs in its own
+                case While_stmt:
+                    While* while_stmt = node;
+                    int is_looping = 0;
+                    switch (task->phase)
+                    {
+                        case 0:
+                            task->phase = 1;
+                            if (push_task(interpreter, while_stmt->condition, task->env))
+                                continue;
+                            // fall through
+
+                        case 1:
+                            expression_result while_test_result = POP_VALUE();
+                            if (while_test_result.type != BOOL_VALUE)
+                            {
+                                PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Condition test is not boolean\n");
+                            }
 
-                    case TOK_LE:
-                        if ((lhs.type == INT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == BOOL_VALUE))
-                        {
-                            int converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : lhs.value.bool_value;
-                            int converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : rhs.value.bool_value;
-                            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left <= converted_val_right};
-                        }
-                        
-                        if ((lhs.type == INT_VALUE || lhs.type == FLOAT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == FLOAT_VALUE || rhs.type == BOOL_VALUE))
-                        {
-                            double converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : (lhs.type == FLOAT_VALUE) ? lhs.value.float_value : lhs.value.bool_value;
-                            double converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : (rhs.type == FLOAT_VALUE) ? rhs.value.float_value : rhs.value.bool_value;
-                            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left <= converted_val_right};
-                        }
+                            task->inner_env = push_environment(interpreter, task->env, ENV_BLOCK, while_stmt->statements, element_line);
+                            is_looping = while_test_result.value.bool_value;
+                            break;
 
-                        if (lhs.type == STRING_VALUE && rhs.type == STRING_VALUE)
-                        {
-                            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = string_comparison(&lhs.value.string_value, &rhs.value.string_value, COMPARE_LE)};
-                        }
+                        // The body is done
+                        case 2:
+                            if (interpreter->is_returning)
+                                break;
 
-                        // Otherwise, this is an unsupported operation. Error-out
-                        PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported operation '%s' between '%s' and '%s'\n", token_symbols[binop_op], type_names[lhs.type], type_names[rhs.type]);
+                            task->phase = 3;
+                            if (push_task(interpreter, while_stmt->condition, task->env))
+                                continue;
+                            // fall through
 
-                    case TOK_EQEQ:
-                        if ((lhs.type == INT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == BOOL_VALUE))
-                        {
-                            int converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : lhs.value.bool_value;
-                            int converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : rhs.value.bool_value;
-                            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left == converted_val_right};
-                        }
-                        
-                        if ((lhs.type == INT_VALUE || lhs.type == FLOAT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == FLOAT_VALUE || rhs.type == BOOL_VALUE))
-                        {
-                            double converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : (lhs.type == FLOAT_VALUE) ? lhs.value.float_value : lhs.value.bool_value;
-                            double converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : (rhs.type == FLOAT_VALUE) ? rhs.value.float_value : rhs.value.bool_value;
-                            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left == converted_val_right};
-                        }
+                        case 3:
+                            is_looping = POP_VALUE().value.bool_value;
+                            break;
+                    }
 
-                        if (lhs.type == STRING_VALUE && rhs.type == STRING_VALUE)
-                        {
-                            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = string_comparison(&lhs.value.string_value, &rhs.value.string_value, COMPARE_EQ)};
-                        }
+                    if (is_looping)
+                    {
+                        task->phase = 2;
+                        push_task(interpreter, while_stmt->statements, task->inner_env);
+                        break;
+                    }
 
-                        // Otherwise, we are comparing non-comparable types. Return false
-                        return false_expression;
+                    pop_environment(interpreter);
+                    FINISH_TASK();
+                    break;
 
-                    case TOK_NE:
-                        if ((lhs.type == INT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == BOOL_VALUE))
-                        {
-                            int converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : lhs.value.bool_value;
-                            int converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : rhs.value.bool_value;
-                            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left != converted_val_right};
-                        }
-                        
-                        if ((lhs.type == INT_VALUE || lhs.type == FLOAT_VALUE || lhs.type == BOOL_VALUE) && (rhs.type == INT_VALUE || rhs.type == FLOAT_VALUE || rhs.type == BOOL_VALUE))
-                        {
-                            double converted_val_left = (lhs.type == INT_VALUE) ? lhs.value.int_value : (lhs.type == FLOAT_VALUE) ? lhs.value.float_value : lhs.value.bool_value;
-                            double converted_val_right = (rhs.type == INT_VALUE) ? rhs.value.int_value : (rhs.type == FLOAT_VALUE) ? rhs.value.float_value : rhs.value.bool_value;
-                            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = converted_val_left != converted_val_right};
-                        }
+                // The loop keeps its iterator, stop value and step, and runs everything in its own environment
+                case For_stmt:
+                    For* for_stmt = node;
+                    Identifier* iterator_identifier = (Identifier*)(((Assignment*)for_stmt->initial_assignment)->lhs);
+                    expression_result* iterator = &task->saved[0];
+                    expression_result* stop_value = &task->saved[1];
+                    expression_result* step_value = &task->saved[2];
 
-                        if (lhs.type == STRING_VALUE && rhs.type == STRING_VALUE)
-                        {
-                            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = string_comparison(&lhs.value.string_value, &rhs.value.string_value, COMPARE_NE)};
-                        }
+                    switch (task->phase)
+                    {
+                        case 0:
+                            task->inner_env = push_environment(interpreter, task->env, ENV_BLOCK, for_stmt->statements, element_line);
+                            task->phase = 1;
+                            if (push_task(interpreter, for_stmt->initial_assignment, task->inner_env))
+                                continue;
+                            // fall through
+
+                        case 1:
+                            *iterator = get_variable(task->inner_env, iterator_identifier->name, element_line);
+                            task->phase = 2;
+                            if (push_task(interpreter, for_stmt->stop, task->inner_env))
+                                continue;
+                            // fall through
+
+                        case 2:
+                            *stop_value = POP_VALUE();
+                            task->phase = 3;
+                            if (for_stmt->step != NULL && push_task(interpreter, for_stmt->step, task->inner_env))
+                                continue;
+                            // fall through
+
+                        case 3:
+                            *step_value = (expression_result) {.type = INT_VALUE, .value.int_value = 1};
+                            if (for_stmt->step != NULL)
+                            {
+                                *step_value = POP_VALUE();
+                                if (step_value->type != INT_VALUE)
+                                {
+                                    PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "For step value must be an integer.");
+                                }
+                            }
 
-                        // Otherwise, we are comparing non-comparable types. Return true
-                        return true_expression;
-                            
-                    default:
-                        PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unknown binary operation '%s'\n", token_symbols[binop_op]);
-                }
-            
+                            if (stop_value->type != INT_VALUE)
+                            {
+                                PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "For stop value must be an integer.");
+                            }
 
-            case UnOp_expr:
-                expression_result operand = interpret(interpreter, ((UnOp*)ast_node)->operand, env);
-                token_type un_op = ((UnOp*)ast_node)->op;
-                switch (un_op)
-                {
-                    case TOK_PLUS:
-                        // Unary plus is only supported for ints and floats.
-                        if (operand.type == INT_VALUE || operand.type == FLOAT_VALUE)
-                        {
-                            return operand;
-                        }
+                            if (iterator->type != INT_VALUE)
+                            {
+                                PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "For iterator must be an integer.");
+                            }
+                            break;
 
-                        PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported unary operation '%s' for '%s'\n", token_symbols[un_op], type_names[operand.type]);
+                        // The body is done
+                        case 4:
+                            if (interpreter->is_returning)
+                            {
+                                pop_environment(interpreter);
+                                FINISH_TASK();
+                                continue;
+                            }
 
-                    case TOK_MINUS:
-                        // Unary minus is only supported for ints and floats.
-                        if (operand.type == INT_VALUE)
-                        {
-                            return (expression_result) {.type = INT_VALUE, .value.int_value = -operand.value.int_value};
-                        }
-                        if (operand.type == FLOAT_VALUE)
-                        {
-                            return (expression_result) {.type = FLOAT_VALUE, .value.float_value = -operand.value.float_value};
-                        }
+                            expression_result new_iter_value = (expression_result) {.type = INT_VALUE, .value.int_value = iterator->value.int_value + step_value->value.int_value};
+                            set_variable(task->inner_env, iterator_identifier->name, new_iter_value, false);
+                            *iterator = get_variable(task->inner_env, iterator_identifier->name, element_line);
+                            break;
+                    }
 
-                        PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported unary operation '%s' for '%s'\n", token_symbols[un_op], type_names[operand.type]);
-                        
-                    case TOK_NOT:
-                        // Unary not is only supported for bools
-                        if (operand.type == BOOL_VALUE)
-                        {
-                            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = !operand.value.bool_value};
-                        }
+                    if (iterator->value.int_value <= stop_value->value.int_value)
+                    {
+                        task->phase = 4;
+                        push_task(interpreter, for_stmt->statements, task->inner_env);
+                        break;
+                    }
 
-                        PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unsupported unary operation '%s' for '%s'\n", token_symbols[un_op], type_names[operand.type]);
+                    pop_environment(interpreter);
+                    FINISH_TASK();
+                    break;
 
-                    default:
-                        PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unknown unary operation '%s'\n", token_symbols[un_op]);
-                }
-            
+                case Assignment_stmt:
+                    Assignment* assignment_stmt = node;
+                    if (task->phase == 0)
+                    {
+                        task->phase = 1;
+                        if (push_task(interpreter, assignment_stmt->rhs, task->env))
+                            continue;
+                    }
 
-            case Grouping_expr:
-                return interpret(interpreter, ((Grouping*)ast_node)->expression, env);
+                    assign_value(assignment_stmt, task->env, POP_VALUE());
+                    FINISH_TASK();
+                    break;
 
+                case FuncCall_expr:
+                    run_call(interpreter, task, 0);
+                    break;
 
-            case FuncCall_expr:
-                // Get function name (and check if it was declared)
-                FuncCall* func_call_stmt = ast_node;
-                function func = get_function(env, func_call_stmt->name, element_line);
-                FuncDecl* func_decl = (FuncDecl*)func.addr;
+                case Return_stmt:
+                    Return* return_stmt = node;
+                    if (task->phase == 0)
+                    {
+                        task->phase = 1;
+                        if (push_task(interpreter, return_stmt->expression, task->env))
+                            continue;
+                    }
+
+                    return_value(interpreter, return_stmt, task->env, POP_VALUE());
+                    FINISH_TASK();
+                    break;
+
+                default:
+                    PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unknown statement type ID %d\n", element_type);
+            }
+            continue;
+        }
+
+        // Only expressions with calls wait on the task stack
+        switch (element_type)
+        {
+            case BinOp_expr:
+                BinOp* binop = node;
+                if (task->phase == 0)
+                {
+                    task->phase = 1;
+                    if (push_task(interpreter, binop->left, task->env))
+                        continue;
+                }
 
-                // Check number of arguments of call and declaration
-                if (func_call_stmt->num_args != func_decl->num_params)
+                if (task->phase == 1)
                 {
-                    PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Function %.*s was declared with %lu parameters, but %lu arguments were given", func_decl->name.length, func_decl->name.string_value, func_decl->num_params, func_call_stmt->num_args);
+                    // Logic operand shortcuts: the result is the left operand, unless it does not decide it, in
+                    // which case the right operand replaces the operation
+                    if (binop->op == TOK_AND || binop->op == TOK_OR)
+                    {
+                        int lhs_is_true = cast_to_bool(&interpreter->memory, TOP_VALUE()) != 0;
+                        FINISH_TASK();
+                        if ((binop->op == TOK_AND) ? lhs_is_true : !lhs_is_true)
+                        {
+                            interpreter->values.used -= 1;
+                            push_task(interpreter, binop->right, task->env);
+                        }
+                        break;
+                    }
+
+                    task->phase = 2;
+                    if (push_task(interpreter, binop->right, task->env))
+                        continue;
                 }
 
-                // Evaluate arguments, and add them to the function environment 
-                CHECK_STACK_OVERFLOW;
-                interpreter->stack_index += 1;
-                set_environment_parent(&interpreter->environ_stack[interpreter->stack_index], func.env);
-                interpreter->environ_stack[interpreter->stack_index].type = ENV_FUNC;
+                expression_result rhs = POP_VALUE();
+                expression_result lhs = POP_VALUE();
+                PUSH_VALUE(interpret_specialized_operation(interpreter, binop, lhs, rhs, element_line));
+                FINISH_TASK();
+                break;
 
-                void** expression_ptrs = (void**)((char*)(func_call_stmt) + sizeof(FuncCall));
-                string_type* param_ptrs = (string_type*)((char*)(func_decl) + sizeof(FuncDecl));
-                for (size_t i = 0; i < func_call_stmt->num_args; i++)
+            case UnOp_expr:
+                UnOp* unop = node;
+                if (task->phase == 0)
                 {
-                     expression_result arg = interpret(interpreter, *expression_ptrs++, env);
-                     string_type param = *param_ptrs++;
-                     set_variable(&interpreter->environ_stack[interpreter->stack_index], param, arg, true);
+                    task->phase = 1;
+                    if (push_task(interpreter, unop->operand, task->env))
+                        continue;
                 }
 
-                // All is ready -- interpret the function!
-                expression_result ret;
-                interpret(interpreter, func_decl->statements, &interpreter->environ_stack[interpreter->stack_index]);
-                ret = (interpreter->is_returning) ? get_variable(env, ret_var, element_line) : (expression_result) { .type = NONE };
-            
-                interpreter->is_returning = 0;
-                clear_environment(&interpreter->environ_stack[interpreter->stack_index]);
-                interpreter->stack_index -= 1;
-                return ret;
-            
+                TOP_VALUE() = interpret_unary_operation(unop->op, TOP_VALUE(), element_line);
+                FINISH_TASK();
+                break;
+
+            // The expression replaces the grouping
+            case Grouping_expr:
+                FINISH_TASK();
+                push_task(interpreter, ((Grouping*)node)->expression, task->env);
+                break;
+
+            case FuncCall_expr:
+                run_call(interpreter, task, 1);
+                break;
+
             default:
                 PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unknown expression type ID %d\n", element_type);
         }
     }
 
-    PRINT_INTERPRETER_ERROR_AND_QUIT(element_line, "Unknown element supertype ID %d\n", element_supertype);
-#ifdef _WIN32 
-    }
-    __except (GetExceptionCode() == EXCEPTION_STACK_OVERFLOW)
-    {
-        PRINT_ERROR_AND_QUIT("Process stack overflow at line %d\n", element_line);
-    }
-#endif
+    return (interpreter->values.used > values_base) ? interpreter->values.data[--interpreter->values.used] : (expression_result) {.type = NONE};
 }
 
 void interpret_ast(interpreter* interpreter, void* ast_node)
 {
-    interpret(interpreter, ast_node, &interpreter->environ_stack[0]);
-    clear_environment(&interpreter->environ_stack[0]);
+    set_environment_layout(interpreter->environ_stack[0], get_layout(ast_node));
+    interpret(interpreter, ast_node, interpreter->environ_stack[0]);
+    clear_environment(interpreter->environ_stack[0]);
 }
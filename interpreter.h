@@ -1,6 +1,7 @@
 #pragma once
 
 #include "compiler_commons.h"
+#include "tokens.h"
 
 
 static expression_result true_expression = {.type = BOOL_VALUE, .value.bool_value = 1};
@@ -10,4 +11,10 @@ void init_interpreter(interpreter* interpreter);
 void free_interpreter(interpreter* interpreter);
 
 expression_result interpret(interpreter* interpreter, void* ast_node, environment* env);
-void interpret_ast(interpreter* interpreter, void* ast_node);
\ No newline at end of file
+void interpret_ast(interpreter* interpreter, void* ast_node);
+
+// Shared with the closure-compiled engine (see closure.h), which runs programs the same way
+environment* push_environment(interpreter* interpreter, environment* parent, environment_type type, const void* block, int line);
+void pop_environment(interpreter* interpreter);
+expression_result interpret_binary_operation(interpreter* interpreter, token_type op, expression_result lhs, expression_result rhs, int element_line);
+expression_result interpret_unary_operation(token_type op, expression_result operand, int element_line);
\ No newline at end of file
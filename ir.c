@@ -0,0 +1,804 @@
+#include "ir.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "model.h"
+#include "types.h"
+#include "utils.h"
+
+MAKE_FSD_ARRAY_FUNCTIONS(ir_instruction, ir_instruction)
+MAKE_FSD_ARRAY_FUNCTIONS(ir_operand, ir_operand)
+MAKE_FSD_ARRAY_FUNCTIONS(ir_block, ir_block)
+
+static const char* ir_opcode_names[] = {
+    "nop", "const", "phi", "gload", "gstore", "binop", "unop", "print", "println", "jump", "branch", "halt"
+};
+
+typedef struct ir_builder
+{
+    ir_program* program;
+    compiler* compiler;
+    uint32_t current_block;
+
+    // Current value of every variable in scope, by variable index, and the global of each variable
+    // (IR_NO_VALUE for locals). Variables are numbered in declaration order
+    uint32_t_array values;
+    uint32_t_array variable_globals;
+    string_array variable_names;
+
+    // Variable of each global, by global index, and the value globals assigned by previous code have
+    // when the program starts, by variable index
+    uint32_t_array global_variables;
+    uint32_t_array initial_values;
+
+    // Visible locals, in declaration order, like in the typer. Each name resolves through local_symbols
+    // to the innermost local declared with it, which keeps the one it shadows
+    string_array local_names;
+    uint32_t_array local_variables;
+    uint32_t_array local_depths;
+    uint32_t_array local_shadows;
+    hashmap local_symbols;
+    uint32_t scope_depth;
+} ir_builder;
+
+void init_ir_program(ir_program* program)
+{
+    init_ir_instruction_array(&program->instructions, 1024);
+    init_ir_operand_array(&program->operands, 2048);
+    init_ir_block_array(&program->blocks, 256);
+    init_string_array(&program->folded_strings, 16);
+}
+
+void free_ir_program(ir_program* program)
+{
+    for (size_t i = 0; i < program->blocks.used; i++)
+    {
+        free_uint32_t_array(&program->blocks.data[i].instructions);
+        free_uint32_t_array(&program->blocks.data[i].predecessors);
+    }
+
+    for (size_t i = 0; i < program->folded_strings.used; i++)
+    {
+        free(program->folded_strings.data[i].string_value);
+    }
+
+    free_ir_instruction_array(&program->instructions);
+    free_ir_operand_array(&program->operands);
+    free_ir_block_array(&program->blocks);
+    free_string_array(&program->folded_strings);
+}
+
+uint32_t add_ir_block(ir_program* program)
+{
+    ir_block block;
+    init_uint32_t_array(&block.instructions, 8);
+    init_uint32_t_array(&block.predecessors, 2);
+    block.num_successors = 0;
+    block.is_removed = 0;
+
+    insert_ir_block_array(&program->blocks, block);
+    return program->blocks.used - 1;
+}
+
+uint32_t add_ir_instruction(ir_program* program, uint32_t block, uint8_t opcode, uint32_t line, uint32_t num_operands)
+{
+    ir_instruction instruction;
+    memset(&instruction, 0, sizeof(instruction));
+    instruction.opcode = opcode;
+    instruction.type = STATIC_TYPE_UNKNOWN;
+    instruction.block = block;
+    instruction.line = line;
+    instruction.first_operand = program->operands.used;
+    instruction.num_operands = num_operands;
+    instruction.global = IR_NO_VALUE;
+    instruction.location = IR_NO_VALUE;
+
+    for (uint32_t i = 0; i < num_operands; i++)
+    {
+        insert_ir_operand_array(&program->operands, (ir_operand) { IR_NO_VALUE, IR_NO_VALUE });
+    }
+
+    insert_ir_instruction_array(&program->instructions, instruction);
+    insert_uint32_t_array(&program->blocks.data[block].instructions, program->instructions.used - 1);
+    return program->instructions.used - 1;
+}
+
+void add_ir_edge(ir_program* program, uint32_t from, uint32_t to)
+{
+    ir_block* from_block = &program->blocks.data[from];
+    from_block->successors[from_block->num_successors++] = to;
+    insert_uint32_t_array(&program->blocks.data[to].predecessors, from);
+}
+
+static void add_jump(ir_builder* builder, uint32_t from, uint32_t to, uint32_t line)
+{
+    add_ir_instruction(builder->program, from, IR_JUMP, line, 0);
+    add_ir_edge(builder->program, from, to);
+}
+
+static uint32_t add_constant_value(ir_builder* builder, expression_result value, uint32_t line)
+{
+    uint32_t constant = add_ir_instruction(builder->program, builder->current_block, IR_CONST, line, 0);
+    builder->program->instructions.data[constant].constant = value;
+    builder->program->instructions.data[constant].type = value.type;
+    return constant;
+}
+
+void remove_predecessor(ir_program* program, uint32_t block, uint32_t predecessor)
+{
+    ir_block* target = &program->blocks.data[block];
+    uint32_t idx = 0;
+    while (idx < target->predecessors.used && target->predecessors.data[idx] != predecessor)
+    {
+        idx++;
+    }
+
+    if (idx == target->predecessors.used)
+        return;
+
+    memmove(&target->predecessors.data[idx], &target->predecessors.data[idx + 1], (target->predecessors.used - idx - 1) * sizeof(uint32_t));
+    target->predecessors.used--;
+
+    for (size_t i = 0; i < target->instructions.used; i++)
+    {
+        ir_instruction* phi = &program->instructions.data[target->instructions.data[i]];
+        if (phi->opcode != IR_PHI)
+            continue;
+
+        ir_operand* operands = IR_OPERANDS(program, phi);
+        memmove(&operands[idx], &operands[idx + 1], (phi->num_operands - idx - 1) * sizeof(ir_operand));
+        phi->num_operands--;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Variables
+////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t declare_variable(ir_builder* builder, string_type name, uint32_t global)
+{
+    insert_uint32_t_array(&builder->values, IR_NO_VALUE);
+    insert_uint32_t_array(&builder->variable_globals, global);
+    insert_string_array(&builder->variable_names, name);
+    insert_uint32_t_array(&builder->initial_values, IR_NO_VALUE);
+    return builder->values.used - 1;
+}
+
+static uint32_t get_global_variable(ir_builder* builder, uint32_t global, string_type name)
+{
+    while (builder->global_variables.used <= global)
+    {
+        insert_uint32_t_array(&builder->global_variables, IR_NO_VALUE);
+    }
+
+    if (builder->global_variables.data[global] == IR_NO_VALUE)
+        builder->global_variables.data[global] = declare_variable(builder, name, global);
+
+    return builder->global_variables.data[global];
+}
+
+// Value of a global before the program assigns it, loaded at the entry of the program
+static uint32_t get_initial_value(ir_builder* builder, uint32_t variable)
+{
+    if (builder->initial_values.data[variable] == IR_NO_VALUE)
+    {
+        uint32_t load = add_ir_instruction(builder->program, 0, IR_GLOAD, 0, 0);
+        builder->program->instructions.data[load].global = builder->variable_globals.data[variable];
+        builder->initial_values.data[variable] = load;
+    }
+
+    return builder->initial_values.data[variable];
+}
+
+static uint32_t read_variable(ir_builder* builder, uint32_t variable)
+{
+    if (builder->values.data[variable] == IR_NO_VALUE)
+        return get_initial_value(builder, variable);
+
+    return builder->values.data[variable];
+}
+
+static int find_local(const ir_builder* builder, const string_type* name)
+{
+    size_t local;
+    if (hashmap_get(&builder->local_symbols, name, &local) == -1 || local == IR_NO_VALUE)
+        return -1;
+
+    return (int)local;
+}
+
+static uint32_t declare_local(ir_builder* builder, string_type name)
+{
+    size_t shadowed;
+    if (hashmap_get(&builder->local_symbols, &name, &shadowed) == -1)
+        shadowed = IR_NO_VALUE;
+
+    uint32_t variable = declare_variable(builder, name, IR_NO_VALUE);
+    hashmap_set(&builder->local_symbols, name, builder->local_names.used);
+    insert_string_array(&builder->local_names, name);
+    insert_uint32_t_array(&builder->local_variables, variable);
+    insert_uint32_t_array(&builder->local_depths, builder->scope_depth);
+    insert_uint32_t_array(&builder->local_shadows, shadowed);
+    return variable;
+}
+
+static void close_scope(ir_builder* builder)
+{
+    builder->scope_depth -= 1;
+    while (builder->local_depths.used > 0 && builder->local_depths.data[builder->local_depths.used - 1] > builder->scope_depth)
+    {
+        size_t local = builder->local_names.used - 1;
+        hashmap_set(&builder->local_symbols, builder->local_names.data[local], builder->local_shadows.data[local]);
+        builder->local_names.used--;
+        builder->local_variables.used--;
+        builder->local_depths.used--;
+        builder->local_shadows.used--;
+    }
+}
+
+static uint32_t* save_values(const ir_builder* builder)
+{
+    uint32_t* values = malloc(builder->values.used * sizeof(uint32_t) + 1);
+    if (values == NULL)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot allocate memory for the IR builder\n");
+    }
+
+    memcpy(values, builder->values.data, builder->values.used * sizeof(uint32_t));
+    return values;
+}
+
+// Set the values of the first num_variables variables at the start of a block, from their values at the
+// end of each of its predecessors, creating a phi for the ones which differ
+static void merge_values(ir_builder* builder, uint32_t block, uint32_t** predecessor_values, uint32_t num_variables)
+{
+    uint32_t num_predecessors = builder->program->blocks.data[block].predecessors.used;
+    for (uint32_t variable = 0; variable < num_variables && num_predecessors > 0; variable++)
+    {
+        uint32_t value = predecessor_values[0][variable];
+        int is_same = 1;
+        for (uint32_t i = 1; i < num_predecessors; i++)
+        {
+            is_same &= (predecessor_values[i][variable] == value);
+        }
+
+        builder->values.data[variable] = value;
+        if (is_same)
+            continue;
+
+        uint32_t phi = add_ir_instruction(builder->program, block, IR_PHI, 0, num_predecessors);
+        for (uint32_t i = 0; i < num_predecessors; i++)
+        {
+            uint32_t predecessor_value = predecessor_values[i][variable];
+            if (predecessor_value == IR_NO_VALUE)
+                predecessor_value = get_initial_value(builder, variable);
+
+            IR_OPERANDS(builder->program, &builder->program->instructions.data[phi])[i] = (ir_operand) { predecessor_value, builder->variable_globals.data[variable] };
+        }
+        builder->values.data[variable] = phi;
+    }
+
+    builder->values.used = num_variables;
+    builder->variable_globals.used = num_variables;
+    builder->variable_names.used = num_variables;
+    builder->initial_values.used = num_variables;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Lowering
+////////////////////////////////////////////////////////////////////////////////
+
+static ir_operand build_expression(ir_builder* builder, void* node);
+
+// Branch to true_block or false_block depending on a condition, with `and` and `or` lowered to chains
+// of branches which only evaluate their second operand when the first one does not decide the result
+static void build_condition(ir_builder* builder, void* condition, uint32_t true_block, uint32_t false_block, int is_logic_condition)
+{
+    while (CHECK_ELEMENT_TYPE(condition, Grouping_expr))
+    {
+        condition = ((Grouping*)condition)->expression;
+    }
+
+    if (CHECK_ELEMENT_TYPE(condition, BinOp_expr) && (((BinOp*)condition)->op == TOK_AND || ((BinOp*)condition)->op == TOK_OR))
+    {
+        BinOp* binop = (BinOp*)condition;
+        uint32_t second_operand_block = add_ir_block(builder->program);
+        if (binop->op == TOK_AND)
+            build_condition(builder, binop->left, second_operand_block, false_block, 1);
+        else
+            build_condition(builder, binop->left, true_block, second_operand_block, 1);
+
+        builder->current_block = second_operand_block;
+        build_condition(builder, binop->right, true_block, false_block, 1);
+        return;
+    }
+
+    ir_operand value = build_expression(builder, condition);
+    uint32_t branch = add_ir_instruction(builder->program, builder->current_block, IR_BRANCH, GET_ELEMENT_LINE(condition), 1);
+    IR_OPERANDS(builder->program, &builder->program->instructions.data[branch])[0] = value;
+    builder->program->instructions.data[branch].is_logic_condition = (char)is_logic_condition;
+    add_ir_edge(builder->program, builder->current_block, true_block);
+    add_ir_edge(builder->program, builder->current_block, false_block);
+}
+
+static ir_operand build_expression(ir_builder* builder, void* node)
+{
+    uint32_t line = GET_ELEMENT_LINE(node);
+    uint32_t instruction;
+    size_t global;
+    int local;
+
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case Integer_expr:
+            expression_result int_value = { .type = INT_VALUE, .value.int_value = ((Integer*)node)->value };
+            return (ir_operand) { add_constant_value(builder, int_value, line), IR_NO_VALUE };
+
+        case Float_expr:
+            expression_result float_value = { .type = FLOAT_VALUE, .value.float_value = ((Float*)node)->value };
+            return (ir_operand) { add_constant_value(builder, float_value, line), IR_NO_VALUE };
+
+        case Bool_expr:
+            expression_result bool_value = { .type = BOOL_VALUE, .value.bool_value = ((Bool*)node)->value };
+            return (ir_operand) { add_constant_value(builder, bool_value, line), IR_NO_VALUE };
+
+        case String_expr:
+            expression_result string_value = { .type = STRING_VALUE, .value.string_value = ((String*)node)->value };
+            return (ir_operand) { add_constant_value(builder, string_value, line), IR_NO_VALUE };
+
+        case Identifier_expr:
+            Identifier* identifier = (Identifier*)node;
+            if ((local = find_local(builder, &identifier->name)) != -1)
+                return (ir_operand) { read_variable(builder, builder->local_variables.data[local]), IR_NO_VALUE };
+
+            if (hashmap_get(&builder->compiler->symbols, &identifier->name, &global) != -1)
+                return (ir_operand) { read_variable(builder, get_global_variable(builder, global, identifier->name)), global };
+
+            PRINT_COMPILER_ERROR_AND_QUIT(line, "Undeclared variable %.*s\n", identifier->name.length, identifier->name.string_value);
+
+        case Grouping_expr:
+            return build_expression(builder, ((Grouping*)node)->expression);
+
+        // Unary operators other than negations leave their operand untouched
+        case UnOp_expr:
+            UnOp* unop = (UnOp*)node;
+            ir_operand operand = build_expression(builder, unop->operand);
+            if (unop->op != TOK_MINUS && unop->op != TOK_NOT)
+                return operand;
+
+            instruction = add_ir_instruction(builder->program, builder->current_block, IR_UNOP, line, 1);
+            builder->program->instructions.data[instruction].op = unop->op;
+            IR_OPERANDS(builder->program, &builder->program->instructions.data[instruction])[0] = operand;
+            return (ir_operand) { instruction, IR_NO_VALUE };
+
+        case BinOp_expr:
+            BinOp* binop = (BinOp*)node;
+
+            // The value of `and` and `or` is a phi of the constants set by each outcome of the condition
+            if (binop->op == TOK_AND || binop->op == TOK_OR)
+            {
+                uint32_t true_block = add_ir_block(builder->program);
+                uint32_t false_block = add_ir_block(builder->program);
+                uint32_t exit_block = add_ir_block(builder->program);
+                build_condition(builder, node, true_block, false_block, 0);
+
+                builder->current_block = true_block;
+                uint32_t true_value = add_constant_value(builder, (expression_result) { .type = BOOL_VALUE, .value.bool_value = 1 }, line);
+                add_jump(builder, true_block, exit_block, line);
+
+                builder->current_block = false_block;
+                uint32_t false_value = add_constant_value(builder, (expression_result) { .type = BOOL_VALUE, .value.bool_value = 0 }, line);
+                add_jump(builder, false_block, exit_block, line);
+
+                builder->current_block = exit_block;
+                instruction = add_ir_instruction(builder->program, exit_block, IR_PHI, line, 2);
+                ir_operand* phi_operands = IR_OPERANDS(builder->program, &builder->program->instructions.data[instruction]);
+                phi_operands[0] = (ir_operand) { true_value, IR_NO_VALUE };
+                phi_operands[1] = (ir_operand) { false_value, IR_NO_VALUE };
+                return (ir_operand) { instruction, IR_NO_VALUE };
+            }
+
+            ir_operand lhs = build_expression(builder, binop->left);
+            ir_operand rhs = build_expression(builder, binop->right);
+            instruction = add_ir_instruction(builder->program, builder->current_block, IR_BINOP, line, 2);
+            builder->program->instructions.data[instruction].op = binop->op;
+            IR_OPERANDS(builder->program, &builder->program->instructions.data[instruction])[0] = lhs;
+            IR_OPERANDS(builder->program, &builder->program->instructions.data[instruction])[1] = rhs;
+            return (ir_operand) { instruction, IR_NO_VALUE };
+
+        default:
+            PRINT_COMPILER_ERROR_AND_QUIT(line, "Function calls are not supported by the VM\n");
+    }
+}
+
+static void build_statement(ir_builder* builder, void* node);
+
+static void build_block(ir_builder* builder, void* statements)
+{
+    builder->scope_depth += 1;
+    build_statement(builder, statements);
+    close_scope(builder);
+}
+
+static void build_if(ir_builder* builder, If* if_stmt)
+{
+    uint32_t line = GET_ELEMENT_LINE(if_stmt);
+
+    // If the condition is a constant, only the branch that would be taken is lowered
+    if (CHECK_ELEMENT_TYPE(if_stmt->condition, Bool_expr))
+    {
+        void* taken_branch = ((Bool*)if_stmt->condition)->value ? if_stmt->then_branch : if_stmt->else_branch;
+        if (taken_branch != NULL)
+            build_block(builder, taken_branch);
+        return;
+    }
+
+    uint32_t num_variables = builder->values.used;
+    uint32_t then_block = add_ir_block(builder->program);
+    uint32_t else_block = (if_stmt->else_branch != NULL) ? add_ir_block(builder->program) : IR_NO_VALUE;
+    uint32_t exit_block = add_ir_block(builder->program);
+    build_condition(builder, if_stmt->condition, then_block, (else_block != IR_NO_VALUE) ? else_block : exit_block, 0);
+    uint32_t* values_before = save_values(builder);
+
+    builder->current_block = then_block;
+    build_block(builder, if_stmt->then_branch);
+    uint32_t then_end = builder->current_block;
+    uint32_t* values_after_then = save_values(builder);
+    add_jump(builder, then_end, exit_block, line);
+
+    uint32_t else_end = IR_NO_VALUE;
+    uint32_t* values_after_else = NULL;
+    if (else_block != IR_NO_VALUE)
+    {
+        memcpy(builder->values.data, values_before, num_variables * sizeof(uint32_t));
+        builder->current_block = else_block;
+        build_block(builder, if_stmt->else_branch);
+        else_end = builder->current_block;
+        values_after_else = save_values(builder);
+        add_jump(builder, else_end, exit_block, line);
+    }
+
+    // Every other predecessor of the exit is a branch of the condition
+    uint32_t_array* predecessors = &builder->program->blocks.data[exit_block].predecessors;
+    uint32_t** predecessor_values = malloc((predecessors->used + 1) * sizeof(uint32_t*));
+    for (size_t i = 0; i < predecessors->used; i++)
+    {
+        uint32_t predecessor = predecessors->data[i];
+        predecessor_values[i] = (predecessor == then_end) ? values_after_then : (predecessor == else_end) ? values_after_else : values_before;
+    }
+
+    builder->current_block = exit_block;
+    merge_values(builder, exit_block, predecessor_values, num_variables);
+
+    free(predecessor_values);
+    free(values_before);
+    free(values_after_then);
+    free(values_after_else);
+}
+
+static void build_while(ir_builder* builder, While* while_stmt)
+{
+    uint32_t line = GET_ELEMENT_LINE(while_stmt);
+    int is_constant_condition = CHECK_ELEMENT_TYPE(while_stmt->condition, Bool_expr);
+    if (is_constant_condition && !((Bool*)while_stmt->condition)->value)
+        return;
+
+    uint32_t header_block = add_ir_block(builder->program);
+    uint32_t body_block = add_ir_block(builder->program);
+    uint32_t exit_block = add_ir_block(builder->program);
+    add_jump(builder, builder->current_block, header_block, line);
+
+    // Variables assigned in the loop start each iteration with a phi of their values before the loop
+    // and at the end of the previous iteration, which is completed once the body is lowered
+    hashmap assigned;
+    int has_calls = 0;
+    init_hashmap(&assigned, 16, 4);
+    collect_loop_assignments(while_stmt->statements, &assigned, &has_calls);
+
+    uint32_t num_variables = builder->values.used;
+    uint32_t_array loop_phis;
+    init_uint32_t_array(&loop_phis, 16);
+    for (uint32_t variable = 0; variable < num_variables; variable++)
+    {
+        size_t unused;
+        if (hashmap_get(&assigned, &builder->variable_names.data[variable], &unused) == -1)
+            continue;
+
+        uint32_t entry_value = read_variable(builder, variable);
+        uint32_t phi = add_ir_instruction(builder->program, header_block, IR_PHI, line, 2);
+        IR_OPERANDS(builder->program, &builder->program->instructions.data[phi])[0] = (ir_operand) { entry_value, builder->variable_globals.data[variable] };
+        builder->program->instructions.data[phi].global = variable;
+        builder->values.data[variable] = phi;
+        insert_uint32_t_array(&loop_phis, phi);
+    }
+    free_hashmap(&assigned);
+
+    builder->current_block = header_block;
+    if (is_constant_condition)
+        add_jump(builder, header_block, body_block, line);
+    else
+        build_condition(builder, while_stmt->condition, body_block, exit_block, 0);
+    uint32_t* header_values = save_values(builder);
+
+    builder->current_block = body_block;
+    build_block(builder, while_stmt->statements);
+    add_jump(builder, builder->current_block, header_block, line);
+
+    // Phis remember their variable until they are completed
+    for (size_t i = 0; i < loop_phis.used; i++)
+    {
+        ir_instruction* phi = &builder->program->instructions.data[loop_phis.data[i]];
+        uint32_t variable = phi->global;
+        IR_OPERANDS(builder->program, phi)[1] = (ir_operand) { builder->values.data[variable], builder->variable_globals.data[variable] };
+        phi->global = IR_NO_VALUE;
+    }
+
+    // The loop exits from the header, or from the blocks testing the operands of its condition, which
+    // all see the values at the start of the iteration
+    uint32_t_array* predecessors = &builder->program->blocks.data[exit_block].predecessors;
+    uint32_t** predecessor_values = malloc((predecessors->used + 1) * sizeof(uint32_t*));
+    for (size_t i = 0; i < predecessors->used; i++)
+    {
+        predecessor_values[i] = header_values;
+    }
+
+    memcpy(builder->values.data, header_values, num_variables * sizeof(uint32_t));
+    builder->current_block = exit_block;
+    merge_values(builder, exit_block, predecessor_values, num_variables);
+
+    free(predecessor_values);
+    free(header_values);
+    free_uint32_t_array(&loop_phis);
+}
+
+static void build_assignment(ir_builder* builder, Assignment* assign_stmt)
+{
+    Identifier* lhs_identifier = assign_stmt->lhs;
+    ir_operand value = build_expression(builder, assign_stmt->rhs);
+    uint32_t variable;
+    size_t global;
+    int local;
+
+    // Same resolution as in the compiler: local assignments always assign the current scope, while others
+    // assign the innermost variable with their name, and only declare a new one when there is none
+    if (assign_stmt->is_local && builder->scope_depth > 0)
+    {
+        local = find_local(builder, &lhs_identifier->name);
+        if (local == -1 || builder->local_depths.data[local] != builder->scope_depth)
+            variable = declare_local(builder, lhs_identifier->name);
+        else
+            variable = builder->local_variables.data[local];
+        builder->values.data[variable] = value.value;
+        return;
+    }
+
+    if ((local = find_local(builder, &lhs_identifier->name)) != -1)
+    {
+        builder->values.data[builder->local_variables.data[local]] = value.value;
+        return;
+    }
+
+    if (hashmap_get(&builder->compiler->symbols, &lhs_identifier->name, &global) == -1)
+    {
+        if (builder->scope_depth > 0)
+        {
+            variable = declare_local(builder, lhs_identifier->name);
+            builder->values.data[variable] = value.value;
+            return;
+        }
+
+        global = declare_global_symbol(builder->compiler, lhs_identifier->name);
+    }
+
+    variable = get_global_variable(builder, global, lhs_identifier->name);
+    builder->values.data[variable] = value.value;
+    uint32_t store = add_ir_instruction(builder->program, builder->current_block, IR_GSTORE, GET_ELEMENT_LINE(assign_stmt), 1);
+    builder->program->instructions.data[store].global = global;
+    IR_OPERANDS(builder->program, &builder->program->instructions.data[store])[0] = value;
+}
+
+static void build_statement(ir_builder* builder, void* node)
+{
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case StatementList_stmt:
+            void** statement_ptrs = (void**)((char*)(node) + sizeof(StatementList));
+            for (size_t i = 0; i < ((StatementList*)(node))->size; i++)
+            {
+                build_statement(builder, statement_ptrs[i]);
+            }
+            break;
+
+        case Print_stmt:
+            Print* print_stmt = (Print*)node;
+            ir_operand value = build_expression(builder, print_stmt->expression);
+            uint32_t print = add_ir_instruction(builder->program, builder->current_block, print_stmt->break_line ? IR_PRINTLN : IR_PRINT, GET_ELEMENT_LINE(node), 1);
+            IR_OPERANDS(builder->program, &builder->program->instructions.data[print])[0] = value;
+            break;
+
+        case If_stmt:
+            build_if(builder, (If*)node);
+            break;
+
+        case While_stmt:
+            build_while(builder, (While*)node);
+            break;
+
+        case Assignment_stmt:
+            build_assignment(builder, (Assignment*)node);
+            break;
+
+        // Anything else is not supported by the VM, and is skipped like the compiler does
+        default:
+            break;
+    }
+}
+
+void build_ir(ir_program* program, compiler* compiler, void* ast_node)
+{
+    ir_builder builder;
+    builder.program = program;
+    builder.compiler = compiler;
+    builder.scope_depth = 0;
+    init_uint32_t_array(&builder.values, 64);
+    init_uint32_t_array(&builder.variable_globals, 64);
+    init_string_array(&builder.variable_names, 64);
+    init_uint32_t_array(&builder.global_variables, 64);
+    init_uint32_t_array(&builder.initial_values, 64);
+    init_string_array(&builder.local_names, 64);
+    init_uint32_t_array(&builder.local_variables, 64);
+    init_uint32_t_array(&builder.local_depths, 64);
+    init_uint32_t_array(&builder.local_shadows, 64);
+    init_hashmap(&builder.local_symbols, 64, 4);
+
+    // The first block only loads the globals assigned by previous code, so that their values are
+    // available everywhere
+    uint32_t entry_block = add_ir_block(builder.program);
+    uint32_t first_block = add_ir_block(builder.program);
+    builder.current_block = first_block;
+
+    build_statement(&builder, ast_node);
+    add_ir_instruction(builder.program, builder.current_block, IR_HALT, 0, 0);
+    add_jump(&builder, entry_block, first_block, 0);
+
+    free_uint32_t_array(&builder.values);
+    free_uint32_t_array(&builder.variable_globals);
+    free_string_array(&builder.variable_names);
+    free_uint32_t_array(&builder.global_variables);
+    free_uint32_t_array(&builder.initial_values);
+    free_string_array(&builder.local_names);
+    free_uint32_t_array(&builder.local_variables);
+    free_uint32_t_array(&builder.local_depths);
+    free_uint32_t_array(&builder.local_shadows);
+    free_hashmap(&builder.local_symbols);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Analysis and printing
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t compute_block_order(const ir_program* program, uint32_t* order)
+{
+    uint32_t num_blocks = program->blocks.used;
+    char* is_visited = calloc(num_blocks + 1, 1);
+    uint32_t* stack = malloc((num_blocks + 1) * sizeof(uint32_t));
+    uint32_t* next_successor = malloc((num_blocks + 1) * sizeof(uint32_t));
+    if (is_visited == NULL || stack == NULL || next_successor == NULL)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot allocate memory for the IR\n");
+    }
+
+    // Depth-first search, visiting the second successor of branches first, so that the first one
+    // is listed right after the branch
+    uint32_t stack_size = 0, num_ordered = 0;
+    stack[stack_size++] = 0;
+    next_successor[0] = 0;
+    is_visited[0] = 1;
+    while (stack_size > 0)
+    {
+        uint32_t block = stack[stack_size - 1];
+        const ir_block* current = &program->blocks.data[block];
+        if (next_successor[block] < current->num_successors)
+        {
+            uint32_t successor = current->successors[current->num_successors - 1 - next_successor[block]++];
+            if (!is_visited[successor])
+            {
+                is_visited[successor] = 1;
+                next_successor[successor] = 0;
+                stack[stack_size++] = successor;
+            }
+            continue;
+        }
+
+        order[num_ordered++] = block;
+        stack_size--;
+    }
+
+    for (uint32_t i = 0; i < num_ordered / 2; i++)
+    {
+        uint32_t temp = order[i];
+        order[i] = order[num_ordered - 1 - i];
+        order[num_ordered - 1 - i] = temp;
+    }
+
+    free(is_visited);
+    free(stack);
+    free(next_successor);
+    return num_ordered;
+}
+
+static void print_ir_operand(const ir_program* program, ir_operand operand)
+{
+    const ir_instruction* definition = &program->instructions.data[operand.value];
+    if (definition->opcode == IR_CONST)
+    {
+        string_type value = (definition->type == STRING_VALUE) ? definition->constant.value.string_value : (string_type) { NULL, 0 };
+        switch (definition->type)
+        {
+            case INT_VALUE:    printf(" %d", definition->constant.value.int_value); break;
+            case FLOAT_VALUE:  printf(" %f", definition->constant.value.float_value); break;
+            case BOOL_VALUE:   printf(" %s", definition->constant.value.bool_value ? "true" : "false"); break;
+            default:           printf(" \"%.*s\"", value.length, value.string_value); break;
+        }
+    }
+    else
+    {
+        printf(" v%u", operand.value);
+    }
+
+    if (operand.global != IR_NO_VALUE)
+        printf("[$%u]", operand.global);
+}
+
+void print_ir(const ir_program* program)
+{
+    uint32_t* order = malloc((program->blocks.used + 1) * sizeof(uint32_t));
+    uint32_t num_blocks = compute_block_order(program, order);
+
+    printf("\e[0;37mIR:\n");
+    for (uint32_t i = 0; i < num_blocks; i++)
+    {
+        const ir_block* block = &program->blocks.data[order[i]];
+        printf("\n\e[0;33mblock%u\e[0;37m", order[i]);
+        for (size_t j = 0; j < block->predecessors.used; j++)
+        {
+            printf("%s block%u", j == 0 ? "    <-" : ",", block->predecessors.data[j]);
+        }
+        printf("\n");
+
+        for (size_t j = 0; j < block->instructions.used; j++)
+        {
+            uint32_t idx = block->instructions.data[j];
+            const ir_instruction* instruction = &program->instructions.data[idx];
+            if (instruction->opcode == IR_NOP || instruction->opcode == IR_CONST)
+                continue;
+
+            if (instruction->opcode <= IR_GLOAD || instruction->opcode == IR_BINOP || instruction->opcode == IR_UNOP)
+                printf("    v%u:%s = ", idx, instruction->type == STATIC_TYPE_UNKNOWN ? "?" : type_names[instruction->type]);
+            else
+                printf("    ");
+
+            printf("\e[0;34m%s\e[0;37m", ir_opcode_names[instruction->opcode]);
+            if (instruction->opcode == IR_BINOP || instruction->opcode == IR_UNOP)
+                printf(" %s", token_symbols[instruction->op]);
+            if (instruction->global != IR_NO_VALUE)
+                printf(" $%u", instruction->global);
+
+            for (uint32_t k = 0; k < instruction->num_operands; k++)
+            {
+                print_ir_operand(program, IR_OPERANDS(program, instruction)[k]);
+            }
+
+            for (uint32_t k = 0; k < block->num_successors && instruction->opcode != IR_HALT && j == block->instructions.used - 1; k++)
+            {
+                printf("%s block%u", k == 0 ? " ->" : ",", block->successors[k]);
+            }
+            printf("\n");
+        }
+    }
+    printf("\n");
+
+    free(order);
+}
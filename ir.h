@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "arrays.h"
+#include "compiler.h"
+#include "compiler_commons.h"
+#include "tokens.h"
+
+// Mid-level intermediate representation, in SSA form. When compiler.use_ir is set, the AST is lowered
+// to it instead of being compiled straight away, the passes of ir_passes.c optimize it, and the bytecode
+// is generated from it by ir_codegen.c. Passes only depend on this representation, so that they can be
+// shared by any backend.
+
+// A program is a graph of basic blocks, entered through the first one. Each block holds a list of
+// instructions, which ends with a terminator (a jump, a branch or HALT). Every instruction defines at
+// most one value, named by the index of the instruction, which is assigned exactly once. Phis, at the
+// start of a block, select the value flowing from each predecessor of the block. Values are given a
+// static type (see typer.h), which is STATIC_TYPE_UNKNOWN when it might change at runtime.
+
+// Variables become SSA values too. Globals, however, are still stored in the VM after every assignment,
+// as code compiled later might read them. Operands read from a global remember it, so that the code
+// generator can load them from the global instead of keeping the value in a stack slot.
+
+#define IR_NO_VALUE UINT32_MAX
+
+typedef enum ir_opcode
+{
+    IR_NOP,         // Instruction removed by a pass
+    IR_CONST,
+    IR_PHI,         // One operand per predecessor of the block, in the same order
+    IR_GLOAD,       // Value of a global assigned by previously compiled code
+    IR_GSTORE,
+    IR_BINOP,
+    IR_UNOP,
+    IR_PRINT,
+    IR_PRINTLN,
+    IR_JUMP,
+    IR_BRANCH,      // To the first successor if the operand is true, to the second one otherwise
+    IR_HALT
+} ir_opcode;
+
+typedef struct ir_operand
+{
+    uint32_t value;
+
+    // Global holding the value where it is used, or IR_NO_VALUE
+    uint32_t global;
+} ir_operand;
+
+typedef struct ir_instruction
+{
+    uint8_t opcode;
+    uint8_t type;
+    token_type op;
+    uint32_t block;
+    uint32_t line;
+
+    uint32_t first_operand;
+    uint32_t num_operands;
+
+    // Value of constants, and index of the global of GLOAD and GSTORE
+    expression_result constant;
+    uint32_t global;
+
+    // Branches on the operands of `and` and `or` cast them to bool, while other conditions must be bools
+    char is_logic_condition;
+
+    // Set by the code generator: address of constants, stack slot of the values kept in one, and whether
+    // the value is computed right where its only use is (see ir_codegen.c)
+    uint32_t location;
+    char is_inlined;
+} ir_instruction;
+
+typedef struct ir_block
+{
+    // Phis first, then the other instructions, ending with a terminator
+    uint32_t_array instructions;
+    uint32_t_array predecessors;
+    uint32_t successors[2];
+    uint32_t num_successors;
+    char is_removed;
+} ir_block;
+
+MAKE_FSD_ARRAY_HEADERS(ir_instruction, ir_instruction)
+MAKE_FSD_ARRAY_HEADERS(ir_operand, ir_operand)
+MAKE_FSD_ARRAY_HEADERS(ir_block, ir_block)
+
+typedef struct ir_program
+{
+    ir_instruction_array instructions;
+    ir_operand_array operands;
+    ir_block_array blocks;
+
+    // Strings created by folding, which constants point to
+    string_array folded_strings;
+} ir_program;
+
+#define IR_OPERANDS(program, instruction) (&(program)->operands.data[(instruction)->first_operand])
+
+void init_ir_program(ir_program* program);
+void free_ir_program(ir_program* program);
+
+// Lower an AST to IR, resolving its variables through the symbols of the compiler, which declares
+// the new globals
+void build_ir(ir_program* program, compiler* compiler, void* ast_node);
+
+void print_ir(const ir_program* program);
+
+// Add an empty block, an instruction at the end of a block, whose operands are left to be set, and an
+// edge between two blocks
+uint32_t add_ir_block(ir_program* program);
+uint32_t add_ir_instruction(ir_program* program, uint32_t block, uint8_t opcode, uint32_t line, uint32_t num_operands);
+void add_ir_edge(ir_program* program, uint32_t from, uint32_t to);
+
+// Blocks reachable from the entry, in reverse postorder, which lists every block before its
+// successors (except along loop back edges). Returns the number of blocks listed
+uint32_t compute_block_order(const ir_program* program, uint32_t* order);
+
+void remove_predecessor(ir_program* program, uint32_t block, uint32_t predecessor);
+
+// Optimization passes (see ir_passes.c)
+void optimize_ir(ir_program* program);
+
+// Code generation (see ir_codegen.c)
+void generate_ir_code(compiler* compiler, ir_program* program);
@@ -0,0 +1,772 @@
+#include "ir.h"
+
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "model.h"
+#include "utils.h"
+#include "vm.h"
+
+// Bytecode generation from the IR. Blocks are laid out in reverse postorder, so that the first
+// successor of most branches is the next block, and jumps to the next block are left out.
+
+// Values live on the stack of the VM. A value used only once, by the instruction emitted right after it
+// in the same block, is left on the stack for it (as WebAssembly stackifies expression trees). A phi used
+// that way by the first instruction of its block is pushed by its predecessors before jumping to it.
+// Any other value gets a stack slot below every other value, which is read with LLOAD, and phis get
+// their values stored into their slot at the end of each predecessor. Values read from a global are
+// loaded from it instead, so that variables held by globals need no slot at all.
+
+typedef struct ir_codegen
+{
+    compiler* compiler;
+    ir_program* program;
+
+    uint32_t* order;
+    uint32_t num_blocks;
+
+    // Uses of each value which need it on the stack, as opposed to loading it from a global
+    uint32_t* use_counts;
+
+    // Phis whose value is needed by some use, and the phi each block leaves on the stack
+    char* is_phi_materialized;
+    uint32_t* stack_phis;
+
+    uint32_t* labels;
+    uint32_t num_slots;
+    uint32_t last_line;
+} ir_codegen;
+
+// Phis need a value in their block when the predecessors are joined along an edge from a branch, so those
+// edges go through a block of their own
+static void split_critical_edges(ir_program* program)
+{
+    uint32_t num_blocks = program->blocks.used;
+    for (uint32_t block = 0; block < num_blocks; block++)
+    {
+        if (program->blocks.data[block].num_successors < 2)
+            continue;
+
+        for (uint32_t i = 0; i < 2; i++)
+        {
+            uint32_t successor = program->blocks.data[block].successors[i];
+            uint32_t_array* predecessors = &program->blocks.data[successor].predecessors;
+            if (predecessors->used < 2)
+                continue;
+
+            uint32_t edge_block = add_ir_block(program);
+            add_ir_instruction(program, edge_block, IR_JUMP, 0, 0);
+            program->blocks.data[edge_block].successors[0] = successor;
+            program->blocks.data[edge_block].num_successors = 1;
+            insert_uint32_t_array(&program->blocks.data[edge_block].predecessors, block);
+            program->blocks.data[block].successors[i] = edge_block;
+
+            predecessors = &program->blocks.data[successor].predecessors;
+            for (size_t j = 0; j < predecessors->used; j++)
+            {
+                if (predecessors->data[j] == block)
+                {
+                    predecessors->data[j] = edge_block;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static int is_materialized(const ir_codegen* codegen, const ir_instruction* instruction, uint32_t idx)
+{
+    return instruction->opcode != IR_NOP && (instruction->opcode != IR_PHI || codegen->is_phi_materialized[idx]);
+}
+
+// Phis need a value when one of their uses does not read it from a global, which might be another phi
+static void materialize_phis(ir_codegen* codegen)
+{
+    ir_program* program = codegen->program;
+    int changed;
+    do
+    {
+        changed = 0;
+        for (uint32_t i = 0; i < codegen->num_blocks; i++)
+        {
+            const uint32_t_array* instructions = &program->blocks.data[codegen->order[i]].instructions;
+            for (size_t j = 0; j < instructions->used; j++)
+            {
+                uint32_t idx = instructions->data[j];
+                const ir_instruction* instruction = &program->instructions.data[idx];
+                if (!is_materialized(codegen, instruction, idx))
+                    continue;
+
+                const ir_operand* operands = IR_OPERANDS(program, instruction);
+                for (uint32_t k = 0; k < instruction->num_operands; k++)
+                {
+                    uint32_t value = operands[k].value;
+                    if (operands[k].global == IR_NO_VALUE && program->instructions.data[value].opcode == IR_PHI && !codegen->is_phi_materialized[value])
+                    {
+                        codegen->is_phi_materialized[value] = 1;
+                        changed = 1;
+                    }
+                }
+            }
+        }
+    } while (changed);
+}
+
+// Operations between a value and itself only use it once, as the value is duplicated on the stack
+static int is_duplicated_operand(const ir_instruction* instruction, const ir_operand* operands)
+{
+    return instruction->opcode == IR_BINOP && operands[0].value == operands[1].value && operands[0].global == operands[1].global;
+}
+
+static void count_uses(ir_codegen* codegen)
+{
+    ir_program* program = codegen->program;
+    for (uint32_t i = 0; i < codegen->num_blocks; i++)
+    {
+        const uint32_t_array* instructions = &program->blocks.data[codegen->order[i]].instructions;
+        for (size_t j = 0; j < instructions->used; j++)
+        {
+            uint32_t idx = instructions->data[j];
+            const ir_instruction* instruction = &program->instructions.data[idx];
+            if (!is_materialized(codegen, instruction, idx))
+                continue;
+
+            const ir_operand* operands = IR_OPERANDS(program, instruction);
+            uint32_t num_operands = is_duplicated_operand(instruction, operands) ? 1 : instruction->num_operands;
+            for (uint32_t k = 0; k < num_operands; k++)
+            {
+                if (operands[k].global == IR_NO_VALUE)
+                    codegen->use_counts[operands[k].value]++;
+            }
+        }
+    }
+}
+
+// Whether an instruction emits code where it is in its block
+static int is_emitted(const ir_codegen* codegen, uint32_t idx)
+{
+    const ir_instruction* instruction = &codegen->program->instructions.data[idx];
+    switch (instruction->opcode)
+    {
+        case IR_NOP:
+        case IR_CONST:
+        case IR_PHI:
+            return 0;
+
+        case IR_GLOAD:
+            return codegen->use_counts[idx] > 0 && !instruction->is_inlined;
+
+        default:
+            return !instruction->is_inlined;
+    }
+}
+
+// Predecessor index of a block among the predecessors of its successor, which is the index of the
+// operands flowing from it in the phis of the successor
+static uint32_t get_predecessor_idx(const ir_program* program, uint32_t block, uint32_t successor)
+{
+    const uint32_t_array* predecessors = &program->blocks.data[successor].predecessors;
+    uint32_t idx = 0;
+    while (predecessors->data[idx] != block)
+    {
+        idx++;
+    }
+
+    return idx;
+}
+
+// Values a jump pushes for the phis of its target: the one left on the stack goes first, below the
+// ones stored into slots
+static uint32_t collect_phi_copies(const ir_codegen* codegen, uint32_t block, uint32_t successor, ir_operand* copies, uint32_t* phis)
+{
+    const ir_program* program = codegen->program;
+    const uint32_t_array* instructions = &program->blocks.data[successor].instructions;
+    uint32_t predecessor_idx = get_predecessor_idx(program, block, successor);
+    uint32_t num_copies = 0;
+
+    uint32_t stack_phi = codegen->stack_phis[successor];
+    if (stack_phi != IR_NO_VALUE)
+    {
+        phis[num_copies] = stack_phi;
+        copies[num_copies++] = IR_OPERANDS(program, &program->instructions.data[stack_phi])[predecessor_idx];
+    }
+
+    for (size_t i = 0; i < instructions->used; i++)
+    {
+        uint32_t idx = instructions->data[i];
+        const ir_instruction* phi = &program->instructions.data[idx];
+        if (phi->opcode != IR_PHI || !codegen->is_phi_materialized[idx] || idx == stack_phi)
+            continue;
+
+        phis[num_copies] = idx;
+        copies[num_copies++] = IR_OPERANDS(program, phi)[predecessor_idx];
+    }
+
+    return num_copies;
+}
+
+// Leave the values of operands on the stack for their use, going backwards from the use as long as
+// each value is computed right before the values used after it. A phi of the block can be left on the
+// stack too if nothing is pushed before it
+static void stackify_operands(ir_codegen* codegen, uint32_t block, const ir_operand* operands, uint32_t num_operands, size_t* position, int is_first_push)
+{
+    ir_program* program = codegen->program;
+    const uint32_t_array* instructions = &program->blocks.data[block].instructions;
+    for (uint32_t k = num_operands; k > 0; k--)
+    {
+        uint32_t value = operands[k - 1].value;
+        ir_instruction* definition = &program->instructions.data[value];
+        if (operands[k - 1].global != IR_NO_VALUE || codegen->use_counts[value] != 1 || definition->opcode == IR_CONST)
+            continue;
+
+        size_t previous = *position;
+        while (previous > 0 && !is_emitted(codegen, instructions->data[previous - 1]))
+        {
+            previous--;
+        }
+
+        if (previous == 0 && definition->opcode == IR_PHI && definition->block == block && block != 0
+            && k == 1 && is_first_push && codegen->stack_phis[block] == IR_NO_VALUE)
+        {
+            definition->is_inlined = 1;
+            codegen->stack_phis[block] = value;
+            *position = 0;
+        }
+
+        if (previous == 0 || instructions->data[previous - 1] != value)
+            continue;
+
+        definition->is_inlined = 1;
+        *position = previous - 1;
+        const ir_operand* definition_operands = IR_OPERANDS(program, definition);
+        uint32_t num_definition_operands = is_duplicated_operand(definition, definition_operands) ? 1 : definition->num_operands;
+        stackify_operands(codegen, block, definition_operands, num_definition_operands, position, is_first_push && k == 1);
+    }
+}
+
+// Jumps only use values through the phis of their target, so their operands are stackified once it is
+// known which phi each block leaves on the stack. They are only stackified in blocks which do not start
+// with a phi on the stack, as pushing their first value might then bury it
+static void stackify_block(ir_codegen* codegen, uint32_t block, int is_jump_pass)
+{
+    ir_program* program = codegen->program;
+    const uint32_t_array* instructions = &program->blocks.data[block].instructions;
+    for (size_t j = instructions->used; j > 0; j--)
+    {
+        uint32_t idx = instructions->data[j - 1];
+        const ir_instruction* instruction = &program->instructions.data[idx];
+        if (!is_emitted(codegen, idx))
+            continue;
+
+        size_t position = j - 1;
+        if (is_jump_pass)
+        {
+            if (instruction->opcode != IR_JUMP || codegen->stack_phis[block] != IR_NO_VALUE)
+                return;
+
+            uint32_t successor = program->blocks.data[block].successors[0];
+            uint32_t max_copies = program->blocks.data[successor].instructions.used;
+            ir_operand* copies = malloc((max_copies + 1) * sizeof(ir_operand));
+            uint32_t* phis = malloc((max_copies + 1) * sizeof(uint32_t));
+            uint32_t num_copies = collect_phi_copies(codegen, block, successor, copies, phis);
+            stackify_operands(codegen, block, copies, num_copies, &position, 0);
+            free(copies);
+            free(phis);
+            return;
+        }
+
+        const ir_operand* operands = IR_OPERANDS(program, instruction);
+        uint32_t num_operands = is_duplicated_operand(instruction, operands) ? 1 : instruction->num_operands;
+        stackify_operands(codegen, block, operands, num_operands, &position, 1);
+        j = position + 1;
+    }
+}
+
+static uint32_t add_ir_constant(compiler* compiler, ir_instruction* constant)
+{
+    expression_result* value = &constant->constant;
+    switch (value->type)
+    {
+        case INT_VALUE:
+            string_type int_val = { (char*)&value->value.int_value, sizeof(int) };
+            return add_constant(compiler, &compiler->int_constants, int_val, NULL, 0, alignof(int));
+
+        case FLOAT_VALUE:
+            string_type double_val = { (char*)&value->value.float_value, sizeof(double) };
+            return add_constant(compiler, &compiler->float_constants, double_val, NULL, 0, alignof(double));
+
+        case BOOL_VALUE:
+            return add_bool_constant(compiler, (char)value->value.bool_value);
+
+        default:
+            string_type string_val = value->value.string_value;
+            return add_constant(compiler, &compiler->string_constants, string_val, &string_val.length, sizeof(int), alignof(int));
+    }
+}
+
+static size_t get_constant_alignment(const ir_instruction* constant)
+{
+    switch (constant->constant.type)
+    {
+        case FLOAT_VALUE:   return alignof(double);
+        case BOOL_VALUE:    return alignof(char);
+        default:            return alignof(int);
+    }
+}
+
+// Constants are added from the most to the least strictly aligned, as the compiler does
+static void add_ir_constants(ir_codegen* codegen)
+{
+    ir_program* program = codegen->program;
+    size_t alignments[] = { alignof(double), alignof(int), alignof(char) };
+    for (size_t a = 0; a < sizeof(alignments) / sizeof(alignments[0]); a++)
+    {
+        for (uint32_t i = 0; i < codegen->num_blocks; i++)
+        {
+            const uint32_t_array* instructions = &program->blocks.data[codegen->order[i]].instructions;
+            for (size_t j = 0; j < instructions->used; j++)
+            {
+                const ir_instruction* instruction = &program->instructions.data[instructions->data[j]];
+                if (!is_materialized(codegen, instruction, instructions->data[j]))
+                    continue;
+
+                const ir_operand* operands = IR_OPERANDS(program, instruction);
+                for (uint32_t k = 0; k < instruction->num_operands; k++)
+                {
+                    ir_instruction* constant = &program->instructions.data[operands[k].value];
+                    if (constant->opcode == IR_CONST && constant->location == IR_NO_VALUE && get_constant_alignment(constant) == alignments[a])
+                        constant->location = add_ir_constant(codegen->compiler, constant);
+                }
+            }
+        }
+    }
+}
+
+// A value only used by a phi of the block its block jumps to is stored right into the slot of the phi,
+// instead of being copied there at the end of its block, as long as the phi is not read in the meantime
+static uint32_t find_coalesced_phi(const ir_codegen* codegen, uint32_t block, size_t position)
+{
+    const ir_program* program = codegen->program;
+    const ir_block* current = &program->blocks.data[block];
+    uint32_t value = current->instructions.data[position];
+    if (codegen->use_counts[value] != 1 || current->num_successors != 1)
+        return IR_NO_VALUE;
+
+    uint32_t successor = current->successors[0];
+    uint32_t max_copies = program->blocks.data[successor].instructions.used;
+    ir_operand* copies = malloc((max_copies + 1) * sizeof(ir_operand));
+    uint32_t* phis = malloc((max_copies + 1) * sizeof(uint32_t));
+    uint32_t num_copies = collect_phi_copies(codegen, block, successor, copies, phis);
+
+    uint32_t phi = IR_NO_VALUE;
+    for (uint32_t i = 0; i < num_copies; i++)
+    {
+        if (copies[i].value == value && copies[i].global == IR_NO_VALUE && phis[i] != codegen->stack_phis[successor])
+            phi = phis[i];
+    }
+
+    for (uint32_t i = 0; i < num_copies && phi != IR_NO_VALUE; i++)
+    {
+        if (copies[i].value == phi && copies[i].global == IR_NO_VALUE)
+            phi = IR_NO_VALUE;
+    }
+
+    for (size_t j = position + 1; j < current->instructions.used && phi != IR_NO_VALUE; j++)
+    {
+        const ir_instruction* instruction = &program->instructions.data[current->instructions.data[j]];
+        const ir_operand* operands = IR_OPERANDS(program, instruction);
+        for (uint32_t k = 0; k < instruction->num_operands; k++)
+        {
+            if (operands[k].value == phi && operands[k].global == IR_NO_VALUE)
+                phi = IR_NO_VALUE;
+        }
+    }
+
+    free(copies);
+    free(phis);
+    return phi;
+}
+
+static int is_coalesced_copy(const ir_codegen* codegen, ir_operand copy, uint32_t phi)
+{
+    const ir_instruction* definition = &codegen->program->instructions.data[copy.value];
+    return copy.global == IR_NO_VALUE && definition->opcode != IR_CONST && definition->opcode != IR_PHI && !definition->is_inlined
+        && definition->location == codegen->program->instructions.data[phi].location;
+}
+
+// Phis get their slots first, so that the values flowing into them can share them
+static void assign_slots(ir_codegen* codegen)
+{
+    ir_program* program = codegen->program;
+    for (int is_phi_pass = 1; is_phi_pass >= 0; is_phi_pass--)
+    {
+        for (uint32_t i = 0; i < codegen->num_blocks; i++)
+        {
+            const uint32_t_array* instructions = &program->blocks.data[codegen->order[i]].instructions;
+            for (size_t j = 0; j < instructions->used; j++)
+            {
+                uint32_t idx = instructions->data[j];
+                ir_instruction* instruction = &program->instructions.data[idx];
+                if (instruction->is_inlined)
+                    continue;
+
+                if (is_phi_pass && instruction->opcode == IR_PHI && codegen->is_phi_materialized[idx])
+                {
+                    instruction->location = codegen->num_slots++;
+                }
+                else if (!is_phi_pass && (instruction->opcode == IR_GLOAD || instruction->opcode == IR_BINOP || instruction->opcode == IR_UNOP)
+                    && codegen->use_counts[idx] > 0)
+                {
+                    uint32_t phi = find_coalesced_phi(codegen, codegen->order[i], j);
+                    instruction->location = (phi != IR_NO_VALUE) ? program->instructions.data[phi].location : codegen->num_slots++;
+                }
+            }
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Emission
+////////////////////////////////////////////////////////////////////////////////
+
+static void emit_value(ir_codegen* codegen, uint32_t idx);
+
+static void emit_operand(ir_codegen* codegen, ir_operand operand)
+{
+    compiler* compiler = codegen->compiler;
+    const ir_instruction* definition = &codegen->program->instructions.data[operand.value];
+    size_t arr_offset;
+
+    if (definition->opcode == IR_CONST)
+    {
+        switch (definition->type)
+        {
+            case INT_VALUE:     ADD_INSTRUCTION_OPERAND(OPCODE_IPUSH, definition->location); break;
+            case FLOAT_VALUE:   ADD_INSTRUCTION_OPERAND(OPCODE_FPUSH, definition->location); break;
+            case BOOL_VALUE:    ADD_INSTRUCTION_OPERAND(OPCODE_BPUSH, definition->location); break;
+            default:            ADD_INSTRUCTION_OPERAND(OPCODE_SPUSH, definition->location); break;
+        }
+    }
+    else if (operand.global != IR_NO_VALUE)
+    {
+        ADD_INSTRUCTION_OPERAND(OPCODE_GLOAD, operand.global);
+    }
+    else if (definition->is_inlined && definition->opcode != IR_PHI)
+    {
+        emit_value(codegen, operand.value);
+    }
+    else if (!definition->is_inlined)
+    {
+        ADD_INSTRUCTION_OPERAND(OPCODE_LLOAD, definition->location);
+    }
+}
+
+static uint8_t get_operand_type(const ir_codegen* codegen, ir_operand operand)
+{
+    return codegen->program->instructions.data[operand.value].type;
+}
+
+static void emit_binop_operands(ir_codegen* codegen, const ir_instruction* binop)
+{
+    compiler* compiler = codegen->compiler;
+    const ir_operand* operands = IR_OPERANDS(codegen->program, binop);
+    size_t arr_offset;
+
+    emit_operand(codegen, operands[0]);
+    if (is_duplicated_operand(binop, operands))
+    {
+        ADD_INSTRUCTION(OPCODE_DUP);
+    }
+    else
+    {
+        emit_operand(codegen, operands[1]);
+    }
+}
+
+// Integer multiplications, divisions and remainders by a constant power of two are computed with a shift of
+// the other operand (see select_shift_opcode). Returns whether the operation was emitted that way
+static int emit_shift(ir_codegen* codegen, const ir_instruction* binop)
+{
+    compiler* compiler = codegen->compiler;
+    const ir_operand* operands = IR_OPERANDS(codegen->program, binop);
+    size_t arr_offset;
+    uint8_t shift;
+
+    for (int k = 1; k >= 0; k--)
+    {
+        const ir_instruction* constant = &codegen->program->instructions.data[operands[k].value];
+        if (constant->opcode != IR_CONST || constant->type != INT_VALUE || (k == 0 && binop->op != TOK_STAR))
+            continue;
+
+        uint8_t opcode = select_shift_opcode(binop->op, get_operand_type(codegen, operands[1 - k]), constant->constant.value.int_value, &shift);
+        if (opcode != OPCODE_HALT)
+        {
+            emit_operand(codegen, operands[1 - k]);
+            ADD_INSTRUCTION_SHIFT(opcode, shift);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Push the value computed by an instruction
+static void emit_value(ir_codegen* codegen, uint32_t idx)
+{
+    compiler* compiler = codegen->compiler;
+    const ir_instruction* instruction = &codegen->program->instructions.data[idx];
+    const ir_operand* operands = IR_OPERANDS(codegen->program, instruction);
+    size_t arr_offset;
+
+    switch (instruction->opcode)
+    {
+        case IR_GLOAD:
+            ADD_INSTRUCTION_OPERAND(OPCODE_GLOAD, instruction->global);
+            break;
+
+        case IR_UNOP:
+            emit_operand(codegen, operands[0]);
+            ADD_INSTRUCTION(instruction->op == TOK_MINUS ? OPCODE_NUMNEG : OPCODE_BOOLNEG);
+            break;
+
+        case IR_BINOP:
+            if (emit_shift(codegen, instruction))
+                break;
+
+            emit_binop_operands(codegen, instruction);
+            ADD_INSTRUCTION(select_typed_opcode(get_binop_opcode(instruction->op), get_operand_type(codegen, operands[0]), get_operand_type(codegen, operands[1])));
+            break;
+    }
+}
+
+static void emit_jump(ir_codegen* codegen, uint32_t block, uint32_t next_block)
+{
+    compiler* compiler = codegen->compiler;
+    ir_program* program = codegen->program;
+    uint32_t successor = program->blocks.data[block].successors[0];
+    size_t arr_offset;
+
+    uint32_t num_phis = program->blocks.data[successor].instructions.used;
+    ir_operand* copies = malloc((num_phis + 1) * sizeof(ir_operand));
+    uint32_t* phis = malloc((num_phis + 1) * sizeof(uint32_t));
+    uint32_t num_copies = collect_phi_copies(codegen, block, successor, copies, phis);
+
+    // Every value is pushed before any of them is stored, as phis might be the operands of other phis
+    for (uint32_t i = 0; i < num_copies; i++)
+    {
+        if (!is_coalesced_copy(codegen, copies[i], phis[i]))
+            emit_operand(codegen, copies[i]);
+    }
+
+    for (uint32_t i = num_copies; i > 0; i--)
+    {
+        if (phis[i - 1] != codegen->stack_phis[successor] && !is_coalesced_copy(codegen, copies[i - 1], phis[i - 1]))
+            ADD_INSTRUCTION_OPERAND(OPCODE_LSTORE, program->instructions.data[phis[i - 1]].location);
+    }
+
+    if (successor != next_block)
+        ADD_JUMP(OPCODE_JMP, codegen->labels[successor]);
+
+    free(copies);
+    free(phis);
+}
+
+// Branch to the successor which is not laid out next, with comparisons between integers fused with the jump
+static void emit_branch(ir_codegen* codegen, uint32_t block, const ir_instruction* branch, uint32_t next_block)
+{
+    compiler* compiler = codegen->compiler;
+    ir_program* program = codegen->program;
+    const ir_block* current = &program->blocks.data[block];
+    ir_operand condition = IR_OPERANDS(program, branch)[0];
+    const ir_instruction* definition = &program->instructions.data[condition.value];
+    size_t arr_offset;
+
+    int jump_if_true = (current->successors[0] != next_block);
+    uint32_t target = current->successors[jump_if_true ? 0 : 1];
+
+    uint8_t comparison_opcode = (definition->opcode == IR_BINOP) ? get_binop_opcode(definition->op) : OPCODE_HALT;
+    if (definition->is_inlined && condition.global == IR_NO_VALUE && comparison_opcode >= OPCODE_EQ && comparison_opcode <= OPCODE_LE
+        && get_operand_type(codegen, IR_OPERANDS(program, definition)[0]) == INT_VALUE
+        && get_operand_type(codegen, IR_OPERANDS(program, definition)[1]) == INT_VALUE)
+    {
+        if (!jump_if_true)
+            comparison_opcode = negate_comparison(comparison_opcode);
+
+        emit_binop_operands(codegen, definition);
+        ADD_JUMP(comparison_opcode - OPCODE_EQ + OPCODE_JMP_IEQ, codegen->labels[target]);
+    }
+    else
+    {
+        emit_operand(codegen, condition);
+        if (branch->is_logic_condition && definition->type != BOOL_VALUE)
+        {
+            ADD_JUMP(jump_if_true ? OPCODE_JMPT : OPCODE_JMPF, codegen->labels[target]);
+        }
+        else
+        {
+            ADD_JUMP(jump_if_true ? OPCODE_JMPNZ : OPCODE_JMPZ, codegen->labels[target]);
+        }
+    }
+
+    if (jump_if_true && current->successors[1] != next_block)
+        ADD_JUMP(OPCODE_JMP, codegen->labels[current->successors[1]]);
+}
+
+static void emit_instruction(ir_codegen* codegen, uint32_t block, uint32_t idx, uint32_t next_block)
+{
+    compiler* compiler = codegen->compiler;
+    const ir_instruction* instruction = &codegen->program->instructions.data[idx];
+    const ir_operand* operands = IR_OPERANDS(codegen->program, instruction);
+    size_t arr_offset;
+
+    if (instruction->line != 0 && instruction->line != codegen->last_line)
+    {
+        insert_uint32_t_array(&compiler->statement_lines, instruction->line);
+        insert_uint32_t_array(&compiler->statement_addrs, compiler->temp_code.used);
+        codegen->last_line = instruction->line;
+    }
+
+    switch (instruction->opcode)
+    {
+        // Values which are not used are still computed, as computing them might fail
+        case IR_GLOAD:
+        case IR_BINOP:
+        case IR_UNOP:
+            emit_value(codegen, idx);
+            if (codegen->use_counts[idx] > 0)
+            {
+                ADD_INSTRUCTION_OPERAND(OPCODE_LSTORE, instruction->location);
+            }
+            else
+            {
+                ADD_INSTRUCTION(OPCODE_POP);
+            }
+            break;
+
+        case IR_GSTORE:
+            emit_operand(codegen, operands[0]);
+            ADD_INSTRUCTION_OPERAND(OPCODE_GSTORE, instruction->global);
+            break;
+
+        case IR_PRINT:
+        case IR_PRINTLN:
+            emit_operand(codegen, operands[0]);
+            ADD_INSTRUCTION(instruction->opcode == IR_PRINTLN ? OPCODE_PRINTLN : OPCODE_PRINT);
+            break;
+
+        case IR_JUMP:
+            emit_jump(codegen, block, next_block);
+            break;
+
+        case IR_BRANCH:
+            emit_branch(codegen, block, instruction, next_block);
+            break;
+
+        case IR_HALT:
+            for (uint32_t i = 0; i < codegen->num_slots; i++)
+            {
+                ADD_INSTRUCTION(OPCODE_POP);
+            }
+            ADD_INSTRUCTION(OPCODE_HALT);
+            break;
+    }
+}
+
+void generate_ir_code(compiler* compiler, ir_program* program)
+{
+    size_t arr_offset;
+    split_critical_edges(program);
+
+    ir_codegen codegen;
+    uint32_t num_all_blocks = program->blocks.used;
+    uint32_t num_instructions = program->instructions.used;
+    codegen.compiler = compiler;
+    codegen.program = program;
+    codegen.order = malloc((num_all_blocks + 1) * sizeof(uint32_t));
+    codegen.use_counts = calloc(num_instructions + 1, sizeof(uint32_t));
+    codegen.is_phi_materialized = calloc(num_instructions + 1, 1);
+    codegen.stack_phis = malloc((num_all_blocks + 1) * sizeof(uint32_t));
+    codegen.labels = malloc((num_all_blocks + 1) * sizeof(uint32_t));
+    codegen.num_slots = 0;
+    codegen.last_line = 0;
+    if (codegen.order == NULL || codegen.use_counts == NULL || codegen.is_phi_materialized == NULL || codegen.stack_phis == NULL || codegen.labels == NULL)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot allocate memory for the code generator\n");
+    }
+
+    codegen.num_blocks = compute_block_order(program, codegen.order);
+    for (uint32_t i = 0; i < num_all_blocks; i++)
+    {
+        codegen.stack_phis[i] = IR_NO_VALUE;
+    }
+
+    for (uint32_t i = 0; i < num_instructions; i++)
+    {
+        program->instructions.data[i].is_inlined = 0;
+        program->instructions.data[i].location = IR_NO_VALUE;
+    }
+
+    // The program ends with HALT, which the code appended later replaces
+    int has_halt = 0;
+    for (uint32_t i = 0; i < codegen.num_blocks && !has_halt; i++)
+    {
+        const uint32_t_array* instructions = &program->blocks.data[codegen.order[i]].instructions;
+        if (instructions->used > 0 && program->instructions.data[instructions->data[instructions->used - 1]].opcode == IR_HALT)
+        {
+            uint32_t halt_block = codegen.order[i];
+            memmove(&codegen.order[i], &codegen.order[i + 1], (codegen.num_blocks - i - 1) * sizeof(uint32_t));
+            codegen.order[codegen.num_blocks - 1] = halt_block;
+            has_halt = 1;
+        }
+    }
+
+    materialize_phis(&codegen);
+    count_uses(&codegen);
+    for (uint32_t i = 0; i < codegen.num_blocks; i++)
+    {
+        stackify_block(&codegen, codegen.order[i], 0);
+    }
+    for (uint32_t i = 0; i < codegen.num_blocks; i++)
+    {
+        stackify_block(&codegen, codegen.order[i], 1);
+    }
+    add_ir_constants(&codegen);
+    assign_slots(&codegen);
+
+    reserve_vsd_array(&compiler->temp_code, num_instructions * 3);
+    for (uint32_t i = 0; i < codegen.num_slots; i++)
+    {
+        ADD_INSTRUCTION(OPCODE_NPUSH);
+    }
+
+    for (uint32_t i = 0; i < codegen.num_blocks; i++)
+    {
+        uint32_t block = codegen.order[i];
+        GENERATE_LABEL_ID(label);
+        codegen.labels[block] = label;
+    }
+
+    for (uint32_t i = 0; i < codegen.num_blocks; i++)
+    {
+        uint32_t block = codegen.order[i];
+        uint32_t next_block = (i + 1 < codegen.num_blocks) ? codegen.order[i + 1] : IR_NO_VALUE;
+        SET_LABEL_ADDR(codegen.labels[block]);
+
+        const uint32_t_array* instructions = &program->blocks.data[block].instructions;
+        for (size_t j = 0; j < instructions->used; j++)
+        {
+            if (is_emitted(&codegen, instructions->data[j]))
+                emit_instruction(&codegen, block, instructions->data[j], next_block);
+        }
+    }
+
+    if (!has_halt)
+        ADD_INSTRUCTION(OPCODE_HALT);
+
+    free(codegen.order);
+    free(codegen.use_counts);
+    free(codegen.is_phi_materialized);
+    free(codegen.stack_phis);
+    free(codegen.labels);
+}
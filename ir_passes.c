@@ -0,0 +1,762 @@
+#include "ir.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashmap.h"
+#include "model.h"
+#include "optimizer.h"
+#include "typer.h"
+#include "types.h"
+#include "utils.h"
+#include "vm_ops.h"
+
+// Passes over the IR. Each of them returns whether it changed the program, and the pass manager runs
+// them in rounds until none does, as each pass exposes opportunities for the others: folding a branch
+// makes phis trivial, which makes more operands constant, and types known, and so on.
+
+// Values removed by a pass are replaced by another one, recorded in an array of replacements, which is
+// applied to every operand in a single sweep at the end of the pass.
+
+#define IR_PASSES_TEMP_MEMORY_SIZE 65535
+
+// Passes never stop making progress in well-formed programs, but the number of rounds is bounded anyway
+#define MAX_OPTIMIZATION_ROUNDS 16
+
+// Marks values not reached yet by type specialization, which might still be given any type
+#define TYPE_NOT_REACHED 0xFE
+
+typedef struct ir_pass
+{
+    const char* name;
+    int (*run)(ir_program* program);
+} ir_pass;
+
+// Key of the computation of a value in global value numbering
+typedef struct gvn_key
+{
+    uint32_t opcode;
+    uint32_t operands[2];
+} gvn_key;
+
+static uint32_t* init_replacements(const ir_program* program)
+{
+    uint32_t* replacements = malloc((program->instructions.used + 1) * sizeof(uint32_t));
+    if (replacements == NULL)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot allocate memory for the IR passes\n");
+    }
+
+    for (uint32_t i = 0; i < program->instructions.used; i++)
+    {
+        replacements[i] = i;
+    }
+
+    return replacements;
+}
+
+static uint32_t resolve_replacement(const uint32_t* replacements, uint32_t value)
+{
+    while (replacements[value] != value)
+    {
+        value = replacements[value];
+    }
+
+    return value;
+}
+
+static void resolve_operands(ir_program* program, ir_instruction* instruction, const uint32_t* replacements)
+{
+    ir_operand* operands = IR_OPERANDS(program, instruction);
+    for (uint32_t i = 0; i < instruction->num_operands; i++)
+    {
+        operands[i].value = resolve_replacement(replacements, operands[i].value);
+    }
+}
+
+static void apply_replacements(ir_program* program, uint32_t* replacements)
+{
+    for (size_t i = 0; i < program->instructions.used; i++)
+    {
+        if (program->instructions.data[i].opcode != IR_NOP)
+            resolve_operands(program, &program->instructions.data[i], replacements);
+    }
+
+    free(replacements);
+}
+
+static void replace_instruction(ir_instruction* instruction, uint32_t* replacements, uint32_t idx, uint32_t value)
+{
+    replacements[idx] = value;
+    instruction->opcode = IR_NOP;
+    instruction->num_operands = 0;
+}
+
+static void make_constant(ir_instruction* instruction, expression_result value)
+{
+    instruction->opcode = IR_CONST;
+    instruction->num_operands = 0;
+    instruction->constant = value;
+    instruction->type = value.type;
+}
+
+static int is_constant(const ir_program* program, uint32_t value)
+{
+    return program->instructions.data[value].opcode == IR_CONST;
+}
+
+static int equal_constants(const expression_result* first, const expression_result* second)
+{
+    if (first->type != second->type)
+        return 0;
+
+    switch (first->type)
+    {
+        case INT_VALUE:     return first->value.int_value == second->value.int_value;
+        case FLOAT_VALUE:   return memcmp(&first->value.float_value, &second->value.float_value, sizeof(double)) == 0;
+        case BOOL_VALUE:    return first->value.bool_value == second->value.bool_value;
+        case STRING_VALUE:  return string_comparison(&first->value.string_value, &second->value.string_value, COMPARE_EQ);
+        default:            return 0;
+    }
+}
+
+// Blocks which are not reachable anymore are removed, along with the phi operands flowing from them
+static int remove_unreachable_blocks(ir_program* program)
+{
+    uint32_t* order = malloc((program->blocks.used + 1) * sizeof(uint32_t));
+    char* is_reachable = calloc(program->blocks.used + 1, 1);
+    uint32_t num_blocks = compute_block_order(program, order);
+    for (uint32_t i = 0; i < num_blocks; i++)
+    {
+        is_reachable[order[i]] = 1;
+    }
+
+    int changed = 0;
+    for (uint32_t block = 0; block < program->blocks.used; block++)
+    {
+        ir_block* removed = &program->blocks.data[block];
+        if (is_reachable[block] || removed->is_removed)
+            continue;
+
+        for (uint32_t i = 0; i < removed->num_successors; i++)
+        {
+            remove_predecessor(program, removed->successors[i], block);
+        }
+
+        for (size_t i = 0; i < removed->instructions.used; i++)
+        {
+            program->instructions.data[removed->instructions.data[i]].opcode = IR_NOP;
+        }
+
+        removed->instructions.used = 0;
+        removed->predecessors.used = 0;
+        removed->num_successors = 0;
+        removed->is_removed = 1;
+        changed = 1;
+    }
+
+    free(order);
+    free(is_reachable);
+    return changed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constant propagation
+////////////////////////////////////////////////////////////////////////////////
+
+// Phis whose operands are all the same value (or the phi itself, along loops) are that value
+static int simplify_phi(ir_program* program, uint32_t idx, uint32_t* replacements)
+{
+    ir_instruction* phi = &program->instructions.data[idx];
+    ir_operand* operands = IR_OPERANDS(program, phi);
+    uint32_t value = IR_NO_VALUE;
+    int is_trivial = 1, is_constant_phi = (phi->num_operands > 0);
+    for (uint32_t i = 0; i < phi->num_operands; i++)
+    {
+        uint32_t operand = operands[i].value;
+        if (operand != idx && operand != value)
+        {
+            is_trivial &= (value == IR_NO_VALUE);
+            value = operand;
+        }
+
+        is_constant_phi &= is_constant(program, operand)
+            && equal_constants(&program->instructions.data[operand].constant, &program->instructions.data[operands[0].value].constant);
+    }
+
+    if (is_trivial && value != IR_NO_VALUE)
+    {
+        replace_instruction(phi, replacements, idx, value);
+        return 1;
+    }
+
+    if (is_constant_phi)
+    {
+        make_constant(phi, program->instructions.data[operands[0].value].constant);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int fold_binop_instruction(ir_program* program, ir_instruction* binop, vss_array* temp_memory)
+{
+    ir_operand* operands = IR_OPERANDS(program, binop);
+
+    // Squares are computed by multiplying values by themselves, which the code generator turns into DUP
+    if (binop->op == TOK_CARET && is_constant(program, operands[1].value))
+    {
+        const expression_result* exponent = &program->instructions.data[operands[1].value].constant;
+        if (exponent->type == INT_VALUE && exponent->value.int_value == 2)
+        {
+            binop->op = TOK_STAR;
+            operands[1] = operands[0];
+            return 1;
+        }
+    }
+
+    if (!is_constant(program, operands[0].value) || !is_constant(program, operands[1].value))
+        return 0;
+
+    expression_result result;
+    if (!fold_constant_binop(temp_memory, binop->op, program->instructions.data[operands[0].value].constant,
+        program->instructions.data[operands[1].value].constant, &result))
+    {
+        return 0;
+    }
+
+    if (result.type == STRING_VALUE)
+        insert_string_array(&program->folded_strings, result.value.string_value);
+
+    make_constant(binop, result);
+    return 1;
+}
+
+// Same rules as the AST optimizer, and negating anything other than a number leaves it untouched
+static int fold_unop_instruction(ir_program* program, uint32_t idx, uint32_t* replacements)
+{
+    ir_instruction* unop = &program->instructions.data[idx];
+    ir_operand operand = IR_OPERANDS(program, unop)[0];
+    if (!is_constant(program, operand.value))
+        return 0;
+
+    expression_result value = program->instructions.data[operand.value].constant;
+    if (unop->op == TOK_MINUS && value.type == INT_VALUE)
+    {
+        make_constant(unop, (expression_result) {.type = INT_VALUE, .value.int_value = -value.value.int_value});
+    }
+
+    else if (unop->op == TOK_MINUS && value.type == FLOAT_VALUE)
+    {
+        make_constant(unop, (expression_result) {.type = FLOAT_VALUE, .value.float_value = -value.value.float_value});
+    }
+
+    else if (unop->op == TOK_MINUS)
+    {
+        replace_instruction(unop, replacements, idx, operand.value);
+    }
+
+    else if (value.type == BOOL_VALUE)
+    {
+        make_constant(unop, (expression_result) {.type = BOOL_VALUE, .value.bool_value = !value.value.bool_value});
+    }
+
+    else if (value.type == INT_VALUE)
+    {
+        make_constant(unop, (expression_result) {.type = BOOL_VALUE, .value.bool_value = !value.value.int_value});
+    }
+
+    else
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+// Branches on constants become jumps, and branches on negated bools swap their successors
+static int fold_branch(ir_program* program, ir_instruction* branch, vss_array* temp_memory)
+{
+    ir_operand* condition = IR_OPERANDS(program, branch);
+    const ir_instruction* definition = &program->instructions.data[condition->value];
+    ir_block* block = &program->blocks.data[branch->block];
+
+    if (definition->opcode == IR_UNOP && definition->op == TOK_NOT
+        && program->instructions.data[IR_OPERANDS(program, definition)[0].value].type == BOOL_VALUE)
+    {
+        *condition = IR_OPERANDS(program, definition)[0];
+        uint32_t true_block = block->successors[0];
+        block->successors[0] = block->successors[1];
+        block->successors[1] = true_block;
+        return 1;
+    }
+
+    // Conditions other than the operands of `and` and `or` raise an error when they are not bools
+    if (definition->opcode != IR_CONST || (definition->type != BOOL_VALUE && !branch->is_logic_condition))
+        return 0;
+
+    int is_true = cast_to_bool(temp_memory, definition->constant);
+    uint32_t taken_block = block->successors[is_true ? 0 : 1];
+    remove_predecessor(program, block->successors[is_true ? 1 : 0], branch->block);
+    block->successors[0] = taken_block;
+    block->num_successors = 1;
+    branch->opcode = IR_JUMP;
+    branch->num_operands = 0;
+    return 1;
+}
+
+static int propagate_constants(ir_program* program)
+{
+    uint32_t* replacements = init_replacements(program);
+    uint32_t* order = malloc((program->blocks.used + 1) * sizeof(uint32_t));
+    uint32_t num_blocks = compute_block_order(program, order);
+    vss_array temp_memory;
+    init_vss_array(&temp_memory, IR_PASSES_TEMP_MEMORY_SIZE);
+
+    int changed = 0;
+    for (uint32_t i = 0; i < num_blocks; i++)
+    {
+        ir_block* block = &program->blocks.data[order[i]];
+        for (size_t j = 0; j < block->instructions.used; j++)
+        {
+            uint32_t idx = block->instructions.data[j];
+            ir_instruction* instruction = &program->instructions.data[idx];
+            resolve_operands(program, instruction, replacements);
+
+            switch (instruction->opcode)
+            {
+                case IR_PHI:
+                    changed |= simplify_phi(program, idx, replacements);
+                    break;
+
+                case IR_BINOP:
+                    changed |= fold_binop_instruction(program, instruction, &temp_memory);
+                    break;
+
+                case IR_UNOP:
+                    changed |= fold_unop_instruction(program, idx, replacements);
+                    break;
+
+                case IR_BRANCH:
+                    changed |= fold_branch(program, instruction, &temp_memory);
+                    break;
+            }
+        }
+    }
+
+    apply_replacements(program, replacements);
+    changed |= remove_unreachable_blocks(program);
+
+    free(order);
+    free_vss_array(&temp_memory);
+    return changed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Type specialization
+////////////////////////////////////////////////////////////////////////////////
+
+static uint8_t meet_types(uint8_t first, uint8_t second)
+{
+    if (first == TYPE_NOT_REACHED)
+        return second;
+    if (second == TYPE_NOT_REACHED || first == second)
+        return first;
+    return STATIC_TYPE_UNKNOWN;
+}
+
+static uint8_t infer_instruction_type(const ir_program* program, const ir_instruction* instruction, const uint8_t* types)
+{
+    const ir_operand* operands = IR_OPERANDS(program, instruction);
+    uint8_t type = TYPE_NOT_REACHED;
+    switch (instruction->opcode)
+    {
+        case IR_CONST:
+            return instruction->constant.type;
+
+        case IR_PHI:
+            for (uint32_t i = 0; i < instruction->num_operands; i++)
+            {
+                type = meet_types(type, types[operands[i].value]);
+            }
+            return type;
+
+        case IR_BINOP:
+            if (types[operands[0].value] == TYPE_NOT_REACHED || types[operands[1].value] == TYPE_NOT_REACHED)
+                return TYPE_NOT_REACHED;
+            return get_binop_result_type(instruction->op, types[operands[0].value], types[operands[1].value]);
+
+        case IR_UNOP:
+            return (instruction->op == TOK_NOT) ? BOOL_VALUE : types[operands[0].value];
+
+        default:
+            return STATIC_TYPE_UNKNOWN;
+    }
+}
+
+// Values start with no type at all, and are given the types their operands might have, following the
+// blocks in order until no type changes. Types only grow along the way, so that loops are typed from
+// their entry, and only the values whose type depends on the path taken end up with an unknown type
+static int specialize_types(ir_program* program)
+{
+    uint8_t* types = malloc(program->instructions.used + 1);
+    uint32_t* order = malloc((program->blocks.used + 1) * sizeof(uint32_t));
+    uint32_t num_blocks = compute_block_order(program, order);
+    memset(types, TYPE_NOT_REACHED, program->instructions.used);
+
+    int is_stable;
+    do
+    {
+        is_stable = 1;
+        for (uint32_t i = 0; i < num_blocks; i++)
+        {
+            const ir_block* block = &program->blocks.data[order[i]];
+            for (size_t j = 0; j < block->instructions.used; j++)
+            {
+                uint32_t idx = block->instructions.data[j];
+                uint8_t type = infer_instruction_type(program, &program->instructions.data[idx], types);
+                if (type != types[idx])
+                {
+                    types[idx] = type;
+                    is_stable = 0;
+                }
+            }
+        }
+    } while (!is_stable);
+
+    int changed = 0;
+    for (uint32_t i = 0; i < program->instructions.used; i++)
+    {
+        ir_instruction* instruction = &program->instructions.data[i];
+        uint8_t type = (types[i] == TYPE_NOT_REACHED) ? STATIC_TYPE_UNKNOWN : types[i];
+        if (instruction->opcode != IR_NOP && instruction->type != type)
+        {
+            instruction->type = type;
+            changed = 1;
+        }
+    }
+
+    free(types);
+    free(order);
+    return changed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Global value numbering
+////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t intersect_dominators(const uint32_t* idoms, const uint32_t* order_idxs, uint32_t first, uint32_t second)
+{
+    while (first != second)
+    {
+        while (order_idxs[first] > order_idxs[second])
+        {
+            first = idoms[first];
+        }
+
+        while (order_idxs[second] > order_idxs[first])
+        {
+            second = idoms[second];
+        }
+    }
+
+    return first;
+}
+
+// Immediate dominator of every reachable block, following "A Simple, Fast Dominance Algorithm"
+// (Cooper, Harvey and Kennedy)
+static void compute_dominators(const ir_program* program, const uint32_t* order, uint32_t num_blocks, uint32_t* idoms)
+{
+    uint32_t* order_idxs = malloc((program->blocks.used + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < program->blocks.used; i++)
+    {
+        order_idxs[i] = IR_NO_VALUE;
+        idoms[i] = IR_NO_VALUE;
+    }
+
+    for (uint32_t i = 0; i < num_blocks; i++)
+    {
+        order_idxs[order[i]] = i;
+    }
+
+    idoms[order[0]] = order[0];
+    int changed;
+    do
+    {
+        changed = 0;
+        for (uint32_t i = 1; i < num_blocks; i++)
+        {
+            const uint32_t_array* predecessors = &program->blocks.data[order[i]].predecessors;
+            uint32_t idom = IR_NO_VALUE;
+            for (size_t j = 0; j < predecessors->used; j++)
+            {
+                uint32_t predecessor = predecessors->data[j];
+                if (idoms[predecessor] == IR_NO_VALUE)
+                    continue;
+
+                idom = (idom == IR_NO_VALUE) ? predecessor : intersect_dominators(idoms, order_idxs, predecessor, idom);
+            }
+
+            if (idoms[order[i]] != idom)
+            {
+                idoms[order[i]] = idom;
+                changed = 1;
+            }
+        }
+    } while (changed);
+
+    free(order_idxs);
+}
+
+// Commutative operations between numbers list their operands in a fixed order, so that both orders
+// get the same number
+static void make_gvn_key(const ir_program* program, const ir_instruction* instruction, gvn_key* key)
+{
+    const ir_operand* operands = IR_OPERANDS(program, instruction);
+    memset(key, 0, sizeof(gvn_key));
+    key->opcode = ((uint32_t)instruction->opcode << 16) | (uint32_t)instruction->op;
+    key->operands[0] = operands[0].value;
+    key->operands[1] = (instruction->num_operands > 1) ? operands[1].value : IR_NO_VALUE;
+
+    uint8_t lhs_type = program->instructions.data[key->operands[0]].type;
+    uint8_t rhs_type = (instruction->num_operands > 1) ? program->instructions.data[key->operands[1]].type : STATIC_TYPE_UNKNOWN;
+    int is_commutative = (instruction->op == TOK_PLUS || instruction->op == TOK_STAR || instruction->op == TOK_EQEQ || instruction->op == TOK_NE);
+    if (is_commutative && (lhs_type == INT_VALUE || lhs_type == FLOAT_VALUE) && (rhs_type == INT_VALUE || rhs_type == FLOAT_VALUE)
+        && key->operands[0] > key->operands[1])
+    {
+        key->operands[0] = operands[1].value;
+        key->operands[1] = operands[0].value;
+    }
+}
+
+// Operations computed again with the same operands, in a block dominated by the one computing them first,
+// are replaced by the first result. Blocks are visited along the dominator tree, with a table of the
+// operations computed in the blocks dominating the current one
+static int number_values(ir_program* program)
+{
+    uint32_t num_all_blocks = program->blocks.used;
+    uint32_t* order = malloc((num_all_blocks + 1) * sizeof(uint32_t));
+    uint32_t* idoms = malloc((num_all_blocks + 1) * sizeof(uint32_t));
+    uint32_t* first_children = malloc((num_all_blocks + 1) * sizeof(uint32_t));
+    uint32_t* next_siblings = malloc((num_all_blocks + 1) * sizeof(uint32_t));
+    uint32_t* scope_starts = malloc((num_all_blocks + 1) * sizeof(uint32_t));
+    uint32_t* stack = malloc((2 * num_all_blocks + 1) * sizeof(uint32_t));
+    gvn_key* keys = malloc((program->instructions.used + 1) * sizeof(gvn_key));
+    uint32_t* replacements = init_replacements(program);
+    if (order == NULL || idoms == NULL || first_children == NULL || next_siblings == NULL || scope_starts == NULL || stack == NULL || keys == NULL)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot allocate memory for the IR passes\n");
+    }
+
+    uint32_t num_blocks = compute_block_order(program, order);
+    compute_dominators(program, order, num_blocks, idoms);
+    for (uint32_t i = 0; i < num_all_blocks; i++)
+    {
+        first_children[i] = IR_NO_VALUE;
+    }
+
+    for (uint32_t i = num_blocks; i > 1; i--)
+    {
+        uint32_t block = order[i - 1];
+        next_siblings[block] = first_children[idoms[block]];
+        first_children[idoms[block]] = block;
+    }
+
+    hashmap table;
+    uint32_t_array numbered;
+    init_hashmap(&table, 256, 8);
+    init_uint32_t_array(&numbered, 256);
+
+    // Each block is pushed twice: to enter it (even entries) and to leave it (odd entries)
+    int changed = 0;
+    uint32_t stack_size = 0;
+    stack[stack_size++] = order[0] * 2;
+    while (stack_size > 0)
+    {
+        uint32_t entry = stack[--stack_size];
+        uint32_t block = entry / 2;
+        if (entry % 2 == 1)
+        {
+            while (numbered.used > scope_starts[block])
+            {
+                uint32_t idx = numbered.data[--numbered.used];
+                string_type key = { (char*)&keys[idx], sizeof(gvn_key) };
+                hashmap_remove(&table, &key);
+            }
+            continue;
+        }
+
+        scope_starts[block] = numbered.used;
+        const uint32_t_array* instructions = &program->blocks.data[block].instructions;
+        for (size_t i = 0; i < instructions->used; i++)
+        {
+            uint32_t idx = instructions->data[i];
+            ir_instruction* instruction = &program->instructions.data[idx];
+            resolve_operands(program, instruction, replacements);
+            if (instruction->opcode != IR_BINOP && instruction->opcode != IR_UNOP)
+                continue;
+
+            make_gvn_key(program, instruction, &keys[idx]);
+            string_type key = { (char*)&keys[idx], sizeof(gvn_key) };
+            size_t value;
+            if (hashmap_get(&table, &key, &value) != -1)
+            {
+                replace_instruction(instruction, replacements, idx, value);
+                changed = 1;
+                continue;
+            }
+
+            hashmap_set(&table, key, idx);
+            insert_uint32_t_array(&numbered, idx);
+        }
+
+        stack[stack_size++] = block * 2 + 1;
+        for (uint32_t child = first_children[block]; child != IR_NO_VALUE; child = next_siblings[child])
+        {
+            stack[stack_size++] = child * 2;
+        }
+    }
+
+    apply_replacements(program, replacements);
+
+    free_hashmap(&table);
+    free_uint32_t_array(&numbered);
+    free(order);
+    free(idoms);
+    free(first_children);
+    free(next_siblings);
+    free(scope_starts);
+    free(stack);
+    free(keys);
+    return changed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Dead code elimination
+////////////////////////////////////////////////////////////////////////////////
+
+// Whether executing an operation might raise an error, which must still be raised even if its result
+// is never used
+static int can_binop_fail(const ir_program* program, const ir_instruction* binop)
+{
+    const ir_operand* operands = IR_OPERANDS(program, binop);
+    const ir_instruction* lhs = &program->instructions.data[operands[0].value];
+    const ir_instruction* rhs = &program->instructions.data[operands[1].value];
+    if (lhs->type == STATIC_TYPE_UNKNOWN || rhs->type == STATIC_TYPE_UNKNOWN || binop->op == TOK_CARET
+        || get_binop_operation(binop->op, lhs->type, rhs->type) == unsupported_op)
+    {
+        return 1;
+    }
+
+    if (binop->op == TOK_SLASH || binop->op == TOK_MOD)
+    {
+        return rhs->opcode != IR_CONST
+            || (rhs->type == INT_VALUE && rhs->constant.value.int_value == 0)
+            || (rhs->type == FLOAT_VALUE && rhs->constant.value.float_value == 0);
+    }
+
+    return 0;
+}
+
+static int is_dead_code_root(const ir_program* program, const ir_instruction* instruction)
+{
+    switch (instruction->opcode)
+    {
+        case IR_GSTORE:
+        case IR_PRINT:
+        case IR_PRINTLN:
+        case IR_JUMP:
+        case IR_BRANCH:
+        case IR_HALT:
+            return 1;
+
+        case IR_BINOP:
+            return can_binop_fail(program, instruction);
+
+        default:
+            return 0;
+    }
+}
+
+// Values are live when they are used by a live instruction, starting from the instructions with side
+// effects. The others are removed, along with the instructions already removed by other passes
+static int eliminate_dead_code(ir_program* program)
+{
+    char* is_live = calloc(program->instructions.used + 1, 1);
+    uint32_t_array worklist;
+    init_uint32_t_array(&worklist, 256);
+
+    for (uint32_t block = 0; block < program->blocks.used; block++)
+    {
+        const uint32_t_array* instructions = &program->blocks.data[block].instructions;
+        for (size_t i = 0; i < instructions->used; i++)
+        {
+            uint32_t idx = instructions->data[i];
+            if (is_dead_code_root(program, &program->instructions.data[idx]))
+            {
+                is_live[idx] = 1;
+                insert_uint32_t_array(&worklist, idx);
+            }
+        }
+    }
+
+    while (worklist.used > 0)
+    {
+        const ir_instruction* instruction = &program->instructions.data[worklist.data[--worklist.used]];
+        const ir_operand* operands = IR_OPERANDS(program, instruction);
+        for (uint32_t i = 0; i < instruction->num_operands; i++)
+        {
+            if (!is_live[operands[i].value])
+            {
+                is_live[operands[i].value] = 1;
+                insert_uint32_t_array(&worklist, operands[i].value);
+            }
+        }
+    }
+
+    int changed = 0;
+    for (uint32_t block = 0; block < program->blocks.used; block++)
+    {
+        uint32_t_array* instructions = &program->blocks.data[block].instructions;
+        size_t num_live = 0;
+        for (size_t i = 0; i < instructions->used; i++)
+        {
+            uint32_t idx = instructions->data[i];
+            if (is_live[idx])
+            {
+                instructions->data[num_live++] = idx;
+                continue;
+            }
+
+            changed |= (program->instructions.data[idx].opcode != IR_NOP);
+            program->instructions.data[idx].opcode = IR_NOP;
+        }
+        instructions->used = num_live;
+    }
+
+    free(is_live);
+    free_uint32_t_array(&worklist);
+    return changed;
+}
+
+static const ir_pass passes[] = {
+    { "constant propagation",       propagate_constants },
+    { "type specialization",        specialize_types },
+    { "global value numbering",     number_values },
+    { "dead code elimination",      eliminate_dead_code },
+};
+
+void optimize_ir(ir_program* program)
+{
+    for (int round = 0; round < MAX_OPTIMIZATION_ROUNDS; round++)
+    {
+        int changed = 0;
+        for (size_t i = 0; i < sizeof(passes) / sizeof(passes[0]); i++)
+        {
+            changed |= passes[i].run(program);
+        }
+
+        if (!changed)
+            break;
+    }
+}
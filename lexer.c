@@ -30,12 +30,27 @@ token_type keyword_tokens[] = {
 void init_lexer(lexer* lexer, FILE* file)
 {
     lexer->source = file;
+    lexer->buffer = NULL;
+    lexer->length = 0;
     lexer->start = lexer->curr = 0;
     lexer->line = 1;
     lexer->column = 1;
     init_token_array(&lexer->tokens, 1024);
 }
 
+void init_lexer_from_source(lexer* lexer, const char* source, size_t length)
+{
+    init_lexer(lexer, NULL);
+
+    // Tokens point into the buffer, so the source is copied to make the lexer own it
+    lexer->buffer = (char*)malloc(length);
+    if (lexer->buffer)
+    {
+        memcpy(lexer->buffer, source, length);
+        lexer->length = length;
+    }
+}
+
 void free_lexer(lexer* lexer)
 {
     free_token_array(&lexer->tokens);
@@ -44,14 +59,17 @@ void free_lexer(lexer* lexer)
 
 void tokenize(lexer* lexer)
 {
-    // Load file into a buffer
-    fseek(lexer->source, 0, SEEK_END);
-    lexer->length = ftell(lexer->source);
-    fseek(lexer->source, 0, SEEK_SET);
-    lexer->buffer = (char*)malloc(lexer->length);
-    if (lexer->buffer)
+    // Load file into a buffer, unless the source was already provided from memory
+    if (lexer->source)
     {
-        fread(lexer->buffer, 1, lexer->length, lexer->source);
+        fseek(lexer->source, 0, SEEK_END);
+        lexer->length = ftell(lexer->source);
+        fseek(lexer->source, 0, SEEK_SET);
+        lexer->buffer = (char*)malloc(lexer->length);
+        if (lexer->buffer)
+        {
+            fread(lexer->buffer, 1, lexer->length, lexer->source);
+        }
     }
 
     // Parse tokens
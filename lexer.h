@@ -14,6 +14,7 @@ typedef struct
 } lexer;
 
 void init_lexer(lexer* lexer, FILE* file);
+void init_lexer_from_source(lexer* lexer, const char* source, size_t length);
 void free_lexer(lexer* lexer);
 
 void tokenize(lexer* lexer);
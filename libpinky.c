@@ -0,0 +1,590 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "libpinky.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "closure.h"
+#include "compiler.h"
+#include "errors.h"
+#include "inliner.h"
+#include "interpreter.h"
+#include "lexer.h"
+#include "memo.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "resolver.h"
+#include "snapshot.h"
+#include "typer.h"
+#include "utils.h"
+#include "vm.h"
+
+struct pinky_program
+{
+    unsigned char* bytecode;
+    size_t size;
+    uint64_t hash;
+
+    // Source line and text address of every statement, in code order
+    uint32_t* statement_lines;
+    uint32_t* statement_addrs;
+    size_t num_statements;
+};
+
+struct pinky_vm
+{
+    vm vm;
+    const pinky_program* program;
+};
+
+// Every stage of a compilation. They are kept in the heap, so that they can be safely cleaned up
+// after an error jumps back to the compilation function
+typedef struct compilation
+{
+    lexer lexer;
+    parser parser;
+    optimizer optimizer;
+    typer typer;
+    compiler compiler;
+} compilation;
+
+// Stages of an interpretation, kept in the heap for the same reason
+typedef struct interpretation
+{
+    lexer lexer;
+    parser parser;
+    inliner inliner;
+    memo_cache memo;
+    resolver resolver;
+    closure_compiler closures;
+    interpreter interpreter;
+} interpretation;
+
+struct pinky_session
+{
+    lexer lexer;
+    parser parser;
+    typer typer;
+    compiler compiler;
+    pinky_vm vm;
+    int flags;
+};
+
+static THREAD_LOCAL char last_error[ERROR_MESSAGE_SIZE];
+
+static void set_last_error(const char* message)
+{
+    snprintf(last_error, ERROR_MESSAGE_SIZE, "%s", message);
+}
+
+const char* pinky_last_error(void)
+{
+    return last_error;
+}
+
+static pinky_status compile_program(compilation* compilation, const char* name, int flags, pinky_program** program)
+{
+    error_handler handler;
+    pinky_status status;
+
+    init_parser(&compilation->parser, &compilation->lexer.tokens);
+    init_optimizer(&compilation->optimizer);
+    init_typer(&compilation->typer);
+    init_compiler(&compilation->compiler);
+
+    push_error_handler(&handler);
+    if (setjmp(handler.jump_buffer) == 0)
+    {
+        if (flags & PINKY_VERBOSE)
+        {
+            PRINT_GOOD("Tokenizing %s\n", name);
+        }
+        tokenize(&compilation->lexer);
+        if (flags & PINKY_VERBOSE)
+        {
+            print_tokens(&compilation->lexer);
+            PRINT_GOOD("Parsing %s\n", name);
+        }
+
+        void* ast = parse(&compilation->parser);
+        if (!(flags & PINKY_NO_OPTIMIZE))
+        {
+            ast = optimize_ast(&compilation->optimizer, ast);
+            infer_types(&compilation->typer, ast);
+        }
+        compilation->compiler.optimize = !(flags & PINKY_NO_OPTIMIZE);
+        compilation->compiler.peephole = !(flags & PINKY_NO_PEEPHOLE);
+        compilation->compiler.use_ir = (flags & PINKY_SSA_IR) != 0;
+        compilation->compiler.print_ir = (flags & PINKY_SSA_IR) && (flags & PINKY_VERBOSE);
+
+        if (flags & PINKY_VERBOSE)
+        {
+            print_ast(ast);
+            PRINT_GOOD("Generating code for %s\n", name);
+        }
+
+        compile_code(&compilation->compiler, ast);
+        if (flags & PINKY_VERBOSE)
+        {
+            print_code(&compilation->compiler);
+        }
+        pop_error_handler(&handler);
+        status = PINKY_OK;
+
+        // The bytecode is copied out of the compiler, so that the program does not depend on it
+        compiler* compiler = &compilation->compiler;
+        size_t num_statements = compiler->statement_lines.used;
+        *program = malloc(sizeof(pinky_program));
+        unsigned char* bytecode = malloc(compiler->program.used);
+        uint32_t* statement_lines = malloc(num_statements * sizeof(uint32_t) + 1);
+        uint32_t* statement_addrs = malloc(num_statements * sizeof(uint32_t) + 1);
+        if (*program == NULL || bytecode == NULL || statement_lines == NULL || statement_addrs == NULL)
+        {
+            free(*program);
+            free(bytecode);
+            free(statement_lines);
+            free(statement_addrs);
+            *program = NULL;
+            set_last_error("Cannot allocate memory for the compiled program");
+            status = PINKY_ERROR_MEMORY;
+        }
+        else
+        {
+            memcpy(bytecode, compiler->program.data, compiler->program.used);
+            memcpy(statement_lines, compiler->statement_lines.data, num_statements * sizeof(uint32_t));
+            memcpy(statement_addrs, compiler->statement_addrs.data, num_statements * sizeof(uint32_t));
+            (*program)->bytecode = bytecode;
+            (*program)->size = compiler->program.used;
+            (*program)->hash = hash_program(bytecode, compiler->program.used);
+            (*program)->statement_lines = statement_lines;
+            (*program)->statement_addrs = statement_addrs;
+            (*program)->num_statements = num_statements;
+        }
+    }
+    else
+    {
+        set_last_error(handler.message);
+        status = (handler.kind == ERROR_LEXER || handler.kind == ERROR_SYNTAX) ? PINKY_ERROR_SYNTAX : PINKY_ERROR_COMPILE;
+    }
+
+    free_lexer(&compilation->lexer);
+    free_parser(&compilation->parser);
+    destroy_optimizer(&compilation->optimizer);
+    destroy_typer(&compilation->typer);
+    destroy_compiler(&compilation->compiler);
+
+    return status;
+}
+
+pinky_status pinky_compile_file(const char* filename, int flags, pinky_program** program)
+{
+    FILE* fp;
+    *program = NULL;
+
+    if ((fp = fopen(filename, "r")) == NULL)
+    {
+        snprintf(last_error, ERROR_MESSAGE_SIZE, "Cannot open file '%s': %s", filename, strerror(errno));
+        return PINKY_ERROR_IO;
+    }
+
+    compilation* compilation = malloc(sizeof(*compilation));
+    if (compilation == NULL)
+    {
+        fclose(fp);
+        set_last_error("Cannot allocate memory for the compiler");
+        return PINKY_ERROR_MEMORY;
+    }
+
+    init_lexer(&compilation->lexer, fp);
+    pinky_status status = compile_program(compilation, filename, flags, program);
+
+    free(compilation);
+    fclose(fp);
+    return status;
+}
+
+pinky_status pinky_compile_source(const char* source, size_t length, int flags, pinky_program** program)
+{
+    *program = NULL;
+
+    compilation* compilation = malloc(sizeof(*compilation));
+    if (compilation == NULL)
+    {
+        set_last_error("Cannot allocate memory for the compiler");
+        return PINKY_ERROR_MEMORY;
+    }
+
+    init_lexer_from_source(&compilation->lexer, source, length);
+    pinky_status status = compile_program(compilation, "<source>", flags, program);
+
+    free(compilation);
+    return status;
+}
+
+void pinky_program_free(pinky_program* program)
+{
+    if (program == NULL)
+        return;
+
+    free(program->bytecode);
+    free(program->statement_lines);
+    free(program->statement_addrs);
+    free(program);
+}
+
+pinky_status pinky_vm_create(const pinky_program* program, pinky_vm** vm)
+{
+    *vm = malloc(sizeof(pinky_vm));
+    if (*vm == NULL)
+    {
+        set_last_error("Cannot allocate memory for the VM");
+        return PINKY_ERROR_MEMORY;
+    }
+
+    init_vm(&(*vm)->vm);
+    (*vm)->program = program;
+    return PINKY_OK;
+}
+
+void pinky_vm_set_output(pinky_vm* vm, FILE* output)
+{
+    vm->vm.output = output;
+}
+
+// Execute the given bytecode from the current program counter of the VM, until a HALT is found.
+// Afterwards, the program counter points to that HALT, so that resuming a finished VM does nothing
+static pinky_status execute(pinky_vm* vm, unsigned char* bytecode)
+{
+    error_handler handler;
+
+    push_error_handler(&handler);
+    if (setjmp(handler.jump_buffer) != 0)
+    {
+        set_last_error(handler.message);
+        clear_vm_stack(&vm->vm);
+        return PINKY_ERROR_RUNTIME;
+    }
+
+    resume_vm(&vm->vm, bytecode);
+    pop_error_handler(&handler);
+
+    vm->vm.pc -= 1;
+    return PINKY_OK;
+}
+
+// Runs the program of the VM from its beginning. Global variables keep the values they were left
+// with by previous runs of the same VM
+pinky_status pinky_vm_run(pinky_vm* vm)
+{
+    vm->vm.pc = 0;
+    return execute(vm, vm->program->bytecode);
+}
+
+// Runs the program of the VM from its beginning, and stops right before executing the first
+// statement found at the given source line or after it. If there is none, the whole program is run
+pinky_status pinky_vm_run_to_line(pinky_vm* vm, int line)
+{
+    const pinky_program* program = vm->program;
+    size_t statement = 0;
+    while (statement < program->num_statements && program->statement_lines[statement] < (uint32_t) line)
+    {
+        statement++;
+    }
+
+    if (statement == program->num_statements)
+    {
+        return pinky_vm_run(vm);
+    }
+
+    // The program is shared with other VMs, so the stop point is set by running a private copy
+    // of it with a HALT instruction placed at that point
+    unsigned char* bytecode = malloc(program->size);
+    if (bytecode == NULL)
+    {
+        set_last_error("Cannot allocate memory for the VM");
+        return PINKY_ERROR_MEMORY;
+    }
+    memcpy(bytecode, program->bytecode, program->size);
+    bytecode[8 + *(uint32_t*)bytecode + program->statement_addrs[statement]] = OPCODE_HALT;
+
+    vm->vm.pc = 0;
+    pinky_status status = execute(vm, bytecode);
+
+    free(bytecode);
+    return status;
+}
+
+// Continues running the program of the VM from the point where it stopped, or where the
+// snapshot it was restored from was taken
+pinky_status pinky_vm_resume(pinky_vm* vm)
+{
+    return execute(vm, vm->program->bytecode);
+}
+
+pinky_status pinky_vm_snapshot(const pinky_vm* vm, const char* filename)
+{
+    error_handler handler;
+    FILE* fp;
+
+    if ((fp = fopen(filename, "wb")) == NULL)
+    {
+        snprintf(last_error, ERROR_MESSAGE_SIZE, "Cannot open file '%s': %s", filename, strerror(errno));
+        return PINKY_ERROR_IO;
+    }
+
+    push_error_handler(&handler);
+    if (setjmp(handler.jump_buffer) != 0)
+    {
+        set_last_error(handler.message);
+        fclose(fp);
+        return PINKY_ERROR_IO;
+    }
+
+    save_vm_snapshot(&vm->vm, vm->program->hash, fp);
+    pop_error_handler(&handler);
+
+    if (fclose(fp) != 0)
+    {
+        snprintf(last_error, ERROR_MESSAGE_SIZE, "Cannot write file '%s': %s", filename, strerror(errno));
+        return PINKY_ERROR_IO;
+    }
+
+    return PINKY_OK;
+}
+
+pinky_status pinky_vm_restore(pinky_vm* vm, const char* filename)
+{
+    error_handler handler;
+    FILE* fp;
+
+    if ((fp = fopen(filename, "rb")) == NULL)
+    {
+        snprintf(last_error, ERROR_MESSAGE_SIZE, "Cannot open file '%s': %s", filename, strerror(errno));
+        return PINKY_ERROR_IO;
+    }
+
+    push_error_handler(&handler);
+    if (setjmp(handler.jump_buffer) != 0)
+    {
+        set_last_error(handler.message);
+        fclose(fp);
+        return PINKY_ERROR_IO;
+    }
+
+    uint32_t text_size = (uint32_t) (vm->program->size - 8 - *(uint32_t*)vm->program->bytecode);
+    load_vm_snapshot(&vm->vm, vm->program->hash, text_size, fp);
+    pop_error_handler(&handler);
+
+    fclose(fp);
+    return PINKY_OK;
+}
+
+void pinky_vm_free(pinky_vm* vm)
+{
+    if (vm == NULL)
+        return;
+
+    clear_vm_stack(&vm->vm);
+    destroy_vm(&vm->vm);
+    free(vm);
+}
+
+pinky_status pinky_session_create(int flags, pinky_session** session)
+{
+    *session = malloc(sizeof(pinky_session));
+    if (*session == NULL)
+    {
+        set_last_error("Cannot allocate memory for the session");
+        return PINKY_ERROR_MEMORY;
+    }
+
+    init_typer(&(*session)->typer);
+    init_compiler(&(*session)->compiler);
+    (*session)->compiler.optimize = !(flags & PINKY_NO_OPTIMIZE);
+    (*session)->compiler.peephole = !(flags & PINKY_NO_PEEPHOLE);
+    init_vm(&(*session)->vm.vm);
+    (*session)->vm.program = NULL;
+    (*session)->flags = flags;
+    return PINKY_OK;
+}
+
+void pinky_session_set_output(pinky_session* session, FILE* output)
+{
+    session->vm.vm.output = output;
+}
+
+static pinky_status compile_session_code(pinky_session* session, const char* source, size_t length)
+{
+    error_handler handler;
+    pinky_status status;
+    uint32_t num_symbols = session->compiler.num_symbols;
+
+    init_lexer_from_source(&session->lexer, source, length);
+    init_parser(&session->parser, &session->lexer.tokens);
+
+    push_error_handler(&handler);
+    if (setjmp(handler.jump_buffer) == 0)
+    {
+        tokenize(&session->lexer);
+        void* ast = parse(&session->parser);
+
+        // The AST optimizer is skipped, as it assumes that it sees the whole program: it would remove
+        // the assignments of globals which are only read by code evaluated later
+        if (!(session->flags & PINKY_NO_OPTIMIZE))
+        {
+            infer_types(&session->typer, ast);
+        }
+
+        append_code(&session->compiler, ast);
+        pop_error_handler(&handler);
+        status = PINKY_OK;
+    }
+    else
+    {
+        set_last_error(handler.message);
+        status = (handler.kind == ERROR_LEXER || handler.kind == ERROR_SYNTAX) ? PINKY_ERROR_SYNTAX : PINKY_ERROR_COMPILE;
+        forget_symbols(&session->compiler, num_symbols);
+    }
+
+    free_lexer(&session->lexer);
+    free_parser(&session->parser);
+
+    return status;
+}
+
+pinky_status pinky_session_eval(pinky_session* session, const char* source, size_t length)
+{
+    pinky_status status = compile_session_code(session, source, length);
+    if (status != PINKY_OK)
+        return status;
+
+    vm* vm = &session->vm.vm;
+    vm->pc = session->compiler.text_base;
+    status = execute(&session->vm, session->compiler.program.data);
+
+    // Globals are first assigned in declaration order, so the ones declared after the last assigned
+    // global were never assigned if the code stopped at an error. They are declared again when some
+    // later code assigns them
+    if (vm->free_var_idx < session->compiler.num_symbols)
+    {
+        forget_symbols(&session->compiler, (uint32_t) vm->free_var_idx);
+    }
+
+    return status;
+}
+
+void pinky_session_free(pinky_session* session)
+{
+    if (session == NULL)
+        return;
+
+    destroy_typer(&session->typer);
+    destroy_compiler(&session->compiler);
+    destroy_vm(&session->vm.vm);
+    free(session);
+}
+
+static pinky_status interpret_program(interpretation* interpretation, const char* name, int flags)
+{
+    error_handler handler;
+    pinky_status status;
+
+    init_parser(&interpretation->parser, &interpretation->lexer.tokens);
+    init_inliner(&interpretation->inliner);
+    init_memo_cache(&interpretation->memo);
+    init_resolver(&interpretation->resolver);
+    init_closure_compiler(&interpretation->closures);
+    init_interpreter(&interpretation->interpreter);
+
+    push_error_handler(&handler);
+    if (setjmp(handler.jump_buffer) == 0)
+    {
+        if (flags & PINKY_VERBOSE)
+        {
+            PRINT_GOOD("Tokenizing %s\n", name);
+        }
+        tokenize(&interpretation->lexer);
+        if (flags & PINKY_VERBOSE)
+        {
+            print_tokens(&interpretation->lexer);
+            PRINT_GOOD("Parsing %s\n", name);
+        }
+
+        // Only functions are inlined, as the other AST optimizations follow the semantics of the VM,
+        // whose logic operators always give a bool (the interpreter gives one of the operands)
+        void* ast = parse(&interpretation->parser);
+        if (!(flags & PINKY_NO_OPTIMIZE))
+        {
+            ast = inline_functions(&interpretation->inliner, ast);
+        }
+        if (flags & PINKY_MEMOIZE)
+        {
+            find_pure_functions(ast);
+            interpretation->interpreter.memo = &interpretation->memo;
+        }
+        resolve_variables(&interpretation->resolver, ast);
+
+        if (flags & PINKY_VERBOSE)
+        {
+            print_ast(ast);
+            PRINT_GOOD("Interpreting %s\n", name);
+            printf("\n");
+        }
+
+        if (flags & PINKY_CLOSURES)
+        {
+            run_closures(&interpretation->interpreter, compile_closures(&interpretation->closures, ast));
+        }
+        else
+        {
+            interpret_ast(&interpretation->interpreter, ast);
+        }
+        pop_error_handler(&handler);
+        status = PINKY_OK;
+    }
+    else
+    {
+        set_last_error(handler.message);
+        status = (handler.kind == ERROR_LEXER || handler.kind == ERROR_SYNTAX) ? PINKY_ERROR_SYNTAX
+            : (handler.kind == ERROR_INTERPRETER) ? PINKY_ERROR_RUNTIME : PINKY_ERROR_COMPILE;
+    }
+
+    free_lexer(&interpretation->lexer);
+    free_parser(&interpretation->parser);
+    destroy_inliner(&interpretation->inliner);
+    free_memo_cache(&interpretation->memo);
+    destroy_resolver(&interpretation->resolver);
+    destroy_closure_compiler(&interpretation->closures);
+    free_interpreter(&interpretation->interpreter);
+
+    return status;
+}
+
+pinky_status pinky_interpret_file(const char* filename, int flags)
+{
+    FILE* fp;
+    if ((fp = fopen(filename, "r")) == NULL)
+    {
+        snprintf(last_error, ERROR_MESSAGE_SIZE, "Cannot open file '%s': %s", filename, strerror(errno));
+        return PINKY_ERROR_IO;
+    }
+
+    interpretation* interpretation = malloc(sizeof(*interpretation));
+    if (interpretation == NULL)
+    {
+        fclose(fp);
+        set_last_error("Cannot allocate memory for the interpreter");
+        return PINKY_ERROR_MEMORY;
+    }
+
+    init_lexer(&interpretation->lexer, fp);
+    pinky_status status = interpret_program(interpretation, filename, flags);
+
+    free(interpretation);
+    fclose(fp);
+    return status;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Embeddable interface to the Pinky compiler and VM.
+
+// A program is compiled once and is immutable afterwards, so it can be shared by any number of
+// VMs, even if those are run concurrently from different threads. A VM, on the other hand, must
+// only be used by one thread at a time. Errors never terminate the host process: every function
+// which may fail returns a status code, and the message of the last error raised in the calling
+// thread can be retrieved with pinky_last_error.
+
+typedef enum pinky_status
+{
+    PINKY_OK = 0,
+    PINKY_ERROR_IO,
+    PINKY_ERROR_MEMORY,
+    PINKY_ERROR_SYNTAX,
+    PINKY_ERROR_COMPILE,
+    PINKY_ERROR_RUNTIME
+} pinky_status;
+
+// Compilation flags
+#define PINKY_VERBOSE     0x01  // Print the tokens, AST and generated code of the program
+#define PINKY_NO_OPTIMIZE 0x02  // Compile the program exactly as written, skipping all optimizations
+#define PINKY_SSA_IR      0x04  // Generate code through the SSA IR and its optimization passes
+#define PINKY_MEMOIZE     0x08  // Cache the results of calls to pure functions (interpreter only)
+#define PINKY_CLOSURES    0x10  // Convert the AST into closures before running it (interpreter only)
+#define PINKY_NO_PEEPHOLE 0x20  // Skip only the peephole optimizer of the generated code (see peephole.h)
+
+typedef struct pinky_program pinky_program;
+typedef struct pinky_vm pinky_vm;
+
+pinky_status pinky_compile_file(const char* filename, int flags, pinky_program** program);
+pinky_status pinky_compile_source(const char* source, size_t length, int flags, pinky_program** program);
+void pinky_program_free(pinky_program* program);
+
+pinky_status pinky_vm_create(const pinky_program* program, pinky_vm** vm);
+void pinky_vm_set_output(pinky_vm* vm, FILE* output);
+pinky_status pinky_vm_run(pinky_vm* vm);
+pinky_status pinky_vm_run_to_line(pinky_vm* vm, int line);
+pinky_status pinky_vm_resume(pinky_vm* vm);
+void pinky_vm_free(pinky_vm* vm);
+
+// Snapshots store the globals, stack and strings of a VM, together with the point where it stopped,
+// so that later runs can restore them and resume from there instead of executing everything again.
+// A snapshot can only be restored into a VM running the same program it was taken from.
+pinky_status pinky_vm_snapshot(const pinky_vm* vm, const char* filename);
+pinky_status pinky_vm_restore(pinky_vm* vm, const char* filename);
+
+// Sessions evaluate source code piece by piece, as a REPL does. One compiler and one VM are kept for
+// the whole session: each piece of code is compiled after the program evaluated so far, seeing all of
+// its globals, and only the new code is run. A piece of code which fails to compile leaves the
+// session as it was.
+// Only the PINKY_NO_OPTIMIZE and PINKY_NO_PEEPHOLE flags apply to sessions.
+typedef struct pinky_session pinky_session;
+
+pinky_status pinky_session_create(int flags, pinky_session** session);
+void pinky_session_set_output(pinky_session* session, FILE* output);
+pinky_status pinky_session_eval(pinky_session* session, const char* source, size_t length);
+void pinky_session_free(pinky_session* session);
+
+// The tree-walking interpreter runs a program straight from its AST, instead of compiling it for the VM.
+// It is slower, but it supports functions, which the VM does not. The program prints to stdout.
+// Functions are inlined unless PINKY_NO_OPTIMIZE is given, and PINKY_SSA_IR does not apply. With
+// PINKY_MEMOIZE, calls to pure functions which are not inlined reuse the results of identical calls.
+// With PINKY_CLOSURES, the program runs the same way, from closures converted once from its AST.
+pinky_status pinky_interpret_file(const char* filename, int flags);
+
+const char* pinky_last_error(void);
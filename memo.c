@@ -0,0 +1,348 @@
+#include "memo.h"
+
+#include <string.h>
+
+#include "arrays.h"
+#include "hashmap.h"
+#include "model.h"
+#include "utils.h"
+
+// Count the declarations of every function, and list the ones at the top level
+static void collect_functions(void* node, hashmap* declaration_counts, statement_array* top_level, int depth)
+{
+    if (node == NULL || !CHECK_ELEMENT_SUPERTYPE(node, Statement))
+        return;
+
+    size_t count;
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case StatementList_stmt:
+            void** statement_ptrs = (void**)((char*)(node) + sizeof(StatementList));
+            for (size_t i = 0; i < ((StatementList*)(node))->size; i++)
+            {
+                collect_functions(statement_ptrs[i], declaration_counts, top_level, depth);
+            }
+            break;
+
+        case If_stmt:
+            collect_functions(((If*)node)->then_branch, declaration_counts, top_level, depth + 1);
+            collect_functions(((If*)node)->else_branch, declaration_counts, top_level, depth + 1);
+            break;
+
+        case While_stmt:
+            collect_functions(((While*)node)->statements, declaration_counts, top_level, depth + 1);
+            break;
+
+        case For_stmt:
+            collect_functions(((For*)node)->statements, declaration_counts, top_level, depth + 1);
+            break;
+
+        case FuncDecl_stmt:
+            FuncDecl* func_decl = (FuncDecl*)node;
+            if (hashmap_get(declaration_counts, &func_decl->name, &count) == -1)
+                count = 0;
+            hashmap_set(declaration_counts, func_decl->name, count + 1);
+
+            if (depth == 0)
+            {
+                insert_statement_array(top_level, (size_t)func_decl);
+            }
+            collect_functions(func_decl->statements, declaration_counts, top_level, depth + 1);
+            break;
+    }
+}
+
+static int is_known_name(const string_array* names, const string_type* name)
+{
+    for (size_t i = 0; i < names->used; i++)
+    {
+        if (string_comparison(name, &names->data[i], COMPARE_EQ))
+            return 1;
+    }
+
+    return 0;
+}
+
+// Whether an element of the body of a function keeps it pure. Names holds the variables the function
+// can use, which are its parameters and the locals declared so far in the outermost block of its body
+static int is_pure_element(const hashmap* functions, void* node, string_array* names, int depth)
+{
+    if (node == NULL)
+        return 1;
+
+    size_t func_decl;
+    if (CHECK_ELEMENT_SUPERTYPE(node, Expression))
+    {
+        switch (GET_ELEMENT_TYPE(node))
+        {
+            case Identifier_expr:
+                return is_known_name(names, &((Identifier*)node)->name);
+
+            case Grouping_expr:
+                return is_pure_element(functions, ((Grouping*)node)->expression, names, depth);
+
+            case UnOp_expr:
+                return is_pure_element(functions, ((UnOp*)node)->operand, names, depth);
+
+            case BinOp_expr:
+                return is_pure_element(functions, ((BinOp*)node)->left, names, depth)
+                    && is_pure_element(functions, ((BinOp*)node)->right, names, depth);
+
+            case FuncCall_expr:
+                FuncCall* func_call = (FuncCall*)node;
+                if (hashmap_get(functions, &func_call->name, &func_decl) == -1 || !((FuncDecl*)func_decl)->is_pure)
+                    return 0;
+
+                void** args_ptrs = (void**)((char*)node + sizeof(FuncCall));
+                for (size_t i = 0; i < func_call->num_args; i++)
+                {
+                    if (!is_pure_element(functions, args_ptrs[i], names, depth))
+                        return 0;
+                }
+                return 1;
+
+            default:
+                return 1;
+        }
+    }
+
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case StatementList_stmt:
+            void** statement_ptrs = (void**)((char*)(node) + sizeof(StatementList));
+            for (size_t i = 0; i < ((StatementList*)(node))->size; i++)
+            {
+                if (!is_pure_element(functions, statement_ptrs[i], names, depth))
+                    return 0;
+            }
+            return 1;
+
+        case If_stmt:
+            return is_pure_element(functions, ((If*)node)->condition, names, depth)
+                && is_pure_element(functions, ((If*)node)->then_branch, names, depth + 1)
+                && is_pure_element(functions, ((If*)node)->else_branch, names, depth + 1);
+
+        case While_stmt:
+            return is_pure_element(functions, ((While*)node)->condition, names, depth)
+                && is_pure_element(functions, ((While*)node)->statements, names, depth + 1);
+
+        case For_stmt:
+            For* for_stmt = (For*)node;
+            return is_pure_element(functions, for_stmt->initial_assignment, names, depth + 1)
+                && is_pure_element(functions, for_stmt->stop, names, depth + 1)
+                && is_pure_element(functions, for_stmt->step, names, depth + 1)
+                && is_pure_element(functions, for_stmt->statements, names, depth + 1);
+
+        // Locals declared in inner blocks are forgotten when the block ends, so they are never listed
+        case Assignment_stmt:
+            Assignment* assign_stmt = (Assignment*)node;
+            string_type* name = &((Identifier*)assign_stmt->lhs)->name;
+            if (!is_pure_element(functions, assign_stmt->rhs, names, depth))
+                return 0;
+
+            if (assign_stmt->is_local)
+            {
+                if (depth == 0 && !is_known_name(names, name))
+                {
+                    insert_string_array(names, *name);
+                }
+                return 1;
+            }
+            return is_known_name(names, name);
+
+        case Return_stmt:
+            return is_pure_element(functions, ((Return*)node)->expression, names, depth);
+
+        default:
+            return 0;
+    }
+}
+
+static int is_pure_function(const hashmap* functions, FuncDecl* func_decl)
+{
+    string_array names;
+    init_string_array(&names, func_decl->num_params + 4);
+
+    string_type* param_ptrs = (string_type*)((char*)func_decl + sizeof(FuncDecl));
+    for (size_t i = 0; i < func_decl->num_params; i++)
+    {
+        insert_string_array(&names, param_ptrs[i]);
+    }
+
+    int is_pure = is_pure_element(functions, func_decl->statements, &names, 0);
+    free_string_array(&names);
+    return is_pure;
+}
+
+void find_pure_functions(void* ast_node)
+{
+    hashmap declaration_counts;
+    hashmap functions;
+    statement_array top_level;
+    init_hashmap(&declaration_counts, 16, 4);
+    init_hashmap(&functions, 16, 4);
+    init_statement_array(&top_level, 16);
+
+    collect_functions(ast_node, &declaration_counts, &top_level, 0);
+
+    // Functions start as pure, and the ones which are not are found until none is left, so that
+    // recursive functions can still be pure
+    size_t count;
+    for (size_t i = 0; i < top_level.used; i++)
+    {
+        FuncDecl* func_decl = (FuncDecl*)top_level.data[i];
+        hashmap_get(&declaration_counts, &func_decl->name, &count);
+        func_decl->is_pure = (count == 1);
+        if (func_decl->is_pure)
+        {
+            hashmap_set(&functions, func_decl->name, (size_t)func_decl);
+        }
+    }
+
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        for (size_t i = 0; i < top_level.used; i++)
+        {
+            FuncDecl* func_decl = (FuncDecl*)top_level.data[i];
+            if (func_decl->is_pure && !is_pure_function(&functions, func_decl))
+            {
+                func_decl->is_pure = 0;
+                changed = 1;
+            }
+        }
+    }
+
+    free_hashmap(&declaration_counts);
+    free_hashmap(&functions);
+    free_statement_array(&top_level);
+}
+
+void init_memo_cache(memo_cache* cache)
+{
+    cache->entries = NULL;
+    cache->clock = 0;
+}
+
+void free_memo_cache(memo_cache* cache)
+{
+    free(cache->entries);
+    cache->entries = NULL;
+}
+
+static int is_cacheable(const expression_result* args, size_t num_args)
+{
+    if (num_args > MEMO_MAX_ARGS)
+        return 0;
+
+    for (size_t i = 0; i < num_args; i++)
+    {
+        if (args[i].type == STRING_VALUE)
+            return 0;
+    }
+
+    return 1;
+}
+
+// Floats are compared bit by bit, as 0.0 and -0.0 are equal but might give different results
+static int is_same_value(const expression_result* value1, const expression_result* value2)
+{
+    if (value1->type != value2->type)
+        return 0;
+
+    switch (value1->type)
+    {
+        case INT_VALUE:
+            return value1->value.int_value == value2->value.int_value;
+
+        case FLOAT_VALUE:
+            return memcmp(&value1->value.float_value, &value2->value.float_value, sizeof(float_type)) == 0;
+
+        case BOOL_VALUE:
+            return value1->value.bool_value == value2->value.bool_value;
+
+        default:
+            return 1;
+    }
+}
+
+static memo_entry* find_set(const memo_cache* cache, const void* func_decl, const expression_result* args, size_t num_args)
+{
+    uint64_t hash = (uint64_t)(size_t)func_decl;
+    for (size_t i = 0; i < num_args; i++)
+    {
+        uint64_t bits = 0;
+        if (args[i].type == FLOAT_VALUE)
+            memcpy(&bits, &args[i].value.float_value, sizeof(float_type));
+        else if (args[i].type != NONE)
+            bits = (uint32_t)args[i].value.int_value;
+
+        hash = (hash ^ bits ^ ((uint64_t)args[i].type << 56)) * 0x9E3779B97F4A7C15ull;
+    }
+
+    return &cache->entries[((hash >> 32) % MEMO_NUM_SETS) * MEMO_NUM_WAYS];
+}
+
+static int is_same_call(const memo_entry* entry, const void* func_decl, const expression_result* args, size_t num_args)
+{
+    if (entry->func_decl != func_decl || entry->num_args != num_args)
+        return 0;
+
+    for (size_t i = 0; i < num_args; i++)
+    {
+        if (!is_same_value(&entry->args[i], &args[i]))
+            return 0;
+    }
+
+    return 1;
+}
+
+int memo_lookup(memo_cache* cache, const void* func_decl, const expression_result* args, size_t num_args, expression_result* result)
+{
+    if (cache->entries == NULL || !is_cacheable(args, num_args))
+        return 0;
+
+    memo_entry* set = find_set(cache, func_decl, args, num_args);
+    for (int i = 0; i < MEMO_NUM_WAYS; i++)
+    {
+        if (is_same_call(&set[i], func_decl, args, num_args))
+        {
+            set[i].last_used = ++cache->clock;
+            *result = set[i].result;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void memo_store(memo_cache* cache, const void* func_decl, const expression_result* args, size_t num_args, expression_result result)
+{
+    if (!is_cacheable(args, num_args) || result.type == STRING_VALUE)
+        return;
+
+    if (cache->entries == NULL)
+    {
+        cache->entries = calloc(MEMO_NUM_SETS * MEMO_NUM_WAYS, sizeof(memo_entry));
+        if (cache->entries == NULL)
+        {
+            PRINT_ERROR_AND_QUIT("Cannot allocate memory for the memoization cache\n");
+        }
+    }
+
+    // Free entries have never been used, so they are the first ones to be taken
+    memo_entry* set = find_set(cache, func_decl, args, num_args);
+    memo_entry* entry = &set[0];
+    for (int i = 1; i < MEMO_NUM_WAYS; i++)
+    {
+        if (set[i].last_used < entry->last_used)
+            entry = &set[i];
+    }
+
+    entry->func_decl = func_decl;
+    entry->num_args = num_args;
+    memcpy(entry->args, args, num_args * sizeof(expression_result));
+    entry->result = result;
+    entry->last_used = ++cache->clock;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "compiler_commons.h"
+
+// Memoization of pure functions in the tree-walking interpreter. It is opt-in (PINKY_MEMOIZE), as it
+// only pays off for programs which call functions again with the same arguments.
+
+// A function is pure when its result only depends on its arguments: it prints nothing, declares no
+// functions, only calls pure functions, and only reads and assigns its parameters and the variables it
+// declares with `local` in the outermost block of its body. Assigning any other variable would assign
+// the global of the same name, if there is one. Only functions declared once, at the top level of the
+// program, can be pure, so that calls by name are known to reach them.
+
+// Results are kept in a set-associative cache of bounded size, keyed on the function and the values of
+// its arguments, where each set evicts its least recently used entry once full. Calls with string
+// arguments or results are not cached, as strings live in the memory of environments.
+
+#define MEMO_MAX_ARGS 4
+#define MEMO_NUM_SETS 1024
+#define MEMO_NUM_WAYS 4
+
+typedef struct memo_entry
+{
+    // Function whose call is cached, or NULL if the entry is free
+    const void* func_decl;
+    size_t num_args;
+    expression_result args[MEMO_MAX_ARGS];
+    expression_result result;
+    uint64_t last_used;
+} memo_entry;
+
+typedef struct memo_cache
+{
+    // MEMO_NUM_SETS sets of MEMO_NUM_WAYS entries, allocated when the first result is stored
+    memo_entry* entries;
+    uint64_t clock;
+} memo_cache;
+
+// Set FuncDecl.is_pure for every function of a program
+void find_pure_functions(void* ast_node);
+
+void init_memo_cache(memo_cache* cache);
+void free_memo_cache(memo_cache* cache);
+
+// Find the result of a previous call to a function with the same arguments. Returns 0 if there is none
+int memo_lookup(memo_cache* cache, const void* func_decl, const expression_result* args, size_t num_args, expression_result* result);
+void memo_store(memo_cache* cache, const void* func_decl, const expression_result* args, size_t num_args, expression_result result);
@@ -17,7 +17,7 @@
 void init_Integer(Integer* integer_elem, int value, int line)
 {
     static const ElementInterface vtable = { print_Integer, element_size_Integer, compute_ptr_Integer };
-    static Element base = { 0, 0, &vtable };
+    static Element base = { 0, STATIC_TYPE_UNKNOWN, 0, &vtable };
     memcpy(&integer_elem->base, &base, sizeof(base));
 
     integer_elem->base.line = line;
@@ -48,7 +48,7 @@ void compute_ptr_Integer(Element* integer_elem, void* ast_base) {}
 void init_Float(Float* float_elem, double value, int line)
 {
     static const ElementInterface vtable = { print_Float, element_size_Float, compute_ptr_Float };
-    static Element base = { 0, 0, &vtable};
+    static Element base = { 0, STATIC_TYPE_UNKNOWN, 0, &vtable };
     memcpy(&float_elem->base, &base, sizeof(base));
 
     float_elem->base.line = line;
@@ -79,7 +79,7 @@ void compute_ptr_Float(Element* float_elem, void* ast_base) {}
 void init_Bool(Bool* bool_elem, char value, int line)
 {
     static const ElementInterface vtable = { print_Bool, element_size_Bool, compute_ptr_Bool };
-    static Element base = { 0, 0, &vtable};
+    static Element base = { 0, STATIC_TYPE_UNKNOWN, 0, &vtable };
     memcpy(&bool_elem->base, &base, sizeof(base));
 
     bool_elem->base.line = line;
@@ -110,7 +110,7 @@ void compute_ptr_Bool(Element* bool_elem, void* ast_base) {}
 void init_String(String* string_elem, string_type value, int line)
 {
     static const ElementInterface vtable = { print_String, element_size_String, compute_ptr_String };
-    static Element base = { 0, 0, &vtable};
+    static Element base = { 0, STATIC_TYPE_UNKNOWN, 0, &vtable };
     memcpy(&string_elem->base, &base, sizeof(base));
 
     string_elem->base.line = line;
@@ -144,13 +144,15 @@ void compute_ptr_String(Element* string_elem, void* ast_base) {}
 void init_Identifier(Identifier* identifier_elem, char* name, int length, int line)
 {
     static const ElementInterface vtable = { print_Identifier, element_size_Identifier, compute_ptr_Identifier };
-    static Element base = { 0, 0, &vtable};
+    static Element base = { 0, STATIC_TYPE_UNKNOWN, 0, &vtable };
     memcpy(&identifier_elem->base, &base, sizeof(base));
 
     identifier_elem->base.line = line;
     identifier_elem->base.tag = SET_ELEMENT_TYPE(Expression, Identifier_expr);
     identifier_elem->name.string_value = name;
     identifier_elem->name.length = length;
+    identifier_elem->scope_depth = 0;
+    identifier_elem->slot = -1;
 }
 
 void print_Identifier(const Element* identifier_elem, int depth)
@@ -185,7 +187,7 @@ void init_BinOp(BinOp* binop_elem, token_type op, size_t left, size_t right, voi
     }
 
     static const ElementInterface vtable = { print_BinOp, element_size_BinOp, compute_ptr_BinOp };
-    static Element base = { 0, 0, &vtable};
+    static Element base = { 0, STATIC_TYPE_UNKNOWN, 0, &vtable };
     memcpy(&binop_elem->base, &base, sizeof(base));
 
     binop_elem->base.line = line;
@@ -193,6 +195,8 @@ void init_BinOp(BinOp* binop_elem, token_type op, size_t left, size_t right, voi
     binop_elem->op = op;
     binop_elem->left = (void*)left;
     binop_elem->right = (void*)right;
+    binop_elem->specialization = BINOP_UNSPECIALIZED;
+    binop_elem->has_calls = -1;
 }
 
 void print_BinOp(const Element* binop_elem, int depth)
@@ -237,7 +241,7 @@ void init_UnOp(UnOp* unop_elem, token_type op, size_t operand, void* ast_base, i
     }
 
     static const ElementInterface vtable = { print_UnOp, element_size_UnOp, compute_ptr_UnOp };
-    static Element base = { 0, 0, &vtable};
+    static Element base = { 0, STATIC_TYPE_UNKNOWN, 0, &vtable };
     memcpy(&unop_elem->base, &base, sizeof(base));
 
     unop_elem->base.line = line;
@@ -284,7 +288,7 @@ void init_Grouping(Grouping* grouping_elem, size_t expression, void* ast_base, i
     }
 
     static const ElementInterface vtable = { print_Grouping, element_size_Grouping, compute_ptr_Grouping };
-    static Element base = { 0, 0, &vtable};
+    static Element base = { 0, STATIC_TYPE_UNKNOWN, 0, &vtable };
     memcpy(&grouping_elem->base, &base, sizeof(base));
 
     grouping_elem->base.line = line;
@@ -332,12 +336,13 @@ void init_StatementList(StatementList* statement_list_elem, statement_array* arr
     }
 
     static const ElementInterface vtable = { print_StatementList, element_size_StatementList, compute_ptr_StatementList };
-    static Element base = { 0, 0, &vtable};
+    static Element base = { 0, STATIC_TYPE_UNKNOWN, 0, &vtable };
     memcpy(&statement_list_elem->base, &base, sizeof(base));
 
     statement_list_elem->base.line = line;
     statement_list_elem->base.tag = SET_ELEMENT_TYPE(Statement, StatementList_stmt);
     statement_list_elem->size = array->used;
+    statement_list_elem->layout = NULL;
 
     // Insert elements into memory after the struct itself
     void** statement_ptrs = (void**)((char*)statement_list_elem + sizeof(StatementList));
@@ -406,7 +411,7 @@ void init_While(While* while_elem, size_t condition, size_t statements, void* as
     }
 
     static const ElementInterface vtable = { print_While, element_size_While, compute_ptr_While };
-    static Element base = { 0, 0, &vtable};
+    static Element base = { 0, STATIC_TYPE_UNKNOWN, 0, &vtable };
     memcpy(&while_elem->base, &base, sizeof(base));
 
     while_elem->base.line = line;
@@ -468,7 +473,7 @@ void init_Assignment(Assignment* assignment_elem, size_t lhs, size_t rhs, int is
     }
 
     static const ElementInterface vtable = { print_Assignment, element_size_Assignment, compute_ptr_Assignment };
-    static Element base = { 0, 0, &vtable };
+    static Element base = { 0, STATIC_TYPE_UNKNOWN, 0, &vtable };
     memcpy(&assignment_elem->base, &base, sizeof(base));
 
     assignment_elem->base.line = line;
@@ -518,7 +523,7 @@ void init_Print(Print* print_elem, char break_line, size_t expression, void* ast
     }
 
     static const ElementInterface vtable = { print_Print, element_size_Print, compute_ptr_Print };
-    static Element base = { 0, 0, &vtable};
+    static Element base = { 0, STATIC_TYPE_UNKNOWN, 0, &vtable };
     memcpy(&print_elem->base, &base, sizeof(base));
 
     print_elem->base.line = line;
@@ -576,7 +581,7 @@ void init_If(If* if_elem, size_t condition, size_t then_branch, size_t else_bran
     }
 
     static const ElementInterface vtable = { print_If, element_size_If, compute_ptr_If };
-    static Element base = { 0, 0, &vtable};
+    static Element base = { 0, STATIC_TYPE_UNKNOWN, 0, &vtable };
     memcpy(&if_elem->base, &base, sizeof(base));
 
     if_elem->base.line = line;
@@ -673,7 +678,7 @@ void init_For(For* for_elem, size_t initial_assignment, size_t stop, size_t step
     }
 
     static const ElementInterface vtable = { print_For, element_size_For, compute_ptr_For };
-    static Element base = { 0, 0, &vtable};
+    static Element base = { 0, STATIC_TYPE_UNKNOWN, 0, &vtable };
     memcpy(&for_elem->base, &base, sizeof(base));
 
     for_elem->base.line = line;
@@ -763,7 +768,7 @@ void init_FuncDecl(FuncDecl* func_decl_elem, string_type name, string_array* par
     }
 
     static const ElementInterface vtable = { print_FuncDecl, element_size_FuncDecl, compute_ptr_FuncDecl };
-    static Element base = { 0, 0, &vtable};
+    static Element base = { 0, STATIC_TYPE_UNKNOWN, 0, &vtable };
     memcpy(&func_decl_elem->base, &base, sizeof(base));
 
     func_decl_elem->base.line = line;
@@ -771,6 +776,7 @@ void init_FuncDecl(FuncDecl* func_decl_elem, string_type name, string_array* par
     func_decl_elem->name = name;
     func_decl_elem->num_params = params->used;
     func_decl_elem->statements = (void*)statements;
+    func_decl_elem->is_pure = 0;
 
     // Insert function parameters into memory after the struct itself
     string_type* param_ptrs = (string_type*)((char*)func_decl_elem + sizeof(FuncDecl));
@@ -834,7 +840,7 @@ void init_FuncCall(FuncCall* func_call_elem, string_type name, expression_array*
     }
     
     static const ElementInterface vtable = { print_FuncCall, element_size_FuncCall, compute_ptr_FuncCall };
-    static Element base = { 0, 0, &vtable};
+    static Element base = { 0, STATIC_TYPE_UNKNOWN, 0, &vtable };
     memcpy(&func_call_elem->base, &base, sizeof(base));
 
     func_call_elem->base.line = line;
@@ -900,7 +906,7 @@ void init_Return(Return* return_elem, size_t expression, void* ast_base, int lin
     }
 
     static const ElementInterface vtable = { print_Return, element_size_Return, compute_ptr_Return };
-    static Element base = { 0, 0, &vtable};
+    static Element base = { 0, STATIC_TYPE_UNKNOWN, 0, &vtable };
     memcpy(&return_elem->base, &base, sizeof(base));
 
     return_elem->base.line = line;
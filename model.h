@@ -47,6 +47,11 @@ enum SUPERTYPES
 #define GET_ELEMENT_SUPERTYPE(element)                 ((((Element*)(element))->tag & 0x80) >> 7)
 #define GET_ELEMENT_TYPE(element)                      ((((Element*)(element))->tag & 0x7F))
 #define GET_ELEMENT_LINE(element)                      ((((Element*)(element))->line))
+#define GET_STATIC_TYPE(element)                       ((((Element*)(element))->static_type))
+
+// Known static types take the values of result_type, while this one means that the value of the
+// expression might have any type
+#define STATIC_TYPE_UNKNOWN 0xFF
 
 // Base struct for elements
 typedef struct Element
@@ -54,6 +59,9 @@ typedef struct Element
     // Data type tag
     uint8_t tag;
 
+    // For expressions, type of their value if it is known before running the program (see typer.h)
+    uint8_t static_type;
+
     // Line where this element appears
     int line;
 
@@ -127,6 +135,12 @@ typedef struct Identifier
 {
     Element base;
     string_type name;
+
+    // For the interpreter, number of environments between the one where the identifier is used and the
+    // one holding its variable, and slot of the variable there. The slot is -1 if it is looked up by name
+    // (see resolver.h)
+    int scope_depth;
+    int slot;
 } Identifier;
 
 void init_Identifier(Identifier* identifier_elem, char* name, int length, int line);
@@ -134,6 +148,15 @@ void print_Identifier(const Element* identifier_elem, int depth);
 size_t element_size_Identifier(const Element* identifier_elem);
 void compute_ptr_Identifier(Element* identifier_elem, void* ast_base);
 
+// Types of operands which the interpreter specialized an operation to (see interpreter.c)
+enum BINOP_SPECIALIZATIONS
+{
+    BINOP_UNSPECIALIZED,
+    BINOP_INT_INT,
+    BINOP_FLOAT_FLOAT,
+    BINOP_GENERIC
+};
+
 // Operations like x + y
 typedef struct BinOp
 {
@@ -141,6 +164,12 @@ typedef struct BinOp
     token_type op;
     void* left;
     void* right;
+
+    // One of BINOP_SPECIALIZATIONS, set by the interpreter once it evaluated the operation
+    uint8_t specialization;
+
+    // Whether the operands contain calls, or -1 until the interpreter first needs to know
+    int8_t has_calls;
 } BinOp;
 
 void init_BinOp(BinOp* binop_elem, token_type op, size_t left, size_t right, void* ast_base, int line);
@@ -178,6 +207,10 @@ typedef struct StatementList
 {
     Element base;
     size_t size;
+
+    // For the body of a block, slots of the variables of its environment in the interpreter, or NULL
+    // (see resolver.h)
+    const struct scope_layout* layout;
 } StatementList;
 
 void init_StatementList(StatementList* statement_list_elem, statement_array* array, void* ast_base, int line);
@@ -261,6 +294,9 @@ typedef struct FuncDecl
     string_type name;
     size_t num_params;
     void* statements;
+
+    // Whether the result only depends on the arguments, so that calls can be memoized (see memo.h)
+    char is_pure;
 } FuncDecl;
 
 void init_FuncDecl(FuncDecl* func_decl_elem, string_type name, string_array* params, size_t statements, void* ast_base, int line);
@@ -0,0 +1,498 @@
+#include "optimizer.h"
+
+#include <string.h>
+
+#include "compiler_commons.h"
+#include "model.h"
+#include "types.h"
+#include "utils.h"
+#include "vm_ops.h"
+
+#define OPTIMIZER_TEMP_MEMORY_SIZE 65535
+
+#define IS_LITERAL(node) (CHECK_ELEMENT_SUPERTYPE(node, Expression) && \
+    (CHECK_ELEMENT_TYPE(node, Integer_expr) || CHECK_ELEMENT_TYPE(node, Float_expr) || \
+     CHECK_ELEMENT_TYPE(node, Bool_expr) || CHECK_ELEMENT_TYPE(node, String_expr)))
+
+void init_optimizer(optimizer* optimizer)
+{
+    init_vss_array(&optimizer->temp_memory, OPTIMIZER_TEMP_MEMORY_SIZE);
+    init_string_array(&optimizer->folded_strings, 64);
+    init_hashmap(&optimizer->assignment_counts, 64, 4);
+    init_hashmap(&optimizer->constants, 64, 4);
+    init_hashmap(&optimizer->read_counts, 64, 4);
+    init_inliner(&optimizer->inliner);
+}
+
+void destroy_optimizer(optimizer* optimizer)
+{
+    for (size_t i = 0; i < optimizer->folded_strings.used; i++)
+    {
+        free(optimizer->folded_strings.data[i].string_value);
+    }
+
+    free_vss_array(&optimizer->temp_memory);
+    free_string_array(&optimizer->folded_strings);
+    free_hashmap(&optimizer->assignment_counts);
+    free_hashmap(&optimizer->constants);
+    free_hashmap(&optimizer->read_counts);
+    destroy_inliner(&optimizer->inliner);
+}
+
+// The VM operations take ownership of (and free) their string operands, so they are given copies
+static void copy_string_operand(expression_result* value)
+{
+    if (value->type != STRING_VALUE)
+        return;
+
+    char* string_copy = malloc(value->value.string_value.length);
+    memcpy(string_copy, value->value.string_value.string_value, value->value.string_value.length);
+    value->value.string_value.string_value = string_copy;
+}
+
+// Value of a literal node, as the VM would push it to the stack. Strings point to the literal
+static expression_result literal_value(const void* node)
+{
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case Integer_expr:
+            return (expression_result) {.type = INT_VALUE, .value.int_value = ((Integer*)node)->value};
+
+        case Float_expr:
+            return (expression_result) {.type = FLOAT_VALUE, .value.float_value = ((Float*)node)->value};
+
+        case Bool_expr:
+            return (expression_result) {.type = BOOL_VALUE, .value.bool_value = ((Bool*)node)->value};
+
+        default:
+            return (expression_result) {.type = STRING_VALUE, .value.string_value = ((String*)node)->value};
+    }
+}
+
+// Overwrite an expression node with a literal holding the given value. Every node which can be
+// folded (BinOp, UnOp and Identifier) is at least as large as any literal node
+static void replace_with_literal(optimizer* optimizer, void* node, expression_result value)
+{
+    int line = GET_ELEMENT_LINE(node);
+    switch (value.type)
+    {
+        case INT_VALUE:
+            init_Integer(node, value.value.int_value, line);
+            break;
+
+        case FLOAT_VALUE:
+            init_Float(node, value.value.float_value, line);
+            break;
+
+        case BOOL_VALUE:
+            init_Bool(node, (char)value.value.bool_value, line);
+            break;
+
+        case STRING_VALUE:
+            insert_string_array(&optimizer->folded_strings, value.value.string_value);
+            init_String(node, value.value.string_value, line);
+            break;
+
+        default:
+            PRINT_COMPILER_ERROR_AND_QUIT(line, "Cannot fold expression into a value of type '%s'\n", type_names[value.type]);
+    }
+}
+
+int fold_constant_binop(vss_array* temp_memory, token_type op, expression_result lhs, expression_result rhs, expression_result* result)
+{
+    if (op == TOK_AND || op == TOK_OR)
+    {
+        int lhs_bool_result = cast_to_bool(temp_memory, lhs);
+        int rhs_bool_result = cast_to_bool(temp_memory, rhs);
+        *result = (expression_result) {
+            .type = BOOL_VALUE,
+            .value.bool_value = (op == TOK_AND) ? (lhs_bool_result & rhs_bool_result) : (lhs_bool_result | rhs_bool_result)
+        };
+        return 1;
+    }
+
+    vm_operation operation = get_binop_operation(op, lhs.type, rhs.type);
+    int is_zero_divisor = (rhs.type == INT_VALUE && rhs.value.int_value == 0) || (rhs.type == FLOAT_VALUE && rhs.value.float_value == 0);
+
+    // String results are built in the scratch memory before being copied, so they must fit in it
+    size_t string_length = 512;
+    if (lhs.type == STRING_VALUE) string_length += lhs.value.string_value.length;
+    if (rhs.type == STRING_VALUE) string_length += rhs.value.string_value.length;
+
+    if (operation == unsupported_op
+        || ((op == TOK_SLASH || op == TOK_MOD) && is_zero_divisor)
+        || string_length > temp_memory->size)
+    {
+        return 0;
+    }
+
+    copy_string_operand(&lhs);
+    copy_string_operand(&rhs);
+    clear_vss_array(temp_memory);
+    operation(temp_memory, &lhs, &rhs, result);
+    return 1;
+}
+
+static void fold_binop(optimizer* optimizer, BinOp* binop)
+{
+    if (!IS_LITERAL(binop->left) || !IS_LITERAL(binop->right))
+        return;
+
+    expression_result result;
+    if (fold_constant_binop(&optimizer->temp_memory, binop->op, literal_value(binop->left), literal_value(binop->right), &result))
+        replace_with_literal(optimizer, binop, result);
+}
+
+static void fold_unop(optimizer* optimizer, UnOp* unop)
+{
+    if (!IS_LITERAL(unop->operand))
+        return;
+
+    void* operand = unop->operand;
+    if (unop->op == TOK_MINUS && CHECK_ELEMENT_TYPE(operand, Integer_expr))
+    {
+        replace_with_literal(optimizer, unop, (expression_result) {.type = INT_VALUE, .value.int_value = -((Integer*)operand)->value});
+    }
+
+    else if (unop->op == TOK_MINUS && CHECK_ELEMENT_TYPE(operand, Float_expr))
+    {
+        replace_with_literal(optimizer, unop, (expression_result) {.type = FLOAT_VALUE, .value.float_value = -((Float*)operand)->value});
+    }
+
+    else if (unop->op == TOK_NOT && CHECK_ELEMENT_TYPE(operand, Bool_expr))
+    {
+        replace_with_literal(optimizer, unop, (expression_result) {.type = BOOL_VALUE, .value.bool_value = !((Bool*)operand)->value});
+    }
+
+    else if (unop->op == TOK_NOT && CHECK_ELEMENT_TYPE(operand, Integer_expr))
+    {
+        replace_with_literal(optimizer, unop, (expression_result) {.type = BOOL_VALUE, .value.bool_value = !((Integer*)operand)->value});
+    }
+}
+
+// Fold an expression, returning the node which must take its place in its parent
+static void* fold_expression(optimizer* optimizer, void* node, int propagate)
+{
+    size_t constant_node;
+
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case Identifier_expr:
+            if (propagate && hashmap_get(&optimizer->constants, &((Identifier*)node)->name, &constant_node) != -1)
+            {
+                int line = GET_ELEMENT_LINE(node);
+                memcpy(node, (void*)constant_node, element_size((Element*)constant_node));
+                ((Element*)node)->line = line;
+            }
+            return node;
+
+        // Groupings only matter to the parser, so they are dropped altogether
+        case Grouping_expr:
+            return fold_expression(optimizer, ((Grouping*)node)->expression, propagate);
+
+        case UnOp_expr:
+            UnOp* unop = (UnOp*)node;
+            unop->operand = fold_expression(optimizer, unop->operand, propagate);
+            fold_unop(optimizer, unop);
+            return node;
+
+        case BinOp_expr:
+            BinOp* binop = (BinOp*)node;
+            binop->left = fold_expression(optimizer, binop->left, propagate);
+            binop->right = fold_expression(optimizer, binop->right, propagate);
+            fold_binop(optimizer, binop);
+            return node;
+
+        case FuncCall_expr:
+            void** args_ptrs = (void**)((char*)node + sizeof(FuncCall));
+            for (size_t i = 0; i < ((FuncCall*)node)->num_args; i++)
+            {
+                args_ptrs[i] = fold_expression(optimizer, args_ptrs[i], propagate);
+            }
+            return node;
+
+        default:
+            return node;
+    }
+}
+
+static void count_assignments(optimizer* optimizer, void* node)
+{
+    if (node == NULL || !CHECK_ELEMENT_SUPERTYPE(node, Statement))
+        return;
+
+    size_t count;
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case StatementList_stmt:
+            void** statement_ptrs = (void**)((char*)(node) + sizeof(StatementList));
+            for (size_t i = 0; i < ((StatementList*)(node))->size; i++)
+            {
+                count_assignments(optimizer, statement_ptrs[i]);
+            }
+            break;
+
+        case Assignment_stmt:
+            Identifier* lhs_identifier = ((Assignment*)node)->lhs;
+            if (hashmap_get(&optimizer->assignment_counts, &lhs_identifier->name, &count) == -1)
+                count = 0;
+            hashmap_set(&optimizer->assignment_counts, lhs_identifier->name, count + 1);
+            break;
+
+        case If_stmt:
+            count_assignments(optimizer, ((If*)node)->then_branch);
+            count_assignments(optimizer, ((If*)node)->else_branch);
+            break;
+
+        case While_stmt:
+            count_assignments(optimizer, ((While*)node)->statements);
+            break;
+
+        case For_stmt:
+            count_assignments(optimizer, ((For*)node)->initial_assignment);
+            count_assignments(optimizer, ((For*)node)->statements);
+            break;
+
+        case FuncDecl_stmt:
+            count_assignments(optimizer, ((FuncDecl*)node)->statements);
+            break;
+    }
+}
+
+// Optimize a statement. Depth is the number of blocks enclosing the statement, and propagate
+// indicates whether constants can be propagated into it (they are not inside function bodies,
+// where parameters may shadow globals)
+static void optimize_statement(optimizer* optimizer, void* node, int depth, int propagate)
+{
+    if (!CHECK_ELEMENT_SUPERTYPE(node, Statement))
+    {
+        fold_expression(optimizer, node, propagate);
+        return;
+    }
+
+    size_t count;
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case StatementList_stmt:
+            void** statement_ptrs = (void**)((char*)(node) + sizeof(StatementList));
+            for (size_t i = 0; i < ((StatementList*)(node))->size; i++)
+            {
+                optimize_statement(optimizer, statement_ptrs[i], depth, propagate);
+            }
+            break;
+
+        case Print_stmt:
+            ((Print*)node)->expression = fold_expression(optimizer, ((Print*)node)->expression, propagate);
+            break;
+
+        case If_stmt:
+            If* if_stmt = (If*)node;
+            if_stmt->condition = fold_expression(optimizer, if_stmt->condition, propagate);
+            optimize_statement(optimizer, if_stmt->then_branch, depth + 1, propagate);
+            if (if_stmt->else_branch != NULL)
+            {
+                optimize_statement(optimizer, if_stmt->else_branch, depth + 1, propagate);
+            }
+            break;
+
+        case While_stmt:
+            While* while_stmt = (While*)node;
+            while_stmt->condition = fold_expression(optimizer, while_stmt->condition, propagate);
+            optimize_statement(optimizer, while_stmt->statements, depth + 1, propagate);
+            break;
+
+        case Assignment_stmt:
+            Assignment* assign_stmt = (Assignment*)node;
+            Identifier* lhs_identifier = assign_stmt->lhs;
+            assign_stmt->rhs = fold_expression(optimizer, assign_stmt->rhs, propagate);
+
+            if (depth == 0 && propagate && IS_LITERAL(assign_stmt->rhs)
+                && hashmap_get(&optimizer->assignment_counts, &lhs_identifier->name, &count) != -1 && count == 1)
+            {
+                hashmap_set(&optimizer->constants, lhs_identifier->name, (size_t)assign_stmt->rhs);
+            }
+            break;
+
+        case For_stmt:
+            For* for_stmt = (For*)node;
+            optimize_statement(optimizer, for_stmt->initial_assignment, depth + 1, propagate);
+            for_stmt->stop = fold_expression(optimizer, for_stmt->stop, propagate);
+            if (for_stmt->step != NULL)
+            {
+                for_stmt->step = fold_expression(optimizer, for_stmt->step, propagate);
+            }
+            optimize_statement(optimizer, for_stmt->statements, depth + 1, propagate);
+            break;
+
+        case FuncDecl_stmt:
+            optimize_statement(optimizer, ((FuncDecl*)node)->statements, depth + 1, 0);
+            break;
+
+        case Return_stmt:
+            ((Return*)node)->expression = fold_expression(optimizer, ((Return*)node)->expression, propagate);
+            break;
+    }
+}
+
+static void count_reads(optimizer* optimizer, void* node)
+{
+    // Missing else branches and for loop steps are NULL
+    if (node == NULL)
+        return;
+
+    size_t count;
+    if (CHECK_ELEMENT_SUPERTYPE(node, Expression))
+    {
+        switch (GET_ELEMENT_TYPE(node))
+        {
+            case Identifier_expr:
+                Identifier* identifier = (Identifier*)node;
+                if (hashmap_get(&optimizer->read_counts, &identifier->name, &count) == -1)
+                    count = 0;
+                hashmap_set(&optimizer->read_counts, identifier->name, count + 1);
+                break;
+
+            case Grouping_expr:
+                count_reads(optimizer, ((Grouping*)node)->expression);
+                break;
+
+            case UnOp_expr:
+                count_reads(optimizer, ((UnOp*)node)->operand);
+                break;
+
+            case BinOp_expr:
+                count_reads(optimizer, ((BinOp*)node)->left);
+                count_reads(optimizer, ((BinOp*)node)->right);
+                break;
+
+            case FuncCall_expr:
+                void** args_ptrs = (void**)((char*)node + sizeof(FuncCall));
+                for (size_t i = 0; i < ((FuncCall*)node)->num_args; i++)
+                {
+                    count_reads(optimizer, args_ptrs[i]);
+                }
+                break;
+        }
+        return;
+    }
+
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case StatementList_stmt:
+            void** statement_ptrs = (void**)((char*)(node) + sizeof(StatementList));
+            for (size_t i = 0; i < ((StatementList*)(node))->size; i++)
+            {
+                count_reads(optimizer, statement_ptrs[i]);
+            }
+            break;
+
+        case Print_stmt:
+            count_reads(optimizer, ((Print*)node)->expression);
+            break;
+
+        case If_stmt:
+            count_reads(optimizer, ((If*)node)->condition);
+            count_reads(optimizer, ((If*)node)->then_branch);
+            count_reads(optimizer, ((If*)node)->else_branch);
+            break;
+
+        case While_stmt:
+            count_reads(optimizer, ((While*)node)->condition);
+            count_reads(optimizer, ((While*)node)->statements);
+            break;
+
+        // The left hand side of an assignment is not a read
+        case Assignment_stmt:
+            count_reads(optimizer, ((Assignment*)node)->rhs);
+            break;
+
+        // The loop variable of a for loop is read by the loop itself
+        case For_stmt:
+            For* for_stmt = (For*)node;
+            count_reads(optimizer, ((Assignment*)for_stmt->initial_assignment)->lhs);
+            count_reads(optimizer, ((Assignment*)for_stmt->initial_assignment)->rhs);
+            count_reads(optimizer, for_stmt->stop);
+            count_reads(optimizer, for_stmt->step);
+            count_reads(optimizer, for_stmt->statements);
+            break;
+
+        case FuncDecl_stmt:
+            count_reads(optimizer, ((FuncDecl*)node)->statements);
+            break;
+
+        case Return_stmt:
+            count_reads(optimizer, ((Return*)node)->expression);
+            break;
+    }
+}
+
+// Assignments can only be removed if evaluating their value cannot have any visible effect
+static int is_dead_assignment(optimizer* optimizer, void* node)
+{
+    size_t count;
+    if (!CHECK_ELEMENT_SUPERTYPE(node, Statement) || !CHECK_ELEMENT_TYPE(node, Assignment_stmt))
+        return 0;
+
+    Assignment* assign_stmt = (Assignment*)node;
+    Identifier* lhs_identifier = assign_stmt->lhs;
+    return IS_LITERAL(assign_stmt->rhs)
+        && hashmap_get(&optimizer->read_counts, &lhs_identifier->name, &count) == -1;
+}
+
+static void eliminate_dead_code(optimizer* optimizer, void* node)
+{
+    if (node == NULL || !CHECK_ELEMENT_SUPERTYPE(node, Statement))
+        return;
+
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        // Statements are compacted in place, so the list keeps its position in the AST
+        case StatementList_stmt:
+            StatementList* statement_list = (StatementList*)node;
+            void** statement_ptrs = (void**)((char*)(node) + sizeof(StatementList));
+            size_t kept_statements = 0;
+            for (size_t i = 0; i < statement_list->size; i++)
+            {
+                void* statement = statement_ptrs[i];
+                if (is_dead_assignment(optimizer, statement))
+                    continue;
+
+                eliminate_dead_code(optimizer, statement);
+                statement_ptrs[kept_statements++] = statement;
+
+                if (CHECK_ELEMENT_SUPERTYPE(statement, Statement) && CHECK_ELEMENT_TYPE(statement, Return_stmt))
+                    break;
+            }
+            statement_list->size = kept_statements;
+            break;
+
+        case If_stmt:
+            eliminate_dead_code(optimizer, ((If*)node)->then_branch);
+            eliminate_dead_code(optimizer, ((If*)node)->else_branch);
+            break;
+
+        case While_stmt:
+            eliminate_dead_code(optimizer, ((While*)node)->statements);
+            break;
+
+        case For_stmt:
+            eliminate_dead_code(optimizer, ((For*)node)->statements);
+            break;
+
+        case FuncDecl_stmt:
+            eliminate_dead_code(optimizer, ((FuncDecl*)node)->statements);
+            break;
+    }
+}
+
+void* optimize_ast(optimizer* optimizer, void* ast_node)
+{
+    ast_node = inline_functions(&optimizer->inliner, ast_node);
+
+    count_assignments(optimizer, ast_node);
+    optimize_statement(optimizer, ast_node, 0, 1);
+
+    count_reads(optimizer, ast_node);
+    eliminate_dead_code(optimizer, ast_node);
+    return ast_node;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "arrays.h"
+#include "compiler_commons.h"
+#include "hashmap.h"
+#include "inliner.h"
+#include "tokens.h"
+
+// AST optimizer. It runs between the parser and the compiler, rewriting the AST in place:
+
+// - Function inlining: calls to small functions without effects are replaced by a copy of their body
+//   (see inliner.h), which the other optimizations then see as any other code.
+// - Constant folding: operations whose operands are all literals are replaced by their result, as
+//   long as computing them cannot fail at runtime. Results are computed with the same functions
+//   the VM uses, so that folding never changes the behaviour of a program.
+// - Constant propagation: global variables assigned only once, at the top level of the program,
+//   with a constant value, are replaced by that value wherever they are read after the assignment.
+// - Dead code elimination: statements following a return in the same block are removed, and so
+//   are assignments of constant values to variables which are never read. Branches on constant
+//   conditions are pruned later, by the compiler, as they still open a block of their own.
+
+typedef struct optimizer
+{
+    // Scratch memory for the string operations of the VM
+    vss_array temp_memory;
+
+    // Strings created by folding. The AST points to them, so they live until the optimizer is destroyed
+    string_array folded_strings;
+
+    // Number of times each variable is assigned anywhere in the program
+    hashmap assignment_counts;
+
+    // Literal node holding the value of each propagated constant
+    hashmap constants;
+
+    // Number of times each variable is read anywhere in the program, once constants are propagated
+    hashmap read_counts;
+
+    inliner inliner;
+} optimizer;
+
+void init_optimizer(optimizer* optimizer);
+void destroy_optimizer(optimizer* optimizer);
+
+void* optimize_ast(optimizer* optimizer, void* ast_node);
+
+// Compute a binary operation between constants, as the VM would. Strings are copied, so the operands
+// are left untouched, while a string result is allocated and owned by the caller. Operations which would
+// raise an error at runtime are not computed, so that the error is still raised when (and if) they are
+// executed, and 0 is returned
+int fold_constant_binop(vss_array* temp_memory, token_type op, expression_result lhs, expression_result rhs, expression_result* result);
@@ -14,11 +14,13 @@ void init_parser(parser* parser, token_array* tokens)
     parser->tokens = tokens;
     parser->curr_token = 0;
     init_vsd_array(&parser->ast_array, 0);
+    init_statement_array(&parser->pending_statements, 1024);
 }
 
 void free_parser(parser* parser)
 {
     free_vsd_array(&parser->ast_array);
+    free_statement_array(&parser->pending_statements);
 }
 
 void print_ast(const void* node)
@@ -108,9 +110,9 @@ size_t stmts(parser* parser)
     // as AST reallocs might potentially invalidate any obtained pointer.
     // However, when the statement list is fully built, these offsets can be
     // converted into pointers, and the statements realloc update function will
-    // update these properly.
-    statement_array array;
-    init_statement_array(&array, 65536);
+    // update these properly. Nested statement lists share the parser's pending statements
+    // array, each one using the range which starts after the statements of its enclosing list.
+    size_t first_statement = parser->pending_statements.used;
 
     while (parser->curr_token < parser->tokens->used && !(parser_peek(parser)->type == TOK_ELSE) && !(parser_peek(parser)->type == TOK_END))
     {
@@ -119,9 +121,15 @@ size_t stmts(parser* parser)
         {
             break;
         }
-        insert_statement_array(&array, result);
+        insert_statement_array(&parser->pending_statements, result);
     }
 
+    statement_array array = {
+        .data = parser->pending_statements.data + first_statement,
+        .size = parser->pending_statements.used - first_statement,
+        .used = parser->pending_statements.used - first_statement
+    };
+
     if (array.used == 0)
     {
         PRINT_SYNTAX_ERROR_AND_QUIT(parser_previous_token(parser)->line, "Empty statement list is not allowed");
@@ -131,7 +139,7 @@ size_t stmts(parser* parser)
     void* first_statement_ptr = OFFSET_PTR(array.data[0]);
     init_StatementList(OFFSET_PTR(stmts), &array, parser->ast_array.data, GET_ELEMENT_LINE(first_statement_ptr));
     
-    free_statement_array(&array);
+    parser->pending_statements.used = first_statement;
     return stmts;
 }
 
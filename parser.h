@@ -9,6 +9,9 @@ typedef struct
     token_array* tokens;
     int curr_token;
     vsd_array ast_array;
+
+    // Statements of every statement list being parsed, innermost list last
+    statement_array pending_statements;
 } parser;
 
 void init_parser(parser* parser, token_array* tokens);
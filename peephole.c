@@ -0,0 +1,285 @@
+#include "peephole.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "vm.h"
+
+// Maximum number of jumps followed when threading a chain of jumps, which avoids looping forever on cycles
+#define MAX_JUMP_CHAIN 16
+
+typedef struct peephole_instruction
+{
+    uint8_t opcode;
+
+    // Constant offset or variable index, or label ID for jumps
+    uint32_t operand;
+
+    // Address of the instruction in the original text
+    uint32_t addr;
+
+    char is_label_target;
+    char is_deleted;
+} peephole_instruction;
+
+typedef struct peephole_code
+{
+    peephole_instruction* instructions;
+    uint32_t num_instructions;
+
+    // Index of the instruction found at each address of the original text
+    uint32_t* instruction_at;
+} peephole_code;
+
+static int is_pure_push(uint8_t opcode)
+{
+    return opcode == OPCODE_NPUSH || opcode == OPCODE_IPUSH || opcode == OPCODE_FPUSH || opcode == OPCODE_BPUSH
+        || opcode == OPCODE_SPUSH || opcode == OPCODE_LLOAD || opcode == OPCODE_DUP;
+}
+
+static void decode_code(compiler* compiler, peephole_code* code)
+{
+    const unsigned char* text = compiler->temp_code.data;
+    uint32_t text_size = compiler->temp_code.used;
+
+    code->instructions = malloc(text_size * sizeof(peephole_instruction));
+    code->instruction_at = malloc((text_size + 1) * sizeof(uint32_t));
+    code->num_instructions = 0;
+    if (code->instructions == NULL || code->instruction_at == NULL)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot allocate memory for the peephole optimizer\n");
+    }
+
+    uint32_t addr = 0;
+    while (addr < text_size)
+    {
+        int wide = (text[addr] == OPCODE_WIDE);
+        peephole_instruction* instruction = &code->instructions[code->num_instructions];
+        instruction->opcode = text[addr + wide];
+        instruction->addr = addr;
+        instruction->is_label_target = 0;
+        instruction->is_deleted = 0;
+
+        switch (get_operand_kind(instruction->opcode))
+        {
+            case OPERAND_INDEX:
+                instruction->operand = wide ? READ_U32(text + addr + 2) : READ_U16(text + addr + 1);
+                break;
+
+            case OPERAND_ADDRESS:
+                instruction->operand = READ_U32(text + addr + 1);
+                break;
+
+            case OPERAND_SHIFT:
+                instruction->operand = text[addr + 1];
+                break;
+
+            default:
+                instruction->operand = 0;
+                break;
+        }
+
+        code->instruction_at[addr] = code->num_instructions++;
+        addr += get_instruction_length(text + addr);
+    }
+    code->instruction_at[text_size] = code->num_instructions;
+
+    for (size_t label = 0; label < compiler->label_addrs.used; label++)
+    {
+        uint32_t label_addr = compiler->label_addrs.data[label];
+        if (label_addr < text_size)
+            code->instructions[code->instruction_at[label_addr]].is_label_target = 1;
+    }
+}
+
+// Index of the first instruction at or after the given one which has not been deleted
+static uint32_t next_live(const peephole_code* code, uint32_t idx)
+{
+    while (idx < code->num_instructions && code->instructions[idx].is_deleted)
+        idx++;
+    return idx;
+}
+
+// Instruction reached when jumping to the given label
+static uint32_t label_target(const compiler* compiler, const peephole_code* code, uint32_t label)
+{
+    return next_live(code, code->instruction_at[compiler->label_addrs.data[label]]);
+}
+
+// An instruction can be jumped to if a label points to it, or to any deleted instruction right before it
+static int is_jump_target(const peephole_code* code, uint32_t idx)
+{
+    if (code->instructions[idx].is_label_target)
+        return 1;
+
+    while (idx > 0 && code->instructions[idx - 1].is_deleted)
+    {
+        idx--;
+        if (code->instructions[idx].is_label_target)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int optimize_instruction(compiler* compiler, peephole_code* code, uint32_t idx)
+{
+    peephole_instruction* instruction = &code->instructions[idx];
+    uint32_t next_idx = next_live(code, idx + 1);
+    peephole_instruction* next = (next_idx < code->num_instructions) ? &code->instructions[next_idx] : NULL;
+
+    if (get_operand_kind(instruction->opcode) == OPERAND_ADDRESS)
+    {
+        // Thread jumps to unconditional jumps
+        uint32_t label = instruction->operand;
+        uint32_t target = label_target(compiler, code, label);
+        for (int hops = 0; hops < MAX_JUMP_CHAIN && target < code->num_instructions && target != idx
+            && code->instructions[target].opcode == OPCODE_JMP; hops++)
+        {
+            label = code->instructions[target].operand;
+            target = label_target(compiler, code, label);
+        }
+
+        if (label != instruction->operand)
+        {
+            instruction->operand = label;
+            return 1;
+        }
+
+        // Unconditional jumps to the next instruction do nothing
+        if (instruction->opcode == OPCODE_JMP && target == next_idx)
+        {
+            instruction->is_deleted = 1;
+            return 1;
+        }
+
+        return 0;
+    }
+
+    if (next == NULL || is_jump_target(code, next_idx))
+        return 0;
+
+    if (is_pure_push(instruction->opcode) && next->opcode == OPCODE_POP)
+    {
+        instruction->is_deleted = 1;
+        next->is_deleted = 1;
+        return 1;
+    }
+
+    if ((instruction->opcode == OPCODE_GSTORE && next->opcode == OPCODE_GLOAD && instruction->operand == next->operand)
+        || (instruction->opcode == OPCODE_LSTORE && next->opcode == OPCODE_LLOAD && instruction->operand == next->operand))
+    {
+        next->opcode = instruction->opcode;
+        instruction->opcode = OPCODE_DUP;
+        instruction->operand = 0;
+        return 1;
+    }
+
+    return 0;
+}
+
+static void encode_instruction(vsd_array* text, const peephole_instruction* instruction)
+{
+    size_t arr_offset;
+    switch (get_operand_kind(instruction->opcode))
+    {
+        case OPERAND_INDEX:
+            if (instruction->operand > 0xFFFF)
+            {
+                arr_offset = allocate_vsd_array(text, 6);
+                *((unsigned char*)text->data + arr_offset) = OPCODE_WIDE;
+                *((unsigned char*)text->data + arr_offset + 1) = instruction->opcode;
+                WRITE_U32((unsigned char*)text->data + arr_offset + 2, instruction->operand);
+            }
+            else
+            {
+                arr_offset = allocate_vsd_array(text, 3);
+                *((unsigned char*)text->data + arr_offset) = instruction->opcode;
+                WRITE_U16((unsigned char*)text->data + arr_offset + 1, instruction->operand);
+            }
+            break;
+
+        case OPERAND_ADDRESS:
+            arr_offset = allocate_vsd_array(text, 5);
+            *((unsigned char*)text->data + arr_offset) = instruction->opcode;
+            WRITE_U32((unsigned char*)text->data + arr_offset + 1, instruction->operand);
+            break;
+
+        case OPERAND_SHIFT:
+            arr_offset = allocate_vsd_array(text, 2);
+            *((unsigned char*)text->data + arr_offset) = instruction->opcode;
+            *((unsigned char*)text->data + arr_offset + 1) = instruction->operand;
+            break;
+
+        default:
+            arr_offset = allocate_vsd_array(text, 1);
+            *((unsigned char*)text->data + arr_offset) = instruction->opcode;
+            break;
+    }
+}
+
+// Re-encode the remaining instructions, and move labels and statements to their new addresses.
+// Anything which pointed to a deleted instruction now points to the next remaining one
+static void encode_code(compiler* compiler, peephole_code* code)
+{
+    uint32_t old_size = compiler->temp_code.used;
+    uint32_t* new_addrs = malloc((code->num_instructions + 1) * sizeof(uint32_t));
+    if (new_addrs == NULL)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot allocate memory for the peephole optimizer\n");
+    }
+
+    vsd_array text;
+    init_vsd_array(&text, old_size);
+    compiler->jump_addrs.used = 0;
+    for (uint32_t i = 0; i < code->num_instructions; i++)
+    {
+        new_addrs[i] = text.used;
+        if (code->instructions[i].is_deleted)
+            continue;
+
+        if (get_operand_kind(code->instructions[i].opcode) == OPERAND_ADDRESS)
+            insert_uint32_t_array(&compiler->jump_addrs, text.used);
+        encode_instruction(&text, &code->instructions[i]);
+    }
+    new_addrs[code->num_instructions] = text.used;
+
+    for (size_t label = 0; label < compiler->label_addrs.used; label++)
+    {
+        if (compiler->label_addrs.data[label] <= old_size)
+            compiler->label_addrs.data[label] = new_addrs[code->instruction_at[compiler->label_addrs.data[label]]];
+    }
+
+    for (size_t i = 0; i < compiler->statement_addrs.used; i++)
+    {
+        compiler->statement_addrs.data[i] = new_addrs[code->instruction_at[compiler->statement_addrs.data[i]]];
+    }
+
+    free_vsd_array(&compiler->temp_code);
+    compiler->temp_code = text;
+    free(new_addrs);
+}
+
+void peephole_optimize(compiler* compiler)
+{
+    peephole_code code;
+    decode_code(compiler, &code);
+
+    // Each rewrite may enable others (e.g. removing a jump may leave a push next to a pop)
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        for (uint32_t i = 0; i < code.num_instructions; i++)
+        {
+            if (!code.instructions[i].is_deleted)
+                changed |= optimize_instruction(compiler, &code, i);
+        }
+    }
+
+    encode_code(compiler, &code);
+
+    free(code.instructions);
+    free(code.instruction_at);
+}
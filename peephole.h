@@ -0,0 +1,15 @@
+#pragma once
+
+#include "compiler.h"
+
+// Peephole optimizer. It rewrites the text being generated by the compiler (before labels are
+// solved), removing the redundancies that code generation leaves behind:
+
+// - Jumps to other unconditional jumps are redirected to the final destination of the chain.
+// - Unconditional jumps to the next instruction are removed.
+// - A push immediately followed by a pop is removed.
+// - A store immediately followed by a load of the same variable becomes a DUP followed by the store.
+
+// Pairs of instructions are never merged if the second one is the target of a jump, as it might be
+// reached without executing the first one. Label and statement addresses are updated accordingly.
+void peephole_optimize(compiler* compiler);
@@ -1,85 +1,205 @@
-#ifdef _MSC_VER
-#define _CRT_SECURE_NO_WARNINGS
-#endif
-
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <errno.h>
 
-#include "lexer.h"
-#include "parser.h"
-#include "interpreter.h"
+#include "batch.h"
+#include "libpinky.h"
+#include "repl.h"
 #include "utils.h"
-#include "compiler.h"
-#include "vm.h"
+
+#define PRINT_USAGE() printf("Usage: pinky [--no-optimize] [--no-peephole] [--ir] [--snapshot <file> [--snapshot-line <line>] | --restore <file>] <filename>\n" \
+                            "       pinky --interpret [--no-optimize] [--memoize] [--closures] <filename>\n" \
+                            "       pinky --batch <manifest> [-j <workers>]\n" \
+                            "       pinky --repl [--no-optimize] [--no-peephole]\n")
 
 int main(const int argc, char* argv[])
 {
-    // Parse program name
-    if (argc != 2)
+    char* filename = NULL;
+    char* snapshot_filename = NULL;
+    char* restore_filename = NULL;
+    char* manifest_filename = NULL;
+    int snapshot_line = 0;
+    int num_workers = 0;
+    int repl = 0;
+    int interpret = 0;
+    int compile_flags = PINKY_VERBOSE;
+
+    // Parse command line options and program name
+    for (int i = 1; i < argc; i++)
     {
-        printf("Usage: pinky <filename>\n");
-        return -1;
+        if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc)
+        {
+            snapshot_filename = argv[++i];
+        }
+
+        else if (strcmp(argv[i], "--snapshot-line") == 0 && i + 1 < argc)
+        {
+            snapshot_line = atoi(argv[++i]);
+        }
+
+        else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc)
+        {
+            restore_filename = argv[++i];
+        }
+
+        else if (strcmp(argv[i], "--no-optimize") == 0)
+        {
+            compile_flags |= PINKY_NO_OPTIMIZE;
+        }
+
+        else if (strcmp(argv[i], "--no-peephole") == 0)
+        {
+            compile_flags |= PINKY_NO_PEEPHOLE;
+        }
+
+        else if (strcmp(argv[i], "--ir") == 0)
+        {
+            compile_flags |= PINKY_SSA_IR;
+        }
+
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+        {
+            manifest_filename = argv[++i];
+        }
+
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            num_workers = atoi(argv[++i]);
+        }
+
+        else if (strcmp(argv[i], "--repl") == 0)
+        {
+            repl = 1;
+        }
+
+        else if (strcmp(argv[i], "--interpret") == 0)
+        {
+            interpret = 1;
+        }
+
+        else if (strcmp(argv[i], "--memoize") == 0)
+        {
+            compile_flags |= PINKY_MEMOIZE;
+        }
+
+        else if (strcmp(argv[i], "--closures") == 0)
+        {
+            compile_flags |= PINKY_CLOSURES;
+        }
+
+        else if (filename == NULL && argv[i][0] != '-')
+        {
+            filename = argv[i];
+        }
+
+        else
+        {
+            PRINT_USAGE();
+            return -1;
+        }
     }
 
-    // Read Pinky script
-    char* filename = argv[1];
-    FILE *fp;
+    if (manifest_filename)
+    {
+        if (filename || snapshot_filename || restore_filename)
+        {
+            PRINT_USAGE();
+            return -1;
+        }
 
-    if ((fp = fopen(filename, "r")) == NULL) {
-        // Cannot open file!
-        PRINT_ERROR_AND_QUIT("Cannot open file '%s': %s\n", filename, strerror(errno));
+        return run_batch(manifest_filename, num_workers);
     }
 
-    // File was opened successfully!
-    // Tokenizing stage
-    lexer lexer;
-    init_lexer(&lexer, fp);
-    PRINT_GOOD("Tokenizing %s\n", filename);
-    tokenize(&lexer);
-    print_tokens(&lexer);
-
-    // Parsing stage
-    parser parser;
-    init_parser(&parser, &lexer.tokens);
-    PRINT_GOOD("Parsing %s\n", filename);
-    void* ast = parse(&parser);
-    print_ast(ast);
-
-    // Interpreter stage
-    //interpreter interpreter;
-    //init_interpreter(&interpreter);
-    //PRINT_GOOD("Interpreting %s\n", filename);
-    //printf("\n");
-    //interpret_ast(&interpreter, ast);
-
-    // Compiler stage
-    compiler compiler;
-    init_compiler(&compiler);
-    PRINT_GOOD("Generating code for %s\n", filename);
-    unsigned char* bytecode = compile_code(&compiler, ast);
-    print_code(&compiler);
+    if (repl)
+    {
+        if (filename || snapshot_filename || restore_filename)
+        {
+            PRINT_USAGE();
+            return -1;
+        }
+
+        return run_repl(compile_flags & (PINKY_NO_OPTIMIZE | PINKY_NO_PEEPHOLE));
+    }
+
+    if (interpret)
+    {
+        if (filename == NULL || snapshot_filename || restore_filename)
+        {
+            PRINT_USAGE();
+            return -1;
+        }
+
+        if (pinky_interpret_file(filename, compile_flags) != PINKY_OK)
+        {
+            printf("%s\n%s%s", KRED, pinky_last_error(), KNRM);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (filename == NULL || (snapshot_filename && restore_filename))
+    {
+        PRINT_USAGE();
+        return -1;
+    }
+
+    // Tokenizing, parsing and compiler stages
+    pinky_program* program;
+    if (pinky_compile_file(filename, compile_flags, &program) != PINKY_OK)
+    {
+        printf("%s\n%s%s", KRED, pinky_last_error(), KNRM);
+        return 1;
+    }
 
     // Execution stage
-    vm vm;
-    init_vm(&vm);
+    pinky_vm* vm;
+    if (pinky_vm_create(program, &vm) != PINKY_OK)
+    {
+        printf("%s\n%s%s", KRED, pinky_last_error(), KNRM);
+        pinky_program_free(program);
+        return 1;
+    }
+
     PRINT_GOOD("Executing %s\n", filename);
     printf("\n");
-    run_vm(&vm, bytecode);
 
-    for (int i = 0; i < vm.sp; i++) 
+    pinky_status status;
+    if (snapshot_filename)
+    {
+        // Run until the snapshot point (the end of the program by default), save it, and carry on
+        status = snapshot_line ? pinky_vm_run_to_line(vm, snapshot_line) : pinky_vm_run(vm);
+        if (status == PINKY_OK)
+        {
+            status = pinky_vm_snapshot(vm, snapshot_filename);
+        }
+        if (status == PINKY_OK)
+        {
+            status = pinky_vm_resume(vm);
+        }
+    }
+
+    else if (restore_filename)
     {
-        if (i % 24 == 0) printf("\n");
-        printf("%02X ", (unsigned char)vm.stack[i]);
+        status = pinky_vm_restore(vm, restore_filename);
+        if (status == PINKY_OK)
+        {
+            status = pinky_vm_resume(vm);
+        }
+    }
+
+    else
+    {
+        status = pinky_vm_run(vm);
+    }
+
+    if (status != PINKY_OK)
+    {
+        printf("%s\n%s%s", KRED, pinky_last_error(), KNRM);
     }
 
     // Close stuff
-    free_lexer(&lexer);
-    free_parser(&parser);
-    destroy_compiler(&compiler);
-    destroy_vm(&vm);
-    //free_interpreter(&interpreter);
-    fclose(fp);
-
-    return 0;
+    pinky_vm_free(vm);
+    pinky_program_free(program);
+
+    return status == PINKY_OK ? 0 : 1;
 }
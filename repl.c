@@ -0,0 +1,139 @@
+#include "repl.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libpinky.h"
+#include "utils.h"
+
+#define REPL_LINE_SIZE 4096
+
+typedef struct repl_input
+{
+    char* data;
+    size_t used, size;
+} repl_input;
+
+static int append_input(repl_input* input, const char* line)
+{
+    size_t length = strlen(line);
+    if (input->used + length + 1 > input->size)
+    {
+        size_t size = (input->size + length + 1) * 2;
+        char* data = realloc(input->data, size);
+        if (data == NULL)
+            return 0;
+
+        input->data = data;
+        input->size = size;
+    }
+
+    memcpy(input->data + input->used, line, length + 1);
+    input->used += length;
+    return 1;
+}
+
+static int is_word(const char* start, size_t length, const char* word)
+{
+    return strlen(word) == length && strncmp(start, word, length) == 0;
+}
+
+// Number of blocks opened and not closed yet by the given code, skipping strings and comments
+static int count_open_blocks(const char* code)
+{
+    int open_blocks = 0;
+    const char* ch = code;
+    while (*ch != '\0')
+    {
+        if (*ch == '"' || *ch == '\'')
+        {
+            char quote = *ch++;
+            while (*ch != '\0' && *ch != quote)
+            {
+                ch++;
+            }
+            if (*ch != '\0')
+                ch++;
+        }
+
+        else if (ch[0] == '-' && ch[1] == '-')
+        {
+            while (*ch != '\0' && *ch != '\n')
+            {
+                ch++;
+            }
+        }
+
+        else if (isalpha((unsigned char)*ch) || *ch == '_')
+        {
+            const char* word = ch;
+            while (isalnum((unsigned char)*ch) || *ch == '_')
+            {
+                ch++;
+            }
+
+            size_t length = ch - word;
+            if (is_word(word, length, "if") || is_word(word, length, "while") || is_word(word, length, "for") || is_word(word, length, "func"))
+                open_blocks++;
+            else if (is_word(word, length, "end"))
+                open_blocks--;
+        }
+
+        else
+        {
+            ch++;
+        }
+    }
+
+    return open_blocks;
+}
+
+int run_repl(int flags)
+{
+    pinky_session* session;
+    if (pinky_session_create(flags, &session) != PINKY_OK)
+    {
+        printf("%s%s%s\n", KRED, pinky_last_error(), KNRM);
+        return 1;
+    }
+
+    repl_input input = { NULL, 0, 0 };
+    char line[REPL_LINE_SIZE];
+
+    printf("> ");
+    fflush(stdout);
+    while (fgets(line, REPL_LINE_SIZE, stdin) != NULL)
+    {
+        if (!append_input(&input, line))
+        {
+            printf("%sCannot allocate memory for the input%s\n", KRED, KNRM);
+            break;
+        }
+
+        // Incomplete statements are completed by the next lines
+        if (count_open_blocks(input.data) > 0)
+        {
+            printf(". ");
+            fflush(stdout);
+            continue;
+        }
+
+        if (pinky_session_eval(session, input.data, input.used) != PINKY_OK)
+        {
+            const char* message = pinky_last_error();
+            size_t length = strlen(message);
+            printf("%s%s%s%s", KRED, message, KNRM, (length > 0 && message[length - 1] == '\n') ? "" : "\n");
+        }
+
+        input.used = 0;
+        printf("> ");
+        fflush(stdout);
+    }
+
+    printf("\n");
+    free(input.data);
+    pinky_session_free(session);
+    return 0;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+// Interactive mode. Source code is read from the standard input, and each complete statement is
+// evaluated as soon as it is entered, in a session which keeps the globals of every previous one
+// (see pinky_session in libpinky.h). Statements spanning several lines, such as loops, are read
+// until the "end" closing them.
+
+// Returns 0 once the input ends
+int run_repl(int flags);
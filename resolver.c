@@ -0,0 +1,319 @@
+#include "resolver.h"
+
+#include <stdlib.h>
+
+#include "model.h"
+#include "utils.h"
+
+MAKE_FSD_ARRAY_FUNCTIONS(scope_layout*, layout)
+
+// Block whose statements are being resolved. The blocks enclosing it follow the parent links, the same
+// way their environments will at runtime
+typedef struct scope_frame
+{
+    scope_layout* layout;
+
+    // Variables which the environment of the block is known to hold at the statement being resolved,
+    // with their slots
+    hashmap known;
+
+    // Whether accesses cannot be resolved past this block, which is the body of a function not declared
+    // at the top level
+    int is_opaque;
+
+    struct scope_frame* parent;
+} scope_frame;
+
+static void resolve_node(resolver* resolver, scope_frame* frame, void* node);
+static int find_variable(const scope_frame* frame, const string_type* name, int* depth, int* slot);
+
+void init_resolver(resolver* resolver)
+{
+    init_layout_array(&resolver->layouts, 16);
+}
+
+void destroy_resolver(resolver* resolver)
+{
+    for (size_t i = 0; i < resolver->layouts.used; i++)
+    {
+        free_hashmap(&resolver->layouts.data[i]->slots);
+        free(resolver->layouts.data[i]);
+    }
+    free_layout_array(&resolver->layouts);
+}
+
+static void add_slot(scope_layout* layout, string_type name)
+{
+    size_t slot;
+    if (hashmap_get(&layout->slots, &name, &slot) == -1)
+    {
+        hashmap_set(&layout->slots, name, layout->num_slots++);
+    }
+}
+
+// Add a slot for every variable the statements of a block might create. Assignments to variables which
+// an enclosing block is known to hold when the block starts (outside, unless it is NULL) always store
+// there, and nested blocks have layouts of their own
+static void collect_slots(scope_layout* layout, void* node, const scope_frame* outside)
+{
+    if (node == NULL || !CHECK_ELEMENT_SUPERTYPE(node, Statement))
+        return;
+
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case StatementList_stmt:
+            void** statement_ptrs = (void**)((char*)(node) + sizeof(StatementList));
+            for (size_t i = 0; i < ((StatementList*)(node))->size; i++)
+            {
+                collect_slots(layout, statement_ptrs[i], outside);
+            }
+            break;
+
+        case Assignment_stmt:
+            Assignment* assignment = (Assignment*)node;
+            string_type name = ((Identifier*)assignment->lhs)->name;
+            int depth, slot;
+            if (assignment->is_local || outside == NULL || !find_variable(outside, &name, &depth, &slot))
+            {
+                add_slot(layout, name);
+            }
+            break;
+    }
+}
+
+// Layouts are attached to the statement list of the block, which is what the interpreter finds when
+// entering it. A block which is not a list gets no layout, so the accesses resolved to its environment
+// fall back to looking up their names
+static scope_layout* new_layout(resolver* resolver, void* block)
+{
+    scope_layout* layout = malloc(sizeof(scope_layout));
+    if (layout == NULL)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot allocate memory for the layout of a block\n");
+    }
+    init_hashmap(&layout->slots, 8, 4);
+    layout->num_slots = 0;
+    insert_layout_array(&resolver->layouts, layout);
+
+    if (block != NULL && GET_ELEMENT_TYPE(block) == StatementList_stmt)
+    {
+        ((StatementList*)block)->layout = layout;
+    }
+    return layout;
+}
+
+static void enter_frame(scope_frame* frame, scope_frame* parent, scope_layout* layout, int is_opaque)
+{
+    frame->layout = layout;
+    init_hashmap(&frame->known, 8, 4);
+    frame->is_opaque = is_opaque;
+    frame->parent = parent;
+}
+
+static void leave_frame(scope_frame* frame)
+{
+    free_hashmap(&frame->known);
+}
+
+static void set_known(scope_frame* frame, string_type name)
+{
+    size_t slot;
+    if (hashmap_get(&frame->layout->slots, &name, &slot) != -1)
+    {
+        hashmap_set(&frame->known, name, slot);
+    }
+}
+
+// Find the block holding a variable, as the number of blocks enclosing the innermost one up to it, and
+// its slot there. Returns 0 if it cannot be known
+static int find_variable(const scope_frame* frame, const string_type* name, int* depth, int* slot)
+{
+    size_t index;
+    for (*depth = 0; frame != NULL; frame = frame->parent, (*depth)++)
+    {
+        if (hashmap_get(&frame->known, name, &index) != -1)
+        {
+            *slot = (int)index;
+            return 1;
+        }
+
+        if (hashmap_get(&frame->layout->slots, name, &index) != -1 || frame->is_opaque)
+            return 0;
+    }
+
+    return 0;
+}
+
+// Whether none of the blocks enclosing the innermost one can hold a variable
+static int is_held_outside(const scope_frame* frame, const string_type* name)
+{
+    size_t index;
+    for (; frame != NULL; frame = frame->parent)
+    {
+        if (frame->is_opaque)
+            return 1;
+
+        if (frame->parent != NULL && hashmap_get(&frame->parent->layout->slots, name, &index) != -1)
+            return 1;
+    }
+
+    return 0;
+}
+
+static void resolve_identifier(const scope_frame* frame, Identifier* identifier)
+{
+    int depth, slot;
+    if (find_variable(frame, &identifier->name, &depth, &slot))
+    {
+        identifier->scope_depth = depth;
+        identifier->slot = slot;
+    }
+    else
+    {
+        identifier->scope_depth = 0;
+        identifier->slot = -1;
+    }
+}
+
+// An assignment stores into the block itself when the variable is local, or when no enclosing block can
+// hold it, as it is created in the block if missing. Otherwise it stores where the variable is found
+static void resolve_assignment(resolver* resolver, scope_frame* frame, Assignment* assignment)
+{
+    resolve_node(resolver, frame, assignment->rhs);
+
+    Identifier* lhs = assignment->lhs;
+    if (assignment->is_local || !is_held_outside(frame, &lhs->name))
+    {
+        set_known(frame, lhs->name);
+    }
+    resolve_identifier(frame, lhs);
+}
+
+// Resolve the statements of a block, in the environment of a function when func_decl is given
+static void resolve_block(resolver* resolver, scope_frame* parent, void* block, FuncDecl* func_decl)
+{
+    scope_layout* layout = new_layout(resolver, block);
+    scope_frame frame;
+    int is_opaque = func_decl != NULL && parent->parent != NULL;
+    enter_frame(&frame, parent, layout, is_opaque);
+
+    if (func_decl != NULL)
+    {
+        string_type* param_ptrs = (string_type*)((char*)func_decl + sizeof(FuncDecl));
+        for (size_t i = 0; i < func_decl->num_params; i++)
+        {
+            add_slot(layout, param_ptrs[i]);
+            set_known(&frame, param_ptrs[i]);
+        }
+    }
+
+    collect_slots(layout, block, is_opaque ? NULL : parent);
+    resolve_node(resolver, &frame, block);
+    leave_frame(&frame);
+}
+
+static void resolve_node(resolver* resolver, scope_frame* frame, void* node)
+{
+    if (node == NULL)
+        return;
+
+    if (CHECK_ELEMENT_SUPERTYPE(node, Expression))
+    {
+        switch (GET_ELEMENT_TYPE(node))
+        {
+            case Identifier_expr:
+                resolve_identifier(frame, node);
+                break;
+
+            case Grouping_expr:
+                resolve_node(resolver, frame, ((Grouping*)node)->expression);
+                break;
+
+            case UnOp_expr:
+                resolve_node(resolver, frame, ((UnOp*)node)->operand);
+                break;
+
+            case BinOp_expr:
+                resolve_node(resolver, frame, ((BinOp*)node)->left);
+                resolve_node(resolver, frame, ((BinOp*)node)->right);
+                break;
+
+            case FuncCall_expr:
+                void** args_ptrs = (void**)((char*)node + sizeof(FuncCall));
+                for (size_t i = 0; i < ((FuncCall*)node)->num_args; i++)
+                {
+                    resolve_node(resolver, frame, args_ptrs[i]);
+                }
+                break;
+        }
+        return;
+    }
+
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case StatementList_stmt:
+            void** statement_ptrs = (void**)((char*)(node) + sizeof(StatementList));
+            for (size_t i = 0; i < ((StatementList*)(node))->size; i++)
+            {
+                resolve_node(resolver, frame, statement_ptrs[i]);
+            }
+            break;
+
+        case Assignment_stmt:
+            resolve_assignment(resolver, frame, node);
+            break;
+
+        case Print_stmt:
+            resolve_node(resolver, frame, ((Print*)node)->expression);
+            break;
+
+        case Return_stmt:
+            resolve_node(resolver, frame, ((Return*)node)->expression);
+            break;
+
+        case If_stmt:
+            resolve_node(resolver, frame, ((If*)node)->condition);
+            resolve_block(resolver, frame, ((If*)node)->then_branch, NULL);
+            if (((If*)node)->else_branch != NULL)
+            {
+                resolve_block(resolver, frame, ((If*)node)->else_branch, NULL);
+            }
+            break;
+
+        case While_stmt:
+            resolve_node(resolver, frame, ((While*)node)->condition);
+            resolve_block(resolver, frame, ((While*)node)->statements, NULL);
+            break;
+
+        // The loop runs its initial assignment, its bounds and its body in the same environment
+        case For_stmt:
+            For* for_stmt = (For*)node;
+            scope_layout* layout = new_layout(resolver, for_stmt->statements);
+            scope_frame for_frame;
+            enter_frame(&for_frame, frame, layout, 0);
+
+            collect_slots(layout, for_stmt->initial_assignment, frame);
+            collect_slots(layout, for_stmt->statements, frame);
+            resolve_node(resolver, &for_frame, for_stmt->initial_assignment);
+            resolve_node(resolver, &for_frame, for_stmt->stop);
+            resolve_node(resolver, &for_frame, for_stmt->step);
+            resolve_node(resolver, &for_frame, for_stmt->statements);
+            leave_frame(&for_frame);
+            break;
+
+        case FuncDecl_stmt:
+            resolve_block(resolver, frame, ((FuncDecl*)node)->statements, node);
+            break;
+    }
+}
+
+void resolve_variables(resolver* resolver, void* ast_node)
+{
+    scope_layout* layout = new_layout(resolver, ast_node);
+    scope_frame frame;
+    enter_frame(&frame, NULL, layout, 0);
+
+    collect_slots(layout, ast_node, NULL);
+    resolve_node(resolver, &frame, ast_node);
+    leave_frame(&frame);
+}
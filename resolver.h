@@ -0,0 +1,37 @@
+#pragma once
+
+#include "array_generics.h"
+#include "compiler_commons.h"
+
+// Static scope resolution for the tree-walking interpreter. Every block runs in an environment of its
+// own, and looking up a variable by name hashes it again in each environment enclosing the access until
+// one holds it. The resolver works out before the program runs which environment, and which slot of it,
+// each access ends up in, so that the interpreter reaches the variable with an indexed load instead.
+
+// Variables are created where they are first assigned if no enclosing environment holds them, so where
+// a variable lives can depend on the path the program took. Accesses are only resolved when it cannot:
+// - Each block gets a layout with a slot for every variable its environment might hold: the parameters
+//   of a function, and the names its statements declare local or assign while no enclosing block is
+//   known to hold them yet.
+// - A variable is known to be in a block once the block received it as a parameter, declared it local,
+//   or assigned it while no enclosing block could hold it.
+// - An access resolves to the innermost block where the variable is known to be, as long as none of the
+//   blocks in between might hold it as well.
+// - Functions declared at the top level of the program see the globals known where they are declared.
+//   Other functions only resolve their own variables, as the environment they were declared in might
+//   not be the one they are called from.
+// Other accesses are looked up by name, as before. Environments keep a slot for each variable either way.
+
+MAKE_FSD_ARRAY_HEADERS(scope_layout*, layout)
+
+typedef struct resolver
+{
+    // Layouts of the blocks of the program, which the AST points to
+    layout_array layouts;
+} resolver;
+
+void init_resolver(resolver* resolver);
+void destroy_resolver(resolver* resolver);
+
+// Give a layout to every block of a program, and set the scope depth and slot of every identifier
+void resolve_variables(resolver* resolver, void* ast_node);
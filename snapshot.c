@@ -0,0 +1,174 @@
+#include "snapshot.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "utils.h"
+
+// Apply an action to every string referenced by the VM: globals first, in index order, and then
+// the stack, from bottom to top. Saving and loading snapshots rely on both following this order
+#define FOR_EACH_VM_STRING(vm, value, action) do { \
+    for (size_t i = 0; i < (vm)->free_var_idx; i++) \
+    { \
+        value = (expression_result*)((char*)(vm)->environment.variables_memory.data + (vm)->environment.variable_addrs.data[i]); \
+        if (value->type == STRING_VALUE) { action; } \
+    } \
+    for (uint32_t offset = 0; offset < (vm)->sp; offset += sizeof(expression_result)) \
+    { \
+        value = (expression_result*)((vm)->stack + offset); \
+        if (value->type == STRING_VALUE) { action; } \
+    } \
+} while(0)
+
+#define WRITE_OR_QUIT(ptr, size, file) \
+    if (fwrite(ptr, 1, size, file) != (size)) { PRINT_ERROR_AND_QUIT("Cannot write VM snapshot\n"); }
+
+#define READ_OR_QUIT(ptr, size, file) \
+    if (fread(ptr, 1, size, file) != (size)) { PRINT_ERROR_AND_QUIT("Cannot read VM snapshot: file is truncated\n"); }
+
+// 64-bit FNV-1a hash
+uint64_t hash_program(const unsigned char* program, size_t size)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= program[i];
+        hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+void save_vm_snapshot(const vm* vm, uint64_t program_hash, FILE* file)
+{
+    expression_result* value;
+    snapshot_header header = {
+        .version = SNAPSHOT_VERSION,
+        .program_hash = program_hash,
+        .pc = vm->pc,
+        .sp = vm->sp,
+        .num_globals = vm->free_var_idx,
+        .globals_size = vm->environment.variables_memory.used,
+        .strings_size = 0
+    };
+    memcpy(header.magic, SNAPSHOT_MAGIC, 4);
+    FOR_EACH_VM_STRING(vm, value, header.strings_size += value->value.string_value.length);
+
+    WRITE_OR_QUIT(&header, sizeof(header), file);
+    for (size_t i = 0; i < vm->free_var_idx; i++)
+    {
+        uint64_t global_offset = vm->environment.variable_addrs.data[i];
+        WRITE_OR_QUIT(&global_offset, sizeof(global_offset), file);
+    }
+    WRITE_OR_QUIT(vm->environment.variables_memory.data, vm->environment.variables_memory.used, file);
+    WRITE_OR_QUIT(vm->stack, vm->sp, file);
+
+    // String pointers stored in the globals and the stack are meaningless once restored, so
+    // the contents of the strings are written after them, in the same order as they appear
+    FOR_EACH_VM_STRING(vm, value, WRITE_OR_QUIT(value->value.string_value.string_value, (size_t) value->value.string_value.length, file));
+}
+
+void load_vm_snapshot(vm* vm, uint64_t program_hash, uint32_t text_size, FILE* file)
+{
+    expression_result* value;
+    snapshot_header header;
+
+    READ_OR_QUIT(&header, sizeof(header), file);
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, 4) != 0 || header.version != SNAPSHOT_VERSION)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot read VM snapshot: not a snapshot, or taken by another version of Pinky\n");
+    }
+
+    if (header.program_hash != program_hash)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot read VM snapshot: it was taken from a different program\n");
+    }
+
+    // The hash only proves the program matches, the pc itself still has to point inside its text
+    if (header.pc >= text_size)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot read VM snapshot: file is corrupted\n");
+    }
+
+    if (header.sp > VM_STACK_RESERVE || header.sp % sizeof(expression_result) != 0 || header.num_globals * sizeof(expression_result) > header.globals_size)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot read VM snapshot: file is corrupted\n");
+    }
+
+    // Read the whole snapshot body before touching the VM, so that a broken snapshot leaves it untouched
+    size_t body_size = header.num_globals * sizeof(uint64_t) + header.globals_size + header.sp + header.strings_size;
+    char* body = malloc(body_size);
+    if (body == NULL)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot allocate memory for VM snapshot\n");
+    }
+
+    if (fread(body, 1, body_size, file) != body_size)
+    {
+        free(body);
+        PRINT_ERROR_AND_QUIT("Cannot read VM snapshot: file is truncated\n");
+    }
+
+    for (size_t i = 0; i < header.num_globals; i++)
+    {
+        uint64_t global_offset;
+        memcpy(&global_offset, body + i * sizeof(global_offset), sizeof(global_offset));
+        if (global_offset + sizeof(expression_result) > header.globals_size)
+        {
+            free(body);
+            PRINT_ERROR_AND_QUIT("Cannot read VM snapshot: file is corrupted\n");
+        }
+    }
+
+    // Drop the current state of the VM
+    FOR_EACH_VM_STRING(vm, value, free(value->value.string_value.string_value));
+    vm->sp = 0;
+    vm->free_var_idx = 0;
+    vm->environment.variable_addrs.used = 0;
+    clear_vsd_array(&vm->environment.variables_memory);
+
+    // Restore globals and stack
+    char* body_ptr = body;
+    for (size_t i = 0; i < header.num_globals; i++)
+    {
+        uint64_t global_offset;
+        memcpy(&global_offset, body_ptr, sizeof(global_offset));
+        insert_vm_variables_array(&vm->environment.variable_addrs, (size_t) global_offset);
+        body_ptr += sizeof(global_offset);
+    }
+    vm->free_var_idx = header.num_globals;
+
+    allocate_vsd_array(&vm->environment.variables_memory, header.globals_size);
+    memcpy(vm->environment.variables_memory.data, body_ptr, header.globals_size);
+    body_ptr += header.globals_size;
+
+    if (header.sp > vm->stack_committed)
+    {
+        grow_vm_stack(vm, header.sp);
+    }
+    memcpy(vm->stack, body_ptr, header.sp);
+    body_ptr += header.sp;
+    vm->sp = header.sp;
+
+    // Give every string its own copy of its contents
+    uint64_t strings_size = 0;
+    FOR_EACH_VM_STRING(vm, value, strings_size += value->value.string_value.length);
+    if (strings_size != header.strings_size)
+    {
+        vm->sp = 0;
+        vm->free_var_idx = 0;
+        free(body);
+        PRINT_ERROR_AND_QUIT("Cannot read VM snapshot: file is corrupted\n");
+    }
+
+    FOR_EACH_VM_STRING(vm, value,
+        char* string_ptr = malloc(value->value.string_value.length);
+        memcpy(string_ptr, body_ptr, value->value.string_value.length);
+        body_ptr += value->value.string_value.length;
+        value->value.string_value.string_value = string_ptr
+    );
+
+    vm->pc = header.pc;
+    free(body);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "vm.h"
+
+// A snapshot holds the complete state of a VM at some point of the execution of a program: its
+// globals, its stack, every string referenced by them, and the address of the next instruction to
+// execute. Restoring it lets a VM resume execution from that point without running everything
+// that came before it again.
+
+// Snapshots are raw dumps of the VM memory, so they can only be restored by the same build of
+// Pinky that took them, and only on top of the exact program they were taken from. This is
+// checked by storing a hash of the program in the snapshot.
+
+#define SNAPSHOT_MAGIC "PNKS"
+#define SNAPSHOT_VERSION 1
+
+typedef struct snapshot_header
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t program_hash;
+    uint32_t pc;
+    uint32_t sp;
+    uint64_t num_globals;
+    uint64_t globals_size;
+    uint64_t strings_size;
+} snapshot_header;
+
+uint64_t hash_program(const unsigned char* program, size_t size);
+
+void save_vm_snapshot(const vm* vm, uint64_t program_hash, FILE* file);
+void load_vm_snapshot(vm* vm, uint64_t program_hash, uint32_t text_size, FILE* file);
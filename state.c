@@ -5,19 +5,41 @@
 
 #include "utils.h"
 
+// Environments start small, as most blocks only hold a few variables, and grow as needed
 void init_environment(environment* e, environment* parent)
 {
-    init_hashmap(&e->variables, 32, 32);
-    init_vsd_array(&e->variables_memory, 65535);
-    init_hashmap(&e->functions, 32, 32);
+    e->layout = NULL;
+    e->slots = NULL;
+    e->slot_sizes = NULL;
+    e->num_slots = 0;
+    e->slots_capacity = 0;
+    init_hashmap(&e->variables, 8, 4);
+    init_vsd_array(&e->variables_memory, 256);
+    e->dead_bytes = 0;
+    e->retired_memory = NULL;
+    init_hashmap(&e->functions, 4, 2);
     e->parent = parent;
 }
 
+static void free_retired_memory(environment* e)
+{
+    while (e->retired_memory != NULL)
+    {
+        void* next = *(void**)e->retired_memory;
+        free(e->retired_memory);
+        e->retired_memory = next;
+    }
+}
+
 void clear_environment(environment* e)
 {
     clear_hashmap(&e->variables);
     clear_hashmap(&e->functions);
     clear_vsd_array(&e->variables_memory);
+    free_retired_memory(e);
+    e->dead_bytes = 0;
+    e->layout = NULL;
+    e->num_slots = 0;
 }
 
 void free_environment(environment* e)
@@ -25,67 +47,248 @@ void free_environment(environment* e)
     free_hashmap(&e->variables);
     free_hashmap(&e->functions);
     free_vsd_array(&e->variables_memory);
+    free_retired_memory(e);
+    free(e->slots);
+    free(e->slot_sizes);
+}
+
+static void reserve_slots(environment* e, int num_slots)
+{
+    if (num_slots <= e->slots_capacity)
+        return;
+
+    int capacity = (e->slots_capacity * 2 > num_slots) ? e->slots_capacity * 2 : num_slots;
+    void* temp = realloc(e->slots, capacity * sizeof(size_t));
+    void* temp_sizes = (temp != NULL) ? realloc(e->slot_sizes, capacity * sizeof(size_t)) : NULL;
+    if (temp == NULL || temp_sizes == NULL)
+    {
+        PRINT_ERROR_AND_QUIT("Cannot allocate memory for the variables of an environment\n");
+    }
+    e->slots = temp;
+    e->slot_sizes = temp_sizes;
+    e->slots_capacity = capacity;
+}
+
+// Give the environment the slots of the block it is about to run, all of them empty
+void set_environment_layout(environment* e, const scope_layout* layout)
+{
+    int num_slots = (layout != NULL) ? layout->num_slots : 0;
+    reserve_slots(e, num_slots);
+    for (int i = 0; i < num_slots; i++)
+    {
+        e->slots[i] = EMPTY_SLOT;
+    }
+
+    e->layout = layout;
+    e->num_slots = num_slots;
+}
+
+static int find_slot(const environment* e, const string_type* name)
+{
+    size_t slot;
+    if (e->layout != NULL && !hashmap_get(&e->layout->slots, name, &slot))
+        return (int)slot;
+
+    if (!hashmap_get(&e->variables, name, &slot))
+        return (int)slot;
+
+    return -1;
+}
+
+static int add_slot(environment* e, string_type name)
+{
+    reserve_slots(e, e->num_slots + 1);
+    e->slots[e->num_slots] = EMPTY_SLOT;
+    hashmap_set(&e->variables, name, e->num_slots);
+    return e->num_slots++;
+}
+
+// Variables keep the bytes they were given, rounded so that the next ones stay aligned, and their new
+// values are written over the old ones when they fit. A string which outgrows its variable is moved, with
+// room to grow as much again, and the bytes it leaves behind are reclaimed once there are enough of them.
+//
+// Values being evaluated may still point to the strings of variables, as an operand waits for a call to
+// return, so strings are only written over, and variables only moved, by the call which owns them. Strings
+// stored from other calls, such as returned values, take new bytes as before, without freeing the memory
+// they grow out of, and the next store of the call which owns the environment reclaims what they left.
+static size_t get_block_size(expression_result value)
+{
+    size_t alignment = _Alignof(expression_result);
+    return (get_value_size(value) + alignment - 1) & ~(alignment - 1);
+}
+
+// Whether an environment enclosing the current one belongs to the same call, as the blocks of a function
+// do up to the environment of the function itself, and the blocks of the main program up to the main one
+static int is_same_frame(const environment* state, const environment* target)
+{
+    while (state != target)
+    {
+        if (state->type == ENV_FUNC)
+            return 0;
+        state = state->parent;
+    }
+    return 1;
+}
+
+static void write_variable(environment* e, size_t variable_offset, expression_result value)
+{
+    char* variable_address = (char*)e->variables_memory.data + variable_offset;
+    if (value.type == STRING_VALUE)
+    {
+        // The string may be the one of the variable itself
+        memmove(variable_address + sizeof(expression_result), value.value.string_value.string_value, value.value.string_value.length);
+        value.value.string_value.string_value = (char*) (variable_offset + sizeof(expression_result));
+    }
+    memcpy(variable_address, &value, sizeof(expression_result));
+}
+
+// Move the variables next to each other, dropping the bytes no variable uses
+static void compact_variables(environment* e)
+{
+    size_t live_bytes = e->variables_memory.used - e->dead_bytes;
+    vsd_array compacted;
+    init_vsd_array(&compacted, (live_bytes > 256) ? live_bytes : 256);
+    for (int i = 0; i < e->num_slots; i++)
+    {
+        if (e->slots[i] == EMPTY_SLOT)
+            continue;
+
+        size_t variable_offset = allocate_vsd_array(&compacted, e->slot_sizes[i]);
+        memcpy((char*)compacted.data + variable_offset, (char*)e->variables_memory.data + e->slots[i], e->slot_sizes[i]);
+        e->slots[i] = variable_offset;
+    }
+
+    free_vsd_array(&e->variables_memory);
+    e->variables_memory = compacted;
+    e->dead_bytes = 0;
+}
+
+// Move the variables to a larger memory, keeping the old one until the call which owns the environment is
+// back. Its first bytes, where the type of a variable was, link it to the memory retired before it
+static void retire_variables_memory(environment* e, size_t bytes)
+{
+    size_t size = e->variables_memory.size * 2;
+    vsd_array grown;
+    init_vsd_array(&grown, (size > e->variables_memory.used + bytes) ? size : e->variables_memory.used + bytes);
+    memcpy(grown.data, e->variables_memory.data, e->variables_memory.used);
+    grown.used = e->variables_memory.used;
+
+    *(void**)e->variables_memory.data = e->retired_memory;
+    e->retired_memory = e->variables_memory.data;
+    e->variables_memory = grown;
+}
+
+// Give a variable new bytes for its value, leaving the old ones behind
+static void move_variable(const environment* state, environment* e, int slot, expression_result value)
+{
+    int is_owner = is_same_frame(state, e);
+    size_t variable_offset = e->slots[slot];
+    size_t block_size = get_block_size(value);
+    if (variable_offset != EMPTY_SLOT)
+    {
+        e->dead_bytes += e->slot_sizes[slot];
+        if (is_owner && block_size < 2 * e->slot_sizes[slot])
+        {
+            block_size = 2 * e->slot_sizes[slot];
+        }
+    }
+
+    if (!is_owner && e->variables_memory.used + block_size > e->variables_memory.size)
+    {
+        retire_variables_memory(e, block_size);
+    }
+
+    // The string may be in this environment, which moves if it grows
+    char* memory = e->variables_memory.data;
+    char* string = (value.type == STRING_VALUE) ? value.value.string_value.string_value : NULL;
+    int is_in_memory = string >= memory && string < memory + e->variables_memory.used;
+
+    variable_offset = allocate_vsd_array(&e->variables_memory, block_size);
+    if (is_in_memory)
+    {
+        value.value.string_value.string_value = (char*)e->variables_memory.data + (string - memory);
+    }
+
+    write_variable(e, variable_offset, value);
+    e->slots[slot] = variable_offset;
+    e->slot_sizes[slot] = block_size;
+}
+
+// Store a variable of an environment enclosing the current one, state
+static void store_variable(const environment* state, environment* e, int slot, expression_result value)
+{
+    size_t variable_offset = e->slots[slot];
+    if (variable_offset != EMPTY_SLOT && value.type != STRING_VALUE)
+    {
+        expression_result* variable_address = (expression_result*)((char*)e->variables_memory.data + variable_offset);
+        variable_address->type = value.type;
+        variable_address->value = value.value;
+    }
+    else if (variable_offset != EMPTY_SLOT && get_block_size(value) <= e->slot_sizes[slot] && is_same_frame(state, e))
+    {
+        write_variable(e, variable_offset, value);
+    }
+    else
+    {
+        move_variable(state, e, slot, value);
+    }
+
+    if ((e->retired_memory != NULL || e->dead_bytes > ENV_DEAD_BYTES_LIMIT) && is_same_frame(state, e))
+    {
+        free_retired_memory(e);
+        if (e->dead_bytes > ENV_DEAD_BYTES_LIMIT && e->dead_bytes > e->variables_memory.used / 2)
+        {
+            compact_variables(e);
+        }
+    }
+}
+
+static expression_result load_variable(const environment* e, int slot)
+{
+    char* variable_address = (char*)e->variables_memory.data + e->slots[slot];
+    expression_result variable = *(expression_result*)variable_address;
+    if(variable.type == STRING_VALUE)
+    {
+        variable.value.string_value.string_value = variable_address + sizeof(expression_result);
+    }
+
+    return variable;
 }
 
 // Set a variable value, either in the current environment (if it exists there), or in the
 // nearest parent in which it exists. If it does not exist, create it in the current environment.
-// For strings, new memory will always be allocated.
 void set_variable(environment* state, string_type name, expression_result value, int force_local)
 {
     environment* current = state;
-    size_t variable_offset = 0;
+    int slot;
     while(!force_local && current)
     {
-        if (!hashmap_get(&current->variables, &name, &variable_offset))
+        slot = find_slot(current, &name);
+        if (slot != -1 && current->slots[slot] != EMPTY_SLOT)
         {
-            if (value.type == STRING_VALUE)
-            {
-                variable_offset = allocate_vsd_array(&current->variables_memory, get_value_size(value));
-                char* variable_address = (char*)current->variables_memory.data + variable_offset;
-                memcpy(variable_address, &value, sizeof(expression_result));
-                memcpy(variable_address + sizeof(expression_result), value.value.string_value.string_value, value.value.string_value.length);
-                ((expression_result*)variable_address)->value.string_value.string_value = (char*) variable_offset + sizeof(expression_result);
-                hashmap_set(&current->variables, name, variable_offset);
-            }
-            else
-            {
-                expression_result* variable_address = (expression_result*)((char*)current->variables_memory.data + variable_offset);
-                variable_address->type = value.type;
-                variable_address->value = value.value;
-            }
+            store_variable(state, current, slot, value);
             return;
         }
         current = current->parent;
     }
 
-    variable_offset = allocate_vsd_array(&state->variables_memory, get_value_size(value));
-    char* variable_address = (char*)state->variables_memory.data + variable_offset;
-    memcpy(variable_address, &value, sizeof(expression_result));
-    if (value.type == STRING_VALUE)
+    slot = find_slot(state, &name);
+    if (slot == -1)
     {
-        memcpy(variable_address + sizeof(expression_result), value.value.string_value.string_value, value.value.string_value.length);
-        ((expression_result*)variable_address)->value.string_value.string_value = (char*) (variable_offset + sizeof(expression_result));
+        slot = add_slot(state, name);
     }
-    
-    hashmap_set(&state->variables, name, variable_offset);
+    store_variable(state, state, slot, value);
 }
 
 expression_result get_variable(environment* state, string_type name, int line)
 {
     environment* current = state;
-    size_t variable_offset = 0;
     while(current)
     {
-        if (!hashmap_get(&current->variables, &name, &variable_offset))
+        int slot = find_slot(current, &name);
+        if (slot != -1 && current->slots[slot] != EMPTY_SLOT)
         {
-            char* variable_address = (char*)current->variables_memory.data + variable_offset;
-            expression_result variable = *(expression_result*)variable_address;
-            if(variable.type == STRING_VALUE)
-            {
-                variable.value.string_value.string_value = variable_address + sizeof(expression_result);
-            }
-
-            return variable;
+            return load_variable(current, slot);
         }
         current = current->parent;
     }
@@ -93,15 +296,58 @@ expression_result get_variable(environment* state, string_type name, int line)
     PRINT_INTERPRETER_ERROR_AND_QUIT(line, "Cannot find variable '%.*s'", name.length, name.string_value);
 }
 
+// The resolver proves where these variables are, so they are reached without looking up their names.
+// A variable which is not set yet is looked up by name, to fail the same way
+static environment* find_environment(environment* state, int depth)
+{
+    while (depth-- > 0 && state != NULL)
+    {
+        state = state->parent;
+    }
+    return state;
+}
+
+expression_result get_variable_at(environment* state, int depth, int slot, string_type name, int line)
+{
+    environment* target = find_environment(state, depth);
+    if (target != NULL && slot >= 0 && slot < target->num_slots && target->slots[slot] != EMPTY_SLOT)
+    {
+        return load_variable(target, slot);
+    }
+
+    return get_variable(state, name, line);
+}
+
+// Assignments to the current environment may create the variable, as the resolver proved that no outer
+// environment holds it
+void set_variable_at(environment* state, int depth, int slot, string_type name, expression_result value, int force_local)
+{
+    environment* target = find_environment(state, depth);
+    if (target != NULL && slot >= 0 && slot < target->num_slots && (target->slots[slot] != EMPTY_SLOT || depth == 0))
+    {
+        store_variable(state, target, slot, value);
+        return;
+    }
+
+    set_variable(state, name, value, force_local);
+}
+
 
 void set_return(environment* state, expression_result value, int line)
 {
     environment* current = state;
     while (current->type != ENV_MAIN)
     {
+        // Stored from the function, as the caller may still be using the value its last call returned
         if (current->type == ENV_FUNC)
         {
-            set_variable(current->parent, ret_var, value, 1);
+            environment* target = current->parent;
+            int slot = find_slot(target, &ret_var);
+            if (slot == -1)
+            {
+                slot = add_slot(target, ret_var);
+            }
+            store_variable(current, target, slot, value);
             return;
         }
         current = current->parent;
@@ -5,9 +5,12 @@
 void init_environment(environment* e, environment* parent);
 void clear_environment(environment* e);
 void free_environment(environment* e);
+void set_environment_layout(environment* e, const scope_layout* layout);
 
 void set_variable(environment* state, string_type name, expression_result value, int force_local);
 expression_result get_variable(environment* state, string_type name, int line);
+expression_result get_variable_at(environment* state, int depth, int slot, string_type name, int line);
+void set_variable_at(environment* state, int depth, int slot, string_type name, expression_result value, int force_local);
 void set_return(environment* state, expression_result value, int line);
 
 int set_function(environment* state, string_type func_name, function func);
@@ -0,0 +1,57 @@
+# Helpers of the scripts which check that programs print the same however they are run. Scripts set
+# PINKY to the path of pinky, source this file, and exit with $failed.
+
+failed=0
+
+# Programs which are not expected to run on the VM, as it does not support functions
+VM_UNSUPPORTED="scripts/functest.pinky tests/interpreter_calls.pinky tests/interpreter_recursion.pinky tests/interpreter_strings.pinky"
+
+# Programs which run for too long are stopped, as a broken optimization may make a loop never end
+LIMIT=""
+if command -v timeout >/dev/null 2>&1; then
+    LIMIT="timeout 60"
+fi
+
+# Whether an exit status means that pinky was killed by a signal, or stopped for running too long
+is_crash() {
+    [ "$1" -gt 128 ] || { [ -n "$LIMIT" ] && [ "$1" -eq 124 ]; }
+}
+
+is_vm_unsupported() {
+    case " $VM_UNSUPPORTED " in
+        *" $1 "*) return 0 ;;
+    esac
+    return 1
+}
+
+# Output of the program itself, after the tokens, AST and code printed before it runs, with the exit
+# status of pinky
+run() {
+    output=$($LIMIT "$PINKY" "$@" 2>&1)
+    status=$?
+    printf '%s\n' "$output" | awk '/Executing|Interpreting/ { found = 1 } found'
+    return $status
+}
+
+# Run a program with two lists of options and check that it prints the same with both, including the
+# errors that stop it. Programs must not crash nor be stopped, and must print something.
+# Usage: compare <name> <program> <first options> <second options>
+compare() {
+    first=$(run $3 "$2")
+    first_status=$?
+    second=$(run $4 "$2")
+    second_status=$?
+
+    if is_crash $first_status || is_crash $second_status; then
+        echo "FAIL $1: crashed or timed out (exit status $first_status and $second_status)"
+        failed=1
+    elif [ -z "$first" ] && [ -z "$second" ]; then
+        echo "FAIL $1: does not run"
+        failed=1
+    elif [ "$first" != "$second" ]; then
+        echo "FAIL $1: output differs with $4"
+        failed=1
+    else
+        echo "ok   $1"
+    fi
+}
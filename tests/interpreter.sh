@@ -0,0 +1,32 @@
+#!/bin/sh
+# Run every program through the tree-walking interpreter, and check that it prints the same with the
+# closure engine, with memoized calls, and without the AST optimizations (which inline calls).
+# Usage: tests/interpreter.sh [path to pinky]
+
+PINKY=${1:-bin/pinky}
+. "$(dirname "$0")/common.sh"
+
+# Programs which recurse deeper than the closure engine allows, as it runs on the C stack
+CLOSURES_UNSUPPORTED="tests/interpreter_recursion.pinky"
+
+for program in scripts/*.pinky tests/*.pinky; do
+    case " $CLOSURES_UNSUPPORTED " in
+        *" $program "*) echo "SKIP $program (--closures): recurses too deep for the closure engine" ;;
+        *) compare "$program (--closures)" "$program" "--interpret" "--interpret --closures" ;;
+    esac
+
+    compare "$program (--memoize)" "$program" "--interpret" "--interpret --memoize"
+    compare "$program (--no-optimize)" "$program" "--interpret" "--interpret --no-optimize"
+done
+
+# The programs written for the interpreter must also run to the end, which comparing them does not show
+for program in tests/interpreter_*.pinky; do
+    run --interpret "$program" >/dev/null
+    status=$?
+    if [ $status -ne 0 ]; then
+        echo "FAIL $program: exit status $status"
+        failed=1
+    fi
+done
+
+exit $failed
@@ -0,0 +1,18 @@
+#!/bin/sh
+# Run every program with and without the optimizations of the compiler (such as loop invariant hoisting
+# and strength reduction), and check that they print the same, including the errors that stop them.
+# Usage: tests/optimizer.sh [path to pinky]
+
+PINKY=${1:-bin/pinky}
+. "$(dirname "$0")/common.sh"
+
+for program in scripts/*.pinky tests/*.pinky; do
+    if is_vm_unsupported "$program"; then
+        echo "SKIP $program: not supported by the VM"
+        continue
+    fi
+
+    compare "$program" "$program" "" "--no-optimize"
+done
+
+exit $failed
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Run every program with and without the peephole optimizer (see peephole.h), through both code
+# generators, and check that they print the same.
+# Usage: tests/peephole.sh [path to pinky]
+
+PINKY=${1:-bin/pinky}
+. "$(dirname "$0")/common.sh"
+
+for program in scripts/*.pinky tests/*.pinky; do
+    if is_vm_unsupported "$program"; then
+        echo "SKIP $program: not supported by the VM"
+        continue
+    fi
+
+    for pipeline in "" "--ir"; do
+        compare "$program${pipeline:+ ($pipeline)}" "$program" "$pipeline" "$pipeline --no-peephole"
+    done
+done
+
+exit $failed
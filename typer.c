@@ -0,0 +1,390 @@
+#include "typer.h"
+
+#include <string.h>
+
+#include "compiler_commons.h"
+#include "model.h"
+#include "utils.h"
+
+// Shadowed variable of those which do not shadow another one
+#define NO_VARIABLE UINT32_MAX
+
+static void init_type_environment(type_environment* environment)
+{
+    init_string_array(&environment->names, 64);
+    init_uint32_t_array(&environment->types, 64);
+    init_uint32_t_array(&environment->shadows, 64);
+    init_hashmap(&environment->variables, 64, 4);
+}
+
+static void free_type_environment(type_environment* environment)
+{
+    free_string_array(&environment->names);
+    free_uint32_t_array(&environment->types);
+    free_uint32_t_array(&environment->shadows);
+    free_hashmap(&environment->variables);
+}
+
+// Names resolve to the innermost variable declared with them, so there is none at or after the first
+// entry when that one comes before it
+static int find_variable(const type_environment* environment, const string_type* name, size_t first)
+{
+    size_t idx;
+    if (hashmap_get(&environment->variables, name, &idx) == -1 || idx == NO_VARIABLE || idx < first)
+        return -1;
+
+    return (int)idx;
+}
+
+static uint8_t get_variable_type(const type_environment* environment, const string_type* name)
+{
+    int idx = find_variable(environment, name, 0);
+    return (idx == -1) ? STATIC_TYPE_UNKNOWN : environment->types.data[idx];
+}
+
+// Set the type of a variable, declaring it if it is not found after the first entry
+static void set_variable_type(type_environment* environment, string_type name, uint8_t type, size_t first)
+{
+    int idx = find_variable(environment, &name, first);
+    if (idx != -1)
+    {
+        environment->types.data[idx] = type;
+        return;
+    }
+
+    size_t shadowed;
+    if (hashmap_get(&environment->variables, &name, &shadowed) == -1)
+        shadowed = NO_VARIABLE;
+
+    hashmap_set(&environment->variables, name, environment->names.used);
+    insert_string_array(&environment->names, name);
+    insert_uint32_t_array(&environment->types, type);
+    insert_uint32_t_array(&environment->shadows, shadowed);
+}
+
+// Drop the variables declared after the first ones, so that those they shadow are visible again
+static void drop_variables(type_environment* environment, size_t count)
+{
+    for (size_t i = environment->names.used; i > count; i--)
+    {
+        hashmap_set(&environment->variables, environment->names.data[i - 1], environment->shadows.data[i - 1]);
+    }
+
+    environment->names.used = count;
+    environment->types.used = count;
+    environment->shadows.used = count;
+}
+
+static void clear_type_environment(type_environment* environment)
+{
+    clear_hashmap(&environment->variables);
+    environment->names.used = 0;
+    environment->types.used = 0;
+    environment->shadows.used = 0;
+}
+
+static void forget_variable_types(type_environment* environment)
+{
+    for (size_t i = 0; i < environment->types.used; i++)
+    {
+        environment->types.data[i] = STATIC_TYPE_UNKNOWN;
+    }
+}
+
+// Environments at the same point of the program list the same variables, in the same order, as the
+// variables declared inside blocks are dropped at their end. So only their types are kept to compare
+// or merge them with those at another point
+static void save_variable_types(const type_environment* environment, uint32_t_array* types)
+{
+    types->used = 0;
+    for (size_t i = 0; i < environment->types.used; i++)
+    {
+        insert_uint32_t_array(types, environment->types.data[i]);
+    }
+}
+
+static void restore_variable_types(type_environment* environment, const uint32_t_array* types)
+{
+    for (size_t i = 0; i < environment->types.used && i < types->used; i++)
+    {
+        environment->types.data[i] = types->data[i];
+    }
+}
+
+// Keep only the types both of them agree on
+static void merge_variable_types(type_environment* environment, const uint32_t_array* other)
+{
+    for (size_t i = 0; i < environment->types.used; i++)
+    {
+        if (i >= other->used || other->data[i] != environment->types.data[i])
+            environment->types.data[i] = STATIC_TYPE_UNKNOWN;
+    }
+}
+
+static int equal_variable_types(const type_environment* environment, const uint32_t_array* other)
+{
+    if (environment->types.used != other->used)
+        return 0;
+
+    for (size_t i = 0; i < other->used; i++)
+    {
+        if (environment->types.data[i] != other->data[i])
+            return 0;
+    }
+
+    return 1;
+}
+
+void init_typer(typer* typer)
+{
+    init_type_environment(&typer->environment);
+    typer->block_start = 0;
+    typer->scope_depth = 0;
+}
+
+void destroy_typer(typer* typer)
+{
+    free_type_environment(&typer->environment);
+}
+
+uint8_t get_binop_result_type(token_type op, uint8_t lhs_type, uint8_t rhs_type)
+{
+    int lhs_is_number = (lhs_type == INT_VALUE || lhs_type == FLOAT_VALUE);
+    int rhs_is_number = (rhs_type == INT_VALUE || rhs_type == FLOAT_VALUE);
+
+    switch (op)
+    {
+        case TOK_EQEQ:
+        case TOK_NE:
+        case TOK_GT:
+        case TOK_GE:
+        case TOK_LT:
+        case TOK_LE:
+        case TOK_AND:
+        case TOK_OR:
+            return BOOL_VALUE;
+
+        case TOK_PLUS:
+            if (lhs_type == STRING_VALUE || rhs_type == STRING_VALUE)
+                return STRING_VALUE;
+        // fallthrough
+        case TOK_MINUS:
+        case TOK_STAR:
+        case TOK_SLASH:
+        case TOK_MOD:
+        case TOK_CARET:
+            if (lhs_type == INT_VALUE && rhs_type == INT_VALUE)
+                return INT_VALUE;
+            if (lhs_is_number && rhs_is_number)
+                return FLOAT_VALUE;
+            return STATIC_TYPE_UNKNOWN;
+
+        default:
+            return STATIC_TYPE_UNKNOWN;
+    }
+}
+
+static uint8_t infer_expression_type(typer* typer, void* node)
+{
+    uint8_t type = STATIC_TYPE_UNKNOWN;
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case Integer_expr:
+            type = INT_VALUE;
+            break;
+
+        case Float_expr:
+            type = FLOAT_VALUE;
+            break;
+
+        case Bool_expr:
+            type = BOOL_VALUE;
+            break;
+
+        case String_expr:
+            type = STRING_VALUE;
+            break;
+
+        case Identifier_expr:
+            type = get_variable_type(&typer->environment, &((Identifier*)node)->name);
+            break;
+
+        case Grouping_expr:
+            type = infer_expression_type(typer, ((Grouping*)node)->expression);
+            break;
+
+        // Negating anything other than a number leaves it untouched
+        case UnOp_expr:
+            type = infer_expression_type(typer, ((UnOp*)node)->operand);
+            if (((UnOp*)node)->op == TOK_NOT)
+                type = BOOL_VALUE;
+            break;
+
+        case BinOp_expr:
+            uint8_t lhs_type = infer_expression_type(typer, ((BinOp*)node)->left);
+            uint8_t rhs_type = infer_expression_type(typer, ((BinOp*)node)->right);
+            type = get_binop_result_type(((BinOp*)node)->op, lhs_type, rhs_type);
+            break;
+
+        case FuncCall_expr:
+            void** args_ptrs = (void**)((char*)node + sizeof(FuncCall));
+            for (size_t i = 0; i < ((FuncCall*)node)->num_args; i++)
+            {
+                infer_expression_type(typer, args_ptrs[i]);
+            }
+            forget_variable_types(&typer->environment);
+            break;
+    }
+
+    ((Element*)node)->static_type = type;
+    return type;
+}
+
+static void infer_statement_types(typer* typer, void* node);
+
+// Blocks open a scope, like in the compiler, and the variables declared in them are dropped at their end
+static void infer_block_types(typer* typer, void* statements)
+{
+    size_t outer_block_start = typer->block_start;
+    typer->block_start = typer->environment.names.used;
+    typer->scope_depth += 1;
+
+    infer_statement_types(typer, statements);
+
+    drop_variables(&typer->environment, typer->block_start);
+    typer->block_start = outer_block_start;
+    typer->scope_depth -= 1;
+}
+
+// Analyse the body of a loop until the types at its start are the same in two consecutive iterations.
+// Each round can only make types unknown, so this always ends
+static void infer_loop_types(typer* typer, void* condition, void* statements)
+{
+    uint32_t_array entry, before_loop;
+    init_uint32_t_array(&entry, 64);
+    init_uint32_t_array(&before_loop, 64);
+    save_variable_types(&typer->environment, &before_loop);
+
+    do
+    {
+        save_variable_types(&typer->environment, &entry);
+        if (condition != NULL)
+            infer_expression_type(typer, condition);
+        infer_block_types(typer, statements);
+        merge_variable_types(&typer->environment, &before_loop);
+        merge_variable_types(&typer->environment, &entry);
+    } while (!equal_variable_types(&typer->environment, &entry));
+
+    // The loop exits after evaluating its condition at the start of some iteration
+    restore_variable_types(&typer->environment, &entry);
+
+    free_uint32_t_array(&entry);
+    free_uint32_t_array(&before_loop);
+}
+
+static void infer_statement_types(typer* typer, void* node)
+{
+    switch (GET_ELEMENT_TYPE(node))
+    {
+        case StatementList_stmt:
+            void** statement_ptrs = (void**)((char*)(node) + sizeof(StatementList));
+            for (size_t i = 0; i < ((StatementList*)(node))->size; i++)
+            {
+                infer_statement_types(typer, statement_ptrs[i]);
+            }
+            break;
+
+        case Print_stmt:
+            infer_expression_type(typer, ((Print*)node)->expression);
+            break;
+
+        case If_stmt:
+            If* if_stmt = (If*)node;
+            infer_expression_type(typer, if_stmt->condition);
+
+            // Branches on constant conditions are pruned by the compiler
+            if (CHECK_ELEMENT_TYPE(if_stmt->condition, Bool_expr))
+            {
+                void* taken_branch = ((Bool*)if_stmt->condition)->value ? if_stmt->then_branch : if_stmt->else_branch;
+                if (taken_branch != NULL)
+                    infer_block_types(typer, taken_branch);
+                break;
+            }
+
+            uint32_t_array before_types, then_types;
+            init_uint32_t_array(&before_types, 64);
+            init_uint32_t_array(&then_types, 64);
+            save_variable_types(&typer->environment, &before_types);
+
+            // The else branch is analysed starting from the same types as the then branch, while the
+            // types after the then branch are set aside
+            infer_block_types(typer, if_stmt->then_branch);
+            if (if_stmt->else_branch != NULL)
+            {
+                save_variable_types(&typer->environment, &then_types);
+                restore_variable_types(&typer->environment, &before_types);
+                infer_block_types(typer, if_stmt->else_branch);
+                merge_variable_types(&typer->environment, &then_types);
+            }
+            else
+            {
+                merge_variable_types(&typer->environment, &before_types);
+            }
+
+            free_uint32_t_array(&before_types);
+            free_uint32_t_array(&then_types);
+            break;
+
+        case While_stmt:
+            While* while_stmt = (While*)node;
+            if (CHECK_ELEMENT_TYPE(while_stmt->condition, Bool_expr) && !((Bool*)while_stmt->condition)->value)
+                break;
+
+            infer_loop_types(typer, while_stmt->condition, while_stmt->statements);
+            break;
+
+        case Assignment_stmt:
+            Assignment* assign_stmt = (Assignment*)node;
+            uint8_t type = infer_expression_type(typer, assign_stmt->rhs);
+            size_t first = (assign_stmt->is_local && typer->scope_depth > 0) ? typer->block_start : 0;
+            set_variable_type(&typer->environment, ((Identifier*)assign_stmt->lhs)->name, type, first);
+            break;
+
+        // The loop variable is updated by the loop itself
+        case For_stmt:
+            For* for_stmt = (For*)node;
+            infer_statement_types(typer, for_stmt->initial_assignment);
+            infer_expression_type(typer, for_stmt->stop);
+            if (for_stmt->step != NULL)
+                infer_expression_type(typer, for_stmt->step);
+            set_variable_type(&typer->environment, ((Identifier*)((Assignment*)for_stmt->initial_assignment)->lhs)->name, STATIC_TYPE_UNKNOWN, 0);
+            infer_loop_types(typer, NULL, for_stmt->statements);
+            break;
+
+        // Functions can be called from anywhere, so nothing is known about the variables they use
+        case FuncDecl_stmt:
+            type_environment outer_environment = typer->environment;
+            init_type_environment(&typer->environment);
+
+            size_t outer_block_start = typer->block_start;
+            typer->block_start = 0;
+            infer_block_types(typer, ((FuncDecl*)node)->statements);
+            typer->block_start = outer_block_start;
+
+            free_type_environment(&typer->environment);
+            typer->environment = outer_environment;
+            break;
+
+        case Return_stmt:
+            infer_expression_type(typer, ((Return*)node)->expression);
+            break;
+    }
+}
+
+void infer_types(typer* typer, void* ast_node)
+{
+    clear_type_environment(&typer->environment);
+    typer->block_start = 0;
+    typer->scope_depth = 0;
+    infer_statement_types(typer, ast_node);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "arrays.h"
+#include "hashmap.h"
+#include "tokens.h"
+
+// Static type inference. It runs after the AST optimizer, annotating every expression with the type of
+// its value (GET_STATIC_TYPE) whenever it is the same every time the expression is evaluated, so that
+// the compiler can emit typed instructions which skip the dynamic type dispatch.
+
+// Types are tracked per variable and per program point: an assignment sets the type of its variable
+// until the next one, branches keep only the types both of them agree on, and loops are analysed until
+// the types at their start stop changing. Function calls might assign any variable, so nothing is known
+// about variables after them.
+
+// Types of the variables visible at some point of the program, in declaration order. Variables not
+// listed are of unknown type. Each name resolves through the hashmap to the innermost variable declared
+// with it, which keeps the one it shadows, to be visible again once it is dropped at the end of its block
+typedef struct type_environment
+{
+    string_array names;
+    uint32_t_array types;
+    uint32_t_array shadows;
+    hashmap variables;
+} type_environment;
+
+typedef struct typer
+{
+    type_environment environment;
+
+    // First variable declared in the innermost block, and the number of blocks enclosing it
+    size_t block_start;
+    uint32_t scope_depth;
+} typer;
+
+void init_typer(typer* typer);
+void destroy_typer(typer* typer);
+
+void infer_types(typer* typer, void* ast_node);
+
+// Result type of a binary operation, following the operation tables of the VM. Operations which fail
+// never produce a value, so their result can be given any type
+uint8_t get_binop_result_type(token_type op, uint8_t lhs_type, uint8_t rhs_type);
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "errors.h"
+
 // Terminal color printing variables
 #define KNRM  "\x1B[0m"
 #define KRED  "\x1B[31m"
@@ -13,22 +16,40 @@
 #define KCYN  "\x1B[36m"
 #define KWHT  "\x1B[37m"
 
-#define PRINT_ERROR_AND_QUIT(...) printf("%s", KRED); printf("\nGeneral compiler error: "); printf(__VA_ARGS__); printf(KNRM); exit(1)
-#define PRINT_SYNTAX_ERROR_AND_QUIT(line, ...) printf("%s", KRED); printf("\nSyntax error [line %d]: ", line); printf(__VA_ARGS__); printf(KNRM); exit(1)
-#define PRINT_LEXER_ERROR_AND_QUIT(line, column, ...) printf("%s", KRED); printf("\nLexer error [line %d, column %d]: ", line, column); printf(__VA_ARGS__); printf(KNRM); exit(1)
-#define PRINT_INTERPRETER_ERROR_AND_QUIT(line, ...) printf("%s", KRED); printf("\nInterpreter error [line %d]: ", line); printf(__VA_ARGS__); printf(KNRM); exit(1)
-#define PRINT_COMPILER_ERROR_AND_QUIT(line, ...) printf("%s", KRED); printf("\nCompiler error [line %d]: ", line); printf(__VA_ARGS__); printf(KNRM); exit(1)
-#define PRINT_VM_ERROR_AND_QUIT(line, ...) printf("%s", KRED); printf("\nVM runtime error [line %d]: ", line); printf(__VA_ARGS__); printf(KNRM); exit(1)
+#define PRINT_ERROR_AND_QUIT(...) raise_error(ERROR_GENERAL, 0, 0, __VA_ARGS__)
+#define PRINT_SYNTAX_ERROR_AND_QUIT(line, ...) raise_error(ERROR_SYNTAX, line, 0, __VA_ARGS__)
+#define PRINT_LEXER_ERROR_AND_QUIT(line, column, ...) raise_error(ERROR_LEXER, line, column, __VA_ARGS__)
+#define PRINT_INTERPRETER_ERROR_AND_QUIT(line, ...) raise_error(ERROR_INTERPRETER, line, 0, __VA_ARGS__)
+#define PRINT_COMPILER_ERROR_AND_QUIT(line, ...) raise_error(ERROR_COMPILER, line, 0, __VA_ARGS__)
+#define PRINT_VM_ERROR_AND_QUIT(line, ...) raise_error(ERROR_VM, line, 0, __VA_ARGS__)
 #define PRINT_WARNING(...) printf("%s", KYEL); printf(__VA_ARGS__); printf(KNRM)
 #define PRINT_GOOD(...) printf("%s", KGRN); printf(__VA_ARGS__); printf(KNRM)
 
+// Exponentiation by squaring. The exponent is taken as unsigned and the arithmetic wraps around, which
+// gives the same result as multiplying the base by itself exp times, in logarithmic time
 inline int int_pow(int base, int exp)
 {
-    int result = 1;
-    while (exp)
+    unsigned int result = 1;
+    unsigned int factor = (unsigned int)base;
+    unsigned int remaining = (unsigned int)exp;
+    while (remaining)
+    {
+        if (remaining & 1)
+        {
+            result *= factor;
+        }
+        factor *= factor;
+        remaining >>= 1;
+    }
+    return (int)result;
+}
+
+// pow() is exact for squares, but far slower than a single multiplication
+inline double float_pow(double base, double exp)
+{
+    if (exp == 2.0)
     {
-        result *= base;
-        exp--;
+        return base * base;
     }
-    return result;
+    return pow(base, exp);
 }
@@ -1,3 +1,7 @@
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#endif
+
 #include "vm.h"
 
 #include "arrays.h"
@@ -6,12 +10,144 @@
 #include "utils.h"
 #include "vm_ops.h"
 
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Fetch the operand of the current instruction, honoring a preceding WIDE prefix
+#define FETCH_OPERAND(dest) do { \
+    if (wide_operand) \
+    { \
+        dest = READ_U32(code + vm->pc); \
+        vm->pc += 4; \
+        wide_operand = 0; \
+    } \
+    else \
+    { \
+        dest = READ_U16(code + vm->pc); \
+        vm->pc += 2; \
+    } \
+} while(0)
+
+#define FETCH_ADDRESS(dest) do { \
+    dest = READ_U32(code + vm->pc); \
+    vm->pc += 4; \
+} while(0)
+
+// Typed instructions know the types of both operands, so they work in place on the value below the
+// top of the stack, which becomes their result
+#define TYPED_BINOP(field, op) do { \
+    rhs = pop(vm); \
+    lhs = (expression_result*)(vm->stack + vm->sp - sizeof(expression_result)); \
+    lhs->value.field = lhs->value.field op rhs->value.field; \
+} while(0)
+
+#define TYPED_COMPARISON(field, op) do { \
+    rhs = pop(vm); \
+    lhs = (expression_result*)(vm->stack + vm->sp - sizeof(expression_result)); \
+    lhs->value.bool_value = lhs->value.field op rhs->value.field; \
+    lhs->type = BOOL_VALUE; \
+} while(0)
+
+#define INT_COMPARISON_JUMP(op) do { \
+    FETCH_ADDRESS(jump_address); \
+    rhs = pop(vm); \
+    lhs = pop(vm); \
+    if (lhs->value.int_value op rhs->value.int_value) \
+        vm->pc = jump_address; \
+} while(0)
+
+// Only instructions which push without popping first can make the stack grow
+#define ENSURE_STACK_SPACE(vm, bytes) do { \
+    if ((vm)->sp + (bytes) > (vm)->stack_committed) \
+        grow_vm_stack(vm, (vm)->sp + (bytes)); \
+} while(0)
+
+static size_t get_page_size(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return (size_t) sysconf(_SC_PAGESIZE);
+#endif
+}
+
+static void reserve_vm_stack(vm* vm)
+{
+    // One extra page is reserved to act as the guard page
+    size_t reserve_size = VM_STACK_RESERVE + get_page_size();
+
+#ifdef _WIN32
+    vm->stack = VirtualAlloc(NULL, reserve_size, MEM_RESERVE, PAGE_NOACCESS);
+    if (vm->stack == NULL)
+#else
+    vm->stack = mmap(NULL, reserve_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (vm->stack == MAP_FAILED)
+#endif
+    {
+        PRINT_ERROR_AND_QUIT("Cannot reserve memory for the VM stack\n");
+    }
+
+    vm->stack_committed = 0;
+}
+
+static void release_vm_stack(vm* vm)
+{
+#ifdef _WIN32
+    VirtualFree(vm->stack, 0, MEM_RELEASE);
+#else
+    munmap(vm->stack, VM_STACK_RESERVE + get_page_size());
+#endif
+    vm->stack = NULL;
+    vm->stack_committed = 0;
+}
+
+// Commit enough stack memory to hold at least required_size bytes. The committed size is doubled
+// every time, so that growing the stack has a constant amortized cost
+void grow_vm_stack(vm* vm, size_t required_size)
+{
+    if (required_size > VM_STACK_RESERVE)
+    {
+        PRINT_VM_ERROR_AND_QUIT(0, "Stack overflow: the stack cannot grow past %d bytes\n", VM_STACK_RESERVE);
+    }
+
+    size_t page_size = get_page_size();
+    size_t new_size = vm->stack_committed ? vm->stack_committed : VM_STACK_INITIAL;
+    while (new_size < required_size)
+    {
+        new_size *= 2;
+    }
+    new_size = (new_size + page_size - 1) / page_size * page_size;
+    if (new_size > VM_STACK_RESERVE)
+    {
+        new_size = VM_STACK_RESERVE;
+    }
+
+#ifdef _WIN32
+    if (VirtualAlloc(vm->stack + vm->stack_committed, new_size - vm->stack_committed, MEM_COMMIT, PAGE_READWRITE) == NULL)
+#else
+    if (mprotect(vm->stack + vm->stack_committed, new_size - vm->stack_committed, PROT_READ | PROT_WRITE) != 0)
+#endif
+    {
+        PRINT_ERROR_AND_QUIT("Cannot commit memory for the VM stack\n");
+    }
+
+    vm->stack_committed = new_size;
+}
+
 
 void push_nonstring(vm* vm, expression_result value)
 {
+    ENSURE_STACK_SPACE(vm, sizeof(expression_result));
     *(expression_result*)(vm->stack + vm->sp) = value;
     vm->sp += sizeof(expression_result);
     return;
@@ -19,6 +155,7 @@ void push_nonstring(vm* vm, expression_result value)
 
 void push_string(vm* vm, expression_result value)
 {
+    ENSURE_STACK_SPACE(vm, sizeof(expression_result));
     char* string_ptr = malloc(value.value.string_value.length);
     memcpy(string_ptr, value.value.string_value.string_value, value.value.string_value.length);
     *(expression_result*)(vm->stack + vm->sp) = (expression_result) {
@@ -103,6 +240,9 @@ void init_vm(vm* vm)
 {
     vm->sp = 0;
     vm->pc = 0;
+    vm->output = stdout;
+    reserve_vm_stack(vm);
+    grow_vm_stack(vm, VM_STACK_INITIAL);
     init_vss_array(&vm->temp_memory, 65535);
 
     init_vm_variables_array(&vm->environment.variable_addrs, 1024);
@@ -112,6 +252,7 @@ void init_vm(vm* vm)
 
 void destroy_vm(vm* vm)
 {
+    release_vm_stack(vm);
     free_vss_array(&vm->temp_memory);
 
     for (int i = 0; i < vm->free_var_idx; i++)
@@ -125,6 +266,19 @@ void destroy_vm(vm* vm)
     free_vsd_array(&vm->environment.variables_memory);
 }
 
+// Drops every value left on the stack, such as the ones remaining after a runtime error
+void clear_vm_stack(vm* vm)
+{
+    for (uint32_t offset = 0; offset < vm->sp; offset += sizeof(expression_result))
+    {
+        expression_result* value = (expression_result*)(vm->stack + offset);
+        if (value->type == STRING_VALUE)
+            free(value->value.string_value.string_value);
+    }
+
+    vm->sp = 0;
+}
+
 inline expression_result* pop(vm* vm)
 {
     expression_result* res = (expression_result*)(vm->stack + vm->sp - sizeof(expression_result));
@@ -139,10 +293,21 @@ inline void free_if_string(expression_result* val)
 }
 
 void run_vm(vm* vm, unsigned char* program)
+{
+    vm->pc = 0;
+    resume_vm(vm, program);
+}
+
+// Run the program starting from the current value of the program counter, which is the
+// text address of the next instruction to execute
+void resume_vm(vm* vm, unsigned char* program)
 {
     char is_running = 1;
-    vm->pc = (*(uint32_t*)program) + 8;
-    uint32_t addr, var_idx;
+    const unsigned char* constants = program + 8;
+    const unsigned char* code = constants + *(uint32_t*)program;
+    uint32_t addr, var_idx, jump_address;
+    uint8_t shift;
+    int wide_operand = 0;
 
     expression_result* lhs, *rhs, push_val;
     string_type print_str;
@@ -151,49 +316,61 @@ void run_vm(vm* vm, unsigned char* program)
     while (is_running)
     {
         clear_vss_array(&vm->temp_memory);
-        uint32_t instr = *(uint32_t*)(program + vm->pc);
-        vm->pc += 4;
+        uint8_t opcode = code[vm->pc++];
 
-        switch (instr & 0xFF)
+        switch (opcode)
         {
             case OPCODE_HALT:
                 is_running = 0;
                 break;
 
+            case OPCODE_WIDE:
+                wide_operand = 1;
+                break;
+
             case OPCODE_NPUSH:
+                ENSURE_STACK_SPACE(vm, sizeof(expression_result));
                 *(expression_result*)(vm->stack + vm->sp) = (expression_result) {.type = NONE};
                 vm->sp += sizeof(expression_result);
                 break;
 
             case OPCODE_IPUSH:
-                addr = instr >> 8;
-                int int_val = *(int*)(program + 8 + addr);
+                FETCH_OPERAND(addr);
+                int int_val = *(int*)(constants + addr);
                 push_val = (expression_result) {.type = INT_VALUE, .value.int_value = int_val};
                 push_nonstring(vm, push_val);
                 break;
 
             case OPCODE_FPUSH:
-                addr = instr >> 8;
-                double float_val = *(double*)(program + 8 + addr);
+                FETCH_OPERAND(addr);
+                double float_val = *(double*)(constants + addr);
                 push_val = (expression_result) {.type = FLOAT_VALUE, .value.float_value = float_val};
                 push_nonstring(vm, push_val);
                 break;
 
             case OPCODE_BPUSH:
-                addr = instr >> 8;
-                char bool_val = *(char*)(program + 8 + addr);
+                FETCH_OPERAND(addr);
+                char bool_val = *(char*)(constants + addr);
                 push_val = (expression_result) {.type = BOOL_VALUE, .value.bool_value = bool_val};
                 push_nonstring(vm, push_val);
                 break;
 
             case OPCODE_SPUSH:
-                addr = instr >> 8;
-                int string_length = *(int*)(program + 8 + addr);
-                char* string_ptr_constants = (char*)(program + 8 + sizeof(int) + addr);
+                FETCH_OPERAND(addr);
+                int string_length = *(int*)(constants + addr);
+                char* string_ptr_constants = (char*)(constants + sizeof(int) + addr);
                 push_val = (expression_result) {.type = STRING_VALUE, .value.string_value = {string_ptr_constants, string_length}};
                 push_string(vm, push_val);
                 break;
 
+            case OPCODE_DUP:
+                rhs = (expression_result*)(vm->stack + vm->sp - sizeof(expression_result));
+                if (rhs->type == STRING_VALUE)
+                    push_string(vm, *rhs);
+                else
+                    push_nonstring(vm, *rhs);
+                break;
+
             case OPCODE_POP:
                 rhs = pop(vm);
                 free_if_string(rhs);
@@ -323,18 +500,19 @@ void run_vm(vm* vm, unsigned char* program)
             case OPCODE_PRINT:
                 rhs = pop(vm);
                 print_str = cast_to_string(&vm->temp_memory, *rhs);
-                printf("%.*s", print_str.length, print_str.string_value);
+                fprintf(vm->output, "%.*s", print_str.length, print_str.string_value);
                 free_if_string(rhs);
                 break;
 
             case OPCODE_PRINTLN:
                 rhs = pop(vm);
                 print_str = cast_to_string(&vm->temp_memory, *rhs);
-                printf("%.*s\n", print_str.length, print_str.string_value);
+                fprintf(vm->output, "%.*s\n", print_str.length, print_str.string_value);
                 free_if_string(rhs);
                 break;
 
             case OPCODE_JMPZ:
+                FETCH_ADDRESS(jump_address);
                 rhs = pop(vm);
                 if (rhs->type != BOOL_VALUE)
                 {
@@ -343,35 +521,138 @@ void run_vm(vm* vm, unsigned char* program)
 
                 if (!rhs->value.bool_value)
                 {
-                    uint32_t jump_address = instr >> 8;
+                    vm->pc = jump_address;
+                }
+
+                break;
+
+            case OPCODE_JMPNZ:
+                FETCH_ADDRESS(jump_address);
+                rhs = pop(vm);
+                if (rhs->type != BOOL_VALUE)
+                {
+                    PRINT_ERROR_AND_QUIT("Condition value is not boolean");
+                }
+
+                if (rhs->value.bool_value)
+                {
+                    vm->pc = jump_address;
+                }
+
+                break;
+
+            // Operands of `and` and `or`, which can be of any type
+            case OPCODE_JMPF:
+            case OPCODE_JMPT:
+                FETCH_ADDRESS(jump_address);
+                rhs = pop(vm);
+                rhs_bool_result = cast_to_bool(&vm->temp_memory, *rhs);
+                free_if_string(rhs);
+                if (rhs_bool_result == (opcode == OPCODE_JMPT))
+                {
                     vm->pc = jump_address;
                 }
 
                 break;
 
             case OPCODE_JMP:
-                uint32_t jump_address = instr >> 8;
+                FETCH_ADDRESS(jump_address);
                 vm->pc = jump_address;
                 break;
 
+            case OPCODE_JMP_IEQ: INT_COMPARISON_JUMP(==); break;
+            case OPCODE_JMP_INE: INT_COMPARISON_JUMP(!=); break;
+            case OPCODE_JMP_IGT: INT_COMPARISON_JUMP(>);  break;
+            case OPCODE_JMP_IGE: INT_COMPARISON_JUMP(>=); break;
+            case OPCODE_JMP_ILT: INT_COMPARISON_JUMP(<);  break;
+            case OPCODE_JMP_ILE: INT_COMPARISON_JUMP(<=); break;
+
+            case OPCODE_IADD: TYPED_BINOP(int_value, +);        break;
+            case OPCODE_ISUB: TYPED_BINOP(int_value, -);        break;
+            case OPCODE_IMUL: TYPED_BINOP(int_value, *);        break;
+            case OPCODE_IEQ:  TYPED_COMPARISON(int_value, ==);  break;
+            case OPCODE_INE:  TYPED_COMPARISON(int_value, !=);  break;
+            case OPCODE_IGT:  TYPED_COMPARISON(int_value, >);   break;
+            case OPCODE_IGE:  TYPED_COMPARISON(int_value, >=);  break;
+            case OPCODE_ILT:  TYPED_COMPARISON(int_value, <);   break;
+            case OPCODE_ILE:  TYPED_COMPARISON(int_value, <=);  break;
+
+            case OPCODE_FADD: TYPED_BINOP(float_value, +);      break;
+            case OPCODE_FSUB: TYPED_BINOP(float_value, -);      break;
+            case OPCODE_FMUL: TYPED_BINOP(float_value, *);      break;
+            case OPCODE_FEQ:  TYPED_COMPARISON(float_value, ==); break;
+            case OPCODE_FNE:  TYPED_COMPARISON(float_value, !=); break;
+            case OPCODE_FGT:  TYPED_COMPARISON(float_value, >);  break;
+            case OPCODE_FGE:  TYPED_COMPARISON(float_value, >=); break;
+            case OPCODE_FLT:  TYPED_COMPARISON(float_value, <);  break;
+            case OPCODE_FLE:  TYPED_COMPARISON(float_value, <=); break;
+
+            case OPCODE_IDIV:
+            case OPCODE_IMOD:
+                rhs = pop(vm);
+                lhs = (expression_result*)(vm->stack + vm->sp - sizeof(expression_result));
+                if (rhs->value.int_value == 0)
+                {
+                    PRINT_ERROR_AND_QUIT("Division by zero.\n");
+                }
+                lhs->value.int_value = (opcode == OPCODE_IDIV) ? lhs->value.int_value / rhs->value.int_value : lhs->value.int_value % rhs->value.int_value;
+                break;
+
+            case OPCODE_FDIV:
+            case OPCODE_FMOD:
+                rhs = pop(vm);
+                lhs = (expression_result*)(vm->stack + vm->sp - sizeof(expression_result));
+                if (rhs->value.float_value == 0)
+                {
+                    PRINT_ERROR_AND_QUIT("Division by zero.\n");
+                }
+                lhs->value.float_value = (opcode == OPCODE_FDIV) ? lhs->value.float_value / rhs->value.float_value : fmod(lhs->value.float_value, rhs->value.float_value);
+                break;
+
+            // Shifting the bits out of an integer gives the same result as multiplying it, wrapping around
+            case OPCODE_ISHL:
+                shift = code[vm->pc++];
+                lhs = (expression_result*)(vm->stack + vm->sp - sizeof(expression_result));
+                lhs->value.int_value = (integer_type)((unsigned int)lhs->value.int_value << shift);
+                break;
+
+            // Negative dividends are offset so that the arithmetic shift rounds them towards zero
+            case OPCODE_ISHR:
+                shift = code[vm->pc++];
+                lhs = (expression_result*)(vm->stack + vm->sp - sizeof(expression_result));
+                if (lhs->value.int_value < 0)
+                    lhs->value.int_value += ((integer_type)1 << shift) - 1;
+                lhs->value.int_value >>= shift;
+                break;
+
+            // Remainders of negative dividends are those of their absolute value negated, as with IMOD
+            case OPCODE_IMASK:
+                shift = code[vm->pc++];
+                lhs = (expression_result*)(vm->stack + vm->sp - sizeof(expression_result));
+                if (lhs->value.int_value < 0)
+                    lhs->value.int_value = -(integer_type)((0u - (unsigned int)lhs->value.int_value) & ((1u << shift) - 1));
+                else
+                    lhs->value.int_value &= ((integer_type)1 << shift) - 1;
+                break;
+
             case OPCODE_GLOAD:
-                var_idx = instr >> 8;
+                FETCH_OPERAND(var_idx);
                 load_global(vm, var_idx);
                 break; 
 
             case OPCODE_GSTORE:
-                var_idx = instr >> 8;
+                FETCH_OPERAND(var_idx);
                 rhs = pop(vm);
                 store_global(vm, var_idx, *rhs);
                 break;
 
             case OPCODE_LLOAD:
-                var_idx = instr >> 8;
+                FETCH_OPERAND(var_idx);
                 load_local(vm, var_idx);
                 break; 
 
             case OPCODE_LSTORE:
-                var_idx = instr >> 8;
+                FETCH_OPERAND(var_idx);
                 rhs = pop(vm);
                 store_local(vm, var_idx, *rhs);
                 break;
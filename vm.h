@@ -1,23 +1,34 @@
 #pragma once
 
+#include <stdio.h>
+
 #include "arrays.h"
 #include "compiler_commons.h"
 
 // The VM consists of a single stack.
 
-// Opcodes are 1 byte each (potentially followed by a certain value).
+// Instructions are variable-length. Every instruction starts with a 1-byte opcode, which is
+// all there is for instructions without operands. Instructions which take a constant offset or
+// a variable index carry a 16-bit little-endian operand after their opcode. If that operand does
+// not fit in 16 bits, the instruction is preceded by the WIDE prefix, and the operand is stored
+// in 32 bits instead. Jump instructions always carry a 32-bit little-endian address, relative to
+// the start of the text section.
+
+//      0000 1111  <instruction>        -> WIDE prefix (next operand is 32 bits wide)
+
 // Instructions to push and pop from the stack have their upper half set to 0,
 // the 4th LSB indicates whether it is a push or a pop, and the three LSBs indicate
 // the type of value that will be pushed.
 
-//      0000 0xxx (3 byte address)      -> PUSH instruction
-//      0000 1000 (3 byte address)      ->  POP instruction (type agnostic)
+//      0000 0xxx <constant offset>     -> PUSH instruction
+//      0000 1000                       ->  POP instruction (type agnostic)
+//      0000 1001                       ->  DUP instruction (push a copy of the top of the stack)
 
 //      0000 x000                       -> NPUSH (PUSH None value)
-//      0000 x001 (3 byte address)      -> IPUSH (PUSH Integer)
-//      0000 x010 (3 byte address)      -> FPUSH (PUSH Float)
-//      0000 x011 (3 byte address)      -> BPUSH (PUSH Boolean)
-//      0000 x100 (3 byte address)      -> SPUSH (PUSH String)
+//      0000 x001 <constant offset>     -> IPUSH (PUSH Integer)
+//      0000 x010 <constant offset>     -> FPUSH (PUSH Float)
+//      0000 x011 <constant offset>     -> BPUSH (PUSH Boolean)
+//      0000 x100 <constant offset>     -> SPUSH (PUSH String)
 
 // Stack values are tagged with a one-byte tag, the same as the one specified in the
 // result_type enum. The stack grows from the smallest address of an array towards
@@ -43,6 +54,21 @@
 //      0001 1110       -> LT       (Compare <)
 //      0001 1111       -> LE       (Compare <=)
 
+// When the compiler can prove the types of both operands, it emits typed versions of these instructions
+// instead, which skip the type dispatch. They keep the lower half of the opcode of the generic instruction,
+// with the upper half set to 0101 for integer operands and to 0111 for float operands.
+
+//      0101 xxxx       -> IADD, ISUB, IMUL, IDIV, IMOD, IEQ, INE, IGT, IGE, ILT, ILE (both operands are integers)
+//      0111 xxxx       -> FADD, FSUB, FMUL, FDIV, FMOD, FEQ, FNE, FGT, FGE, FLT, FLE (both operands are floats)
+
+// Integer multiplications, divisions and remainders by a constant power of two 2^k take k as an 8-bit
+// operand instead of popping it, and are computed with shifts and masks. Like IDIV and IMOD, divisions
+// are rounded towards zero and remainders have the sign of the dividend.
+
+//      0110 0000  <shift>              -> ISHL k   (Multiply the integer on top of the stack by 2^k)
+//      0110 0001  <shift>              -> ISHR k   (Divide the integer on top of the stack by 2^k)
+//      0110 0010  <shift>              -> IMASK k  (Remainder of dividing the integer on top of the stack by 2^k)
+
 // So, to perform 7 + 2 * 3, one would do:
 
 //      IPUSH 7
@@ -53,16 +79,21 @@
 
 // Variable load/store functions
 
-//      0010 0000  <24-bit number>      -> LOAD_GLOBAL n    (Push globals[n] to the stack)
-//      0010 0001  <24-bit number>      -> STORE_GLOBAL n   (Pop the stack into globals[n])
-//      0011 0000  <24-bit number>      -> LOAD_LOCAL n     (Push locals[n] to the stack)
-//      0011 0001  <24-bit number>      -> STORE_LOCAL n    (Pop the stack into locals[n])
+//      0010 0000  <variable index>     -> LOAD_GLOBAL n    (Push globals[n] to the stack)
+//      0010 0001  <variable index>     -> STORE_GLOBAL n   (Pop the stack into globals[n])
+//      0011 0000  <variable index>     -> LOAD_LOCAL n     (Push locals[n] to the stack)
+//      0011 0001  <variable index>     -> STORE_LOCAL n    (Pop the stack into locals[n])
 
 // Flow control instructions.
 
-//      0100 0000  <24-bit number>      -> JMP addr         (Unconditional jump to address)
-//      0100 0001  <24-bit number>      -> JMPZ addr        (Jump to address if top of stack is 0/false)
-//      0100 0010  <24-bit number>      -> JSR addr         (Jump to subroutine and store PC)
+//      0100 0000  <32-bit address>     -> JMP addr         (Unconditional jump to address)
+//      0100 0001  <32-bit address>     -> JMPZ addr        (Jump to address if top of stack is 0/false)
+//      0100 0100  <32-bit address>     -> JMPNZ addr       (Jump to address if top of stack is true)
+//      0100 0101  <32-bit address>     -> JMPF addr        (Jump to address if top of stack is false once cast to bool)
+//      0100 0110  <32-bit address>     -> JMPT addr        (Jump to address if top of stack is true once cast to bool)
+//      0100 1xxx  <32-bit address>     -> JMP_I* addr      (Pop two integers and jump to address if they compare
+//                                                           true, with the lower half of the opcode of the comparison)
+//      0100 0010  <32-bit address>     -> JSR addr         (Jump to subroutine and store PC)
 //      0100 0011                       -> RTS              (Return from subroutine)
 //      0110 1001                       -> HALT             (Halts the VM, nicely)
 
@@ -118,15 +149,22 @@
 //
 // 
 //
-#define STACK_SIZE 65536
 #include <stdint.h>
 
+// The stack lives in its own region of address space, which is reserved when the VM is created
+// but only committed as the stack grows. The page right after the reserved region is never
+// committed, so any access past the end of the stack faults instead of corrupting memory.
+#define VM_STACK_RESERVE (64 * 1024 * 1024)
+#define VM_STACK_INITIAL (16 * 1024)
+
 #define OPCODE_NPUSH   0x00
 #define OPCODE_IPUSH   0x01
 #define OPCODE_FPUSH   0x02
 #define OPCODE_BPUSH   0x03
 #define OPCODE_SPUSH   0x04
 #define OPCODE_POP     0x08
+#define OPCODE_DUP     0x09
+#define OPCODE_WIDE    0x0F
 #define OPCODE_ADD     0x10
 #define OPCODE_SUB     0x11
 #define OPCODE_MUL     0x12
@@ -143,16 +181,133 @@
 #define OPCODE_GE      0x1D
 #define OPCODE_LT      0x1E
 #define OPCODE_LE      0x1F
+#define OPCODE_IADD    0x50
+#define OPCODE_ISUB    0x51
+#define OPCODE_IMUL    0x52
+#define OPCODE_IDIV    0x53
+#define OPCODE_IMOD    0x59
+#define OPCODE_IEQ     0x5A
+#define OPCODE_INE     0x5B
+#define OPCODE_IGT     0x5C
+#define OPCODE_IGE     0x5D
+#define OPCODE_ILT     0x5E
+#define OPCODE_ILE     0x5F
+#define OPCODE_FADD    0x70
+#define OPCODE_FSUB    0x71
+#define OPCODE_FMUL    0x72
+#define OPCODE_FDIV    0x73
+#define OPCODE_FMOD    0x79
+#define OPCODE_FEQ     0x7A
+#define OPCODE_FNE     0x7B
+#define OPCODE_FGT     0x7C
+#define OPCODE_FGE     0x7D
+#define OPCODE_FLT     0x7E
+#define OPCODE_FLE     0x7F
+#define OPCODE_ISHL    0x60
+#define OPCODE_ISHR    0x61
+#define OPCODE_IMASK   0x62
 #define OPCODE_PRINT   0x80
 #define OPCODE_PRINTLN 0x81
 #define OPCODE_HALT    0x69
 #define OPCODE_JMPZ    0x41
+#define OPCODE_JMPNZ   0x44
+#define OPCODE_JMPF    0x45
+#define OPCODE_JMPT    0x46
+#define OPCODE_JMP_IEQ 0x4A
+#define OPCODE_JMP_INE 0x4B
+#define OPCODE_JMP_IGT 0x4C
+#define OPCODE_JMP_IGE 0x4D
+#define OPCODE_JMP_ILT 0x4E
+#define OPCODE_JMP_ILE 0x4F
 #define OPCODE_JMP     0x40
 #define OPCODE_GLOAD   0x20
 #define OPCODE_GSTORE  0x21
 #define OPCODE_LLOAD   0x30
 #define OPCODE_LSTORE  0x31
 
+// Little-endian operand access. Instructions are not aligned, so operands are read byte by byte
+#define READ_U16(ptr) ((uint32_t)(ptr)[0] | ((uint32_t)(ptr)[1] << 8))
+#define READ_U32(ptr) ((uint32_t)(ptr)[0] | ((uint32_t)(ptr)[1] << 8) | ((uint32_t)(ptr)[2] << 16) | ((uint32_t)(ptr)[3] << 24))
+
+#define WRITE_U16(ptr, value) do { \
+    (ptr)[0] = (value) & 0xFF; \
+    (ptr)[1] = ((value) >> 8) & 0xFF; \
+} while(0)
+
+#define WRITE_U32(ptr, value) do { \
+    (ptr)[0] = (value) & 0xFF; \
+    (ptr)[1] = ((value) >> 8) & 0xFF; \
+    (ptr)[2] = ((value) >> 16) & 0xFF; \
+    (ptr)[3] = ((value) >> 24) & 0xFF; \
+} while(0)
+
+typedef enum
+{
+    OPERAND_NONE,
+    OPERAND_INDEX,
+    OPERAND_ADDRESS,
+    OPERAND_SHIFT
+} operand_kind;
+
+// Kind of operand taken by each opcode. Constant offsets and variable indices are 16-bit
+// (32-bit after a WIDE prefix), jump addresses are always 32-bit, and shifts are 8-bit
+static inline operand_kind get_operand_kind(uint8_t opcode)
+{
+    switch (opcode)
+    {
+        case OPCODE_IPUSH:
+        case OPCODE_FPUSH:
+        case OPCODE_BPUSH:
+        case OPCODE_SPUSH:
+        case OPCODE_GLOAD:
+        case OPCODE_GSTORE:
+        case OPCODE_LLOAD:
+        case OPCODE_LSTORE:
+            return OPERAND_INDEX;
+
+        case OPCODE_JMP:
+        case OPCODE_JMPZ:
+        case OPCODE_JMPNZ:
+        case OPCODE_JMPF:
+        case OPCODE_JMPT:
+        case OPCODE_JMP_IEQ:
+        case OPCODE_JMP_INE:
+        case OPCODE_JMP_IGT:
+        case OPCODE_JMP_IGE:
+        case OPCODE_JMP_ILT:
+        case OPCODE_JMP_ILE:
+            return OPERAND_ADDRESS;
+
+        case OPCODE_ISHL:
+        case OPCODE_ISHR:
+        case OPCODE_IMASK:
+            return OPERAND_SHIFT;
+
+        default:
+            return OPERAND_NONE;
+    }
+}
+
+// Length in bytes of the instruction starting at the given address, including any WIDE prefix
+static inline uint32_t get_instruction_length(const unsigned char* instruction)
+{
+    int wide = (instruction[0] == OPCODE_WIDE);
+    switch (get_operand_kind(instruction[wide]))
+    {
+        case OPERAND_INDEX:
+            return wide ? 6 : 3;
+
+        case OPERAND_ADDRESS:
+            return 5;
+
+        case OPERAND_SHIFT:
+            return 2;
+
+        default:
+            return 1;
+    }
+}
+
 typedef struct vm_environment
 {
     vm_variables_array variable_addrs;
@@ -170,7 +325,8 @@ typedef struct globals
 
 typedef struct vm
 {
-    char stack[STACK_SIZE];
+    char* stack;
+    uint32_t stack_committed;
     vss_array temp_memory;
 
     vm_environment environment;
@@ -178,9 +334,16 @@ typedef struct vm
 
     uint32_t sp;
     uint32_t pc;
+
+    // Stream where PRINT and PRINTLN write their output
+    FILE* output;
 } vm;
 
 void init_vm(vm* vm);
 void destroy_vm(vm* vm);
+void clear_vm_stack(vm* vm);
+
+void grow_vm_stack(vm* vm, size_t required_size);
 
 void run_vm(vm* vm, unsigned char* program);
+void resume_vm(vm* vm, unsigned char* program);
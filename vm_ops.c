@@ -134,7 +134,7 @@ int float_exp(vss_array* temp_memory, expression_result* lhs, expression_result*
 {
     double vl = (lhs->type == FLOAT_VALUE) ? lhs->value.float_value : (double) (lhs->value.int_value);
     double vr = (rhs->type == FLOAT_VALUE) ? rhs->value.float_value : (double) (rhs->value.int_value);
-    *dest = (expression_result) { .type=FLOAT_VALUE, .value.float_value=pow(vl, vr) };
+    *dest = (expression_result) { .type=FLOAT_VALUE, .value.float_value=float_pow(vl, vr) };
     return sizeof(expression_result);
 }
 
@@ -287,3 +287,23 @@ int str_le(vss_array* temp_memory, expression_result* lhs, expression_result* rh
     *dest = (expression_result) {.type = BOOL_VALUE, .value.bool_value = comp_result};
     return sizeof(expression_result);
 }
+
+vm_operation get_binop_operation(token_type op, result_type lhs_type, result_type rhs_type)
+{
+    switch (op)
+    {
+        case TOK_PLUS:  return add_funcs[lhs_type][rhs_type];
+        case TOK_MINUS: return sub_funcs[lhs_type][rhs_type];
+        case TOK_STAR:  return mul_funcs[lhs_type][rhs_type];
+        case TOK_SLASH: return div_funcs[lhs_type][rhs_type];
+        case TOK_MOD:   return mod_funcs[lhs_type][rhs_type];
+        case TOK_CARET: return exp_funcs[lhs_type][rhs_type];
+        case TOK_EQEQ:  return eq_funcs[lhs_type][rhs_type];
+        case TOK_NE:    return ne_funcs[lhs_type][rhs_type];
+        case TOK_GT:    return gt_funcs[lhs_type][rhs_type];
+        case TOK_GE:    return ge_funcs[lhs_type][rhs_type];
+        case TOK_LT:    return lt_funcs[lhs_type][rhs_type];
+        case TOK_LE:    return le_funcs[lhs_type][rhs_type];
+        default:        return unsupported_op;
+    }
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "compiler_commons.h"
+#include "tokens.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 ///
@@ -11,6 +12,8 @@
 ///
 ////////////////////////////////////////////////////////////////////////////////
 
+typedef int (*vm_operation) (vss_array*, expression_result*, expression_result*, expression_result*);
+
 int unsupported_op(vss_array* temp_memory, expression_result* lhs, expression_result* rhs, expression_result* dest);
 
 int int_add(vss_array* temp_memory, expression_result* lhs, expression_result* rhs, expression_result* dest);
@@ -164,3 +167,6 @@ static int (*le_funcs[5][5]) (vss_array*, expression_result*, expression_result*
     {unsupported_op, int_le        , float_le      , int_le        , unsupported_op},
     {unsupported_op, unsupported_op, unsupported_op, unsupported_op, str_le        }
 };
+
+// Operation the VM applies to the given operand types, or unsupported_op if they cannot be combined
+vm_operation get_binop_operation(token_type op, result_type lhs_type, result_type rhs_type);